@@ -0,0 +1,46 @@
+//
+//  CDEBenchmarkDataGenerator.h
+//  Ensembles
+//
+//  Created by Drew McCormack on 28/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+// Sizes of the synthetic data set. Defaults can be overridden with environment variables,
+// eg CDE_BENCHMARK_OBJECT_COUNT, so a CI job can run larger workloads without code changes.
+@interface CDEBenchmarkConfiguration : NSObject
+
+@property (nonatomic, assign) NSUInteger objectCount; // Parent objects. Default 2000.
+@property (nonatomic, assign) NSUInteger fanOut; // Children per parent. Default 5.
+@property (nonatomic, assign) NSUInteger attributeSize; // Bytes in each text attribute. Default 200.
+@property (nonatomic, assign) NSUInteger blobCount; // Default 20
+@property (nonatomic, assign) NSUInteger blobSize; // Bytes. Default 512 KB.
+@property (nonatomic, assign) NSUInteger deviceCount; // Default 3
+@property (nonatomic, assign) NSUInteger offlineDays; // Default 7
+@property (nonatomic, assign) NSUInteger savesPerDay; // Default 10
+@property (nonatomic, assign) NSUInteger rounds; // Steady-state merge rounds. Default 10.
+
++ (instancetype)configurationFromEnvironment;
+
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
+
+
+@interface CDEBenchmarkDataGenerator : NSObject
+
+@property (nonatomic, readonly) CDEBenchmarkConfiguration *configuration;
+
++ (NSManagedObjectModel *)managedObjectModel;
++ (NSURL *)writeManagedObjectModelToDirectory:(NSString *)directory;
+
+- (instancetype)initWithConfiguration:(CDEBenchmarkConfiguration *)configuration;
+
+- (void)insertObjects:(NSUInteger)count inContext:(NSManagedObjectContext *)context;
+- (void)updateObjects:(NSUInteger)count inContext:(NSManagedObjectContext *)context;
+- (void)insertBlobs:(NSUInteger)count inContext:(NSManagedObjectContext *)context;
+
+@end
@@ -0,0 +1,232 @@
+//
+//  CDEBenchmarkDataGenerator.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 28/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEBenchmarkDataGenerator.h"
+
+static NSUInteger CDEBenchmarkEnvironmentValue(NSString *name, NSUInteger defaultValue)
+{
+    NSString *value = [[NSProcessInfo processInfo] environment][name];
+    return value ? (NSUInteger)value.longLongValue : defaultValue;
+}
+
+
+@implementation CDEBenchmarkConfiguration
+
++ (instancetype)configurationFromEnvironment
+{
+    CDEBenchmarkConfiguration *configuration = [[self alloc] init];
+    configuration.objectCount = CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_OBJECT_COUNT", 2000);
+    configuration.fanOut = CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_FAN_OUT", 5);
+    configuration.attributeSize = CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_ATTRIBUTE_SIZE", 200);
+    configuration.blobCount = CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_BLOB_COUNT", 20);
+    configuration.blobSize = CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_BLOB_SIZE", 512 * 1024);
+    configuration.deviceCount = MAX(2, CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_DEVICE_COUNT", 3));
+    configuration.offlineDays = CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_OFFLINE_DAYS", 7);
+    configuration.savesPerDay = CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_SAVES_PER_DAY", 10);
+    configuration.rounds = MAX(1, CDEBenchmarkEnvironmentValue(@"CDE_BENCHMARK_ROUNDS", 10));
+    return configuration;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+    return @{
+        @"objectCount" : @(self.objectCount),
+        @"fanOut" : @(self.fanOut),
+        @"attributeSize" : @(self.attributeSize),
+        @"blobCount" : @(self.blobCount),
+        @"blobSize" : @(self.blobSize),
+        @"deviceCount" : @(self.deviceCount),
+        @"offlineDays" : @(self.offlineDays),
+        @"savesPerDay" : @(self.savesPerDay),
+        @"rounds" : @(self.rounds)
+    };
+}
+
+@end
+
+
+@implementation CDEBenchmarkDataGenerator {
+    NSUInteger insertCount;
+    NSUInteger updateCount;
+}
+
+@synthesize configuration = configuration;
+
+#pragma mark Model
+
++ (NSAttributeDescription *)attributeWithName:(NSString *)name type:(NSAttributeType)type
+{
+    NSAttributeDescription *attribute = [[NSAttributeDescription alloc] init];
+    attribute.name = name;
+    attribute.attributeType = type;
+    attribute.optional = YES;
+    return attribute;
+}
+
++ (NSManagedObjectModel *)managedObjectModel
+{
+    NSEntityDescription *parent = [[NSEntityDescription alloc] init];
+    parent.name = @"Parent";
+    parent.managedObjectClassName = NSStringFromClass([NSManagedObject class]);
+
+    NSEntityDescription *child = [[NSEntityDescription alloc] init];
+    child.name = @"Child";
+    child.managedObjectClassName = NSStringFromClass([NSManagedObject class]);
+
+    NSEntityDescription *blob = [[NSEntityDescription alloc] init];
+    blob.name = @"Blob";
+    blob.managedObjectClassName = NSStringFromClass([NSManagedObject class]);
+
+    NSRelationshipDescription *children = [[NSRelationshipDescription alloc] init];
+    children.name = @"children";
+    children.destinationEntity = child;
+    children.minCount = 0;
+    children.maxCount = 0;
+    children.deleteRule = NSCascadeDeleteRule;
+    children.optional = YES;
+
+    NSRelationshipDescription *parentRelationship = [[NSRelationshipDescription alloc] init];
+    parentRelationship.name = @"parent";
+    parentRelationship.destinationEntity = parent;
+    parentRelationship.minCount = 0;
+    parentRelationship.maxCount = 1;
+    parentRelationship.deleteRule = NSNullifyDeleteRule;
+    parentRelationship.optional = YES;
+
+    children.inverseRelationship = parentRelationship;
+    parentRelationship.inverseRelationship = children;
+
+    parent.properties = @[
+        [self attributeWithName:@"name" type:NSStringAttributeType],
+        [self attributeWithName:@"text" type:NSStringAttributeType],
+        [self attributeWithName:@"count" type:NSInteger64AttributeType],
+        [self attributeWithName:@"score" type:NSDoubleAttributeType],
+        [self attributeWithName:@"date" type:NSDateAttributeType],
+        children
+    ];
+
+    child.properties = @[
+        [self attributeWithName:@"name" type:NSStringAttributeType],
+        [self attributeWithName:@"text" type:NSStringAttributeType],
+        [self attributeWithName:@"value" type:NSInteger64AttributeType],
+        parentRelationship
+    ];
+
+    NSAttributeDescription *data = [self attributeWithName:@"data" type:NSBinaryDataAttributeType];
+    data.allowsExternalBinaryDataStorage = YES;
+    blob.properties = @[[self attributeWithName:@"name" type:NSStringAttributeType], data];
+
+    NSManagedObjectModel *model = [[NSManagedObjectModel alloc] init];
+    model.entities = @[parent, child, blob];
+    return model;
+}
+
++ (NSURL *)writeManagedObjectModelToDirectory:(NSString *)directory
+{
+    // A compiled model is a keyed archive, so an archived model can be loaded from a URL, as the ensemble requires
+    NSString *path = [directory stringByAppendingPathComponent:@"CDEBenchmarkModel.mom"];
+    BOOL success = [NSKeyedArchiver archiveRootObject:[self managedObjectModel] toFile:path];
+    return success ? [NSURL fileURLWithPath:path] : nil;
+}
+
+#pragma mark Data
+
+- (instancetype)initWithConfiguration:(CDEBenchmarkConfiguration *)newConfiguration
+{
+    self = [super init];
+    if (self) {
+        configuration = newConfiguration;
+    }
+    return self;
+}
+
+- (NSString *)textOfLength:(NSUInteger)length seed:(NSUInteger)seed
+{
+    static NSString * const alphabet = @"abcdefghijklmnopqrstuvwxyz ";
+    unichar *characters = malloc(sizeof(unichar) * MAX(length, 1));
+    for (NSUInteger i = 0; i < length; i++) {
+        characters[i] = [alphabet characterAtIndex:(seed * 31 + i * 7) % alphabet.length];
+    }
+    NSString *text = [[NSString alloc] initWithCharacters:characters length:length];
+    free(characters);
+    return text;
+}
+
+- (void)insertObjects:(NSUInteger)count inContext:(NSManagedObjectContext *)context
+{
+    [context performBlockAndWait:^{
+        for (NSUInteger i = 0; i < count; i++) {
+            NSUInteger seed = self->insertCount++;
+            NSManagedObject *parent = [NSEntityDescription insertNewObjectForEntityForName:@"Parent" inManagedObjectContext:context];
+            [parent setValue:[NSString stringWithFormat:@"parent %lu", (unsigned long)seed] forKey:@"name"];
+            [parent setValue:[self textOfLength:self->configuration.attributeSize seed:seed] forKey:@"text"];
+            [parent setValue:@(seed) forKey:@"count"];
+            [parent setValue:@(seed * 0.5) forKey:@"score"];
+            [parent setValue:[NSDate dateWithTimeIntervalSinceReferenceDate:seed] forKey:@"date"];
+
+            NSMutableSet *children = [parent mutableSetValueForKey:@"children"];
+            for (NSUInteger c = 0; c < self->configuration.fanOut; c++) {
+                NSManagedObject *child = [NSEntityDescription insertNewObjectForEntityForName:@"Child" inManagedObjectContext:context];
+                [child setValue:[NSString stringWithFormat:@"child %lu.%lu", (unsigned long)seed, (unsigned long)c] forKey:@"name"];
+                [child setValue:[self textOfLength:self->configuration.attributeSize / 2 seed:seed + c] forKey:@"text"];
+                [child setValue:@(c) forKey:@"value"];
+                [children addObject:child];
+            }
+
+            if (i % 500 == 499) [self saveContext:context];
+        }
+        [self saveContext:context];
+        [context reset];
+    }];
+}
+
+- (void)updateObjects:(NSUInteger)count inContext:(NSManagedObjectContext *)context
+{
+    [context performBlockAndWait:^{
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Parent"];
+        fetch.fetchLimit = count;
+        fetch.fetchOffset = self->updateCount % MAX(self->configuration.objectCount, 1);
+        fetch.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"count" ascending:YES]];
+        NSArray *parents = [context executeFetchRequest:fetch error:NULL];
+        for (NSManagedObject *parent in parents) {
+            NSUInteger seed = self->updateCount++;
+            [parent setValue:[self textOfLength:self->configuration.attributeSize seed:seed] forKey:@"text"];
+            [parent setValue:@(seed * 0.25) forKey:@"score"];
+        }
+        [self saveContext:context];
+        [context reset];
+    }];
+}
+
+- (void)insertBlobs:(NSUInteger)count inContext:(NSManagedObjectContext *)context
+{
+    [context performBlockAndWait:^{
+        for (NSUInteger i = 0; i < count; i++) {
+            NSUInteger seed = self->insertCount++;
+            NSMutableData *data = [NSMutableData dataWithLength:self->configuration.blobSize];
+            uint8_t *bytes = data.mutableBytes;
+            for (NSUInteger b = 0; b < data.length; b++) bytes[b] = (uint8_t)((seed * 131 + b * 17) & 0xFF);
+
+            NSManagedObject *blob = [NSEntityDescription insertNewObjectForEntityForName:@"Blob" inManagedObjectContext:context];
+            [blob setValue:[NSString stringWithFormat:@"blob %lu", (unsigned long)seed] forKey:@"name"];
+            [blob setValue:data forKey:@"data"];
+            [self saveContext:context];
+            [context reset];
+        }
+    }];
+}
+
+- (void)saveContext:(NSManagedObjectContext *)context
+{
+    NSError *error = nil;
+    if (context.hasChanges && ![context save:&error]) {
+        NSLog(@"Benchmark data failed to save: %@", error);
+    }
+}
+
+@end
@@ -0,0 +1,47 @@
+//
+//  CDEBenchmarkDevice.h
+//  Ensembles
+//
+//  Created by Drew McCormack on 28/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "CDELocalCloudFileSystem.h"
+
+@class CDEPersistentStoreEnsemble;
+
+// A local cloud file system that counts the files and bytes that pass through it
+@interface CDEBenchmarkCloudFileSystem : CDELocalCloudFileSystem
+
+@property (atomic, assign, readonly) NSUInteger filesUploaded;
+@property (atomic, assign, readonly) NSUInteger filesDownloaded;
+@property (atomic, assign, readonly) unsigned long long bytesUploaded;
+@property (atomic, assign, readonly) unsigned long long bytesDownloaded;
+
+- (void)resetCounts;
+
+@end
+
+
+// One simulated device: a store, a context, and an ensemble sharing a cloud directory with the other devices
+@interface CDEBenchmarkDevice : NSObject
+
+@property (nonatomic, readonly) NSString *name;
+@property (nonatomic, readonly) NSManagedObjectContext *managedObjectContext;
+@property (nonatomic, readonly) CDEPersistentStoreEnsemble *ensemble;
+@property (nonatomic, readonly) CDEBenchmarkCloudFileSystem *cloudFileSystem;
+@property (nonatomic, readonly) NSString *eventDataRootPath;
+
+- (instancetype)initWithName:(NSString *)name rootDirectory:(NSString *)rootDirectory cloudDirectory:(NSString *)cloudDirectory managedObjectModelURL:(NSURL *)modelURL;
+
+- (NSError *)leech;
+- (NSError *)merge;
+- (NSError *)rebase;
+
+- (unsigned long long)eventStoreSize;
+
+- (void)dismantle;
+
+@end
@@ -0,0 +1,200 @@
+//
+//  CDEBenchmarkDevice.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 28/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEBenchmarkDevice.h"
+#import "CDEPersistentStoreEnsemble.h"
+#import "CDERebaser.h"
+
+@interface CDEPersistentStoreEnsemble (CDEBenchmarkMethods)
+
+- (CDERebaser *)rebaser;
+- (void)dismantle;
+
+@end
+
+
+static unsigned long long CDEBenchmarkSizeOfItemsAtPaths(NSArray *paths)
+{
+    unsigned long long size = 0;
+    for (NSString *path in paths) {
+        size += [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+    }
+    return size;
+}
+
+
+@implementation CDEBenchmarkCloudFileSystem
+
+@synthesize filesUploaded = filesUploaded;
+@synthesize filesDownloaded = filesDownloaded;
+@synthesize bytesUploaded = bytesUploaded;
+@synthesize bytesDownloaded = bytesDownloaded;
+
+- (void)resetCounts
+{
+    @synchronized (self) {
+        filesUploaded = filesDownloaded = 0;
+        bytesUploaded = bytesDownloaded = 0;
+    }
+}
+
+- (void)recordUploadOfFiles:(NSArray *)localPaths
+{
+    unsigned long long size = CDEBenchmarkSizeOfItemsAtPaths(localPaths);
+    @synchronized (self) {
+        filesUploaded += localPaths.count;
+        bytesUploaded += size;
+    }
+}
+
+- (void)recordDownloadOfFiles:(NSArray *)localPaths
+{
+    unsigned long long size = CDEBenchmarkSizeOfItemsAtPaths(localPaths);
+    @synchronized (self) {
+        filesDownloaded += localPaths.count;
+        bytesDownloaded += size;
+    }
+}
+
+- (void)uploadLocalFile:(NSString *)fromPath toPath:(NSString *)toPath completion:(CDECompletionBlock)block
+{
+    [self recordUploadOfFiles:@[fromPath]];
+    [super uploadLocalFile:fromPath toPath:toPath completion:block];
+}
+
+- (void)uploadLocalFiles:(NSArray *)fromPaths toPaths:(NSArray *)toPaths completion:(CDECompletionBlock)block
+{
+    [self recordUploadOfFiles:fromPaths];
+    [super uploadLocalFiles:fromPaths toPaths:toPaths completion:block];
+}
+
+- (void)downloadFromPath:(NSString *)fromPath toLocalFile:(NSString *)toPath completion:(CDECompletionBlock)block
+{
+    [super downloadFromPath:fromPath toLocalFile:toPath completion:^(NSError *error) {
+        if (!error) [self recordDownloadOfFiles:@[toPath]];
+        if (block) block(error);
+    }];
+}
+
+- (void)downloadFromPaths:(NSArray *)fromPaths toLocalFiles:(NSArray *)toPaths completion:(CDECompletionBlock)block
+{
+    [super downloadFromPaths:fromPaths toLocalFiles:toPaths completion:^(NSError *error) {
+        if (!error) [self recordDownloadOfFiles:toPaths];
+        if (block) block(error);
+    }];
+}
+
+@end
+
+
+@interface CDEBenchmarkDevice () <CDEPersistentStoreEnsembleDelegate>
+
+@end
+
+@implementation CDEBenchmarkDevice
+
+@synthesize name = name;
+@synthesize managedObjectContext = managedObjectContext;
+@synthesize ensemble = ensemble;
+@synthesize cloudFileSystem = cloudFileSystem;
+@synthesize eventDataRootPath = eventDataRootPath;
+
+- (instancetype)initWithName:(NSString *)newName rootDirectory:(NSString *)rootDirectory cloudDirectory:(NSString *)cloudDirectory managedObjectModelURL:(NSURL *)modelURL
+{
+    self = [super init];
+    if (self) {
+        name = [newName copy];
+
+        NSString *deviceDirectory = [rootDirectory stringByAppendingPathComponent:name];
+        [[NSFileManager defaultManager] createDirectoryAtPath:deviceDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+
+        NSManagedObjectModel *model = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
+        NSURL *storeURL = [NSURL fileURLWithPath:[deviceDirectory stringByAppendingPathComponent:@"store.sqlite"]];
+        NSPersistentStoreCoordinator *coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+        NSError *error = nil;
+        if (![coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:storeURL options:nil error:&error]) {
+            NSLog(@"Benchmark device %@ failed to add store: %@", name, error);
+            return nil;
+        }
+
+        managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
+        managedObjectContext.persistentStoreCoordinator = coordinator;
+        managedObjectContext.mergePolicy = NSMergeByPropertyStoreTrumpMergePolicy;
+        managedObjectContext.undoManager = nil;
+
+        cloudFileSystem = [[CDEBenchmarkCloudFileSystem alloc] initWithRootDirectory:cloudDirectory];
+        eventDataRootPath = [deviceDirectory stringByAppendingPathComponent:@"eventData"];
+        ensemble = [[CDEPersistentStoreEnsemble alloc] initWithEnsembleIdentifier:@"com.ensembles.benchmark" persistentStoreURL:storeURL persistentStoreOptions:nil managedObjectModelURL:modelURL cloudFileSystem:cloudFileSystem localDataRootDirectoryURL:[NSURL fileURLWithPath:eventDataRootPath]];
+        ensemble.delegate = self;
+    }
+    return self;
+}
+
+- (void)dismantle
+{
+    [ensemble dismantle];
+    [managedObjectContext reset];
+}
+
+#pragma mark Synchronous Operations
+
+- (NSError *)waitForOperation:(void(^)(CDECompletionBlock completion))operation
+{
+    __block NSError *result = nil;
+    operation(^(NSError *error) {
+        result = error;
+        CFRunLoopStop(CFRunLoopGetCurrent());
+    });
+    CFRunLoopRun();
+    return result;
+}
+
+- (NSError *)leech
+{
+    return [self waitForOperation:^(CDECompletionBlock completion) {
+        [self->ensemble leechPersistentStoreWithCompletion:completion];
+    }];
+}
+
+- (NSError *)merge
+{
+    return [self waitForOperation:^(CDECompletionBlock completion) {
+        [self->ensemble mergeWithCompletion:completion];
+    }];
+}
+
+- (NSError *)rebase
+{
+    return [self waitForOperation:^(CDECompletionBlock completion) {
+        [self->ensemble.rebaser rebaseWithCompletion:completion];
+    }];
+}
+
+#pragma mark Measurements
+
+- (unsigned long long)eventStoreSize
+{
+    unsigned long long size = 0;
+    NSDirectoryEnumerator *enumerator = [[NSFileManager defaultManager] enumeratorAtPath:eventDataRootPath];
+    while ([enumerator nextObject]) {
+        if ([enumerator.fileAttributes.fileType isEqualToString:NSFileTypeRegular]) size += enumerator.fileAttributes.fileSize;
+    }
+    return size;
+}
+
+#pragma mark Ensemble Delegate
+
+- (void)persistentStoreEnsemble:(CDEPersistentStoreEnsemble *)sender didSaveMergeChangesWithNotification:(NSNotification *)notification
+{
+    NSManagedObjectContext *context = managedObjectContext;
+    [context performBlockAndWait:^{
+        [context mergeChangesFromContextDidSaveNotification:notification];
+    }];
+}
+
+@end
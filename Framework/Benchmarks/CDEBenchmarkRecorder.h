@@ -0,0 +1,29 @@
+//
+//  CDEBenchmarkRecorder.h
+//  Ensembles
+//
+//  Created by Drew McCormack on 28/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class CDEBenchmarkConfiguration;
+@class CDEBenchmarkDevice;
+
+// Measures scenarios, and writes the results as JSON so runs can be compared between releases.
+// The results file is CDE_BENCHMARK_RESULTS_PATH if set, and otherwise a timestamped file in the temporary directory.
+@interface CDEBenchmarkRecorder : NSObject
+
+@property (nonatomic, readonly) NSString *resultsPath;
+@property (nonatomic, readonly) NSArray *results;
+
++ (instancetype)sharedRecorderWithConfiguration:(CDEBenchmarkConfiguration *)configuration;
+
+// Records time, peak resident memory, and files transferred by all devices while the block runs,
+// and the event store size of the measured device afterwards.
+- (NSDictionary *)measureScenario:(NSString *)scenario devices:(NSArray *)devices measuredDevice:(CDEBenchmarkDevice *)device usingBlock:(void(^)(void))block;
+
+- (BOOL)writeResults:(NSError * __autoreleasing *)error;
+
+@end
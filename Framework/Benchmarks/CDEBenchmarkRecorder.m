@@ -0,0 +1,165 @@
+//
+//  CDEBenchmarkRecorder.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 28/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEBenchmarkRecorder.h"
+#import "CDEBenchmarkDataGenerator.h"
+#import "CDEBenchmarkDevice.h"
+#import "CDEPersistentStoreEnsemble.h"
+#import <mach/mach.h>
+#import <sys/sysctl.h>
+
+static const NSTimeInterval CDEMemorySampleInterval = 0.01;
+
+static unsigned long long CDEBenchmarkResidentMemory(void)
+{
+    struct mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    kern_return_t result = task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count);
+    return result == KERN_SUCCESS ? info.resident_size : 0;
+}
+
+static NSString *CDEBenchmarkHardwareModel(void)
+{
+    char model[256];
+    size_t size = sizeof(model);
+    if (sysctlbyname("hw.model", model, &size, NULL, 0) != 0) return @"unknown";
+    return [NSString stringWithUTF8String:model];
+}
+
+
+@implementation CDEBenchmarkRecorder {
+    CDEBenchmarkConfiguration *configuration;
+    NSMutableArray *results;
+    NSDate *startDate;
+}
+
+@synthesize resultsPath = resultsPath;
+
++ (instancetype)sharedRecorderWithConfiguration:(CDEBenchmarkConfiguration *)configuration
+{
+    static CDEBenchmarkRecorder *recorder = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        recorder = [[self alloc] initWithConfiguration:configuration];
+    });
+    return recorder;
+}
+
+- (instancetype)initWithConfiguration:(CDEBenchmarkConfiguration *)newConfiguration
+{
+    self = [super init];
+    if (self) {
+        configuration = newConfiguration;
+        results = [[NSMutableArray alloc] init];
+        startDate = [NSDate date];
+
+        resultsPath = [[NSProcessInfo processInfo] environment][@"CDE_BENCHMARK_RESULTS_PATH"];
+        if (!resultsPath) {
+            NSString *filename = [NSString stringWithFormat:@"EnsemblesBenchmarks-%.0f.json", startDate.timeIntervalSince1970];
+            resultsPath = [NSTemporaryDirectory() stringByAppendingPathComponent:filename];
+        }
+    }
+    return self;
+}
+
+- (NSArray *)results
+{
+    return [results copy];
+}
+
+#pragma mark Measuring
+
+- (NSDictionary *)measureScenario:(NSString *)scenario devices:(NSArray *)devices measuredDevice:(CDEBenchmarkDevice *)device usingBlock:(void(^)(void))block
+{
+    for (CDEBenchmarkDevice *d in devices) [d.cloudFileSystem resetCounts];
+
+    // Sample memory on a background queue, because the block occupies the main thread
+    __block unsigned long long peakMemory = CDEBenchmarkResidentMemory();
+    unsigned long long initialMemory = peakMemory;
+    dispatch_queue_t samplingQueue = dispatch_queue_create("com.mentalfaculty.ensembles.benchmarks.memory", DISPATCH_QUEUE_SERIAL);
+    dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, samplingQueue);
+    dispatch_source_set_timer(timer, DISPATCH_TIME_NOW, (uint64_t)(CDEMemorySampleInterval * NSEC_PER_SEC), (uint64_t)(CDEMemorySampleInterval * NSEC_PER_SEC / 10));
+    dispatch_source_set_event_handler(timer, ^{
+        peakMemory = MAX(peakMemory, CDEBenchmarkResidentMemory());
+    });
+    dispatch_resume(timer);
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    block();
+    CFAbsoluteTime duration = CFAbsoluteTimeGetCurrent() - start;
+
+    dispatch_source_cancel(timer);
+    __block unsigned long long measuredPeak = 0;
+    dispatch_sync(samplingQueue, ^{
+        measuredPeak = MAX(peakMemory, CDEBenchmarkResidentMemory());
+    });
+
+    NSUInteger filesUploaded = 0, filesDownloaded = 0;
+    unsigned long long bytesUploaded = 0, bytesDownloaded = 0;
+    for (CDEBenchmarkDevice *d in devices) {
+        filesUploaded += d.cloudFileSystem.filesUploaded;
+        filesDownloaded += d.cloudFileSystem.filesDownloaded;
+        bytesUploaded += d.cloudFileSystem.bytesUploaded;
+        bytesDownloaded += d.cloudFileSystem.bytesDownloaded;
+    }
+
+    NSDictionary *result = @{
+        @"scenario" : scenario,
+        @"seconds" : @(duration),
+        @"peakResidentBytes" : @(measuredPeak),
+        @"peakResidentGrowthBytes" : @(measuredPeak > initialMemory ? measuredPeak - initialMemory : 0),
+        @"eventStoreBytes" : @(device.eventStoreSize),
+        @"filesUploaded" : @(filesUploaded),
+        @"filesDownloaded" : @(filesDownloaded),
+        @"bytesUploaded" : @(bytesUploaded),
+        @"bytesDownloaded" : @(bytesDownloaded)
+    };
+    [results addObject:result];
+    NSLog(@"Benchmark %@: %@", scenario, result);
+
+    NSError *error = nil;
+    if (![self writeResults:&error]) NSLog(@"Failed to write benchmark results: %@", error);
+
+    return result;
+}
+
+#pragma mark Writing
+
+- (NSDictionary *)environmentDescription
+{
+    NSBundle *frameworkBundle = [NSBundle bundleForClass:[CDEPersistentStoreEnsemble class]];
+    NSString *version = [frameworkBundle objectForInfoDictionaryKey:@"CFBundleShortVersionString"] ? : @"unknown";
+#ifdef DEBUG
+    NSString *buildConfiguration = @"Debug";
+#else
+    NSString *buildConfiguration = @"Release";
+#endif
+    return @{
+        @"frameworkVersion" : version,
+        @"buildConfiguration" : buildConfiguration,
+        @"operatingSystem" : [[NSProcessInfo processInfo] operatingSystemVersionString],
+        @"hardwareModel" : CDEBenchmarkHardwareModel(),
+        @"processorCount" : @([[NSProcessInfo processInfo] activeProcessorCount])
+    };
+}
+
+- (BOOL)writeResults:(NSError * __autoreleasing *)error
+{
+    NSDictionary *document = @{
+        @"formatVersion" : @1,
+        @"date" : @(startDate.timeIntervalSince1970),
+        @"environment" : [self environmentDescription],
+        @"configuration" : [configuration dictionaryRepresentation],
+        @"results" : [results copy]
+    };
+    NSData *data = [NSJSONSerialization dataWithJSONObject:document options:NSJSONWritingPrettyPrinted error:error];
+    if (!data) return NO;
+    return [data writeToFile:resultsPath options:NSDataWritingAtomic error:error];
+}
+
+@end
@@ -0,0 +1,182 @@
+//
+//  CDESyncBenchmarks.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 28/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "CDEBenchmarkDataGenerator.h"
+#import "CDEBenchmarkDevice.h"
+#import "CDEBenchmarkRecorder.h"
+
+static const NSUInteger CDEBenchmarkObjectsPerEdit = 20;
+
+@interface CDESyncBenchmarks : XCTestCase
+
+@end
+
+@implementation CDESyncBenchmarks {
+    CDEBenchmarkConfiguration *configuration;
+    CDEBenchmarkDataGenerator *generator;
+    CDEBenchmarkRecorder *recorder;
+    NSString *rootDirectory;
+    NSMutableArray *devices;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    configuration = [CDEBenchmarkConfiguration configurationFromEnvironment];
+    generator = [[CDEBenchmarkDataGenerator alloc] initWithConfiguration:configuration];
+    recorder = [CDEBenchmarkRecorder sharedRecorderWithConfiguration:configuration];
+
+    rootDirectory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"CDESyncBenchmarks"];
+    [[NSFileManager defaultManager] removeItemAtPath:rootDirectory error:NULL];
+    [[NSFileManager defaultManager] createDirectoryAtPath:rootDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+
+    NSString *cloudDirectory = [rootDirectory stringByAppendingPathComponent:@"cloud"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:cloudDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+
+    NSURL *modelURL = [CDEBenchmarkDataGenerator writeManagedObjectModelToDirectory:rootDirectory];
+    XCTAssertNotNil(modelURL);
+
+    devices = [[NSMutableArray alloc] init];
+    for (NSUInteger i = 0; i < configuration.deviceCount; i++) {
+        NSString *name = [NSString stringWithFormat:@"device%lu", (unsigned long)i];
+        CDEBenchmarkDevice *device = [[CDEBenchmarkDevice alloc] initWithName:name rootDirectory:rootDirectory cloudDirectory:cloudDirectory managedObjectModelURL:modelURL];
+        XCTAssertNotNil(device);
+        [devices addObject:device];
+    }
+}
+
+- (void)tearDown
+{
+    for (CDEBenchmarkDevice *device in devices) [device dismantle];
+    [[NSFileManager defaultManager] removeItemAtPath:rootDirectory error:NULL];
+    [super tearDown];
+}
+
+#pragma mark Helpers
+
+- (void)leechDevices
+{
+    for (CDEBenchmarkDevice *device in devices) {
+        XCTAssertNil([device leech], @"Leech failed for %@", device.name);
+    }
+}
+
+- (void)mergeDevices
+{
+    // Twice around, so every device has everyone's changes
+    for (NSUInteger pass = 0; pass < 2; pass++) {
+        for (CDEBenchmarkDevice *device in devices) {
+            XCTAssertNil([device merge], @"Merge failed for %@", device.name);
+        }
+    }
+}
+
+- (void)seedSharedData
+{
+    [self leechDevices];
+    CDEBenchmarkDevice *device = devices.firstObject;
+    [generator insertObjects:configuration.objectCount inContext:device.managedObjectContext];
+    [self mergeDevices];
+}
+
+#pragma mark Scenarios
+
+- (void)testFirstLeech
+{
+    CDEBenchmarkDevice *device = devices.firstObject;
+    [generator insertObjects:configuration.objectCount inContext:device.managedObjectContext];
+
+    [recorder measureScenario:@"firstLeech" devices:devices measuredDevice:device usingBlock:^{
+        XCTAssertNil([device leech]);
+    }];
+}
+
+- (void)testSteadyStateMerge
+{
+    [self seedSharedData];
+
+    [recorder measureScenario:@"steadyStateMerge" devices:devices measuredDevice:devices.firstObject usingBlock:^{
+        for (NSUInteger round = 0; round < self->configuration.rounds; round++) {
+            for (CDEBenchmarkDevice *device in self->devices) {
+                [self->generator updateObjects:CDEBenchmarkObjectsPerEdit inContext:device.managedObjectContext];
+                XCTAssertNil([device merge]);
+            }
+        }
+    }];
+}
+
+- (void)testOfflineCatchUp
+{
+    [self seedSharedData];
+
+    // The first device keeps working, and merging, while the last is offline
+    CDEBenchmarkDevice *activeDevice = devices.firstObject;
+    NSUInteger saveCount = configuration.offlineDays * configuration.savesPerDay;
+    for (NSUInteger i = 0; i < saveCount; i++) {
+        [generator updateObjects:CDEBenchmarkObjectsPerEdit inContext:activeDevice.managedObjectContext];
+        if (i % 5 == 0) [generator insertObjects:1 inContext:activeDevice.managedObjectContext];
+        XCTAssertNil([activeDevice merge]);
+    }
+
+    CDEBenchmarkDevice *offlineDevice = devices.lastObject;
+    [recorder measureScenario:@"offlineCatchUp" devices:devices measuredDevice:offlineDevice usingBlock:^{
+        XCTAssertNil([offlineDevice merge]);
+    }];
+}
+
+- (void)testRebase
+{
+    [self seedSharedData];
+
+    CDEBenchmarkDevice *device = devices.firstObject;
+    NSUInteger saveCount = configuration.offlineDays * configuration.savesPerDay;
+    for (NSUInteger i = 0; i < saveCount; i++) {
+        [generator updateObjects:CDEBenchmarkObjectsPerEdit inContext:device.managedObjectContext];
+    }
+    XCTAssertNil([device merge]);
+
+    [recorder measureScenario:@"rebase" devices:devices measuredDevice:device usingBlock:^{
+        XCTAssertNil([device rebase]);
+    }];
+}
+
+- (void)testBaselineConsolidation
+{
+    // Every device has data before leeching, so each contributes a baseline
+    NSUInteger objectsPerDevice = MAX(configuration.objectCount / devices.count, 1);
+    for (CDEBenchmarkDevice *device in devices) {
+        [generator insertObjects:objectsPerDevice inContext:device.managedObjectContext];
+    }
+    [self leechDevices];
+    for (CDEBenchmarkDevice *device in devices) {
+        if (device != devices.firstObject) XCTAssertNil([device merge]);
+    }
+
+    CDEBenchmarkDevice *device = devices.firstObject;
+    [recorder measureScenario:@"baselineConsolidation" devices:devices measuredDevice:device usingBlock:^{
+        XCTAssertNil([device merge]);
+    }];
+}
+
+- (void)testLargeBlobSync
+{
+    [self leechDevices];
+
+    CDEBenchmarkDevice *sender = devices.firstObject;
+    CDEBenchmarkDevice *receiver = devices.lastObject;
+    [generator insertBlobs:configuration.blobCount inContext:sender.managedObjectContext];
+
+    [recorder measureScenario:@"largeBlobSync" devices:devices measuredDevice:receiver usingBlock:^{
+        XCTAssertNil([sender merge]);
+        XCTAssertNil([receiver merge]);
+    }];
+}
+
+@end
@@ -130,7 +130,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 - (void)connect:(CDECompletionBlock)completion
 {
     if (self.isConnected) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (completion) completion(nil);
         });
     }
@@ -139,7 +139,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
     }
     else {
         NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeConnectionError userInfo:nil];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (completion) completion(error);
         });
     }
@@ -160,7 +160,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(NO, NO, [[self class] genericAuthorizationError]);
         });
         return;
@@ -168,7 +168,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
     DBRpcTask *task = [authorizedClient.filesRoutes getMetadata:[self fullDropboxPathForPath:path]];
     task.retryCount = kCDENumberOfRetriesForFailedAttempt;
     [task setResponseBlock:^(DBFILESMetadata * _Nullable metadata, DBFILESGetMetadataError * _Nullable routeError, DBRequestError * _Nullable error) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (metadata) {
                 if ([metadata isKindOfClass:[DBFILESFileMetadata class]]) {
                     if (block) block(/*exist*/YES, /*isDirectory*/NO, /*error*/nil);
@@ -189,13 +189,42 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 }
 
 
+#pragma mark Change Detection
+
+- (void)fetchRevisionTokenForFileAtPath:(NSString *)path completion:(CDERevisionTokenCallback)block
+{
+    DBUserClient *authorizedClient = [self authorizedClient];
+    if (!authorizedClient) {
+        dispatch_async(CDEWorkQueue(), ^{
+            if (block) block(nil, [[self class] genericAuthorizationError]);
+        });
+        return;
+    }
+    DBRpcTask *task = [authorizedClient.filesRoutes getMetadata:[self fullDropboxPathForPath:path]];
+    task.retryCount = kCDENumberOfRetriesForFailedAttempt;
+    [task setResponseBlock:^(DBFILESMetadata * _Nullable metadata, DBFILESGetMetadataError * _Nullable routeError, DBRequestError * _Nullable error) {
+        dispatch_async(CDEWorkQueue(), ^{
+            if ([metadata isKindOfClass:[DBFILESFileMetadata class]]) {
+                if (block) block([(DBFILESFileMetadata *)metadata rev], nil);
+            }
+            else if (metadata || ([routeError isPath] && routeError.path.isNotFound)) {
+                if (block) block(nil, nil);
+            }
+            else {
+                if (block) block(nil, [self errorForRouteError:routeError requestError:error result:metadata]);
+            }
+        });
+    }];
+}
+
+
 #pragma mark Getting Directory Contents
 
 - (void)contentsOfDirectoryAtPath:(NSString *)path completion:(CDEDirectoryContentsCallback)block
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(nil, [[self class] genericAuthorizationError]);
         });
         return;
@@ -314,14 +343,14 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 
 - (void)handleLoadContentOfDirectory:(CDECloudDirectory *)directory finishedWithCompletion:(CDEDirectoryContentsCallback)block
 {
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (block) block(directory.contents, nil);
     });
 }
 
 - (void)handleLoadContentOfDirectoryFailedWithCompletion:(CDEDirectoryContentsCallback)block error:(NSError * _Nullable)error
 {
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (block) block(nil, error);
     });
 }
@@ -333,7 +362,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([[self class] genericAuthorizationError]);
         });
         return;
@@ -343,7 +372,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
     [task setResponseBlock:^(DBFILESFolderMetadata * _Nullable metadata, DBFILESCreateFolderError * _Nullable routeError, DBRequestError * _Nullable error) {
         if (routeError) CDELog(CDELoggingLevelError, @"Dropbox: routeError in createFolder: %@\npath: %@", routeError, path);
         else if (error) CDELog(CDELoggingLevelError, @"Dropbox: error in createFolder: %@\npath: %@", error, path);
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([self errorForRouteError:routeError requestError:error result:metadata]);
         });
     }];
@@ -356,13 +385,13 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([[self class] genericAuthorizationError]);
         });
         return;
     }
     if (paths.count == 0) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             block(nil);
         });
         return;
@@ -376,7 +405,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
     task.retryCount = kCDENumberOfRetriesForFailedAttempt;
     [task setResponseBlock:^(DBFILESDeleteBatchLaunch * _Nullable result, DBNilObject * _Nullable routeError, DBRequestError * _Nullable error) {
         if (error) CDELog(CDELoggingLevelError, @"Dropbox: error in deleteBatch: %@\nfilesToDelete: %@", error, filesToDelete);
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([self errorForRouteError:nil requestError:error result:result]);
         });
     }];
@@ -386,7 +415,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([[self class] genericAuthorizationError]);
         });
         return;
@@ -396,7 +425,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
     [task setResponseBlock:^(DBFILESMetadata * _Nullable metadata, DBFILESDeleteError * _Nullable routeError, DBRequestError * _Nullable error) {
         if (routeError) CDELog(CDELoggingLevelError, @"Dropbox: routeError in delete_: %@\npath: %@", routeError, [self fullDropboxPathForPath:path]);
         else if (error) CDELog(CDELoggingLevelError, @"Dropbox: error in delete_: %@\npath: %@", error, [self fullDropboxPathForPath:path]);
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([self errorForRouteError:routeError requestError:error result:metadata]);
         });
     }];
@@ -409,13 +438,13 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([[self class] genericAuthorizationError]);
         });
         return;
     }
     if (fromPaths.count == 0) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             block(nil);
         });
         return;
@@ -428,7 +457,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([[self class] genericAuthorizationError]);
         });
         return;
@@ -486,7 +515,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
                                    if (retryCounter) {
                                        CDELog(CDELoggingLevelWarning, @"Dropbox: batch upload succeeded: attempt %ld", (long)retryCounter);
                                    }
-                                   dispatch_async(dispatch_get_main_queue(), ^{
+                                   dispatch_async(CDEWorkQueue(), ^{
                                        if (block) block(nil);
                                    });
                                }
@@ -545,7 +574,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
         else {
             error = [[NSError alloc] initWithDomain:CDEErrorDomain code:CDEErrorCodeNetworkError userInfo:nil];
         }
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(error);
         });
     }
@@ -555,7 +584,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([[self class] genericAuthorizationError]);
         });
         return;
@@ -565,7 +594,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
     [task setResponseBlock:^(DBFILESFileMetadata * _Nullable metadata, DBFILESUploadError * _Nullable routeError, DBRequestError * _Nullable error) {
         if (routeError) CDELog(CDELoggingLevelError, @"Dropbox: routeError in uploadUrl: %@\nfromPath: %@\ntoPath: %@", routeError, fromPath, [self fullDropboxPathForPath:toPath]);
         else if (error) CDELog(CDELoggingLevelError, @"Dropbox: error in uploadUrl: %@\nfromPath: %@\ntoPath: %@", error, fromPath, [self fullDropboxPathForPath:toPath]);
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([self errorForRouteError:routeError requestError:error result:metadata]);
         });
     }];
@@ -575,7 +604,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
 {
     DBUserClient *authorizedClient = [self authorizedClient];
     if (!authorizedClient) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block([[self class] genericAuthorizationError]);
         });
         return;
@@ -605,7 +634,7 @@ static const NSUInteger kCDENumberOfRetriesForFailedAttempt = 5;
         }];
     }];
 
-    dispatch_group_notify(group, dispatch_get_main_queue(), ^{
+    dispatch_group_notify(group, CDEWorkQueue(), ^{
         if (block) block(lastError);
     });
 }
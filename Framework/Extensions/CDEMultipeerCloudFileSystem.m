@@ -52,7 +52,7 @@ NSString * const CDEMultipeerMessageTypeKey = @"messageType";
 
 - (void)connect:(CDECompletionBlock)completion
 {
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(nil);
     });
 }
@@ -66,7 +66,7 @@ NSString * const CDEMultipeerMessageTypeKey = @"messageType";
 {
     BOOL exists, isDir;
     exists = [fileManager fileExistsAtPath:[self fullPathForRelativePath:path] isDirectory:&isDir];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(exists, isDir, nil);
     });
 }
@@ -97,7 +97,7 @@ NSString * const CDEMultipeerMessageTypeKey = @"messageType";
         }
     }
 
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(contents, nil);
     });
 }
@@ -106,7 +106,7 @@ NSString * const CDEMultipeerMessageTypeKey = @"messageType";
 {
     NSError *error = nil;
     [fileManager createDirectoryAtPath:[self fullPathForRelativePath:path] withIntermediateDirectories:NO attributes:nil error:&error];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(error);
     });
 }
@@ -115,7 +115,7 @@ NSString * const CDEMultipeerMessageTypeKey = @"messageType";
 {
     NSError *error = nil;
     [fileManager removeItemAtPath:[self fullPathForRelativePath:fromPath] error:&error];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(error);
     });
 }
@@ -124,7 +124,7 @@ NSString * const CDEMultipeerMessageTypeKey = @"messageType";
 {
     NSError *error = nil;
     [fileManager copyItemAtPath:fromPath toPath:[self fullPathForRelativePath:toPath] error:&error];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(error);
     });
 }
@@ -133,7 +133,7 @@ NSString * const CDEMultipeerMessageTypeKey = @"messageType";
 {
     NSError *error = nil;
     [fileManager copyItemAtPath:[self fullPathForRelativePath:fromPath] toPath:toPath error:&error];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(error);
     });
 }
@@ -29,6 +29,7 @@
 @property (nonatomic, readwrite, weak) id <CDENodeCloudFileSystemDelegate> delegate;
 
 - (id)initWithBaseURL:(NSURL *)baseURL;
+- (id)initWithBaseURL:(NSURL *)baseURL sessionConfiguration:(NSURLSessionConfiguration *)configuration; // Pass nil for the default configuration
 
 - (void)loginWithCompletion:(CDECompletionBlock)completion;
 
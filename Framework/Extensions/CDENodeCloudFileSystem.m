@@ -7,6 +7,9 @@
 
 #import "CDENodeCloudFileSystem.h"
 
+static const NSUInteger CDENodeMaximumPathsPerURLRequest = 50;
+static const NSInteger CDENodeMaximumConcurrentTransfers = 4;
+
 @interface CDENodeCloudFileSystem ()
 
 @property (nonatomic, readwrite, assign, getter = isLoggedIn) BOOL loggedIn;
@@ -16,6 +19,7 @@
 
 @implementation CDENodeCloudFileSystem {
     NSOperationQueue *operationQueue;
+    NSURLSession *session;
 }
 
 @synthesize username = username;
@@ -23,21 +27,48 @@
 @synthesize baseURL = baseURL;
 @synthesize loggedIn = loggedIn;
 
-- (instancetype)initWithBaseURL:(NSURL *)newBaseURL
++ (NSURLSessionConfiguration *)defaultSessionConfiguration
+{
+    // One session is shared by all requests, so connections are kept alive, and
+    // HTTP/2 servers multiplex the transfers over a single connection.
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+    configuration.HTTPMaximumConnectionsPerHost = CDENodeMaximumConcurrentTransfers;
+    configuration.HTTPShouldUsePipelining = YES;
+    configuration.HTTPCookieStorage = nil;
+    configuration.URLCache = nil;
+    configuration.requestCachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
+    return configuration;
+}
+
+- (instancetype)initWithBaseURL:(NSURL *)newBaseURL sessionConfiguration:(NSURLSessionConfiguration *)configuration
 {
     self = [super init];
     if (self) {
         baseURL = newBaseURL;
         loggedIn = NO;
+        
         operationQueue = [[NSOperationQueue alloc] init];
-        operationQueue.maxConcurrentOperationCount = 1;
+        operationQueue.maxConcurrentOperationCount = CDENodeMaximumConcurrentTransfers;
         if ([operationQueue respondsToSelector:@selector(setQualityOfService:)]) {
             [operationQueue setQualityOfService:NSQualityOfServiceUtility];
         }
+        
+        configuration = configuration ? : [self.class defaultSessionConfiguration];
+        
+        // Session callbacks run on a private serial queue. Completions are passed on to the
+        // work queue when they are delivered, so the work queue can be set after creation.
+        NSOperationQueue *delegateQueue = [[NSOperationQueue alloc] init];
+        delegateQueue.maxConcurrentOperationCount = 1;
+        session = [NSURLSession sessionWithConfiguration:configuration delegate:nil delegateQueue:delegateQueue];
     }
     return self;
 }
 
+- (instancetype)initWithBaseURL:(NSURL *)newBaseURL
+{
+    return [self initWithBaseURL:newBaseURL sessionConfiguration:nil];
+}
+
 - (instancetype)init
 {
     return [self initWithBaseURL:nil];
@@ -46,6 +77,7 @@
 - (void)dealloc
 {
     [operationQueue cancelAllOperations];
+    [session invalidateAndCancel];
 }
 
 #pragma mark KVO
@@ -120,6 +152,55 @@
     }];
 }
 
+- (void)fileExistsAtPaths:(NSArray *)paths completion:(CDEBatchFileExistenceCallback)completion
+{
+    NSURL *url = [self.baseURL URLByAppendingPathComponent:@"fileexists" isDirectory:NO];
+    [self postJSONObject:@{@"paths":paths} toURL:url completion:^(NSError *error, NSDictionary *responseDict) {
+        // Servers that predate batch requests reject them, or return a single result. Fall back to one request per path.
+        BOOL isServerError = [error.domain isEqualToString:CDEErrorDomain] && error.code == CDEErrorCodeServerError;
+        if (error && !isServerError) {
+            if (completion) completion(nil, nil, error);
+            return;
+        }
+        
+        NSArray *existences = responseDict[@"exists"];
+        NSArray *directories = responseDict[@"isdir"];
+        BOOL isBatchResponse = [existences isKindOfClass:[NSArray class]] && [directories isKindOfClass:[NSArray class]];
+        if (isBatchResponse && existences.count == paths.count && directories.count == paths.count) {
+            if (completion) completion(existences, directories, nil);
+            return;
+        }
+        
+        [self fileExistsAtEachOfPaths:paths completion:completion];
+    }];
+}
+
+- (void)fileExistsAtEachOfPaths:(NSArray *)paths completion:(CDEBatchFileExistenceCallback)completion
+{
+    NSMutableArray *existences = [[NSMutableArray alloc] initWithCapacity:paths.count];
+    NSMutableArray *directories = [[NSMutableArray alloc] initWithCapacity:paths.count];
+    for (NSUInteger i = 0; i < paths.count; i++) {
+        [existences addObject:@NO];
+        [directories addObject:@NO];
+    }
+    
+    __block NSError *lastError = nil;
+    dispatch_group_t group = dispatch_group_create();
+    [paths enumerateObjectsUsingBlock:^(NSString *path, NSUInteger index, BOOL *stop) {
+        dispatch_group_enter(group);
+        [self fileExistsAtPath:path completion:^(BOOL exists, BOOL isDirectory, NSError *error) {
+            if (error) lastError = error;
+            existences[index] = @(exists);
+            directories[index] = @(isDirectory);
+            dispatch_group_leave(group);
+        }];
+    }];
+    
+    dispatch_group_notify(group, CDEWorkQueue(), ^{
+        if (completion) completion((lastError ? nil : existences), (lastError ? nil : directories), lastError);
+    });
+}
+
 #pragma mark - Getting Directory Contents
 
 - (void)contentsOfDirectoryAtPath:(NSString *)path completion:(CDEDirectoryContentsCallback)completion
@@ -142,7 +223,7 @@
 - (void)createDirectoryAtPath:(NSString *)path completion:(CDECompletionBlock)completion
 {
     // S3 doesn't have directories, so just indicate success
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(nil);
     });
 }
@@ -151,59 +232,142 @@
 
 - (void)removeItemAtPath:(NSString *)path completion:(CDECompletionBlock)completion
 {
-    NSURL *url = [self.baseURL URLByAppendingPathComponent:@"deleteurls" isDirectory:NO];
-    [self postJSONObject:@{@"paths" : @[path]} toURL:url completion:^(NSError *error, NSDictionary *responseDict) {
-        if (error) {
-            if (completion) completion(error);
-            return;
-        }
-        
-        NSArray *urls = responseDict[@"urls"];
-        NSURL *url = [NSURL URLWithString:urls.lastObject];
+    [self removeItemsAtPaths:@[path] completion:completion];
+}
+
+- (void)removeItemsAtPaths:(NSArray *)paths completion:(CDECompletionBlock)completion
+{
+    [self performRequestsOfType:@"deleteurls" forPaths:paths usingBlock:^(NSURL *url, NSString *checksum, NSUInteger index, CDECompletionBlock done) {
         [self sendRequestForURL:url HTTPMethod:@"DELETE" authenticate:NO contentType:nil body:nil completion:^(NSError *error, NSDictionary *responseDict) {
-            if (completion) completion(error);
+            done(error);
         }];
-    }];
+    } completion:completion];
 }
 
 #pragma mark - Uploading and Downloading
 
 - (void)uploadLocalFile:(NSString *)fromPath toPath:(NSString *)toPath completion:(CDECompletionBlock)completion
 {
-    NSURL *url = [self.baseURL URLByAppendingPathComponent:@"uploadurls" isDirectory:NO];
-    [self postJSONObject:@{@"paths" : @[toPath]} toURL:url completion:^(NSError *error, NSDictionary *responseDict) {
+    [self uploadLocalFiles:@[fromPath] toPaths:@[toPath] completion:completion];
+}
+
+- (void)uploadLocalFiles:(NSArray *)fromPaths toPaths:(NSArray *)toPaths completion:(CDECompletionBlock)completion
+{
+    [self performRequestsOfType:@"uploadurls" forPaths:toPaths usingBlock:^(NSURL *url, NSString *checksum, NSUInteger index, CDECompletionBlock done) {
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalAndRemoteCacheData timeoutInterval:300.0];
+        request.HTTPMethod = @"PUT";
+        
+        CDEFileUploadOperation *operation = [[CDEFileUploadOperation alloc] initWithURLRequest:request localPath:fromPaths[index] session:self->session];
+        operation.completion = done;
+        [self->operationQueue addOperation:operation];
+    } completion:completion];
+}
+
+- (void)downloadFromPath:(NSString *)fromPath toLocalFile:(NSString *)toPath completion:(CDECompletionBlock)completion
+{
+    [self downloadFromPaths:@[fromPath] toLocalFiles:@[toPath] completion:completion];
+}
+
+- (void)downloadFromPaths:(NSArray *)fromPaths toLocalFiles:(NSArray *)toPaths completion:(CDECompletionBlock)completion
+{
+    [self performRequestsOfType:@"downloadurls" forPaths:fromPaths usingBlock:^(NSURL *url, NSString *checksum, NSUInteger index, CDECompletionBlock done) {
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
+        request.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
+        
+        CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:toPaths[index] session:self->session];
+        operation.expectedSHA256String = checksum;
+        operation.completion = done;
+        [self->operationQueue addOperation:operation];
+    } completion:completion];
+}
+
+#pragma mark - Signed URLs
+
+// Signed URLs are requested in batches. The next batch is requested once half of the current
+// batch has transferred, so URL requests overlap with transfers without signing URLs long before use.
+- (void)performRequestsOfType:(NSString *)type forPaths:(NSArray *)paths usingBlock:(void(^)(NSURL *url, NSString *checksum, NSUInteger index, CDECompletionBlock done))block completion:(CDECompletionBlock)completion
+{
+    if (paths.count == 0) {
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(nil);
+        });
+        return;
+    }
+    
+    NSMutableArray *errors = [NSMutableArray array];
+    dispatch_group_t group = dispatch_group_create();
+    [self performRequestsOfType:type forPaths:paths fromIndex:0 group:group errors:errors usingBlock:block];
+    
+    dispatch_group_notify(group, CDEWorkQueue(), ^{
+        if (completion) completion(errors.lastObject);
+    });
+}
+
+- (void)performRequestsOfType:(NSString *)type forPaths:(NSArray *)paths fromIndex:(NSUInteger)start group:(dispatch_group_t)group errors:(NSMutableArray *)errors usingBlock:(void(^)(NSURL *url, NSString *checksum, NSUInteger index, CDECompletionBlock done))block
+{
+    NSUInteger length = MIN(CDENodeMaximumPathsPerURLRequest, paths.count - start);
+    NSUInteger nextStart = start + length;
+    NSArray *batch = [paths subarrayWithRange:NSMakeRange(start, length)];
+    
+    dispatch_group_enter(group);
+    [self requestURLsOfType:type forPaths:batch completion:^(NSError *error, NSArray *urls, NSArray *checksums) {
         if (error) {
-            if (completion) completion(error);
+            [errors addObject:error];
+            dispatch_group_leave(group);
             return;
         }
         
-        NSArray *urls = responseDict[@"urls"];
-        NSURL *url = [NSURL URLWithString:urls.lastObject];
-        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalAndRemoteCacheData timeoutInterval:300.0];
-        request.HTTPMethod = @"PUT";
+        __block NSUInteger remaining = urls.count;
+        __block BOOL requestedNextBatch = NO;
+        [urls enumerateObjectsUsingBlock:^(NSURL *url, NSUInteger index, BOOL *stop) {
+            dispatch_group_enter(group);
+            block(url, CDENSNullToNil(checksums[index]), start + index, ^(NSError *error) {
+                if (error) [errors addObject:error];
+                
+                remaining--;
+                if (!requestedNextBatch && nextStart < paths.count && remaining <= length / 2 && errors.count == 0) {
+                    requestedNextBatch = YES;
+                    [self performRequestsOfType:type forPaths:paths fromIndex:nextStart group:group errors:errors usingBlock:block];
+                }
+                
+                dispatch_group_leave(group);
+            });
+        }];
         
-        CDEFileUploadOperation *operation = [[CDEFileUploadOperation alloc] initWithURLRequest:request localPath:fromPath];
-        operation.completion = completion;
-        [self->operationQueue addOperation:operation];
+        dispatch_group_leave(group);
     }];
 }
 
-- (void)downloadFromPath:(NSString *)fromPath toLocalFile:(NSString *)toPath completion:(CDECompletionBlock)completion
+// Download URLs come with the SHA-256 of each file, so a download is verified before it is used.
+// Checksums are NSNull where the server has none.
+- (void)requestURLsOfType:(NSString *)type forPaths:(NSArray *)paths completion:(void(^)(NSError *error, NSArray *urls, NSArray *checksums))completion
 {
-    NSURL *url = [self.baseURL URLByAppendingPathComponent:@"downloadurls" isDirectory:NO];
-    [self postJSONObject:@{@"paths" : @[fromPath]} toURL:url completion:^(NSError *error, NSDictionary *responseDict) {
+    NSURL *url = [self.baseURL URLByAppendingPathComponent:type isDirectory:NO];
+    [self postJSONObject:@{@"paths" : paths} toURL:url completion:^(NSError *error, NSDictionary *responseDict) {
         if (error) {
-            if (completion) completion(error);
+            if (completion) completion(error, nil, nil);
             return;
         }
         
-        NSArray *urls = responseDict[@"urls"];
-        NSURL *url = [NSURL URLWithString:urls.lastObject];
-        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
-        request.cachePolicy = NSURLRequestReloadIgnoringLocalAndRemoteCacheData;
-        CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:toPath];
-        operation.completion = completion;
-        [self->operationQueue addOperation:operation];
+        NSArray *urlStrings = responseDict[@"urls"];
+        if (urlStrings.count != paths.count) {
+            NSDictionary *userInfo = @{NSLocalizedDescriptionKey : @"Number of signed URLs does not match number of paths"};
+            error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:userInfo];
+            if (completion) completion(error, nil, nil);
+            return;
+        }
+        
+        NSArray *urls = [urlStrings cde_arrayByTransformingObjectsWithBlock:^NSURL *(NSString *urlString) {
+            return [NSURL URLWithString:urlString];
+        }];
+        
+        NSArray *checksumStrings = responseDict[@"checksums"];
+        NSMutableArray *checksums = [[NSMutableArray alloc] initWithCapacity:paths.count];
+        for (NSUInteger i = 0; i < paths.count; i++) {
+            id checksum = i < checksumStrings.count ? checksumStrings[i] : nil;
+            [checksums addObject:[checksum isKindOfClass:[NSString class]] ? [checksum lowercaseString] : [NSNull null]];
+        }
+        if (completion) completion(nil, urls, checksums);
     }];
 }
 
@@ -267,45 +431,53 @@
         [request setValue:authValue forHTTPHeaderField:@"Authorization"];
     }
     
-    // Send request
-    [NSURLConnection sendAsynchronousRequest:request queue:[NSOperationQueue mainQueue] completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
-        // Check error
-        BOOL isAuthError = NO;
-        if (error) isAuthError = ([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorUserCancelledAuthentication);
-        if (error && !isAuthError) {
-            if (completion) completion(error, nil);
-            return;
-        }
-        
-        // Check HTTP status
-        NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
-		NSInteger statusCode = httpResponse.statusCode;
-        BOOL statusOK = (statusCode >= 200 && statusCode < 300);
-        BOOL authFailed = (statusCode == 401 || isAuthError);
-        if (authFailed) self.password = nil;
-        if (!statusOK) {
-            NSInteger code = authFailed ? CDEErrorCodeAuthenticationFailure : CDEErrorCodeServerError;
-            NSDictionary *userInfo = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"HTTP status code was %ld", (long)statusCode]};
-            error = [NSError errorWithDomain:CDEErrorDomain code:code userInfo:userInfo];
-            if (completion) completion(error, nil);
-            return;
-        }
-        
-        // Parse Body
-        NSDictionary *responseDict = nil;
-        if (data) responseDict = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
-        
-        // Check for JSON error
-        if (data.length == 0 || (responseDict && [responseDict[@"success"] boolValue])) {
-            if (completion) completion(nil, responseDict);
-        }
-        else {
-            NSString *message = responseDict ? responseDict[@"error"] : @"No response";
-            NSDictionary *userInfo = @{NSLocalizedDescriptionKey : message};
-            error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:userInfo];
-            if (completion) completion(error, nil);
-        }
+    // Send request, and handle the response on the work queue
+    NSURLSessionDataTask *task = [session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        dispatch_async(CDEWorkQueue(), ^{
+            [self handleResponse:response data:data error:error completion:completion];
+        });
     }];
+    [task resume];
+}
+
+- (void)handleResponse:(NSURLResponse *)response data:(NSData *)data error:(NSError *)error completion:(void(^)(NSError *error, NSDictionary *responseDict))completion
+{
+    // Check error
+    BOOL isAuthError = NO;
+    if (error) isAuthError = ([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorUserCancelledAuthentication);
+    if (error && !isAuthError) {
+        if (completion) completion(error, nil);
+        return;
+    }
+    
+    // Check HTTP status
+    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+	NSInteger statusCode = httpResponse.statusCode;
+    BOOL statusOK = (statusCode >= 200 && statusCode < 300);
+    BOOL authFailed = (statusCode == 401 || isAuthError);
+    if (authFailed) self.password = nil;
+    if (!statusOK) {
+        NSInteger code = authFailed ? CDEErrorCodeAuthenticationFailure : CDEErrorCodeServerError;
+        NSDictionary *userInfo = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"HTTP status code was %ld", (long)statusCode]};
+        error = [NSError errorWithDomain:CDEErrorDomain code:code userInfo:userInfo];
+        if (completion) completion(error, nil);
+        return;
+    }
+    
+    // Parse Body
+    NSDictionary *responseDict = nil;
+    if (data) responseDict = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
+    
+    // Check for JSON error
+    if (data.length == 0 || (responseDict && [responseDict[@"success"] boolValue])) {
+        if (completion) completion(nil, responseDict);
+    }
+    else {
+        NSString *message = responseDict ? responseDict[@"error"] : @"No response";
+        NSDictionary *userInfo = @{NSLocalizedDescriptionKey : message};
+        error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:userInfo];
+        if (completion) completion(error, nil);
+    }
 }
 
 @end
@@ -20,6 +20,95 @@
 #import "CDEObjectChange.h"
 #import "CDEGlobalIdentifier.h"
 #import "CDEPropertyChangeValue.h"
+#import "CDEEventPurger.h"
+
+static const NSUInteger CDEBaselineMergeFetchBatchSize = 500;
+
+// Orders global identifiers the way the SQLite store does, by the bytes of the identifier, then entity name
+static NSComparisonResult CDECompareGlobalIdentifierKeys(NSString *identifier, NSString *entityName, NSString *otherIdentifier, NSString *otherEntityName)
+{
+    int result = strcmp(identifier.UTF8String, otherIdentifier.UTF8String);
+    if (result == 0) result = strcmp(entityName.UTF8String, otherEntityName.UTF8String);
+    if (result < 0) return NSOrderedAscending;
+    return result > 0 ? NSOrderedDescending : NSOrderedSame;
+}
+
+
+// Pages through the object changes of one baseline in global identifier order
+@interface CDEBaselineObjectChangeCursor : NSObject
+
+@property (nonatomic, readonly) CDEStoreModificationEvent *baseline;
+@property (nonatomic, readonly) CDEObjectChange *currentChange; // Nil when the page is used up
+@property (nonatomic, readonly) BOOL needsPage;
+
+- (instancetype)initWithBaseline:(CDEStoreModificationEvent *)baseline;
+
+- (BOOL)loadPageAfterGlobalIdentifier:(NSString *)identifier entityName:(NSString *)entityName error:(NSError * __autoreleasing *)error;
+- (void)advance;
+
+@end
+
+@implementation CDEBaselineObjectChangeCursor {
+    NSMutableArray *page;
+    BOOL exhausted;
+}
+
+@synthesize baseline = baseline;
+
+- (instancetype)initWithBaseline:(CDEStoreModificationEvent *)newBaseline
+{
+    self = [super init];
+    if (self) {
+        baseline = newBaseline;
+        page = [[NSMutableArray alloc] init];
+        exhausted = NO;
+    }
+    return self;
+}
+
+- (CDEObjectChange *)currentChange
+{
+    return page.firstObject;
+}
+
+- (BOOL)needsPage
+{
+    return page.count == 0 && !exhausted;
+}
+
+- (void)advance
+{
+    if (page.count > 0) [page removeObjectAtIndex:0];
+}
+
+- (BOOL)loadPageAfterGlobalIdentifier:(NSString *)identifier entityName:(NSString *)entityName error:(NSError * __autoreleasing *)error
+{
+    // Changes at or before the last merged key are done with, including any moved into this baseline
+    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent = %@", baseline];
+    if (identifier) {
+        NSPredicate *afterPredicate = [NSPredicate predicateWithFormat:@"globalIdentifier.globalIdentifier > %@ OR (globalIdentifier.globalIdentifier = %@ AND globalIdentifier.nameOfEntity > %@)", identifier, identifier, entityName];
+        predicate = [NSCompoundPredicate andPredicateWithSubpredicates:@[predicate, afterPredicate]];
+    }
+    
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+    fetch.predicate = predicate;
+    fetch.sortDescriptors = @[
+        [NSSortDescriptor sortDescriptorWithKey:@"globalIdentifier.globalIdentifier" ascending:YES],
+        [NSSortDescriptor sortDescriptorWithKey:@"globalIdentifier.nameOfEntity" ascending:YES]
+    ];
+    fetch.fetchLimit = CDEBaselineMergeFetchBatchSize;
+    fetch.relationshipKeyPathsForPrefetching = @[@"globalIdentifier", @"dataFiles"];
+    
+    NSArray *changes = [baseline.managedObjectContext executeFetchRequest:fetch error:error];
+    if (!changes) return NO;
+    
+    [page setArray:changes];
+    exhausted = changes.count < CDEBaselineMergeFetchBatchSize;
+    return YES;
+}
+
+@end
+
 
 @implementation CDEBaselineConsolidator {
 }
@@ -89,14 +178,9 @@
         NSSet *baselinesToEliminate = [self redundantBaselinesInBaselines:baselineEvents];
         
         // Delete redundant baselines
-        [CDEStoreModificationEvent prefetchRelatedObjectsForStoreModificationEvents:baselinesToEliminate.allObjects];
-        for (CDEStoreModificationEvent *baseline in baselinesToEliminate) {
-            CDELog(CDELoggingLevelVerbose, @"Deleting redundant baseline with unique id: %@", baseline.uniqueIdentifier);
-            [context deleteObject:baseline];
-        }
-        
-        // Save
-        BOOL success = [context save:&error];
+        CDEEventPurger *purger = [[CDEEventPurger alloc] initWithEventStore:self.eventStore];
+        CDELog(CDELoggingLevelVerbose, @"Deleting redundant baselines with unique ids: %@", [baselinesToEliminate valueForKeyPath:@"uniqueIdentifier"]);
+        BOOL success = [purger purgeStoreModificationEventsWithObjectIDs:[baselinesToEliminate.allObjects valueForKeyPath:@"objectID"] error:&error];
         if (!success) {
             [self failWithCompletion:completion error:error];
             return;
@@ -113,21 +197,16 @@
             return;
         }
         
-        // Delete old baselines
+        // Delete old baselines. The new baseline is saved first.
         [survivingBaselines removeObject:newBaseline];
-        for (CDEStoreModificationEvent *baseline in survivingBaselines) {
-            [context deleteObject:baseline];
-            CDELog(CDELoggingLevelVerbose, @"Deleting baseline with unique id: %@", baseline.uniqueIdentifier);
-        }
-        
-        // Save
-        if (context.hasChanges) success = [context save:&error];
+        CDELog(CDELoggingLevelVerbose, @"Deleting baselines with unique ids: %@", [survivingBaselines valueForKeyPath:@"uniqueIdentifier"]);
+        success = [purger purgeStoreModificationEventsWithObjectIDs:[survivingBaselines valueForKeyPath:@"objectID"] error:&error];
         if (!success) {
             [self failWithCompletion:completion error:error];
             return;
         }
         
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             CDELog(CDELoggingLevelVerbose, @"Finishing baseline consolidation");
             if (completion) completion(nil);
         });
@@ -136,7 +215,7 @@
 
 - (void)failWithCompletion:(CDECompletionBlock)completion error:(NSError *)error
 {
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(error);
     });
 }
@@ -196,50 +275,109 @@
     
     CDELog(CDELoggingLevelVerbose, @"Merging baselines with unique ids: %@", [baselines valueForKeyPath:@"uniqueIdentifier"]);
     
-    // Change the first baseline into our new baseline by assigning a different unique id
+    // Merge the object changes of all baselines into the first. The merge saves as it goes, but the
+    // baselines keep their identities and revisions, so an interrupted merge is simply run again.
+    CDEStoreModificationEvent *firstBaseline = baselines.firstObject;
+    CDERevisionSet *newRevisionSet = [CDERevisionSet revisionSetByTakingStoreWiseMaximumOfRevisionSets:[baselines valueForKeyPath:@"revisionSet"]];
+    if (![self mergeObjectChangesOfOrderedBaselines:baselines intoBaseline:firstBaseline error:error]) return nil;
+    
+    // Only now change the first baseline into our new baseline by assigning a different unique id.
     // Global count should be maximum, ie, just keep the count of the existing first baseline.
     // A baseline global count is not required to precede save/merge events, and assigning the
     // maximum will give this new baseline precedence over older baselines.
-    CDEStoreModificationEvent *firstBaseline = baselines.firstObject;
     firstBaseline.uniqueIdentifier = [[NSProcessInfo processInfo] globallyUniqueString];
     firstBaseline.timestamp = [NSDate timeIntervalSinceReferenceDate];
     firstBaseline.modelVersion = [self.ensemble.managedObjectModel cde_entityHashesPropertyList];
     
     // Update the revisions of each store in the baseline
-    CDERevisionSet *newRevisionSet = [CDERevisionSet revisionSetByTakingStoreWiseMaximumOfRevisionSets:[baselines valueForKeyPath:@"revisionSet"]];
     NSString *persistentStoreId = self.eventStore.persistentStoreIdentifier;
     [firstBaseline setRevisionSet:newRevisionSet forPersistentStoreIdentifier:persistentStoreId];
     if (firstBaseline.eventRevision.revisionNumber == -1) firstBaseline.eventRevision.revisionNumber = 0;
-
-    // Retrieve all global identifiers. Map global ids to object changes.
-    [CDEStoreModificationEvent prefetchRelatedObjectsForStoreModificationEvents:@[firstBaseline]];
-    NSMapTable *objectChangesByGlobalId = [NSMapTable cde_strongToStrongObjectsMapTable];
-    NSSet *objectChanges = firstBaseline.objectChanges;
-    for (CDEObjectChange *change in objectChanges) {
-        [objectChangesByGlobalId setObject:change forKey:change.globalIdentifier];
+    
+    NSManagedObjectContext *context = firstBaseline.managedObjectContext;
+    if (![context save:error]) {
+        [context rollback];
+        return nil;
     }
     
-    // Get other baselines
-    NSMutableArray *otherBaselines = [baselines mutableCopy];
-    [otherBaselines removeObject:firstBaseline];
+    return firstBaseline;
+}
+
+// A k-way merge of the baselines' object changes, in global identifier order. Changes are paged in,
+// and progress saved and faulted out as it goes, so memory does not grow with the size of the baselines.
+- (BOOL)mergeObjectChangesOfOrderedBaselines:(NSArray *)baselines intoBaseline:(CDEStoreModificationEvent *)newBaseline error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = newBaseline.managedObjectContext;
+    if (context.hasChanges && ![context save:error]) return NO;
     
-    // Apply changes from others
-    for (CDEStoreModificationEvent *baseline in otherBaselines) {
-        [CDEStoreModificationEvent prefetchRelatedObjectsForStoreModificationEvents:@[baseline]];
-        [baseline.objectChanges.allObjects cde_enumerateObjectsDrainingEveryIterations:100 usingBlock:^(CDEObjectChange *change, NSUInteger index, BOOL *stop) {
-            CDEObjectChange *existingChange = [objectChangesByGlobalId objectForKey:change.globalIdentifier];
-            if (!existingChange) {
-                // Move change to new baseline
-                change.storeModificationEvent = firstBaseline;
-                [objectChangesByGlobalId setObject:change forKey:change.globalIdentifier];
+    NSMutableArray *cursors = [[NSMutableArray alloc] initWithCapacity:baselines.count];
+    for (CDEStoreModificationEvent *baseline in baselines) {
+        [cursors addObject:[[CDEBaselineObjectChangeCursor alloc] initWithBaseline:baseline]];
+    }
+    
+    NSString *lastIdentifier = nil, *lastEntityName = nil;
+    NSMutableArray *processedObjects = [[NSMutableArray alloc] init];
+    while (YES) {
+        @autoreleasepool {
+            // Save and fault out merged changes before paging in more
+            BOOL needsPage = [[cursors valueForKeyPath:@"@max.needsPage"] boolValue];
+            if (needsPage || processedObjects.count >= CDEBaselineMergeFetchBatchSize) {
+                if (![self saveAndFaultObjects:processedObjects baselines:baselines inContext:context error:error]) return NO;
+                [processedObjects removeAllObjects];
+            }
+            for (CDEBaselineObjectChangeCursor *cursor in cursors) {
+                if (cursor.needsPage && ![cursor loadPageAfterGlobalIdentifier:lastIdentifier entityName:lastEntityName error:error]) return NO;
             }
-            else {
-                [existingChange mergeValuesFromSubordinateObjectChange:change];
+            
+            // Find the smallest global identifier at the head of the cursors
+            CDEGlobalIdentifier *nextGlobalId = nil;
+            for (CDEBaselineObjectChangeCursor *cursor in cursors) {
+                CDEGlobalIdentifier *globalId = cursor.currentChange.globalIdentifier;
+                if (!globalId) continue;
+                if (!nextGlobalId || CDECompareGlobalIdentifierKeys(globalId.globalIdentifier, globalId.nameOfEntity, nextGlobalId.globalIdentifier, nextGlobalId.nameOfEntity) == NSOrderedAscending) {
+                    nextGlobalId = globalId;
+                }
             }
-        }];
+            if (!nextGlobalId) break;
+            lastIdentifier = nextGlobalId.globalIdentifier;
+            lastEntityName = nextGlobalId.nameOfEntity;
+            
+            // Merge every change with that key. Cursors are in baseline priority order.
+            NSMapTable *objectChangesByGlobalId = [NSMapTable cde_strongToStrongObjectsMapTable];
+            for (CDEBaselineObjectChangeCursor *cursor in cursors) {
+                CDEObjectChange *change;
+                while ((change = cursor.currentChange) && CDECompareGlobalIdentifierKeys(change.globalIdentifier.globalIdentifier, change.globalIdentifier.nameOfEntity, lastIdentifier, lastEntityName) == NSOrderedSame) {
+                    CDEObjectChange *existingChange = [objectChangesByGlobalId objectForKey:change.globalIdentifier];
+                    if (!existingChange) {
+                        // Move change to new baseline
+                        if (change.storeModificationEvent != newBaseline) change.storeModificationEvent = newBaseline;
+                        [objectChangesByGlobalId setObject:change forKey:change.globalIdentifier];
+                        [processedObjects addObject:change];
+                    }
+                    else {
+                        [existingChange mergeValuesFromSubordinateObjectChange:change];
+                        [context deleteObject:change];
+                    }
+                    [processedObjects addObject:change.globalIdentifier];
+                    [cursor advance];
+                }
+            }
+        }
     }
     
-    return firstBaseline;
+    return [self saveAndFaultObjects:processedObjects baselines:baselines inContext:context error:error];
+}
+
+- (BOOL)saveAndFaultObjects:(NSArray *)objects baselines:(NSArray *)baselines inContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    if (context.hasChanges && ![context save:error]) return NO;
+    for (NSManagedObject *object in objects) {
+        if (object.managedObjectContext) [context refreshObject:object mergeChanges:NO];
+    }
+    for (CDEStoreModificationEvent *baseline in baselines) {
+        [context refreshObject:baseline mergeChanges:NO];
+    }
+    return YES;
 }
 
 @end
@@ -11,19 +11,28 @@
 
 @class CDEEventStore;
 @class CDEPersistentStoreEnsemble;
+@class CDERebasePolicy;
+@class CDEEventStoreStatistics;
 
 @interface CDERebaser : NSObject
 
 @property (nonatomic, readonly) CDEEventStore *eventStore;
 @property (nonatomic, weak, readwrite) CDEPersistentStoreEnsemble *ensemble;
+@property (nonatomic, strong, readwrite) CDERebasePolicy *policy;
 
 - (instancetype)initWithEventStore:(CDEEventStore *)eventStore;
 
 - (void)deleteEventsPrecedingBaselineWithCompletion:(CDECompletionBlock)completion;
 
+- (void)fetchEventStoreStatisticsWithCompletion:(void(^)(CDEEventStoreStatistics *statistics, NSError *error))completion;
 - (void)estimateEventStoreCompactionFollowingRebaseWithCompletion:(void(^)(float compaction))completion;
 - (void)shouldRebaseWithCompletion:(void(^)(BOOL result))completion;
+- (void)shouldRebaseUrgentlyWithCompletion:(void(^)(BOOL result))completion;
 
 - (void)rebaseWithCompletion:(CDECompletionBlock)completion;
 
+// Merges events into the baseline until the budget is used, and saves the progress.
+// Finished is NO if events remain. A budget of zero or less has no limit.
+- (void)rebaseWithTimeBudget:(NSTimeInterval)budget completion:(void(^)(BOOL finished, NSError *error))completion;
+
 @end
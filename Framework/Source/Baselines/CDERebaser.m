@@ -20,6 +20,12 @@
 #import "CDERevisionManager.h"
 #import "CDERevisionSet.h"
 #import "CDERevision.h"
+#import "CDERebasePolicy.h"
+#import "CDEObjectChangeStatistics.h"
+#import "CDEEventPurger.h"
+
+static const NSUInteger CDEBaselineChangeFetchBatchSize = 500;
+static const NSUInteger CDERebaseSliceEventLimit = 200;
 
 @interface CDERebaser ()
 
@@ -27,10 +33,14 @@
 
 @end
 
-@implementation CDERebaser
+@implementation CDERebaser {
+    BOOL statisticsReconciled;
+    NSTimeInterval measuredSecondsPerObjectChange;
+}
 
 @synthesize eventStore = eventStore;
 @synthesize ensemble = ensemble;
+@synthesize policy = policy;
 @synthesize forceRebase = forceRebase;
 
 - (instancetype)initWithEventStore:(CDEEventStore *)newStore
@@ -38,11 +48,21 @@
     self = [super init];
     if (self) {
         eventStore = newStore;
+        policy = [[CDERebasePolicy alloc] init];
         forceRebase = NO;
+        statisticsReconciled = NO;
+        measuredSecondsPerObjectChange = 0.0;
+        
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(managedObjectContextWillSave:) name:NSManagedObjectContextWillSaveNotification object:nil];
     }
     return self;
 }
 
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:NSManagedObjectContextWillSaveNotification object:nil];
+}
+
 
 #pragma mark Removing Out-of-Date Events
 
@@ -54,103 +74,138 @@
         CDERevisionSet *baselineRevisionSet = baseline.revisionSet;
         NSSet *storeIds = baselineRevisionSet.persistentStoreIdentifiers;
         NSArray *types = @[@(CDEStoreModificationEventTypeMerge), @(CDEStoreModificationEventTypeSave)];
+        NSMutableArray *storePredicates = [[NSMutableArray alloc] init];
         for (NSString *storeId in storeIds) {
             CDERevision *baseRevision = [baselineRevisionSet revisionForPersistentStoreIdentifier:storeId];
-            
-            NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
             NSPredicate *storePredicate = [CDEStoreModificationEvent predicateForAllowedTypes:types persistentStoreIdentifier:storeId];
             NSPredicate *revisionPredicate = [NSPredicate predicateWithFormat:@"eventRevision.revisionNumber <= %lld", baseRevision.revisionNumber];
-            fetch.predicate = [NSCompoundPredicate andPredicateWithSubpredicates:@[storePredicate, revisionPredicate]];
-            
-            NSError *error;
-            NSArray *events = [context executeFetchRequest:fetch error:&error];
-            if (!events) {
-                dispatch_async(dispatch_get_main_queue(), ^{
-                    if (completion) completion(error);
-                });
-                return;
-            }
-            
-            [CDEStoreModificationEvent prefetchRelatedObjectsForStoreModificationEvents:events];
-            for (CDEStoreModificationEvent *event in events) {
-                [context deleteObject:event];
-            }
+            [storePredicates addObject:[NSCompoundPredicate andPredicateWithSubpredicates:@[storePredicate, revisionPredicate]]];
         }
         
+        // Purged in the store, rather than faulted in and cascaded
         NSError *error = nil;
-        BOOL saved = [context save:&error];
+        BOOL success = YES;
+        if (storePredicates.count > 0) {
+            CDEEventPurger *purger = [[CDEEventPurger alloc] initWithEventStore:self.eventStore];
+            NSPredicate *predicate = [NSCompoundPredicate orPredicateWithSubpredicates:storePredicates];
+            success = [purger purgeStoreModificationEventsMatchingPredicate:predicate error:&error];
+        }
+        
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(success ? nil : error);
+        });
+    }];
+}
+
+#pragma mark Object Change Statistics
+
+- (void)managedObjectContextWillSave:(NSNotification *)notif
+{
+    NSManagedObjectContext *context = notif.object;
+    if (context != self.eventStore.managedObjectContext) return;
+    [CDEObjectChangeStatistics updateStatisticsForChangesInManagedObjectContext:context];
+}
+
+// Call on the event store context queue. Statistics are added for events that predate them the first time.
+- (BOOL)reconcileObjectChangeStatistics:(NSError * __autoreleasing *)error
+{
+    if (statisticsReconciled) return YES;
+    
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    if (![CDEObjectChangeStatistics updateStatisticsForAllEventsInManagedObjectContext:context error:error]) return NO;
+    if (context.hasChanges && ![context save:error]) return NO;
+    
+    statisticsReconciled = YES;
+    return YES;
+}
+
+// Call on the event store context queue
+- (CDEEventStoreStatistics *)eventStoreStatistics:(NSError * __autoreleasing *)error
+{
+    if (![self reconcileObjectChangeStatistics:error]) return nil;
+
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    CDEEventStoreStatistics *statistics = [CDEObjectChangeStatistics eventStoreStatisticsInManagedObjectContext:context error:error];
+    if (!statistics) return nil;
+    
+    // Stores missing from the baseline
+    CDEStoreModificationEvent *baseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:context];
+    statistics.hasBaseline = baseline != nil;
+    if (baseline) {
+        CDERevisionManager *revisionManager = [[CDERevisionManager alloc] initWithEventStore:self.eventStore];
+        NSSet *allStores = revisionManager.allPersistentStoreIdentifiers;
+        statistics.baselineIncludesAllStores = [allStores isSubsetOfSet:baseline.revisionSet.persistentStoreIdentifiers]; // Baseline also keeps retired stores
+    }
+    
+    statistics.measuredSecondsPerObjectChange = measuredSecondsPerObjectChange;
+    
+    return statistics;
+}
 
-        dispatch_async(dispatch_get_main_queue(), ^{
-            if (completion) completion(saved ? nil : error);
+- (void)fetchEventStoreStatisticsWithCompletion:(void(^)(CDEEventStoreStatistics *statistics, NSError *error))completion
+{
+    NSParameterAssert(completion);
+    [eventStore.managedObjectContext performBlock:^{
+        NSError *error = nil;
+        CDEEventStoreStatistics *statistics = [self eventStoreStatistics:&error];
+        if (!statistics) CDELog(CDELoggingLevelError, @"Could not fetch event store statistics: %@", error);
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(statistics, statistics ? nil : error);
         });
     }];
 }
 
+
 #pragma mark Determining When to Rebase
 
 - (void)estimateEventStoreCompactionFollowingRebaseWithCompletion:(void(^)(float compaction))completion
 {
     NSParameterAssert(completion);
-    [self.eventStore.managedObjectContext performBlock:^{
-        // Determine size of baseline
-        NSInteger currentBaselineCount = [self countOfBaseline];
-        
-        // Determine inserted, deleted, and updated changes outside baseline
-        NSInteger deletedCount = [self countOfNonBaselineObjectChangesOfType:CDEObjectChangeTypeDelete];
-        NSInteger insertedCount = [self countOfNonBaselineObjectChangesOfType:CDEObjectChangeTypeInsert];
-        NSInteger updatedCount = [self countOfNonBaselineObjectChangesOfType:CDEObjectChangeTypeUpdate];
-        
-        // Estimate size of baseline after rebasing.
-        // Assume that an insertion is 1 data unit.
-        // A deletion removes at least one insertion, so it is worth 1 data unit.
-        // An update is usually to some subset of properties. Assume it has weight 0.2 data units.
-        float postRebaseSize = currentBaselineCount - deletedCount + insertedCount;
-        
-        // Estimate compaction
-        float currentSize = currentBaselineCount + insertedCount + 0.2*updatedCount;
-        float compaction = 1.0f - ( postRebaseSize / (float)MAX(1,currentSize) );
-        compaction = MIN( MAX(compaction, 0.0f), 1.0f);
-        
-        dispatch_async(dispatch_get_main_queue(), ^{
-            if (completion) completion(compaction);
-        });
+    [self fetchEventStoreStatisticsWithCompletion:^(CDEEventStoreStatistics *statistics, NSError *error) {
+        float compaction = statistics ? [self.policy predictedCompactionForStatistics:statistics] : 0.0f;
+        if (completion) completion(compaction);
     }];
 }
 
 - (void)shouldRebaseWithCompletion:(void(^)(BOOL result))completion
+{
+    [self shouldRebaseUrgently:NO completion:completion];
+}
+
+- (void)shouldRebaseUrgentlyWithCompletion:(void(^)(BOOL result))completion
+{
+    [self shouldRebaseUrgently:YES completion:completion];
+}
+
+- (void)shouldRebaseUrgently:(BOOL)urgent completion:(void(^)(BOOL result))completion
 {
     NSParameterAssert(completion);
     
     if (self.forceRebase) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (completion) completion(YES);
         });
         return;
     }
 
-    // Rebase if there are more than 500 object changes, or we can reduce data by more than 50%,
-    // or if there is no baseline at all
-    NSManagedObjectContext *context = eventStore.managedObjectContext;
-    [context performBlock:^{
-        BOOL hasBaseline = NO;
-        CDERevisionSet *baselineRevisionSet = nil;
-        CDEStoreModificationEvent *baseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:context];
-        hasBaseline = baseline != nil;
-        baselineRevisionSet = baseline.revisionSet;
+    [self fetchEventStoreStatisticsWithCompletion:^(CDEEventStoreStatistics *statistics, NSError *error) {
+        if (!statistics) {
+            if (completion) completion(NO);
+            return;
+        }
         
-        // Rebase if the baseline doesn't include all stores
-        CDERevisionManager *revisionManager = [[CDERevisionManager alloc] initWithEventStore:self.eventStore];
-        NSSet *allStores = revisionManager.allPersistentStoreIdentifiers;
-        BOOL hasAllDevicesInBaseline = [baselineRevisionSet.persistentStoreIdentifiers isEqualToSet:allStores];
+        CDERebasePolicy *rebasePolicy = self.policy;
+        BOOL result = urgent ? [rebasePolicy shouldRebaseUrgentlyWithStatistics:statistics] : [rebasePolicy shouldRebaseWithStatistics:statistics];
+        CDELog(CDELoggingLevelVerbose, @"Rebase policy result: %d, urgent: %d, statistics: %@", result, urgent, statistics);
         
-        BOOL hasManyEvents = [self countOfStoreModificationEvents] > 50;
-        BOOL hasAdequateChanges = [self countOfAllObjectChanges] >= 500;
+        // Let the app override the policy
+        CDEPersistentStoreEnsemble *strongEnsemble = self.ensemble;
+        id <CDEPersistentStoreEnsembleDelegate> delegate = strongEnsemble.delegate;
+        if ([delegate respondsToSelector:@selector(persistentStoreEnsemble:shouldRebaseWithStatistics:urgently:proposedResult:)]) {
+            result = [delegate persistentStoreEnsemble:strongEnsemble shouldRebaseWithStatistics:statistics urgently:urgent proposedResult:result];
+        }
         
-        [self estimateEventStoreCompactionFollowingRebaseWithCompletion:^(float compaction) {
-            BOOL compactionIsAdequate = compaction > 0.5f;
-            BOOL result = !hasBaseline || !hasAllDevicesInBaseline || hasManyEvents || (hasAdequateChanges && compactionIsAdequate);
-            if (completion) completion(result);
-        }];
+        if (completion) completion(result);
     }];
 }
 
@@ -158,6 +213,13 @@
 #pragma mark Rebasing
 
 - (void)rebaseWithCompletion:(CDECompletionBlock)completion
+{
+    [self rebaseWithTimeBudget:0.0 completion:^(BOOL finished, NSError *error) {
+        if (completion) completion(error);
+    }];
+}
+
+- (void)rebaseWithTimeBudget:(NSTimeInterval)budget completion:(void(^)(BOOL finished, NSError *error))completion
 {
     CDELog(CDELoggingLevelVerbose, @"Starting rebase");
     
@@ -166,12 +228,19 @@
     
     NSManagedObjectContext *context = eventStore.managedObjectContext;
     [context performBlock:^{
+        // Statistics of older events must exist before changes move between events
+        NSError *statisticsError = nil;
+        if (![self reconcileObjectChangeStatistics:&statisticsError]) CDELog(CDELoggingLevelWarning, @"Could not add object change statistics: %@", statisticsError);
+
         // Fetch objects
         CDEStoreModificationEvent *existingBaseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:context];
-        NSArray *eventsToMerge = [CDEStoreModificationEvent fetchNonBaselineEventsUpToGlobalCount:newBaselineGlobalCount inManagedObjectContext:context];
+        // A time-sliced rebase only fetches and checks the earliest events, so a slice does not grow with the backlog
+        NSUInteger eventLimit = budget > 0.0 ? CDERebaseSliceEventLimit : 0;
+        NSArray *eventsToMerge = [CDEStoreModificationEvent fetchNonBaselineEventsUpToGlobalCount:newBaselineGlobalCount limit:eventLimit inManagedObjectContext:context];
+        BOOL fetchedAllEvents = eventLimit == 0 || eventsToMerge.count < eventLimit;
         if (existingBaseline && eventsToMerge.count == 0) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                if (completion) completion(nil);
+            dispatch_async(CDEWorkQueue(), ^{
+                if (completion) completion(YES, nil);
             });
             return;
         }
@@ -183,8 +252,8 @@
         BOOL passedChecks = [revisionManager checkRebasingPrerequisitesForEvents:eventsToMerge error:&error];
         if (!passedChecks) {
             CDELog(CDELoggingLevelWarning, @"Failed rebasing prerequisite checks. Aborting rebase");
-            dispatch_async(dispatch_get_main_queue(), ^{
-                if (completion) completion(error);
+            dispatch_async(CDEWorkQueue(), ^{
+                if (completion) completion(NO, error);
             });
             return;
         }
@@ -196,59 +265,131 @@
             newBaseline.type = CDEStoreModificationEventTypeBaseline;
         }
     
-        // Merge events into baseline
-        [self mergeOrderedEvents:eventsToMerge intoBaseline:newBaseline];
+        // Merge events into baseline, stopping early if the time budget runs out
+        NSDate *startDate = [NSDate date];
+        NSDate *deadline = budget > 0.0 ? [NSDate dateWithTimeIntervalSinceNow:budget] : nil;
+        NSUInteger mergedCount = 0, mergedObjectChangeCount = 0;
+        if (![self mergeOrderedEvents:eventsToMerge intoBaseline:newBaseline deadline:deadline mergedCount:&mergedCount objectChangeCount:&mergedObjectChangeCount error:&error]) {
+            CDELog(CDELoggingLevelError, @"Failed to merge events into baseline: %@", error);
+            [context rollback];
+            dispatch_async(CDEWorkQueue(), ^{
+                if (completion) completion(NO, error);
+            });
+            return;
+        }
         
-        // Set new count and other properties
-        newBaseline.globalCount = newBaselineGlobalCount;
+        BOOL finished = fetchedAllEvents && mergedCount == eventsToMerge.count;
+        NSArray *mergedEvents = [eventsToMerge subarrayWithRange:NSMakeRange(0, mergedCount)];
+        if (!finished) CDELog(CDELoggingLevelVerbose, @"Rebase time budget used after merging %lu of %lu events", (unsigned long)mergedCount, (unsigned long)eventsToMerge.count);
+        
+        // Set new count and other properties. A partial rebase only reaches the last merged event.
+        newBaseline.globalCount = finished ? newBaselineGlobalCount : [mergedEvents.lastObject globalCount];
         newBaseline.timestamp = [NSDate timeIntervalSinceReferenceDate];
         newBaseline.modelVersion = [self.ensemble.managedObjectModel cde_entityHashesPropertyList];
         
         // Update store revisions by taking the maximum for each store, and the baseline
-        NSArray *revisionedEvents = eventsToMerge;
+        NSArray *revisionedEvents = mergedEvents;
         if (existingBaseline) revisionedEvents = [revisionedEvents arrayByAddingObject:existingBaseline];
         CDERevisionSet *newRevisionSet = [CDERevisionSet revisionSetByTakingStoreWiseMaximumOfRevisionSets:[revisionedEvents valueForKeyPath:@"revisionSet"]];
         NSString *persistentStoreId = self.eventStore.persistentStoreIdentifier;
         [newBaseline setRevisionSet:newRevisionSet forPersistentStoreIdentifier:persistentStoreId];
         if (newBaseline.eventRevision.revisionNumber == -1) newBaseline.eventRevision.revisionNumber = 0;
         
-        // Delete merged events
-        for (CDEStoreModificationEvent *event in eventsToMerge) [context deleteObject:event];
-
-        // Save
+        // Retire the merged events in the same save as the baseline. Their changes are already folded into
+        // the baseline, and incomplete events are never merged a second time. They are purged from the
+        // store afterwards, and any left by an interrupted purge are removed at the next launch.
+        for (CDEStoreModificationEvent *event in mergedEvents) {
+            event.type = CDEStoreModificationEventTypeIncomplete;
+        }
+        
         BOOL saved = [context save:&error];
-        if (!saved) CDELog(CDELoggingLevelError, @"Failed to save rebase: %@", error);
+        if (!saved) {
+            CDELog(CDELoggingLevelError, @"Failed to save rebase: %@", error);
+            [context rollback];
+        }
+        else {
+            NSError *purgeError = nil;
+            CDEEventPurger *purger = [[CDEEventPurger alloc] initWithEventStore:self.eventStore];
+            if (![purger purgeStoreModificationEventsWithObjectIDs:[mergedEvents valueForKeyPath:@"objectID"] error:&purgeError]) {
+                CDELog(CDELoggingLevelWarning, @"Could not purge merged events after rebase: %@", purgeError);
+            }
+        }
+        
+        // Measure the cost of merging, for the rebase policy
+        if (saved && mergedObjectChangeCount > 0) {
+            self->measuredSecondsPerObjectChange = -startDate.timeIntervalSinceNow / mergedObjectChangeCount;
+        }
         
         // Complete
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             CDELog(CDELoggingLevelVerbose, @"Finishing rebase");
-            if (completion) completion(saved ? nil : error);
+            if (completion) completion(saved && finished, saved ? nil : error);
         });
     }];
 }
 
-- (void)mergeOrderedEvents:(NSArray *)eventsToMerge intoBaseline:(CDEStoreModificationEvent *)baseline
+- (BOOL)mergeOrderedEvents:(NSArray *)eventsToMerge intoBaseline:(CDEStoreModificationEvent *)baseline deadline:(NSDate *)deadline mergedCount:(NSUInteger *)mergedCount objectChangeCount:(NSUInteger *)objectChangeCount error:(NSError * __autoreleasing *)error
 {
-    // Create map of existing object changes
-    [CDEStoreModificationEvent prefetchRelatedObjectsForStoreModificationEvents:@[baseline]];
+    // Map of the baseline object changes touched so far. Only objects appearing in the merged events are
+    // fetched, using the index on the baseline and global identifier, so cost scales with the delta.
     NSMapTable *objectChangesByGlobalId = [NSMapTable cde_strongToStrongObjectsMapTable];
-    NSSet *objectChanges = baseline.objectChanges;
-    for (CDEObjectChange *change in objectChanges) {
-        [objectChangesByGlobalId setObject:change forKey:change.globalIdentifier];
-    }
+    NSMutableSet *fetchedGlobalIds = [[NSMutableSet alloc] init];
     
     // Loop through events, merging them in the baseline
+    *mergedCount = 0;
+    *objectChangeCount = 0;
+    CDEStoreModificationEvent *previousEvent = nil;
     for (CDEStoreModificationEvent *event in eventsToMerge) {
         
+        // Only stop between global counts, so the baseline never splits events with the same count
+        BOOL outOfTime = deadline && deadline.timeIntervalSinceNow < 0.0;
+        if (outOfTime && previousEvent && event.globalCount != previousEvent.globalCount) break;
+        
         // Prefetch for performance
         [CDEStoreModificationEvent prefetchRelatedObjectsForStoreModificationEvents:@[event]];
         
+        // Fetch baseline changes for global ids not seen in earlier events
+        NSArray *objectChanges = event.objectChanges.allObjects;
+        NSMutableSet *globalIds = [NSMutableSet setWithArray:[objectChanges valueForKeyPath:@"globalIdentifier"]];
+        [globalIds minusSet:fetchedGlobalIds];
+        if (![self fetchObjectChangesInBaseline:baseline forGlobalIdentifiers:globalIds intoMapTable:objectChangesByGlobalId error:error]) return NO;
+        [fetchedGlobalIds unionSet:globalIds];
+        
         // Loop through object changes
-        [event.objectChanges.allObjects cde_enumerateObjectsDrainingEveryIterations:100 usingBlock:^(CDEObjectChange *change, NSUInteger index, BOOL *stop) {
+        [objectChanges cde_enumerateObjectsDrainingEveryIterations:100 usingBlock:^(CDEObjectChange *change, NSUInteger index, BOOL *stop) {
             CDEObjectChange *existingChange = [objectChangesByGlobalId objectForKey:change.globalIdentifier];
             [self mergeChange:change withSubordinateChange:existingChange addToBaseline:baseline withObjectChangesByGlobalId:objectChangesByGlobalId];
         }];
+        
+        previousEvent = event;
+        (*mergedCount)++;
+        *objectChangeCount += objectChanges.count;
+    }
+    
+    return YES;
+}
+
+- (BOOL)fetchObjectChangesInBaseline:(CDEStoreModificationEvent *)baseline forGlobalIdentifiers:(NSSet *)globalIds intoMapTable:(NSMapTable *)objectChangesByGlobalId error:(NSError * __autoreleasing *)error
+{
+    // A new baseline has nothing in the store yet
+    if (globalIds.count == 0 || baseline.objectID.isTemporaryID) return YES;
+    
+    NSManagedObjectContext *context = baseline.managedObjectContext;
+    NSArray *globalIdArray = globalIds.allObjects;
+    for (NSUInteger i = 0; i < globalIdArray.count; i += CDEBaselineChangeFetchBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEBaselineChangeFetchBatchSize, globalIdArray.count - i));
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent = %@ AND globalIdentifier IN %@", baseline, [globalIdArray subarrayWithRange:range]];
+        fetch.relationshipKeyPathsForPrefetching = @[@"dataFiles"];
+        NSArray *changes = [context executeFetchRequest:fetch error:error];
+        if (!changes) return NO;
+        
+        for (CDEObjectChange *change in changes) {
+            [objectChangesByGlobalId setObject:change forKey:change.globalIdentifier];
+        }
     }
+    
+    return YES;
 }
 
 - (void)mergeChange:(CDEObjectChange *)change withSubordinateChange:(CDEObjectChange *)subordinateChange addToBaseline:(CDEStoreModificationEvent *)baseline withObjectChangesByGlobalId:(NSMapTable *)objectChangesByGlobalId
@@ -317,63 +458,4 @@
     return baselineCount;
 }
 
-
-#pragma mark Fetching Counts
-
-- (NSUInteger)countOfStoreModificationEvents
-{
-    __block NSUInteger count = 0;
-    NSManagedObjectContext *context = eventStore.managedObjectContext;
-    [context performBlockAndWait:^{
-        NSError *error = nil;
-        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
-        count = [context countForFetchRequest:fetch error:&error];
-        if (error) CDELog(CDELoggingLevelError, @"Couldn't fetch count of events: %@", error);
-    }];
-    return count;
-}
-
-- (NSUInteger)countOfAllObjectChanges
-{
-    __block NSUInteger count = 0;
-    NSManagedObjectContext *context = eventStore.managedObjectContext;
-    [context performBlockAndWait:^{
-        NSError *error = nil;
-        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
-        count = [context countForFetchRequest:fetch error:&error];
-        if (error) CDELog(CDELoggingLevelError, @"Couldn't fetch count of object changes: %@", error);
-    }];
-    return count;
-}
-
-- (NSUInteger)countOfNonBaselineObjectChangesOfType:(CDEObjectChangeType)type
-{
-    __block NSUInteger count = 0;
-    NSManagedObjectContext *context = eventStore.managedObjectContext;
-    [context performBlockAndWait:^{
-        NSError *error = nil;
-        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
-        NSPredicate *eventTypePredicate = [NSPredicate predicateWithFormat:@"storeModificationEvent.type != %d && storeModificationEvent.type != %d", CDEStoreModificationEventTypeBaseline, CDEStoreModificationEventTypeIncomplete];
-        NSPredicate *changeTypePredicate = [NSPredicate predicateWithFormat:@"type = %d", type];
-        fetch.predicate = [NSCompoundPredicate andPredicateWithSubpredicates:@[eventTypePredicate, changeTypePredicate]];
-        count = [context countForFetchRequest:fetch error:&error];
-        if (error) CDELog(CDELoggingLevelError, @"Couldn't fetch count of non-baseline objects: %@", error);
-    }];
-    return count;
-}
-
-- (NSUInteger)countOfBaseline
-{
-    __block NSUInteger count = 0;
-    NSManagedObjectContext *context = eventStore.managedObjectContext;
-    [context performBlockAndWait:^{
-        NSError *error = nil;
-        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
-        fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent.type = %d", CDEStoreModificationEventTypeBaseline];
-        count = [context countForFetchRequest:fetch error:&error];
-        if (error) CDELog(CDELoggingLevelError, @"Couldn't fetch count of baseline: %@", error);
-    }];
-    return count;
-}
-
 @end
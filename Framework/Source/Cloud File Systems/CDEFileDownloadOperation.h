@@ -14,8 +14,18 @@
 
 @property (nonatomic, copy, readonly) NSURLRequest *request;
 @property (nonatomic, copy, readonly) NSString *localPath;
+@property (nonatomic, strong, readonly) NSURLSession *session;
 @property (nonatomic, copy, readwrite) CDECompletionBlock completion;
 
+// Dropped connections and server errors are retried, with backoff. Without a session, a retry
+// asks for the remainder of the file with a Range request. Defaults are 3 retries from 1s.
+@property (nonatomic, assign, readwrite) NSUInteger maximumRetryCount;
+@property (nonatomic, assign, readwrite) NSTimeInterval retryBaseDelay;
+
+// The file is verified against this, and any SHA-256 Digest header, before it is moved to the local path.
+@property (nonatomic, copy, readwrite) NSString *expectedSHA256String; // Lowercase hexadecimal
+
 - (instancetype)initWithURLRequest:(NSURLRequest *)newRequest localPath:(NSString *)path;
+- (instancetype)initWithURLRequest:(NSURLRequest *)newRequest localPath:(NSString *)path session:(NSURLSession *)session; // Designated. Session may be nil, in which case a connection is used.
 
 @end
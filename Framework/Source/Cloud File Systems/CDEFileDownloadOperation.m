@@ -6,7 +6,13 @@
 //  Copyright (c) 2014 The Mental Faculty B.V. All rights reserved.
 //
 
+#import <CommonCrypto/CommonDigest.h>
 #import "CDEFileDownloadOperation.h"
+#import "CDEFoundationAdditions.h"
+
+static const NSUInteger CDEDefaultMaximumRetryCount = 3;
+static const NSTimeInterval CDEDefaultRetryBaseDelay = 1.0;
+static const NSUInteger CDEDigestReadLength = 256 * 1024;
 
 @interface CDEFileDownloadOperation () <NSURLConnectionDelegate, NSURLConnectionDataDelegate>
 @end
@@ -15,14 +21,28 @@
     NSFileManager *fileManager;
     NSFileHandle *fileHandle;
     NSURLConnection *connection;
+    NSURLSessionDownloadTask *downloadTask;
     NSMutableURLRequest *mutableRequest;
     NSError *responseError;
+    BOOL responseErrorIsTransient;
+    NSString *partialPath;
+    NSUInteger attempt;
+    CC_SHA256_CTX digestContext;
+    unsigned long long bytesReceived;
+    long long expectedLength;
+    NSString *validator;
+    NSString *serverDigest;
+    NSData *resumeData;
 }
 
 @synthesize localPath = localPath;
+@synthesize session = session;
 @synthesize completion = completion;
+@synthesize maximumRetryCount = maximumRetryCount;
+@synthesize retryBaseDelay = retryBaseDelay;
+@synthesize expectedSHA256String = expectedSHA256String;
 
-- (instancetype)initWithURLRequest:(NSURLRequest *)newURLRequest localPath:(NSString *)newPath
+- (instancetype)initWithURLRequest:(NSURLRequest *)newURLRequest localPath:(NSString *)newPath session:(NSURLSession *)newSession
 {
     NSParameterAssert(newURLRequest != nil);
     NSParameterAssert(newPath != nil);
@@ -30,12 +50,21 @@
     if (self) {
         mutableRequest = [newURLRequest mutableCopy];
         localPath = [newPath copy];
+        partialPath = [localPath stringByAppendingPathExtension:@"partial"];
+        session = newSession;
         fileManager = [[NSFileManager alloc] init];
         responseError = nil;
+        maximumRetryCount = CDEDefaultMaximumRetryCount;
+        retryBaseDelay = CDEDefaultRetryBaseDelay;
     }
     return self;
 }
 
+- (instancetype)initWithURLRequest:(NSURLRequest *)newURLRequest localPath:(NSString *)newPath
+{
+    return [self initWithURLRequest:newURLRequest localPath:newPath session:nil];
+}
+
 - (NSURLRequest *)request
 {
     return [mutableRequest copy];
@@ -43,10 +72,17 @@
 
 - (void)beginAsynchronousTask
 {
-    [fileManager removeItemAtPath:localPath error:NULL];
-    [fileManager createFileAtPath:localPath contents:nil attributes:nil];
-    fileHandle = [NSFileHandle fileHandleForWritingAtPath:localPath];
-    
+    attempt = 0;
+    [self discardPartialFile];
+
+    if (session) {
+        [self beginSessionTask];
+        return;
+    }
+
+    [fileManager createFileAtPath:partialPath contents:nil attributes:nil];
+    fileHandle = [NSFileHandle fileHandleForWritingAtPath:partialPath];
+
     if (!fileHandle) {
         NSDictionary *info = @{NSLocalizedDescriptionKey : @"Could not create local file for downloading"};
         NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeFileAccessFailed userInfo:info];
@@ -54,26 +90,230 @@
         [self endAsynchronousTask];
         return;
     }
-    
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated"
-    connection = [[NSURLConnection alloc] initWithRequest:mutableRequest delegate:self startImmediately:YES];
-#pragma clang diagnostic pop
+
+    [self beginConnection];
 }
 
-- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error
+
+#pragma mark Retrying
+
+- (void)retryOrFailWithError:(NSError *)error retryable:(BOOL)retryable
+{
+    if (self.isCancelled) return;
+
+    if (!retryable || attempt >= maximumRetryCount) {
+        [fileHandle closeFile];
+        fileHandle = nil;
+        [fileManager removeItemAtPath:partialPath error:NULL];
+        if (completion) completion(error);
+        [self endAsynchronousTask];
+        return;
+    }
+
+    NSTimeInterval delay = CDERetryDelayForAttempt(attempt, retryBaseDelay);
+    attempt++;
+    CDELog(CDELoggingLevelWarning, @"Download of %@ failed. Retrying in %.1fs (%lu of %lu): %@", localPath.lastPathComponent, delay, (unsigned long)attempt, (unsigned long)maximumRetryCount, error);
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), CDEWorkQueue(), ^{
+        if (self.isCancelled) return;
+        if (self->session)
+            [self beginSessionTask];
+        else
+            [self beginConnection];
+    });
+}
+
+- (void)discardPartialFile
+{
+    if (fileHandle)
+        [fileHandle truncateFileAtOffset:0];
+    else
+        [fileManager removeItemAtPath:partialPath error:NULL];
+    CC_SHA256_Init(&digestContext);
+    bytesReceived = 0;
+    expectedLength = -1;
+    validator = nil;
+    serverDigest = nil;
+    resumeData = nil;
+}
+
+
+#pragma mark Verifying
+
+- (void)readHeadersOfResponse:(NSHTTPURLResponse *)response
+{
+    NSDictionary *headers = response.allHeaderFields;
+    validator = headers[@"ETag"] ? : headers[@"Last-Modified"];
+
+    // RFC 3230 instance digest, eg "SHA-256=<base64>"
+    serverDigest = nil;
+    for (NSString *component in [headers[@"Digest"] componentsSeparatedByString:@","]) {
+        NSString *trimmed = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if ([trimmed.lowercaseString hasPrefix:@"sha-256="]) serverDigest = [trimmed substringFromIndex:8];
+    }
+}
+
+- (NSError *)verificationErrorForDigest:(NSData *)digest length:(unsigned long long)length
+{
+    NSString *description = nil;
+    if (expectedLength >= 0 && length != (unsigned long long)expectedLength) {
+        description = [NSString stringWithFormat:@"Downloaded %llu bytes, but expected %lld", length, expectedLength];
+    }
+    else if (expectedSHA256String && ![expectedSHA256String isEqualToString:[self hexadecimalStringForDigest:digest]]) {
+        description = @"Downloaded file does not match the expected checksum";
+    }
+    else if (serverDigest && ![serverDigest isEqualToString:digest.cde_base64String]) {
+        description = @"Downloaded file does not match the digest sent by the server";
+    }
+
+    if (!description) return nil;
+    return [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeDataCorruptionDetected userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+- (NSString *)hexadecimalStringForDigest:(NSData *)digest
+{
+    const unsigned char *bytes = digest.bytes;
+    NSMutableString *string = [[NSMutableString alloc] initWithCapacity:digest.length * 2];
+    for (NSUInteger i = 0; i < digest.length; i++) [string appendFormat:@"%02x", bytes[i]];
+    return string;
+}
+
+- (NSData *)finalDigest
+{
+    CC_SHA256_CTX context = digestContext; // Copy, so a resumed download can continue updating
+    NSMutableData *digest = [[NSMutableData alloc] initWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest.mutableBytes, &context);
+    return digest;
+}
+
+- (BOOL)digestFileAtPath:(NSString *)path
 {
+    NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:path];
+    if (!handle) return NO;
+
+    CC_SHA256_Init(&digestContext);
+    bytesReceived = 0;
+    while (YES) {
+        @autoreleasepool {
+            NSData *data = [handle readDataOfLength:CDEDigestReadLength];
+            if (data.length == 0) break;
+            CC_SHA256_Update(&digestContext, data.bytes, (CC_LONG)data.length);
+            bytesReceived += data.length;
+        }
+    }
+    [handle closeFile];
+
+    return YES;
+}
+
+// Moves the verified file to the local path, or retries
+- (void)completeWithPartialFile
+{
+    NSError *error = [self verificationErrorForDigest:[self finalDigest] length:bytesReceived];
+    if (error) {
+        // A short file can be resumed. Anything else starts over.
+        BOOL resumable = !session && validator && expectedLength >= 0 && bytesReceived < (unsigned long long)expectedLength;
+        if (!resumable) [self discardPartialFile];
+        [self retryOrFailWithError:error retryable:YES];
+        return;
+    }
+
+    [fileHandle closeFile];
+    fileHandle = nil;
+    [fileManager removeItemAtPath:localPath error:NULL];
+    [fileManager moveItemAtPath:partialPath toPath:localPath error:&error];
+
     if (completion) completion(error);
     [self endAsynchronousTask];
 }
 
+
+#pragma mark Session
+
+- (void)beginSessionTask
+{
+    void (^handler)(NSURL *, NSURLResponse *, NSError *) = ^(NSURL *location, NSURLResponse *response, NSError *error) {
+        if (self.isCancelled) return;
+
+        BOOL retryable = NO;
+        if (error) {
+            self->resumeData = error.userInfo[NSURLSessionDownloadTaskResumeData];
+            retryable = CDEErrorIsTransient(error);
+        }
+        else {
+            NSHTTPURLResponse *httpResponse = (id)response;
+            BOOL success = (httpResponse.statusCode >= 200 && httpResponse.statusCode < 300);
+            if (!success) {
+                CDELog(CDELoggingLevelError, @"Error downloading file. Response: %@", response);
+                NSDictionary *info = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Status code: %ld", (long)httpResponse.statusCode]};
+                error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:info];
+                retryable = CDEHTTPStatusCodeIsTransient(httpResponse.statusCode);
+            }
+            else {
+                [self readHeadersOfResponse:httpResponse];
+                self->resumeData = nil;
+            }
+        }
+
+        // The temporary file is deleted when this block returns, so move it now
+        if (!error) {
+            [self->fileManager removeItemAtPath:self->partialPath error:NULL];
+            [self->fileManager moveItemAtURL:location toURL:[NSURL fileURLWithPath:self->partialPath] error:&error];
+        }
+
+        if (!error && ![self digestFileAtPath:self->partialPath]) {
+            error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeFileAccessFailed userInfo:nil];
+        }
+
+        dispatch_async(CDEWorkQueue(), ^{
+            if (error)
+                [self retryOrFailWithError:error retryable:retryable];
+            else
+                [self completeWithPartialFile];
+        });
+    };
+
+    if (resumeData)
+        downloadTask = [session downloadTaskWithResumeData:resumeData completionHandler:handler];
+    else
+        downloadTask = [session downloadTaskWithRequest:mutableRequest completionHandler:handler];
+    [downloadTask resume];
+}
+
+
+#pragma mark Connection
+
+- (void)beginConnection
+{
+    responseError = nil;
+    responseErrorIsTransient = NO;
+
+    NSMutableURLRequest *request = [mutableRequest mutableCopy];
+    if (bytesReceived > 0) {
+        [request setValue:[NSString stringWithFormat:@"bytes=%llu-", bytesReceived] forHTTPHeaderField:@"Range"];
+        if (validator) [request setValue:validator forHTTPHeaderField:@"If-Range"];
+    }
+
+    connection = CDEURLConnectionOnWorkQueue(request, self);
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error
+{
+    [fileHandle synchronizeFile];
+
+    // Keep what was received if the server can send the rest
+    if (!validator) [self discardPartialFile];
+    [self retryOrFailWithError:error retryable:CDEErrorIsTransient(error)];
+}
+
 - (void)cancel
 {
     [super cancel];
-    
+
     [connection cancel];
+    [downloadTask cancel];
     [fileHandle closeFile];
-    [fileManager removeItemAtPath:localPath error:NULL];
+    [fileManager removeItemAtPath:partialPath error:NULL];
 
     NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeCancelled userInfo:nil];
     if (completion) completion(error);
@@ -83,7 +323,10 @@
 
 - (void)connection:(NSURLConnection *)aConnection didReceiveData:(NSData *)data
 {
+    if (responseError) return;
     [fileHandle writeData:data];
+    CC_SHA256_Update(&digestContext, data.bytes, (CC_LONG)data.length);
+    bytesReceived += data.length;
 }
 
 - (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response
@@ -91,17 +334,53 @@
     NSHTTPURLResponse *httpResponse = (id)response;
     BOOL success = (httpResponse.statusCode >= 200 && httpResponse.statusCode < 300);
     if (!success) {
-        CDELog(CDELoggingLevelError, @"Error uploading file. Response: %@", response);
+        CDELog(CDELoggingLevelError, @"Error downloading file. Response: %@", response);
         NSDictionary *info = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Status code: %ld", (long)httpResponse.statusCode]};
         responseError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:info];
+        responseErrorIsTransient = CDEHTTPStatusCodeIsTransient(httpResponse.statusCode);
+        return;
+    }
+
+    // Partial content continues where the last attempt stopped. Otherwise start over.
+    unsigned long long start = 0;
+    long long total = httpResponse.expectedContentLength;
+    NSString *contentRange = httpResponse.allHeaderFields[@"Content-Range"];
+    if (httpResponse.statusCode == 206 && contentRange) {
+        NSScanner *scanner = [NSScanner scannerWithString:contentRange];
+        long long first = -1;
+        [scanner scanString:@"bytes" intoString:NULL];
+        [scanner scanLongLong:&first];
+        [scanner scanUpToString:@"/" intoString:NULL];
+        [scanner scanString:@"/" intoString:NULL];
+        if (![scanner scanLongLong:&total]) total = -1;
+        start = first >= 0 ? (unsigned long long)first : ULLONG_MAX;
     }
+
+    if (start != bytesReceived) {
+        [self discardPartialFile];
+        if (start != 0) {
+            NSDictionary *info = @{NSLocalizedDescriptionKey : @"Server resumed the download at the wrong offset"};
+            responseError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:info];
+            responseErrorIsTransient = YES;
+            return;
+        }
+        if (httpResponse.statusCode != 206) total = httpResponse.expectedContentLength;
+    }
+
+    [self readHeadersOfResponse:httpResponse];
+    expectedLength = total;
 }
 
 - (void)connectionDidFinishLoading:(NSURLConnection *)connection
 {
-    [fileHandle closeFile];
-    if (completion) completion(responseError);
-    [self endAsynchronousTask];
+    [fileHandle synchronizeFile];
+
+    if (responseError) {
+        [self retryOrFailWithError:responseError retryable:responseErrorIsTransient];
+        return;
+    }
+
+    [self completeWithPartialFile];
 }
 
 @end
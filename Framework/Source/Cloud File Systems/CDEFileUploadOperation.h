@@ -13,8 +13,15 @@
 
 @property (nonatomic, copy, readonly) NSString *localPath;
 @property (nonatomic, copy, readonly) NSURLRequest *request;
+@property (nonatomic, strong, readonly) NSURLSession *session;
 @property (nonatomic, copy, readwrite) CDECompletionBlock completion;
 
+// Dropped connections and server errors are retried, with backoff. Each retry sends the whole file again.
+// Defaults are 3 retries from 1s.
+@property (nonatomic, assign, readwrite) NSUInteger maximumRetryCount;
+@property (nonatomic, assign, readwrite) NSTimeInterval retryBaseDelay;
+
 - (instancetype)initWithURLRequest:(NSURLRequest *)urlRequest localPath:(NSString *)path;
+- (instancetype)initWithURLRequest:(NSURLRequest *)urlRequest localPath:(NSString *)path session:(NSURLSession *)session; // Designated. Session may be nil, in which case a connection is used.
 
 @end
@@ -8,29 +8,39 @@
 
 #import "CDEFileUploadOperation.h"
 
+static const NSUInteger CDEDefaultMaximumRetryCount = 3;
+static const NSTimeInterval CDEDefaultRetryBaseDelay = 1.0;
+
 @interface CDEFileUploadOperation () <NSURLConnectionDelegate, NSURLConnectionDataDelegate>
 @end
 
 @implementation CDEFileUploadOperation {
     NSURLConnection *connection;
+    NSURLSessionUploadTask *uploadTask;
     NSError *responseError;
+    BOOL responseErrorIsTransient;
     NSMutableURLRequest *mutableRequest;
-    
+    NSUInteger attempt;
 }
 
 @synthesize localPath = localPath;
+@synthesize session = session;
 @synthesize completion = completion;
+@synthesize maximumRetryCount = maximumRetryCount;
+@synthesize retryBaseDelay = retryBaseDelay;
 
-- (instancetype)initWithURLRequest:(NSURLRequest *)newURLRequest localPath:(NSString *)newPath
+- (instancetype)initWithURLRequest:(NSURLRequest *)newURLRequest localPath:(NSString *)newPath session:(NSURLSession *)newSession
 {
     NSParameterAssert(newURLRequest != nil);
     NSParameterAssert(newPath != nil);
     self = [super init];
     if (self) {
         localPath = [newPath copy];
+        session = newSession;
         responseError = nil;
         mutableRequest = [newURLRequest mutableCopy];
-        mutableRequest.HTTPBodyStream = [NSInputStream inputStreamWithFileAtPath:localPath];
+        maximumRetryCount = CDEDefaultMaximumRetryCount;
+        retryBaseDelay = CDEDefaultRetryBaseDelay;
         
         NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:localPath error:NULL];
         unsigned long long result = attributes.fileSize;
@@ -40,6 +50,11 @@
     return self;
 }
 
+- (instancetype)initWithURLRequest:(NSURLRequest *)newURLRequest localPath:(NSString *)newPath
+{
+    return [self initWithURLRequest:newURLRequest localPath:newPath session:nil];
+}
+
 - (NSURLRequest *)request
 {
     return [mutableRequest copy];
@@ -47,10 +62,69 @@
 
 - (void)beginAsynchronousTask
 {
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated"
-    connection = [[NSURLConnection alloc] initWithRequest:mutableRequest delegate:self startImmediately:YES];
-#pragma clang diagnostic pop
+    attempt = 0;
+    [self beginAttempt];
+}
+
+- (void)beginAttempt
+{
+    if (session) {
+        [self beginSessionTask];
+        return;
+    }
+    
+    // A stream can only be read once, so each attempt needs a new one. Sessions upload from the file directly.
+    responseError = nil;
+    responseErrorIsTransient = NO;
+    NSMutableURLRequest *request = [mutableRequest mutableCopy];
+    request.HTTPBodyStream = [NSInputStream inputStreamWithFileAtPath:localPath];
+    
+    connection = CDEURLConnectionOnWorkQueue(request, self);
+}
+
+- (void)retryOrFailWithError:(NSError *)error retryable:(BOOL)retryable
+{
+    if (self.isCancelled) return;
+    
+    if (!error || !retryable || attempt >= maximumRetryCount) {
+        if (completion) completion(error);
+        [self endAsynchronousTask];
+        return;
+    }
+    
+    NSTimeInterval delay = CDERetryDelayForAttempt(attempt, retryBaseDelay);
+    attempt++;
+    CDELog(CDELoggingLevelWarning, @"Upload of %@ failed. Retrying in %.1fs (%lu of %lu): %@", localPath.lastPathComponent, delay, (unsigned long)attempt, (unsigned long)maximumRetryCount, error);
+    
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), CDEWorkQueue(), ^{
+        if (self.isCancelled) return;
+        [self beginAttempt];
+    });
+}
+
+- (void)beginSessionTask
+{
+    NSURL *fileURL = [NSURL fileURLWithPath:localPath];
+    uploadTask = [session uploadTaskWithRequest:mutableRequest fromFile:fileURL completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        if (self.isCancelled) return;
+        
+        BOOL retryable = CDEErrorIsTransient(error);
+        if (!error) {
+            NSHTTPURLResponse *httpResponse = (id)response;
+            BOOL success = (httpResponse.statusCode >= 200 && httpResponse.statusCode < 300);
+            if (!success) {
+                CDELog(CDELoggingLevelError, @"Error uploading file. Response: %@", response);
+                NSDictionary *info = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Status code: %ld", (long)httpResponse.statusCode]};
+                error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:info];
+                retryable = CDEHTTPStatusCodeIsTransient(httpResponse.statusCode);
+            }
+        }
+        
+        dispatch_async(CDEWorkQueue(), ^{
+            [self retryOrFailWithError:error retryable:retryable];
+        });
+    }];
+    [uploadTask resume];
 }
 
 - (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response
@@ -61,6 +135,7 @@
         CDELog(CDELoggingLevelError, @"Error uploading file. Response: %@", response);
         NSDictionary *info = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Status code: %ld", (long)httpResponse.statusCode]};
         responseError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:info];
+        responseErrorIsTransient = CDEHTTPStatusCodeIsTransient(httpResponse.statusCode);
     }
 }
 
@@ -73,14 +148,14 @@
 
 - (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error
 {
-    if (completion) completion(error);
-    [self endAsynchronousTask];
+    [self retryOrFailWithError:error retryable:CDEErrorIsTransient(error)];
 }
 
 - (void)cancel
 {
     [super cancel];
     [connection cancel];
+    [uploadTask cancel];
     
     NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeCancelled userInfo:nil];
     if (completion) completion(error);
@@ -90,8 +165,7 @@
 
 - (void)connectionDidFinishLoading:(NSURLConnection *)connection
 {
-    if (completion) completion(responseError);
-    [self endAsynchronousTask];
+    [self retryOrFailWithError:responseError retryable:responseErrorIsTransient];
 }
 
 @end
@@ -153,18 +153,16 @@ NSString * const CDEICloudFileSystemDidMakeDownloadProgressNotification = @"CDEI
     [self checkUserIsLoggedIn:^(NSError *error, BOOL loggedIn) {
         if (loggedIn) {
             [self setupRootDirectory:^(NSError *error) {
-                [self startMonitoringMetadata];
-                [self addUbiquityContainerNotificationObservers];
                 dispatch_async(dispatch_get_main_queue(), ^{
-                    if (completion) completion(error);
+                    [self startMonitoringMetadata];
+                    [self addUbiquityContainerNotificationObservers];
+                    [self dispatchCompletion:completion withError:error];
                 });
             }];
         }
         else {
             [self addUbiquityContainerNotificationObservers];
-            dispatch_async(dispatch_get_main_queue(), ^{
-                if (completion) completion(nil);
-            });
+            [self dispatchCompletion:completion withError:nil];
         }
     }];
 }
@@ -359,7 +357,7 @@ NSString * const CDEICloudFileSystemDidMakeDownloadProgressNotification = @"CDEI
 
 - (void)dispatchCompletion:(CDECompletionBlock)completion withError:(NSError *)error
 {
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(error);
     });
 }
@@ -402,14 +400,16 @@ NSString * const CDEICloudFileSystemDidMakeDownloadProgressNotification = @"CDEI
     [self checkUserIsLoggedIn:^(NSError *error, BOOL loggedIn) {
         if (loggedIn) {
             [self setupRootDirectory:^(NSError *error) {
-                [self startMonitoringMetadata];
-                [self addUbiquityContainerNotificationObservers];
-                if (completion) completion(error);
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    [self startMonitoringMetadata];
+                    [self addUbiquityContainerNotificationObservers];
+                    [self dispatchCompletion:completion withError:error];
+                });
             }];
         }
         else {
             error = loggedIn && !error ? nil : [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeAuthenticationFailure userInfo:@{NSLocalizedDescriptionKey : NSLocalizedString(@"User is not logged into iCloud.", @"")} ];
-            if (completion) completion(error);
+            [self dispatchCompletion:completion withError:error];
         }
     }];
 }
@@ -652,7 +652,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
 {
     [operationQueue addOperationWithBlock:^{
         if (!self.isConnected || !self->rootDirectoryURL) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (block) block(NO, NO, [self notConnectedError]);
             });
             return;
@@ -672,7 +672,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
         
         NSError *error = fileCoordinatorError ? : nil;
         error = [self specializedErrorForCocoaError:error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(exists, isDirectory, error);
         });
     }];
@@ -682,7 +682,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
 {
     [operationQueue addOperationWithBlock:^{
         if (!self.isConnected || !self->rootDirectoryURL) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (block) block(nil, [self notConnectedError]);
             });
             return;
@@ -727,7 +727,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
         
         NSError *error = fileCoordinatorError ? : fileManagerError ? : nil;
         error = [self specializedErrorForCocoaError:error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(contents, error);
         });
     }];
@@ -738,7 +738,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
 {
     [operationQueue addOperationWithBlock:^{
         if (!self.isConnected || !self->rootDirectoryURL) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (block) block([self notConnectedError]);
             });
             return;
@@ -759,7 +759,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
         
         NSError *error = fileCoordinatorError ? : fileManagerError ? : nil;
         error = [self specializedErrorForCocoaError:error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(error);
         });
     }];
@@ -769,7 +769,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
 {
     [operationQueue addOperationWithBlock:^{
         if (!self.isConnected || !self->rootDirectoryURL) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (block) block([self notConnectedError]);
             });
             return;
@@ -790,7 +790,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
         
         NSError *error = fileCoordinatorError ? : fileManagerError ? : nil;
         error = [self specializedErrorForCocoaError:error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(error);
         });
     }];
@@ -800,7 +800,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
 {
     [operationQueue addOperationWithBlock:^{
         if (!self.isConnected || !self->rootDirectoryURL) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (block) block([self notConnectedError]);
             });
             return;
@@ -823,7 +823,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
         
         NSError *error = fileCoordinatorError ? : fileManagerError ? : nil;
         error = [self specializedErrorForCocoaError:error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(error);
         });
     }];
@@ -833,7 +833,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
 {
     [operationQueue addOperationWithBlock:^{
         if (!self.isConnected || !self->rootDirectoryURL) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (block) block([self notConnectedError]);
             });
             return;
@@ -853,7 +853,7 @@ static const NSTimeInterval CDEFileCoordinatorTimeOut = 10.0;
         
         NSError *error = fileCoordinatorError ? : fileManagerError ? : nil;
         error = [self specializedErrorForCocoaError:error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (block) block(error);
         });
     }];
@@ -38,7 +38,7 @@
 
 - (void)connect:(CDECompletionBlock)completion
 {
-    if (completion) dispatch_async(dispatch_get_main_queue(), ^{
+    if (completion) dispatch_async(CDEWorkQueue(), ^{
         completion(nil);
     });
 }
@@ -52,7 +52,7 @@
 {
     BOOL exists, isDir;
     exists = [fileManager fileExistsAtPath:[self fullPathForPath:path] isDirectory:&isDir];
-    if (block) dispatch_async(dispatch_get_main_queue(), ^{
+    if (block) dispatch_async(CDEWorkQueue(), ^{
         block(exists, isDir, nil);
     });
 }
@@ -81,7 +81,7 @@
         }
     }
     
-    if (block) dispatch_async(dispatch_get_main_queue(), ^{
+    if (block) dispatch_async(CDEWorkQueue(), ^{
         block(contents, nil);
     });
 }
@@ -90,7 +90,7 @@
 {
     NSError *error = nil;
     [fileManager createDirectoryAtPath:[self fullPathForPath:path] withIntermediateDirectories:NO attributes:nil error:&error];
-    if (block) dispatch_async(dispatch_get_main_queue(), ^{
+    if (block) dispatch_async(CDEWorkQueue(), ^{
        block(error);
     });
 }
@@ -99,7 +99,7 @@
 {
     NSError *error = nil;
     [fileManager removeItemAtPath:[self fullPathForPath:fromPath] error:&error];
-    if (block) dispatch_async(dispatch_get_main_queue(), ^{
+    if (block) dispatch_async(CDEWorkQueue(), ^{
         block(error);
     });
 }
@@ -108,7 +108,7 @@
 {
     NSError *error = nil;
     [fileManager copyItemAtPath:fromPath toPath:[self fullPathForPath:toPath] error:&error];
-    if (block) dispatch_async(dispatch_get_main_queue(), ^{
+    if (block) dispatch_async(CDEWorkQueue(), ^{
         block(error);
     });
 }
@@ -117,9 +117,87 @@
 {
     NSError *error = nil;
     [fileManager copyItemAtPath:[self fullPathForPath:fromPath] toPath:toPath error:&error];
-    if (block) dispatch_async(dispatch_get_main_queue(), ^{
+    if (block) dispatch_async(CDEWorkQueue(), ^{
         block(error);
     });
 }
 
+#pragma mark Batch Operations
+
+- (void)fileExistsAtPaths:(NSArray *)paths completion:(CDEBatchFileExistenceCallback)block
+{
+    NSMutableArray *existences = [[NSMutableArray alloc] initWithCapacity:paths.count];
+    NSMutableArray *directories = [[NSMutableArray alloc] initWithCapacity:paths.count];
+    for (NSString *path in paths) {
+        BOOL isDir = NO;
+        BOOL exists = [fileManager fileExistsAtPath:[self fullPathForPath:path] isDirectory:&isDir];
+        [existences addObject:@(exists)];
+        [directories addObject:@(exists && isDir)];
+    }
+    if (block) dispatch_async(CDEWorkQueue(), ^{
+        block(existences, directories, nil);
+    });
+}
+
+- (void)removeItemsAtPaths:(NSArray *)paths completion:(CDECompletionBlock)block
+{
+    NSError *firstError = nil;
+    for (NSString *path in paths) {
+        NSError *error = nil;
+        if (![fileManager removeItemAtPath:[self fullPathForPath:path] error:&error] && !firstError) firstError = error;
+    }
+    if (block) dispatch_async(CDEWorkQueue(), ^{
+        block(firstError);
+    });
+}
+
+- (void)uploadLocalFiles:(NSArray *)fromPaths toPaths:(NSArray *)toPaths completion:(CDECompletionBlock)block
+{
+    NSError *firstError = nil;
+    for (NSUInteger i = 0; i < fromPaths.count; i++) {
+        NSError *error = nil;
+        if (![fileManager copyItemAtPath:fromPaths[i] toPath:[self fullPathForPath:toPaths[i]] error:&error]) {
+            firstError = error;
+            break;
+        }
+    }
+    if (block) dispatch_async(CDEWorkQueue(), ^{
+        block(firstError);
+    });
+}
+
+- (void)downloadFromPaths:(NSArray *)fromPaths toLocalFiles:(NSArray *)toPaths completion:(CDECompletionBlock)block
+{
+    NSError *firstError = nil;
+    for (NSUInteger i = 0; i < fromPaths.count; i++) {
+        NSError *error = nil;
+        if (![fileManager copyItemAtPath:[self fullPathForPath:fromPaths[i]] toPath:toPaths[i] error:&error]) {
+            firstError = error;
+            break;
+        }
+    }
+    if (block) dispatch_async(CDEWorkQueue(), ^{
+        block(firstError);
+    });
+}
+
+#pragma mark Change Detection
+
+- (void)fetchRevisionTokenForFileAtPath:(NSString *)path completion:(CDERevisionTokenCallback)block
+{
+    // Files are replaced rather than rewritten in place, so the file number changes along with the date
+    NSError *error = nil;
+    NSArray *token = nil;
+    NSDictionary *attributes = [fileManager attributesOfItemAtPath:[self fullPathForPath:path] error:&error];
+    if (attributes) {
+        token = @[attributes.fileModificationDate, @(attributes.fileSystemFileNumber), @(attributes.fileSize)];
+    }
+    else if ([error.domain isEqualToString:NSCocoaErrorDomain] && error.code == NSFileReadNoSuchFileError) {
+        error = nil;
+    }
+    if (block) dispatch_async(CDEWorkQueue(), ^{
+        block(token, error);
+    });
+}
+
 @end
@@ -0,0 +1,40 @@
+//
+//  CDEBaselineIndex.h
+//  Ensembles
+//
+//  Describes a baseline uploaded in segments. The index is uploaded with the name of the baseline file,
+//  and holds the baseline event properties and revisions, and the names of the segment files that hold
+//  its object changes. Segments are named for their contents, so they are immutable, and can be shared by
+//  successive baselines.
+//
+//  Created by Drew McCormack on 29/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "CDEDefines.h"
+
+@class CDEStoreModificationEvent;
+
+@interface CDEBaselineIndex : NSObject
+
+@property (nonatomic, copy, readwrite) NSString *uniqueIdentifier;
+@property (nonatomic, assign, readwrite) CDEGlobalCount globalCount;
+@property (nonatomic, assign, readwrite) NSTimeInterval timestamp;
+@property (nonatomic, copy, readwrite) NSString *modelVersion;
+@property (nonatomic, copy, readwrite) NSString *persistentStoreIdentifier;
+@property (nonatomic, assign, readwrite) CDERevisionNumber revisionNumber;
+@property (nonatomic, copy, readwrite) NSDictionary *revisionNumbersOfOtherStores; // Store identifier to revision number
+@property (nonatomic, copy, readwrite) NSArray *segmentFilenames;
+
++ (BOOL)isBaselineIndexAtPath:(NSString *)path;
+
++ (instancetype)baselineIndexWithContentsOfFile:(NSString *)path error:(NSError * __autoreleasing *)error;
+- (BOOL)writeToFile:(NSString *)path error:(NSError * __autoreleasing *)error;
+
+// Call on the queue of the event's context
+- (instancetype)initWithStoreModificationEvent:(CDEStoreModificationEvent *)event;
+- (void)applyToStoreModificationEvent:(CDEStoreModificationEvent *)event; // Sets properties and revisions, but not the type
+
+@end
@@ -0,0 +1,136 @@
+//
+//  CDEBaselineIndex.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 29/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEBaselineIndex.h"
+#import "CDEStoreModificationEvent.h"
+#import "CDEEventRevision.h"
+#import "CDERevision.h"
+#import "CDERevisionSet.h"
+
+static const uint8_t CDEBaselineIndexMagic[8] = {'C', 'D', 'E', 'B', 'I', 'D', 'X', '1'};
+static const NSUInteger CDEBaselineIndexMagicLength = 8;
+
+static NSString * const kCDEBaselineIndexUniqueIdentifierKey = @"uniqueIdentifier";
+static NSString * const kCDEBaselineIndexGlobalCountKey = @"globalCount";
+static NSString * const kCDEBaselineIndexTimestampKey = @"timestamp";
+static NSString * const kCDEBaselineIndexModelVersionKey = @"modelVersion";
+static NSString * const kCDEBaselineIndexStoreIdentifierKey = @"persistentStoreIdentifier";
+static NSString * const kCDEBaselineIndexRevisionNumberKey = @"revisionNumber";
+static NSString * const kCDEBaselineIndexOtherRevisionsKey = @"revisionNumbersOfOtherStores";
+static NSString * const kCDEBaselineIndexSegmentsKey = @"segments";
+
+@implementation CDEBaselineIndex
+
+@synthesize uniqueIdentifier = uniqueIdentifier;
+@synthesize globalCount = globalCount;
+@synthesize timestamp = timestamp;
+@synthesize modelVersion = modelVersion;
+@synthesize persistentStoreIdentifier = persistentStoreIdentifier;
+@synthesize revisionNumber = revisionNumber;
+@synthesize revisionNumbersOfOtherStores = revisionNumbersOfOtherStores;
+@synthesize segmentFilenames = segmentFilenames;
+
+#pragma mark Events
+
+- (instancetype)initWithStoreModificationEvent:(CDEStoreModificationEvent *)event
+{
+    self = [super init];
+    if (self) {
+        uniqueIdentifier = [event.uniqueIdentifier copy];
+        globalCount = event.globalCount;
+        timestamp = event.timestamp;
+        modelVersion = [event.modelVersion copy];
+        persistentStoreIdentifier = [event.eventRevision.persistentStoreIdentifier copy];
+        revisionNumber = event.eventRevision.revisionNumber;
+
+        NSMutableDictionary *otherRevisions = [[NSMutableDictionary alloc] init];
+        for (CDEEventRevision *eventRevision in event.eventRevisionsOfOtherStores) {
+            otherRevisions[eventRevision.persistentStoreIdentifier] = @(eventRevision.revisionNumber);
+        }
+        revisionNumbersOfOtherStores = otherRevisions;
+        segmentFilenames = @[];
+    }
+    return self;
+}
+
+- (void)applyToStoreModificationEvent:(CDEStoreModificationEvent *)event
+{
+    event.uniqueIdentifier = self.uniqueIdentifier;
+    event.globalCount = self.globalCount;
+    event.timestamp = self.timestamp;
+    event.modelVersion = self.modelVersion;
+
+    CDERevisionSet *revisionSet = [[CDERevisionSet alloc] init];
+    [self.revisionNumbersOfOtherStores enumerateKeysAndObjectsUsingBlock:^(NSString *storeId, NSNumber *number, BOOL *stop) {
+        [revisionSet addRevision:[[CDERevision alloc] initWithPersistentStoreIdentifier:storeId revisionNumber:number.longLongValue]];
+    }];
+    [revisionSet addRevision:[[CDERevision alloc] initWithPersistentStoreIdentifier:self.persistentStoreIdentifier revisionNumber:self.revisionNumber]];
+    [event setRevisionSet:revisionSet forPersistentStoreIdentifier:self.persistentStoreIdentifier];
+}
+
+#pragma mark Reading and Writing
+
++ (BOOL)isBaselineIndexAtPath:(NSString *)path
+{
+    NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:path];
+    NSData *magic = [handle readDataOfLength:CDEBaselineIndexMagicLength];
+    [handle closeFile];
+    return magic.length == CDEBaselineIndexMagicLength && memcmp(magic.bytes, CDEBaselineIndexMagic, CDEBaselineIndexMagicLength) == 0;
+}
+
++ (instancetype)baselineIndexWithContentsOfFile:(NSString *)path error:(NSError * __autoreleasing *)error
+{
+    NSData *data = [NSData dataWithContentsOfFile:path options:0 error:error];
+    if (!data) return nil;
+
+    NSDictionary *plist = nil;
+    if (data.length > CDEBaselineIndexMagicLength && memcmp(data.bytes, CDEBaselineIndexMagic, CDEBaselineIndexMagicLength) == 0) {
+        NSData *plistData = [data subdataWithRange:NSMakeRange(CDEBaselineIndexMagicLength, data.length - CDEBaselineIndexMagicLength)];
+        plist = [NSPropertyListSerialization propertyListWithData:plistData options:NSPropertyListImmutable format:NULL error:NULL];
+    }
+
+    NSArray *segments = [plist isKindOfClass:[NSDictionary class]] ? plist[kCDEBaselineIndexSegmentsKey] : nil;
+    if (!segments || !plist[kCDEBaselineIndexUniqueIdentifierKey] || !plist[kCDEBaselineIndexStoreIdentifierKey]) {
+        NSDictionary *info = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Invalid baseline index: %@", path.lastPathComponent]};
+        if (error) *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeDataCorruptionDetected userInfo:info];
+        return nil;
+    }
+
+    CDEBaselineIndex *index = [[self alloc] init];
+    index.uniqueIdentifier = plist[kCDEBaselineIndexUniqueIdentifierKey];
+    index.globalCount = [plist[kCDEBaselineIndexGlobalCountKey] longLongValue];
+    index.timestamp = [plist[kCDEBaselineIndexTimestampKey] doubleValue];
+    index.modelVersion = plist[kCDEBaselineIndexModelVersionKey];
+    index.persistentStoreIdentifier = plist[kCDEBaselineIndexStoreIdentifierKey];
+    index.revisionNumber = [plist[kCDEBaselineIndexRevisionNumberKey] longLongValue];
+    index.revisionNumbersOfOtherStores = plist[kCDEBaselineIndexOtherRevisionsKey] ? : @{};
+    index.segmentFilenames = segments;
+    return index;
+}
+
+- (BOOL)writeToFile:(NSString *)path error:(NSError * __autoreleasing *)error
+{
+    NSMutableDictionary *plist = [[NSMutableDictionary alloc] init];
+    plist[kCDEBaselineIndexUniqueIdentifierKey] = self.uniqueIdentifier;
+    plist[kCDEBaselineIndexGlobalCountKey] = @(self.globalCount);
+    plist[kCDEBaselineIndexTimestampKey] = @(self.timestamp);
+    if (self.modelVersion) plist[kCDEBaselineIndexModelVersionKey] = self.modelVersion;
+    plist[kCDEBaselineIndexStoreIdentifierKey] = self.persistentStoreIdentifier;
+    plist[kCDEBaselineIndexRevisionNumberKey] = @(self.revisionNumber);
+    plist[kCDEBaselineIndexOtherRevisionsKey] = self.revisionNumbersOfOtherStores ? : @{};
+    plist[kCDEBaselineIndexSegmentsKey] = self.segmentFilenames ? : @[];
+
+    NSData *plistData = [NSPropertyListSerialization dataWithPropertyList:plist format:NSPropertyListBinaryFormat_v1_0 options:0 error:error];
+    if (!plistData) return NO;
+
+    NSMutableData *data = [[NSMutableData alloc] initWithBytes:CDEBaselineIndexMagic length:CDEBaselineIndexMagicLength];
+    [data appendData:plistData];
+    return [data writeToFile:path options:NSDataWritingAtomic error:error];
+}
+
+@end
@@ -11,11 +11,15 @@
 
 typedef void (^CDEFileExistenceCallback)(BOOL exists, BOOL isDirectory, NSError *error);
 typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
+typedef void (^CDEBatchFileExistenceCallback)(NSArray *existences, NSArray *directories, NSError *error);
+typedef void (^CDERevisionTokenCallback)(id <NSObject, NSCopying, NSCoding> token, NSError *error);
 
 /**
  A cloud file system facilitates data transfer between devices.
  
  Any backend that can store files at paths can be used. This could be a key-value store like S3, or a true file system like WebDAV. Even direct connections like the multipeer connectivity in iOS 7 can be used as a cloud file system when coupled with a local cache of files.
+ 
+ Completion blocks are called on the work queue returned by `CDEWorkQueue()`. This is the main queue, unless the app has set a different queue with `CDESetWorkQueue`.
  */
 @protocol CDECloudFileSystem <NSObject>
 
@@ -46,7 +50,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 /**
  Attempts to connect to the cloud backend.
  
- If successful, the completion block should be called on the main thread with argument of `nil`. If the connection fails, an `NSError` instance should be passed to the completion block.
+ If successful, the completion block should be called on the work queue with argument of `nil`. If the connection fails, an `NSError` instance should be passed to the completion block.
  
  @param completion The completion block called when the connection succeeds or fails.
  */
@@ -59,7 +63,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 /**
  Determines whether a file exists in the cloud, and if so, whether it is a standard file or a directory.
  
- Upon determining whether the file exists, the completion block should be called on the main thread.
+ Upon determining whether the file exists, the completion block should be called on the work queue.
  
  @param block The completion block, which takes `BOOL` arguments for whether the file exists and whether it is a directory. The last argument is an `NSError`, which should be `nil` if successful.
  */
@@ -72,7 +76,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 /**
  Creates a directory at a given path.
  
- The completion block should be called on the main thread when the creation concludes, passing an error or `nil`.
+ The completion block should be called on the work queue when the creation concludes, passing an error or `nil`.
  
  @param block The completion block, which takes one argument, an `NSError`. It should be `nil` upon success.
  */
@@ -81,7 +85,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 /**
  Determines the contents of a directory at a given path.
  
- The completion block has an `NSArray` as its first parameter. The array should contain `CDECloudFile` and `CDECloudDirectory` objects. The completion block should should be called on the main thread.
+ The completion block has an `NSArray` as its first parameter. The array should contain `CDECloudFile` and `CDECloudDirectory` objects. The completion block should be called on the work queue.
  
  @param block The completion block, which takes two arguments. The first is an array of file/directory objects, and the second is an `NSError`. It should be `nil` upon success.
  */
@@ -94,7 +98,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 /**
  Deletes a file or directory.
  
- The completion block takes and `NSError`, which should be `nil` upon successful completion. The block should be called on the main thread.
+ The completion block takes and `NSError`, which should be `nil` upon successful completion. The block should be called on the work queue.
  
  @param block The completion block, which takes one argument, an `NSError`.
  */
@@ -107,7 +111,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 /**
  Uploads a local file to the cloud file system.
  
- The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the main thread.
+ The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the work queue.
  
  @param fromPath The path to the file on the device.
  @param toPath The path of the file in the cloud file system.
@@ -118,7 +122,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 /**
  Downloads a cloud file to the local file system.
  
- The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the main thread.
+ The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the work queue.
  
  @param fromPath The path of the file in the cloud file system.
  @param toPath The path to the file on the device.
@@ -137,7 +141,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
  
  For example, if the root directory of the file system needs to be created, this would be a good time to do that.
  
- The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the main thread.
+ The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the work queue.
 
  @param completion The completion block, which takes one argument, an `NSError`.
  */
@@ -153,7 +157,7 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
  
  Eg. Systems like iCloud and Dropbox can sometimes create duplicate files or folders. This is a good place to 'fix' that.
  
- The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the main thread.
+ The completion block takes an `NSError`, which should be `nil` upon successful completion. The block should be called on the work queue.
  
  @param ensembleDir Path to the directory of the ensemble.
  @param completion The completion block, which takes one argument, an `NSError`.
@@ -161,4 +165,78 @@ typedef void (^CDEDirectoryContentsCallback)(NSArray *contents, NSError *error);
 - (void)repairEnsembleDirectory:(NSString *)ensembleDir completion:(CDECompletionBlock)completion;
 
 
+///
+/// @name Change Detection
+///
+
+/**
+ An optional method which can be implemented to cheaply determine whether a file has changed, without downloading it.
+ 
+ The token can be any object that changes whenever the file is rewritten, such as an ETag, a revision identifier, or a modification date. Tokens are compared with `isEqual:`, and archived between launches, so they must support `NSCoding`. If the file does not exist, the token and error should both be `nil`.
+ 
+ Ensembles uses this to check the manifest of the ensemble before taking a snapshot of the remote files. If the method is not implemented, the manifest is downloaded instead.
+ 
+ The completion block should be called on the work queue.
+ 
+ @param path The path of the file in the cloud file system.
+ @param completion The completion block, which takes two arguments: the revision token, and an `NSError`.
+ */
+- (void)fetchRevisionTokenForFileAtPath:(NSString *)path completion:(CDERevisionTokenCallback)completion;
+
+
+
+///
+/// @name Batch Operations
+///
+
+/**
+ An optional method to determine whether several files exist in a single request.
+ 
+ The arrays passed to the completion block contain `NSNumber` booleans, in the same order as the paths. The first indicates whether each file exists, and the second whether it is a directory. The block should be called on the work queue.
+ 
+ If this method is not implemented, `fileExistsAtPath:completion:` is called for each path.
+ 
+ @param paths The paths of the files in the cloud file system.
+ @param block The completion block, which takes the existence and directory arrays, and an `NSError`, which should be `nil` if successful.
+ */
+- (void)fileExistsAtPaths:(NSArray *)paths completion:(CDEBatchFileExistenceCallback)block;
+
+/**
+ An optional method to delete several files or directories at once.
+ 
+ The completion block takes an `NSError`, which should be `nil` if all items were removed. The block should be called on the work queue.
+ 
+ If this method is not implemented, `removeItemAtPath:completion:` is called for each path.
+ 
+ @param paths The paths of the items in the cloud file system.
+ @param block The completion block, which takes one argument, an `NSError`.
+ */
+- (void)removeItemsAtPaths:(NSArray *)paths completion:(CDECompletionBlock)block;
+
+/**
+ An optional method to upload several local files at once.
+ 
+ The completion block takes an `NSError`, which should be `nil` if all files were uploaded. The block should be called on the work queue.
+ 
+ If this method is not implemented, `uploadLocalFile:toPath:completion:` is called for each file.
+ 
+ @param fromPaths The paths to the files on the device.
+ @param toPaths The paths of the files in the cloud file system, in the same order as `fromPaths`.
+ @param block The completion block, which takes one argument, an `NSError`.
+ */
+- (void)uploadLocalFiles:(NSArray *)fromPaths toPaths:(NSArray *)toPaths completion:(CDECompletionBlock)block;
+
+/**
+ An optional method to download several cloud files at once.
+ 
+ The completion block takes an `NSError`, which should be `nil` if all files were downloaded. The block should be called on the work queue.
+ 
+ If this method is not implemented, `downloadFromPath:toLocalFile:completion:` is called for each file.
+ 
+ @param fromPaths The paths of the files in the cloud file system.
+ @param toPaths The paths to the files on the device, in the same order as `fromPaths`.
+ @param block The completion block, which takes one argument, an `NSError`.
+ */
+- (void)downloadFromPaths:(NSArray *)fromPaths toLocalFiles:(NSArray *)toPaths completion:(CDECompletionBlock)block;
+
 @end
@@ -17,6 +17,11 @@
 @property (nonatomic, strong, readonly) CDEEventStore *eventStore;
 @property (nonatomic, strong, readonly) id <CDECloudFileSystem> cloudFileSystem;
 @property (nonatomic, strong, readonly) NSString *remoteEnsembleDirectory;
+@property (nonatomic, assign, readonly) BOOL snapshotIsUnchanged; // Remote manifest unchanged since the last stored snapshot
+@property (nonatomic, assign, readwrite) CDECompressionCodec compressionCodec; // Applied to uploaded events and data files. Downloads are always restored.
+@property (nonatomic, assign, readwrite) BOOL usesStreamingEventFiles; // Export events as event streams. Downloads of either format are imported.
+@property (nonatomic, assign, readwrite) BOOL usesSegmentedBaselines; // Export baselines as an index and content-named segments. Downloads of either form are imported.
+@property (nonatomic, assign, readwrite) BOOL usesChunkedDataFiles; // Store new large data values as content-named chunks. Chunked values are always read.
 
 - (instancetype)initWithEventStore:(CDEEventStore *)newStore cloudFileSystem:(id <CDECloudFileSystem>)cloudFileSystem;
 
@@ -26,11 +31,15 @@
 
 - (void)snapshotRemoteFilesWithCompletion:(CDECompletionBlock)completion;
 - (void)clearSnapshot;
+- (void)storeSnapshotForReuse; // Call when all files in the snapshot have been processed
+
+- (void)publishManifestWithCompletion:(CDECompletionBlock)completion;
 
 - (void)importNewRemoteNonBaselineEventsWithCompletion:(CDECompletionBlock)completion;
 - (void)importNewBaselineEventsWithCompletion:(CDECompletionBlock)completion;
 - (void)importNewDataFilesWithCompletion:(CDECompletionBlock)completion;
 
+- (void)squashUnexportedLocalEventsWithCompletion:(CDECompletionBlock)completion; // Requires a snapshot
 - (void)exportNewLocalNonBaselineEventsWithCompletion:(CDECompletionBlock)completion;
 - (void)exportNewLocalBaselineWithCompletion:(CDECompletionBlock)completion;
 - (void)exportDataFilesWithCompletion:(CDECompletionBlock)completion;
@@ -16,22 +16,65 @@
 #import "CDEEventRevision.h"
 #import "CDERevision.h"
 #import "CDEEventMigrator.h"
+#import "CDEEventSquasher.h"
+#import "CDEFileCompressor.h"
+#import "CDEEventStream.h"
+#import "CDEEventFileRecord.h"
+#import "CDEBaselineIndex.h"
+
+static NSString * const kCDEManifestFilename = @"manifest";
+static NSString * const kCDEManifestGenerationKey = @"generation";
+static NSString * const kCDEManifestIdentifierKey = @"identifier";
+static NSString * const kCDEManifestStoreIdentifierKey = @"storeIdentifier";
+static NSString * const kCDEManifestDateKey = @"date";
+
+static NSString * const kCDEManifestStateFilename = @"manifeststate.plist";
+static NSString * const kCDEManifestStatePublicationRequiredKey = @"publicationRequired";
+static NSString * const kCDEManifestStateTokenKey = @"token";
+static NSString * const kCDEManifestStateSnapshotDateKey = @"snapshotDate";
+static NSString * const kCDEManifestStateBaselinesKey = @"baselines";
+static NSString * const kCDEManifestStateEventsKey = @"events";
+static NSString * const kCDEManifestStateDataKey = @"data";
+static NSString * const kCDEManifestStateBaselineSegmentsKey = @"baselineSegments";
+
+static NSString * const kCDEBaselineSegmentsStateFilename = @"baselinesegments.plist";
+static NSString * const kCDEBaselineSegmentsStateBaselinesKey = @"baselines";
+static NSString * const kCDEBaselineSegmentsStateUnreferencedKey = @"unreferenced";
+
+static NSString * const kCDEEventStoreContextObservationContext = @"kCDEEventStoreContextObservationContext";
+
+// Clients that predate the manifest don't update it, so a stored snapshot is never trusted indefinitely
+static const NSTimeInterval CDEMaximumAgeOfReusableSnapshot = 3600.0;
+
+// Segments are uploaded before the index that refers to them, so an unreferenced segment may belong to a baseline
+// still being uploaded. It is only removed once it has been unreferenced this long.
+static const NSTimeInterval CDEMinimumAgeOfUnreferencedBaselineSegment = 3600.0;
+
+static const NSUInteger CDEMaximumConcurrentSegmentDownloads = 4;
 
 @interface CDECloudManager ()
 
 @property (nonatomic, strong, readwrite) NSSet *snapshotBaselineFilenames;
 @property (nonatomic, strong, readwrite) NSSet *snapshotEventFilenames;
 @property (nonatomic, strong, readwrite) NSSet *snapshotDataFilenames;
+@property (nonatomic, strong, readwrite) NSSet *snapshotBaselineSegmentFilenames;
+@property (nonatomic, assign, readwrite) BOOL snapshotIsUnchanged;
 
 @property (nonatomic, strong, readonly) NSString *localEnsembleDirectory;
 
 @property (nonatomic, strong, readonly) NSString *localDownloadDirectory;
 @property (nonatomic, strong, readonly) NSString *localUploadDirectory;
+@property (nonatomic, strong, readonly) NSString *localBaselineSegmentsDirectory;
 
 @property (nonatomic, strong, readonly) NSString *remoteStoresDirectory;
 @property (nonatomic, strong, readonly) NSString *remoteEventsDirectory;
 @property (nonatomic, strong, readonly) NSString *remoteBaselinesDirectory;
+@property (nonatomic, strong, readonly) NSString *remoteBaselineSegmentsDirectory;
 @property (nonatomic, strong, readonly) NSString *remoteDataDirectory;
+@property (nonatomic, strong, readonly) NSString *remoteManifestPath;
+
+@property (nonatomic, strong, readonly) NSString *localManifestStatePath;
+@property (nonatomic, strong, readonly) NSString *localBaselineSegmentsStatePath;
 
 @end
 
@@ -39,6 +82,13 @@
     NSString *localFileRoot;
     NSFileManager *fileManager;
     NSOperationQueue *operationQueue;
+    id <NSObject, NSCopying, NSCoding> manifestToken;
+    NSDate *snapshotDate;
+    CDEGlobalCount manifestGeneration;
+    BOOL manifestPublicationRequired;
+    BOOL remoteFilesModified;
+    BOOL eventFileLedgerReconciled;
+    NSManagedObjectContext *observedContext;
 }
 
 @synthesize eventStore = eventStore;
@@ -46,6 +96,11 @@
 @synthesize snapshotBaselineFilenames = snapshotBaselineFilenames;
 @synthesize snapshotEventFilenames = snapshotEventFilenames;
 @synthesize snapshotDataFilenames = snapshotDataFilenames;
+@synthesize snapshotBaselineSegmentFilenames = snapshotBaselineSegmentFilenames;
+@synthesize snapshotIsUnchanged = snapshotIsUnchanged;
+@synthesize compressionCodec = compressionCodec;
+@synthesize usesStreamingEventFiles = usesStreamingEventFiles;
+@synthesize usesSegmentedBaselines = usesSegmentedBaselines;
 
 #pragma mark Initialization
 
@@ -56,6 +111,9 @@
         fileManager = [[NSFileManager alloc] init];
         eventStore = newStore;
         cloudFileSystem = newSystem;
+        compressionCodec = CDECompressionCodecNone;
+        usesStreamingEventFiles = NO;
+        usesSegmentedBaselines = NO;
         localFileRoot = [eventStore.pathToEventDataRootDirectory stringByAppendingPathComponent:@"transitcache"];
         
         operationQueue = [[NSOperationQueue alloc] init];
@@ -65,13 +123,32 @@
         }
         
         [self setup];
+        
+        [eventStore addObserver:self forKeyPath:@"managedObjectContext" options:NSKeyValueObservingOptionInitial context:(__bridge void *)kCDEEventStoreContextObservationContext];
     }
     return self;
 }
 
+- (void)dealloc
+{
+    [eventStore removeObserver:self forKeyPath:@"managedObjectContext" context:(__bridge void *)kCDEEventStoreContextObservationContext];
+    [self observeSavesOfContext:nil];
+}
+
 - (void)setup
 {
     [self createTransitCacheDirectories];
+    [self loadManifestState];
+}
+
+- (BOOL)usesChunkedDataFiles
+{
+    return eventStore.splitsLargeDataIntoChunks;
+}
+
+- (void)setUsesChunkedDataFiles:(BOOL)flag
+{
+    eventStore.splitsLargeDataIntoChunks = flag;
 }
 
 
@@ -80,6 +157,26 @@
 - (void)snapshotRemoteFilesWithCompletion:(CDECompletionBlock)completion
 {
     [self clearSnapshot];
+    snapshotDate = [NSDate date];
+    
+    CDEAsynchronousTaskBlock manifestTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self fetchManifestTokenWithCompletion:^(id <NSObject, NSCopying, NSCoding> token, NSError *error) {
+            if (error) {
+                // The manifest is only an optimization, so fall back to listing directories
+                CDELog(CDELoggingLevelWarning, @"Could not retrieve manifest: %@", error);
+                next(nil, NO);
+                return;
+            }
+            
+            self->manifestToken = token;
+            if (!token) self->manifestPublicationRequired = YES;
+            
+            // Stop early if the stored snapshot is still valid
+            BOOL reused = [self reuseStoredSnapshot];
+            if (reused) CDELog(CDELoggingLevelVerbose, @"Manifest unchanged. Reusing snapshot of remote files.");
+            next(nil, reused);
+        }];
+    };
     
     CDEAsynchronousTaskBlock baselinesTask = ^(CDEAsynchronousTaskCallbackBlock next) {
         [self.cloudFileSystem contentsOfDirectoryAtPath:self.remoteBaselinesDirectory completion:^(NSArray *baselineContents, NSError *error) {
@@ -102,7 +199,16 @@
         }];
     };
     
-    NSArray *tasks = @[baselinesTask, eventsTask, dataTask];
+    CDEAsynchronousTaskBlock baselineSegmentsTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self.cloudFileSystem contentsOfDirectoryAtPath:self.remoteBaselineSegmentsDirectory completion:^(NSArray *segmentContents, NSError *error) {
+            // Without a listing, segments are all uploaded again, and none are removed
+            if (error) CDELog(CDELoggingLevelWarning, @"Could not list baseline segments: %@", error);
+            self->snapshotBaselineSegmentFilenames = error ? nil : [NSSet setWithArray:[segmentContents valueForKeyPath:@"name"]];
+            next(nil, NO);
+        }];
+    };
+    
+    NSArray *tasks = @[manifestTask, baselinesTask, baselineSegmentsTask, eventsTask, dataTask];
     CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:^(NSError *error) {
         if (error) [self clearSnapshot];
         if (completion) completion(error);
@@ -115,6 +221,191 @@
     snapshotEventFilenames = nil;
     snapshotBaselineFilenames = nil;
     snapshotDataFilenames = nil;
+    snapshotBaselineSegmentFilenames = nil;
+    snapshotIsUnchanged = NO;
+    snapshotDate = nil;
+    manifestToken = nil;
+    remoteFilesModified = NO;
+}
+
+
+#pragma mark Manifest
+
+- (void)fetchManifestTokenWithCompletion:(CDERevisionTokenCallback)completion
+{
+    NSString *remotePath = self.remoteManifestPath;
+    if ([self.cloudFileSystem respondsToSelector:@selector(fetchRevisionTokenForFileAtPath:completion:)]) {
+        [self.cloudFileSystem fetchRevisionTokenForFileAtPath:remotePath completion:completion];
+        return;
+    }
+    
+    // Fall back to downloading the manifest. The generation and identifier together form the token.
+    NSString *localPath = [self.localEnsembleDirectory stringByAppendingPathComponent:kCDEManifestFilename];
+    [fileManager removeItemAtPath:localPath error:NULL];
+    [self.cloudFileSystem fileExistsAtPath:remotePath completion:^(BOOL exists, BOOL isDirectory, NSError *error) {
+        if (error || !exists || isDirectory) {
+            if (completion) completion(nil, error);
+            return;
+        }
+        
+        [self.cloudFileSystem downloadFromPath:remotePath toLocalFile:localPath completion:^(NSError *error) {
+            NSDictionary *manifest = error ? nil : [NSDictionary dictionaryWithContentsOfFile:localPath];
+            [self->fileManager removeItemAtPath:localPath error:NULL];
+            
+            NSArray *token = nil;
+            NSNumber *generation = manifest[kCDEManifestGenerationKey];
+            NSString *identifier = manifest[kCDEManifestIdentifierKey];
+            if (generation && identifier) {
+                token = @[generation, identifier];
+                self->manifestGeneration = MAX(self->manifestGeneration, generation.longLongValue);
+            }
+            
+            if (completion) completion(token, error);
+        }];
+    }];
+}
+
+- (void)publishManifestWithCompletion:(CDECompletionBlock)completion
+{
+    if (!manifestPublicationRequired) {
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(nil);
+        });
+        return;
+    }
+    
+    CDELog(CDELoggingLevelVerbose, @"Publishing manifest");
+    
+    // The unique identifier distinguishes manifests written concurrently by different devices
+    CDEGlobalCount newGeneration = manifestGeneration + 1;
+    NSDictionary *manifest = @{
+        kCDEManifestGenerationKey : @(newGeneration),
+        kCDEManifestIdentifierKey : [[NSProcessInfo processInfo] globallyUniqueString],
+        kCDEManifestStoreIdentifierKey : self.eventStore.persistentStoreIdentifier,
+        kCDEManifestDateKey : [NSDate date]
+    };
+    
+    NSString *localPath = [self.localEnsembleDirectory stringByAppendingPathComponent:kCDEManifestFilename];
+    if (![manifest writeToFile:localPath atomically:YES]) {
+        NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeFailedToWriteFile userInfo:nil];
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(error);
+        });
+        return;
+    }
+    
+    NSString *remotePath = self.remoteManifestPath;
+    CDEAsynchronousTaskBlock removeTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self.cloudFileSystem fileExistsAtPath:remotePath completion:^(BOOL exists, BOOL isDirectory, NSError *error) {
+            if (error || !exists) {
+                next(error, NO);
+                return;
+            }
+            [self.cloudFileSystem removeItemAtPath:remotePath completion:^(NSError *error) {
+                next(error, NO);
+            }];
+        }];
+    };
+    
+    CDEAsynchronousTaskBlock uploadTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self.cloudFileSystem uploadLocalFile:localPath toPath:remotePath completion:^(NSError *error) {
+            next(error, NO);
+        }];
+    };
+    
+    NSArray *tasks = @[removeTask, uploadTask];
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:^(NSError *error) {
+        [self->fileManager removeItemAtPath:localPath error:NULL];
+        if (!error) {
+            self->manifestGeneration = newGeneration;
+            self->manifestPublicationRequired = NO;
+            [self saveManifestStateIncludingSnapshot:NO];
+        }
+        else {
+            CDELog(CDELoggingLevelError, @"Failed to publish manifest: %@", error);
+        }
+        if (completion) completion(error);
+    }];
+    [operationQueue addOperation:taskQueue];
+}
+
+- (void)registerRemoteFilesModified
+{
+    // Our own changes alter the manifest, so the snapshot can't be reused
+    remoteFilesModified = YES;
+    manifestPublicationRequired = YES;
+    [self saveManifestStateIncludingSnapshot:NO];
+}
+
+- (void)storeSnapshotForReuse
+{
+    BOOL canReuse = manifestToken && snapshotDate && !remoteFilesModified && snapshotBaselineFilenames && snapshotEventFilenames && snapshotDataFilenames;
+    [self saveManifestStateIncludingSnapshot:canReuse];
+}
+
+- (BOOL)reuseStoredSnapshot
+{
+    if (!manifestToken) return NO;
+    
+    NSDictionary *state = [NSDictionary dictionaryWithContentsOfFile:self.localManifestStatePath];
+    NSData *tokenData = state[kCDEManifestStateTokenKey];
+    NSDate *storedSnapshotDate = state[kCDEManifestStateSnapshotDateKey];
+    if (!tokenData || !storedSnapshotDate) return NO;
+    if (![state[kCDEManifestStoreIdentifierKey] isEqualToString:self.eventStore.persistentStoreIdentifier]) return NO;
+    if ([[NSDate date] timeIntervalSinceDate:storedSnapshotDate] > CDEMaximumAgeOfReusableSnapshot) return NO;
+    
+    id storedToken = nil;
+    @try {
+        storedToken = [NSKeyedUnarchiver unarchiveObjectWithData:tokenData];
+    }
+    @catch (NSException *exception) {
+        CDELog(CDELoggingLevelWarning, @"Failed to unarchive manifest token: %@", exception);
+        return NO;
+    }
+    if (![storedToken isEqual:manifestToken]) return NO;
+    
+    NSArray *baselines = state[kCDEManifestStateBaselinesKey];
+    NSArray *events = state[kCDEManifestStateEventsKey];
+    NSArray *data = state[kCDEManifestStateDataKey];
+    if (!baselines || !events || !data) return NO;
+    
+    snapshotBaselineFilenames = [NSSet setWithArray:baselines];
+    snapshotEventFilenames = [NSSet setWithArray:events];
+    snapshotDataFilenames = [NSSet setWithArray:data];
+    NSArray *baselineSegments = state[kCDEManifestStateBaselineSegmentsKey];
+    snapshotBaselineSegmentFilenames = baselineSegments ? [NSSet setWithArray:baselineSegments] : nil;
+    snapshotDate = storedSnapshotDate; // Age from the last full listing
+    snapshotIsUnchanged = YES;
+    
+    return YES;
+}
+
+- (void)loadManifestState
+{
+    NSDictionary *state = [NSDictionary dictionaryWithContentsOfFile:self.localManifestStatePath];
+    manifestGeneration = [state[kCDEManifestGenerationKey] longLongValue];
+    manifestPublicationRequired = [state[kCDEManifestStatePublicationRequiredKey] boolValue];
+}
+
+- (void)saveManifestStateIncludingSnapshot:(BOOL)includeSnapshot
+{
+    NSMutableDictionary *state = [NSMutableDictionary dictionary];
+    state[kCDEManifestGenerationKey] = @(manifestGeneration);
+    state[kCDEManifestStatePublicationRequiredKey] = @(manifestPublicationRequired);
+    
+    if (includeSnapshot) {
+        state[kCDEManifestStateTokenKey] = [NSKeyedArchiver archivedDataWithRootObject:manifestToken];
+        state[kCDEManifestStoreIdentifierKey] = self.eventStore.persistentStoreIdentifier;
+        state[kCDEManifestStateSnapshotDateKey] = snapshotDate;
+        state[kCDEManifestStateBaselinesKey] = snapshotBaselineFilenames.allObjects;
+        state[kCDEManifestStateEventsKey] = snapshotEventFilenames.allObjects;
+        state[kCDEManifestStateDataKey] = snapshotDataFilenames.allObjects;
+        if (snapshotBaselineSegmentFilenames) state[kCDEManifestStateBaselineSegmentsKey] = snapshotBaselineSegmentFilenames.allObjects;
+    }
+    
+    if (![state writeToFile:self.localManifestStatePath atomically:YES]) {
+        CDELog(CDELoggingLevelWarning, @"Could not save manifest state");
+    }
 }
 
 
@@ -122,7 +413,7 @@
 
 - (void)importNewRemoteNonBaselineEventsWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"importNewRemote... called off the main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"importNewRemote... called off the work queue");
     
     CDELog(CDELoggingLevelVerbose, @"Transferring new events from cloud to event store");
     
@@ -138,7 +429,7 @@
 
 - (void)importNewBaselineEventsWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"importNewBaselineEventsWithCompletion... called off the main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"importNewBaselineEventsWithCompletion... called off the work queue");
     
     CDELog(CDELoggingLevelVerbose, @"Transferring new baselines from cloud to event store");
     
@@ -154,7 +445,7 @@
 
 - (void)importNewDataFilesWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"importNewDataFilesWithCompletion... called off the main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"importNewDataFilesWithCompletion... called off the work queue");
     
     CDELog(CDELoggingLevelVerbose, @"Transferring new data files from cloud to event store");
     
@@ -202,31 +493,133 @@
         return;
     }
     
-    NSMutableArray *taskBlocks = [NSMutableArray array];
+    NSMutableArray *remotePaths = [NSMutableArray arrayWithCapacity:filenames.count];
+    NSMutableArray *localPaths = [NSMutableArray arrayWithCapacity:filenames.count];
     for (NSString *filename in filenames) {
-        NSString *remotePath = [remoteDirectory stringByAppendingPathComponent:filename];
-        NSString *localPath = [self.localDownloadDirectory stringByAppendingPathComponent:filename];
+        [remotePaths addObject:[remoteDirectory stringByAppendingPathComponent:filename]];
+        [localPaths addObject:[self.localDownloadDirectory stringByAppendingPathComponent:filename]];
+    }
+    
+    NSMutableArray *taskBlocks = [NSMutableArray array];
+    if (remotePaths.count > 0 && [self.cloudFileSystem respondsToSelector:@selector(downloadFromPaths:toLocalFiles:completion:)]) {
         CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [self.cloudFileSystem downloadFromPath:remotePath toLocalFile:localPath completion:^(NSError *error) {
+            dispatch_async(CDEWorkQueue(), ^{
+                [self.cloudFileSystem downloadFromPaths:remotePaths toLocalFiles:localPaths completion:^(NSError *error) {
                     next(error, NO);
                 }];
             });
         };
         [taskBlocks addObject:block];
     }
+    else {
+        for (NSUInteger i = 0; i < remotePaths.count; i++) {
+            NSString *remotePath = remotePaths[i];
+            NSString *localPath = localPaths[i];
+            CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+                dispatch_async(CDEWorkQueue(), ^{
+                    [self.cloudFileSystem downloadFromPath:remotePath toLocalFile:localPath completion:^(NSError *error) {
+                        next(error, NO);
+                    }];
+                });
+            };
+            [taskBlocks addObject:block];
+        }
+    }
+    
+    // Files from devices that compress are restored before import. Others are left untouched.
+    CDEAsynchronousTaskBlock decompressBlock = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self decompressFilesAtPaths:localPaths];
+        next(nil, NO);
+    };
+    [taskBlocks addObject:decompressBlock];
     
     CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:taskBlocks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:completion];
     [operationQueue addOperation:taskQueue];
 }
 
+- (void)downloadBaselineSegments:(NSArray *)filenames completion:(CDECompletionBlock)completion
+{
+    NSMutableArray *remotePaths = [NSMutableArray arrayWithCapacity:filenames.count];
+    NSMutableArray *localPaths = [NSMutableArray arrayWithCapacity:filenames.count];
+    for (NSString *filename in filenames) {
+        NSString *localPath = [self.localBaselineSegmentsDirectory stringByAppendingPathComponent:filename];
+        if ([fileManager fileExistsAtPath:localPath]) continue;
+        [remotePaths addObject:[self.remoteBaselineSegmentsDirectory stringByAppendingPathComponent:filename]];
+        [localPaths addObject:localPath];
+    }
+    
+    CDELog(CDELoggingLevelVerbose, @"Downloading %lu of %lu baseline segments", (unsigned long)remotePaths.count, (unsigned long)filenames.count);
+    
+    CDECompletionBlock downloadCompletion = ^(NSError *error) {
+        if (!error) [self decompressFilesAtPaths:localPaths];
+        for (NSString *path in localPaths) {
+            if (error || [self->fileManager fileExistsAtPath:path]) continue;
+            NSDictionary *info = @{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Could not restore baseline segment: %@", path.lastPathComponent]};
+            error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeFileAccessFailed userInfo:info];
+        }
+        if (completion) completion(error);
+    };
+    
+    if (remotePaths.count == 0) {
+        dispatch_async(CDEWorkQueue(), ^{
+            downloadCompletion(nil);
+        });
+        return;
+    }
+    
+    if ([self.cloudFileSystem respondsToSelector:@selector(downloadFromPaths:toLocalFiles:completion:)]) {
+        dispatch_async(CDEWorkQueue(), ^{
+            [self.cloudFileSystem downloadFromPaths:remotePaths toLocalFiles:localPaths completion:^(NSError *error) {
+                dispatch_async(CDEWorkQueue(), ^{
+                    downloadCompletion(error);
+                });
+            }];
+        });
+        return;
+    }
+    
+    // Without batch downloads, several lanes each download their share of the segments one at a time
+    NSUInteger laneCount = MIN(CDEMaximumConcurrentSegmentDownloads, remotePaths.count);
+    __block NSError *lastError = nil;
+    dispatch_group_t group = dispatch_group_create();
+    for (NSUInteger lane = 0; lane < laneCount; lane++) {
+        dispatch_group_enter(group);
+        [self downloadFromPaths:remotePaths toLocalFiles:localPaths startingAtIndex:lane stride:laneCount completion:^(NSError *error) {
+            if (error) {
+                @synchronized (self) { lastError = error; }
+            }
+            dispatch_group_leave(group);
+        }];
+    }
+    
+    dispatch_group_notify(group, CDEWorkQueue(), ^{
+        downloadCompletion(lastError);
+    });
+}
+
+- (void)downloadFromPaths:(NSArray *)remotePaths toLocalFiles:(NSArray *)localPaths startingAtIndex:(NSUInteger)index stride:(NSUInteger)stride completion:(CDECompletionBlock)completion
+{
+    if (index >= remotePaths.count) {
+        if (completion) completion(nil);
+        return;
+    }
+    
+    dispatch_async(CDEWorkQueue(), ^{
+        [self.cloudFileSystem downloadFromPath:remotePaths[index] toLocalFile:localPaths[index] completion:^(NSError *error) {
+            if (error) {
+                CDELog(CDELoggingLevelError, @"Failed to download baseline segment: %@", error);
+                if (completion) completion(error);
+                return;
+            }
+            [self downloadFromPaths:remotePaths toLocalFiles:localPaths startingAtIndex:index + stride stride:stride completion:completion];
+        }];
+    });
+}
+
 - (NSArray *)filesRequiringRetrievalFromAvailableRemoteFiles:(NSArray *)remoteFiles allowedEventTypes:(NSArray *)eventTypes
 {
     NSMutableSet *toRetrieve = [NSMutableSet setWithArray:remoteFiles];
-    NSSet *eventFiles = [self eventFilesForEventsWithAllowedTypes:eventTypes createdInStore:nil];
-    for (CDEEventFile *eventFile in eventFiles) {
-        [toRetrieve minusSet:eventFile.aliases];
-    }
+    [toRetrieve minusSet:[self eventFilenamesForEventsWithAllowedTypes:eventTypes createdInStore:nil]];
     return [self sortFilenamesByGlobalCount:toRetrieve.allObjects];
 }
 
@@ -247,53 +640,113 @@
     NSError *error = nil;
     NSArray *files = [fileManager contentsOfDirectoryAtPath:self.localDownloadDirectory error:&error];
     
-    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
-    CDEEventMigrator *migrator = [[CDEEventMigrator alloc] initWithEventStore:self.eventStore];
+    if (!files) CDELog(CDELoggingLevelError, @"Could not list downloaded files: %@", error);
     
-    NSMutableArray *tasks = [[NSMutableArray alloc] initWithCapacity:files.count];
+    // One lookup for all existing events, rather than a fetch per file
+    NSSet *existingFilenames = [self eventFilenamesForEventsWithAllowedTypes:types createdInStore:nil];
+    
+    NSMutableArray *filesToMigrate = [[NSMutableArray alloc] initWithCapacity:files.count];
     for (NSString *file in files) {
+        CDEEventFile *eventFile = [[CDEEventFile alloc] initWithFilename:file];
+        if (eventFile == nil) continue;
+        
+        if (eventFile.eventShouldBeUnique && [existingFilenames containsObject:file]) {
+            NSString *path = [self.localDownloadDirectory stringByAppendingPathComponent:file];
+            [fileManager removeItemAtPath:path error:NULL];
+            continue;
+        }
+        
+        [filesToMigrate addObject:file];
+    }
+    
+    // Segmented baselines are downloaded as an index, and their segments are fetched separately
+    NSMutableArray *paths = [[NSMutableArray alloc] initWithCapacity:filesToMigrate.count];
+    NSMutableArray *baselineIndexFiles = [[NSMutableArray alloc] init];
+    for (NSString *file in [self sortFilenamesByGlobalCount:filesToMigrate]) {
         NSString *path = [self.localDownloadDirectory stringByAppendingPathComponent:file];
+        if ([CDEBaselineIndex isBaselineIndexAtPath:path])
+            [baselineIndexFiles addObject:file];
+        else
+            [paths addObject:path];
+    }
+    
+    // Migrate data into event store. The migrator imports the files in batched transactions.
+    CDEEventMigrator *migrator = [[CDEEventMigrator alloc] initWithEventStore:self.eventStore];
+    CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+        if (paths.count == 0) {
+            next(nil, NO);
+            return;
+        }
         
-        CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
-            CDEEventFile *eventFile = [[CDEEventFile alloc] initWithFilename:file];
-            if (eventFile == nil) {
-                next(nil, NO);
-                return;
-            }
-            
-            // Check for a pre-existing event first. Skip if we find one.
-            __block BOOL eventsExist = NO;
-            [moc performBlockAndWait:^{
-                NSError *error;
-                NSFetchRequest *fetch = [[NSFetchRequest alloc] initWithEntityName:@"CDEStoreModificationEvent"];
-                fetch.predicate = eventFile.eventFetchPredicate;
-                NSArray *events = [moc executeFetchRequest:fetch error:&error];
-                if (!events) CDELog(CDELoggingLevelError, @"Could not fetch events: %@", error);
-                eventsExist = events.count > 0;
+        dispatch_async(CDEWorkQueue(), ^{
+            [migrator migrateEventsInFromFiles:paths completion:^(NSError *error) {
+                for (NSString *path in paths) [self->fileManager removeItemAtPath:path error:NULL];
+                next(error, NO);
+            }];
+        });
+    };
+    
+    NSMutableArray *tasks = [[NSMutableArray alloc] initWithObjects:block, nil];
+    for (NSString *file in baselineIndexFiles) {
+        CDEAsynchronousTaskBlock indexBlock = ^(CDEAsynchronousTaskCallbackBlock next) {
+            [self migrateSegmentedBaselineFromIndexFile:file completion:^(NSError *error) {
+                next(error, NO);
             }];
-            
-            if (eventsExist && eventFile.eventShouldBeUnique) {
-                [self->fileManager removeItemAtPath:path error:NULL];
-                next(nil, NO);
-                return;
-            }
-            
-            // Migrate data into event store
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [migrator migrateEventsInFromFiles:@[path] completion:^(NSError *error) {
-                    [self->fileManager removeItemAtPath:path error:NULL];
-                    next(error, NO);
-                }];
-            });
         };
-        
-        [tasks addObject:block];
+        [tasks addObject:indexBlock];
     }
     
-    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyCompleteAll completion:completion];
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:completion];
     [operationQueue addOperation:taskQueue];
 }
 
+- (void)migrateSegmentedBaselineFromIndexFile:(NSString *)file completion:(CDECompletionBlock)completion
+{
+    NSString *indexPath = [self.localDownloadDirectory stringByAppendingPathComponent:file];
+    NSError *error = nil;
+    CDEBaselineIndex *index = [CDEBaselineIndex baselineIndexWithContentsOfFile:indexPath error:&error];
+    [fileManager removeItemAtPath:indexPath error:NULL];
+    if (!index) {
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(error);
+        });
+        return;
+    }
+    
+    // An index can be uploaded before its segments are all in place. It is left until a later merge.
+    if (snapshotBaselineSegmentFilenames) {
+        NSMutableSet *missingSegments = [NSMutableSet setWithArray:index.segmentFilenames];
+        [missingSegments minusSet:snapshotBaselineSegmentFilenames];
+        if (missingSegments.count > 0) {
+            CDELog(CDELoggingLevelWarning, @"Skipping baseline %@ with %lu segments not yet in the cloud", file, (unsigned long)missingSegments.count);
+            dispatch_async(CDEWorkQueue(), ^{
+                if (completion) completion(nil);
+            });
+            return;
+        }
+    }
+    
+    NSMutableArray *segmentPaths = [[NSMutableArray alloc] initWithCapacity:index.segmentFilenames.count];
+    for (NSString *segment in index.segmentFilenames) {
+        [segmentPaths addObject:[self.localBaselineSegmentsDirectory stringByAppendingPathComponent:segment]];
+    }
+    
+    [self downloadBaselineSegments:index.segmentFilenames completion:^(NSError *error) {
+        if (error) {
+            if (completion) completion(error);
+            return;
+        }
+        
+        CDEEventMigrator *migrator = [[CDEEventMigrator alloc] initWithEventStore:self.eventStore];
+        [migrator migrateBaselineWithIndex:index inFromSegmentFiles:segmentPaths completion:^(NSError *error) {
+            // Segments already downloaded are kept after a failed download, but not after a failed import
+            for (NSString *path in segmentPaths) [self->fileManager removeItemAtPath:path error:NULL];
+            if (!error) [self recordBaselineSegmentFilenames:index.segmentFilenames forBaselineFilename:file];
+            if (completion) completion(error);
+        }];
+    }];
+}
+
 - (BOOL)migrateNewDataFilesFromTransitCache:(NSError * __autoreleasing *)error
 {
     NSArray *files = [fileManager contentsOfDirectoryAtPath:self.localDownloadDirectory error:error];
@@ -314,6 +767,15 @@
 
 #pragma mark Uploading Local Events
 
+- (void)squashUnexportedLocalEventsWithCompletion:(CDECompletionBlock)completion
+{
+    NSAssert(snapshotEventFilenames, @"No snapshot");
+    CDELog(CDELoggingLevelVerbose, @"Squashing local events not yet exported");
+    
+    CDEEventSquasher *squasher = [[CDEEventSquasher alloc] initWithEventStore:self.eventStore];
+    [squasher squashUnexportedSaveEventsExcludingCloudFilenames:snapshotEventFilenames completion:completion];
+}
+
 - (void)exportNewLocalNonBaselineEventsWithCompletion:(CDECompletionBlock)completion
 {
     NSAssert(snapshotEventFilenames, @"No snapshot");
@@ -331,6 +793,11 @@
     NSAssert(snapshotBaselineFilenames, @"No snapshot");
     CDELog(CDELoggingLevelVerbose, @"Transferring baseline from event store to cloud");
     
+    if (self.usesSegmentedBaselines) {
+        [self exportNewLocalBaselineInSegmentsWithCompletion:completion];
+        return;
+    }
+    
     NSArray *types = @[@(CDEStoreModificationEventTypeBaseline)];
     [self migrateNewLocalEventsToTransitCacheWithRemoteDirectory:self.remoteBaselinesDirectory existingRemoteFilenames:snapshotBaselineFilenames.allObjects allowedTypes:types completion:^(NSError *error) {
         if (error) CDELog(CDELoggingLevelWarning, @"Error migrating out baseline: %@", error);
@@ -338,6 +805,80 @@
     }];
 }
 
+- (void)exportNewLocalBaselineInSegmentsWithCompletion:(CDECompletionBlock)completion
+{
+    NSArray *types = @[@(CDEStoreModificationEventTypeBaseline)];
+    NSArray *filenames = [self localEventFilesMissingFromRemoteCloudFiles:snapshotBaselineFilenames.allObjects allowedTypes:types];
+    
+    NSError *error = nil;
+    BOOL success = [self removeFilesInDirectory:self.localUploadDirectory error:&error];
+    if (!success) {
+        if (completion) completion(error);
+        return;
+    }
+    
+    // Only segments missing from the cloud are written. A segment no retained index refers to may be
+    // removed by another device at any time, so it is written again, rather than trusted to stay.
+    NSMutableSet *existingSegments = [snapshotBaselineSegmentFilenames mutableCopy] ? : [NSMutableSet set];
+    [existingSegments intersectSet:[self baselineSegmentsReferencedByBaselines:snapshotBaselineFilenames]];
+    NSMutableDictionary *indexesByFilename = [[NSMutableDictionary alloc] initWithCapacity:filenames.count];
+    CDEEventMigrator *migrator = [[CDEEventMigrator alloc] initWithEventStore:self.eventStore];
+    NSMutableArray *tasks = [[NSMutableArray alloc] initWithCapacity:filenames.count];
+    for (NSString *filename in filenames) {
+        CDEEventFile *eventFile = [[CDEEventFile alloc] initWithFilename:filename];
+        NSAssert(eventFile, @"Invalid filename");
+        
+        CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+            [migrator migrateLocalBaselineMatchingPredicate:eventFile.eventFetchPredicate toSegmentsInDirectory:self.localUploadDirectory excludingSegmentFilenames:existingSegments completion:^(CDEBaselineIndex *index, NSError *error) {
+                if (index) indexesByFilename[filename] = index;
+                next(error, NO);
+            }];
+        };
+        [tasks addObject:block];
+    }
+    
+    // Segments go up before the indexes, so other devices never find an index with missing segments
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:^(NSError *error) {
+        if (error) {
+            [self removeFilesInDirectory:self.localUploadDirectory error:NULL];
+            if (completion) completion(error);
+            return;
+        }
+        
+        [self transferFilesInTransitCacheToRemoteDirectory:self.remoteBaselineSegmentsDirectory completion:^(NSError *error) {
+            if (error) {
+                if (completion) completion(error);
+                return;
+            }
+            [self transferBaselineIndexesToRemoteDirectory:indexesByFilename completion:completion];
+        }];
+    }];
+    [operationQueue addOperation:taskQueue];
+}
+
+- (void)transferBaselineIndexesToRemoteDirectory:(NSDictionary *)indexesByFilename completion:(CDECompletionBlock)completion
+{
+    for (NSString *filename in indexesByFilename) {
+        NSError *error = nil;
+        CDEBaselineIndex *index = indexesByFilename[filename];
+        NSString *path = [self.localUploadDirectory stringByAppendingPathComponent:filename];
+        if (![index writeToFile:path error:&error]) {
+            [self removeFilesInDirectory:self.localUploadDirectory error:NULL];
+            if (completion) completion(error);
+            return;
+        }
+    }
+    
+    [self transferFilesInTransitCacheToRemoteDirectory:self.remoteBaselinesDirectory completion:^(NSError *error) {
+        if (!error) {
+            [indexesByFilename enumerateKeysAndObjectsUsingBlock:^(NSString *filename, CDEBaselineIndex *index, BOOL *stop) {
+                [self recordBaselineSegmentFilenames:index.segmentFilenames forBaselineFilename:filename];
+            }];
+        }
+        if (completion) completion(error);
+    }];
+}
+
 - (void)exportDataFilesWithCompletion:(CDECompletionBlock)completion
 {
     NSAssert(snapshotDataFilenames, @"No snapshot");
@@ -369,44 +910,36 @@
         return;
     }
     
-    // Migrate events to file
-    CDEEventMigrator *migrator = [[CDEEventMigrator alloc] initWithEventStore:self.eventStore];
-    NSMutableArray *tasks = [[NSMutableArray alloc] initWithCapacity:filesToUpload.count];
+    // Migrate events to files. The migrator exports several at once.
+    NSMutableArray *predicates = [[NSMutableArray alloc] initWithCapacity:filesToUpload.count];
+    NSMutableArray *paths = [[NSMutableArray alloc] initWithCapacity:filesToUpload.count];
+    NSPredicate *typesPredicate = [NSPredicate predicateWithFormat:@"type IN %@", types];
     for (NSString *file in filesToUpload) {
-        NSString *path = [self.localUploadDirectory stringByAppendingPathComponent:file];
-        
-        CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
-            CDEEventFile *eventFile = [[CDEEventFile alloc] initWithFilename:file];
-            NSAssert(eventFile, @"Invalid filename");
-
-            // Migrate data to file
-            dispatch_async(dispatch_get_main_queue(), ^{
-                BOOL isDir;
-                if ([self->fileManager fileExistsAtPath:path isDirectory:&isDir]) {
-                    NSError *error;
-                    if (![self->fileManager removeItemAtPath:path error:&error]) {
-                        next(error, NO);
-                        return;
-                    }
-                }
-                
-                if (eventFile.isBaseline) {
-                    [migrator migrateLocalBaselineWithUniqueIdentifier:eventFile.uniqueIdentifier globalCount:eventFile.globalCount persistentStorePrefix:eventFile.persistentStorePrefix toFile:path completion:^(NSError *error) {
-                        next(error, NO);
-                    }];
-                }
-                else {
-                    [migrator migrateLocalEventWithRevision:eventFile.revisionNumber toFile:path allowedTypes:types completion:^(NSError *error) {
-                        next(error, NO);
-                    }];
-                }
-            });
-        };
+        CDEEventFile *eventFile = [[CDEEventFile alloc] initWithFilename:file];
+        NSAssert(eventFile, @"Invalid filename");
         
-        [tasks addObject:block];
+        NSPredicate *predicate = eventFile.eventFetchPredicate;
+        if (!eventFile.isBaseline) predicate = [NSCompoundPredicate andPredicateWithSubpredicates:@[predicate, typesPredicate]];
+        [predicates addObject:predicate];
+        [paths addObject:[self.localUploadDirectory stringByAppendingPathComponent:file]];
     }
     
-    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyCompleteAll completion:completion];
+    CDEEventMigrator *migrator = [[CDEEventMigrator alloc] initWithEventStore:self.eventStore];
+    if (self.usesStreamingEventFiles) migrator.storeTypeForNewFiles = CDEEventStreamStoreType;
+    CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+        if (paths.count == 0) {
+            next(nil, NO);
+            return;
+        }
+        
+        dispatch_async(CDEWorkQueue(), ^{
+            [migrator migrateLocalEventsMatchingPredicates:predicates toFiles:paths completion:^(NSError *error) {
+                next(error, NO);
+            }];
+        });
+    };
+    
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTask:block completion:completion];
     [operationQueue addOperation:taskQueue];
 }
 
@@ -433,48 +966,123 @@
 
 - (void)transferFilesInTransitCacheToRemoteDirectory:(NSString *)remoteDirectory completion:(CDECompletionBlock)completion
 {
+    BOOL transfersEvents = [remoteDirectory isEqualToString:self.remoteEventsDirectory] || [remoteDirectory isEqualToString:self.remoteBaselinesDirectory];
+
     NSError *error = nil;
     NSArray *files = [fileManager contentsOfDirectoryAtPath:self.localUploadDirectory error:&error];
     files = [self sortFilenamesByGlobalCount:files];
+    if (files.count > 0) [self registerRemoteFilesModified];
     
-    NSMutableArray *taskBlocks = [NSMutableArray array];
+    NSMutableArray *remotePaths = [NSMutableArray arrayWithCapacity:files.count];
+    NSMutableArray *localPaths = [NSMutableArray arrayWithCapacity:files.count];
     for (NSString *filename in files) {
-        NSString *remotePath = [remoteDirectory stringByAppendingPathComponent:filename];
-        NSString *localPath = [self.localUploadDirectory stringByAppendingPathComponent:filename];
+        [remotePaths addObject:[remoteDirectory stringByAppendingPathComponent:filename]];
+        [localPaths addObject:[self.localUploadDirectory stringByAppendingPathComponent:filename]];
+    }
+    
+    NSMutableArray *taskBlocks = [NSMutableArray array];
+    CDECompressionCodec codec = self.compressionCodec;
+    if (localPaths.count > 0 && codec != CDECompressionCodecNone) {
         CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                CDELog(CDELoggingLevelVerbose, @"Uploading file to remote path: %@", remotePath);
-                [self.cloudFileSystem uploadLocalFile:localPath toPath:remotePath completion:^(NSError *error) {
-                    [self->fileManager removeItemAtPath:localPath error:NULL];
-                    if (error) CDELog(CDELoggingLevelError, @"Failed file upload with error: %@", error);
+            NSError *error = nil;
+            BOOL success = [self compressFilesAtPaths:localPaths codec:codec error:&error];
+            next(success ? nil : error, NO);
+        };
+        [taskBlocks addObject:block];
+    }
+    
+    if (remotePaths.count > 0 && [self.cloudFileSystem respondsToSelector:@selector(uploadLocalFiles:toPaths:completion:)]) {
+        CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+            dispatch_async(CDEWorkQueue(), ^{
+                CDELog(CDELoggingLevelVerbose, @"Uploading files to remote paths: %@", remotePaths);
+                [self.cloudFileSystem uploadLocalFiles:localPaths toPaths:remotePaths completion:^(NSError *error) {
+                    for (NSString *localPath in localPaths) [self->fileManager removeItemAtPath:localPath error:NULL];
+                    if (error) CDELog(CDELoggingLevelError, @"Failed batch upload with error: %@", error);
                     next(error, NO);
                 }];
             });
         };
         [taskBlocks addObject:block];
     }
+    else {
+        for (NSUInteger i = 0; i < remotePaths.count; i++) {
+            NSString *remotePath = remotePaths[i];
+            NSString *localPath = localPaths[i];
+            CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+                dispatch_async(CDEWorkQueue(), ^{
+                    CDELog(CDELoggingLevelVerbose, @"Uploading file to remote path: %@", remotePath);
+                    [self.cloudFileSystem uploadLocalFile:localPath toPath:remotePath completion:^(NSError *error) {
+                        [self->fileManager removeItemAtPath:localPath error:NULL];
+                        if (error) CDELog(CDELoggingLevelError, @"Failed file upload with error: %@", error);
+                        next(error, NO);
+                    }];
+                });
+            };
+            [taskBlocks addObject:block];
+        }
+    }
     
-    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:taskBlocks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:completion];
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:taskBlocks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:^(NSError *error) {
+        if (!error && transfersEvents && files.count > 0) [self markEventFilesExported:files];
+        if (completion) completion(error);
+    }];
     [operationQueue addOperation:taskQueue];
 }
 
 
+#pragma mark Compression
+
+- (BOOL)compressFilesAtPaths:(NSArray *)paths codec:(CDECompressionCodec)codec error:(NSError * __autoreleasing *)error
+{
+    unsigned long long originalBytes = 0, compressedBytes = 0;
+    NSDate *startDate = [NSDate date];
+    for (NSString *path in paths) {
+        @autoreleasepool {
+            originalBytes += [[fileManager attributesOfItemAtPath:path error:NULL] fileSize];
+            if (![CDEFileCompressor compressFileInPlaceAtPath:path codec:codec error:error]) return NO;
+            compressedBytes += [[fileManager attributesOfItemAtPath:path error:NULL] fileSize];
+        }
+    }
+    
+    NSTimeInterval duration = MAX(-[startDate timeIntervalSinceNow], 1.0e-6);
+    CDELog(CDELoggingLevelVerbose, @"Compressed %lu files from %llu to %llu bytes (ratio %.2f, %.1f MB/s)", (unsigned long)paths.count, originalBytes, compressedBytes, originalBytes > 0 ? (double)compressedBytes / originalBytes : 1.0, originalBytes / duration / 1.0e6);
+    
+    return YES;
+}
+
+- (void)decompressFilesAtPaths:(NSArray *)paths
+{
+    for (NSString *path in paths) {
+        @autoreleasepool {
+            if (![fileManager fileExistsAtPath:path]) continue;
+            
+            NSError *error = nil;
+            if (![CDEFileCompressor decompressFileInPlaceAtPath:path error:&error]) {
+                // Leave it out of the transit cache. It will be downloaded again on the next merge.
+                CDELog(CDELoggingLevelWarning, @"Could not decompress downloaded file %@: %@", path.lastPathComponent, error);
+                [fileManager removeItemAtPath:path error:NULL];
+            }
+        }
+    }
+}
+
+
 #pragma mark Event Files
 
 - (NSArray *)localEventFilesMissingFromRemoteCloudFiles:(NSArray *)remoteFiles allowedTypes:(NSArray *)types
 {
     NSString *persistentStoreId = self.eventStore.persistentStoreIdentifier;
-    NSSet *eventFiles = [self eventFilesForEventsWithAllowedTypes:types createdInStore:persistentStoreId];
-    
     NSSet *remoteSet = [NSSet setWithArray:remoteFiles];
-    NSMutableSet *filenames = [[NSMutableSet alloc] init];
-    for (CDEEventFile *eventFile in eventFiles) {
-        if (![remoteSet intersectsSet:eventFile.aliases]) {
-            [filenames addObject:eventFile.preferredFilename];
-        }
-    }
     
-    return [self sortFilenamesByGlobalCount:filenames.allObjects];
+    __block NSArray *filenames = nil;
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    [moc performBlockAndWait:^{
+        if (![self reconcileEventFileLedger]) return;
+        filenames = [CDEEventFileRecord preferredFilenamesForEventTypes:types persistentStoreIdentifier:persistentStoreId missingFromFilenames:remoteSet inManagedObjectContext:moc];
+        [self saveEventFileLedger];
+    }];
+    
+    return [self sortFilenamesByGlobalCount:filenames];
 }
 
 - (NSArray *)sortFilenamesByGlobalCount:(NSArray *)filenames
@@ -487,22 +1095,162 @@
     return sortedResult;
 }
 
-- (NSSet *)eventFilesForEventsWithAllowedTypes:(NSArray *)types createdInStore:(NSString *)persistentStoreIdentifier
+- (NSSet *)eventFilenamesForEventsWithAllowedTypes:(NSArray *)types createdInStore:(NSString *)persistentStoreIdentifier
 {
+    __block NSSet *filenames = nil;
     NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
-    __block NSMutableSet *eventFiles = [NSMutableSet set];
     [moc performBlockAndWait:^{
-        NSArray *events = [CDEStoreModificationEvent fetchStoreModificationEventsWithTypes:types persistentStoreIdentifier:persistentStoreIdentifier inManagedObjectContext:moc];
-        if (!events) {
-            CDELog(CDELoggingLevelError, @"Could not retrieve local events");
-        }
+        if (![self reconcileEventFileLedger]) return;
+        filenames = [CDEEventFileRecord filenamesForEventTypes:types persistentStoreIdentifier:persistentStoreIdentifier inManagedObjectContext:moc];
+    }];
+    return filenames ? : [NSSet set];
+}
 
-        for (CDEStoreModificationEvent *event in events) {
-            CDEEventFile *eventFile = [[CDEEventFile alloc] initWithStoreModificationEvent:event];
-            [eventFiles addObject:eventFile];
-        }
+
+#pragma mark Event File Ledger
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context
+{
+    if (context == (__bridge void *)kCDEEventStoreContextObservationContext) {
+        [self observeSavesOfContext:eventStore.managedObjectContext];
+    }
+    else {
+        [super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+    }
+}
+
+// The event store replaces its context when the store is removed and prepared again, so the observation follows it
+- (void)observeSavesOfContext:(NSManagedObjectContext *)context
+{
+    @synchronized (self) {
+        if (context == observedContext) return;
+        NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+        if (observedContext) [center removeObserver:self name:NSManagedObjectContextWillSaveNotification object:observedContext];
+        observedContext = context;
+        if (observedContext) [center addObserver:self selector:@selector(managedObjectContextWillSave:) name:NSManagedObjectContextWillSaveNotification object:observedContext];
+    }
+}
+
+- (void)managedObjectContextWillSave:(NSNotification *)notif
+{
+    NSManagedObjectContext *context = notif.object;
+    [CDEEventFileRecord updateRecordsForChangesInManagedObjectContext:context localPersistentStoreIdentifier:self.eventStore.persistentStoreIdentifier];
+}
+
+// Call on the event store context queue. Records are added for events that predate the ledger the first time.
+- (BOOL)reconcileEventFileLedger
+{
+    if (eventFileLedgerReconciled) return YES;
+    
+    NSError *error = nil;
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    BOOL success = [CDEEventFileRecord updateRecordsForAllEventsInManagedObjectContext:moc localPersistentStoreIdentifier:self.eventStore.persistentStoreIdentifier error:&error];
+    if (!success) {
+        CDELog(CDELoggingLevelError, @"Could not update event file ledger: %@", error);
+        return NO;
+    }
+    
+    eventFileLedgerReconciled = [self saveEventFileLedger];
+    return eventFileLedgerReconciled;
+}
+
+// Call on the event store context queue
+- (BOOL)saveEventFileLedger
+{
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    if (!moc.hasChanges) return YES;
+    
+    NSError *error = nil;
+    BOOL success = [moc save:&error];
+    if (!success) CDELog(CDELoggingLevelError, @"Could not save event file ledger: %@", error);
+    return success;
+}
+
+- (void)markEventFilesExported:(NSArray *)filenames
+{
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    [moc performBlockAndWait:^{
+        [CDEEventFileRecord markFilenames:filenames exportedInManagedObjectContext:moc];
+        [self saveEventFileLedger];
     }];
-    return eventFiles;
+}
+
+
+#pragma mark Baseline Segments
+
+- (void)recordBaselineSegmentFilenames:(NSArray *)segments forBaselineFilename:(NSString *)filename
+{
+    NSMutableDictionary *state = [[NSDictionary dictionaryWithContentsOfFile:self.localBaselineSegmentsStatePath] mutableCopy] ? : [NSMutableDictionary dictionary];
+    NSMutableDictionary *segmentsByBaseline = [state[kCDEBaselineSegmentsStateBaselinesKey] mutableCopy] ? : [NSMutableDictionary dictionary];
+    segmentsByBaseline[filename] = segments;
+    state[kCDEBaselineSegmentsStateBaselinesKey] = segmentsByBaseline;
+    if (![state writeToFile:self.localBaselineSegmentsStatePath atomically:YES]) {
+        CDELog(CDELoggingLevelWarning, @"Could not save baseline segments state");
+    }
+}
+
+- (NSSet *)baselineSegmentsReferencedByBaselines:(NSSet *)baselineFilenames
+{
+    NSDictionary *state = [NSDictionary dictionaryWithContentsOfFile:self.localBaselineSegmentsStatePath];
+    NSDictionary *segmentsByBaseline = state[kCDEBaselineSegmentsStateBaselinesKey];
+    NSMutableSet *referencedSegments = [[NSMutableSet alloc] init];
+    for (NSString *filename in baselineFilenames) {
+        NSArray *segments = segmentsByBaseline[filename];
+        if (segments) [referencedSegments addObjectsFromArray:segments];
+    }
+    return referencedSegments;
+}
+
+// Segments are only attributed when the segments of every retained baseline are known.
+// A baseline uploaded as a single file, or imported before segments were recorded, leaves them all in place.
+- (NSSet *)baselineSegmentsToRemoveRetainingBaselines:(NSSet *)retainedBaselineFilenames
+{
+    if (snapshotBaselineSegmentFilenames.count == 0) return [NSSet set];
+    
+    NSMutableDictionary *state = [[NSDictionary dictionaryWithContentsOfFile:self.localBaselineSegmentsStatePath] mutableCopy] ? : [NSMutableDictionary dictionary];
+    NSMutableDictionary *segmentsByBaseline = [state[kCDEBaselineSegmentsStateBaselinesKey] mutableCopy] ? : [NSMutableDictionary dictionary];
+    for (NSString *filename in segmentsByBaseline.allKeys) {
+        if (![retainedBaselineFilenames containsObject:filename]) [segmentsByBaseline removeObjectForKey:filename];
+    }
+    
+    NSMutableSet *referencedSegments = [[NSMutableSet alloc] init];
+    BOOL allBaselinesKnown = YES;
+    for (NSString *filename in retainedBaselineFilenames) {
+        NSArray *segments = segmentsByBaseline[filename];
+        if (!segments) {
+            allBaselinesKnown = NO;
+            break;
+        }
+        [referencedSegments addObjectsFromArray:segments];
+    }
+    
+    NSMutableSet *segmentsToRemove = [[NSMutableSet alloc] init];
+    NSMutableDictionary *unreferencedDates = [state[kCDEBaselineSegmentsStateUnreferencedKey] mutableCopy] ? : [NSMutableDictionary dictionary];
+    if (allBaselinesKnown) {
+        NSMutableSet *unreferencedSegments = [snapshotBaselineSegmentFilenames mutableCopy];
+        [unreferencedSegments minusSet:referencedSegments];
+        
+        NSDate *now = [NSDate date];
+        for (NSString *segment in unreferencedSegments) {
+            NSDate *firstUnreferenced = unreferencedDates[segment];
+            if (!firstUnreferenced)
+                unreferencedDates[segment] = now;
+            else if ([now timeIntervalSinceDate:firstUnreferenced] > CDEMinimumAgeOfUnreferencedBaselineSegment)
+                [segmentsToRemove addObject:segment];
+        }
+        
+        for (NSString *segment in unreferencedDates.allKeys) {
+            if (![unreferencedSegments containsObject:segment] || [segmentsToRemove containsObject:segment]) [unreferencedDates removeObjectForKey:segment];
+        }
+    }
+    
+    state[kCDEBaselineSegmentsStateBaselinesKey] = segmentsByBaseline;
+    state[kCDEBaselineSegmentsStateUnreferencedKey] = unreferencedDates;
+    if (![state writeToFile:self.localBaselineSegmentsStatePath atomically:YES]) {
+        CDELog(CDELoggingLevelWarning, @"Could not save baseline segments state");
+    }
+    
+    return segmentsToRemove;
 }
 
 
@@ -523,12 +1271,27 @@
     return [self.localEnsembleDirectory stringByAppendingPathComponent:@"download"];
 }
 
+- (NSString *)localBaselineSegmentsDirectory
+{
+    return [self.localEnsembleDirectory stringByAppendingPathComponent:@"segments"];
+}
+
+- (NSString *)localManifestStatePath
+{
+    return [self.localEnsembleDirectory stringByAppendingPathComponent:kCDEManifestStateFilename];
+}
+
+- (NSString *)localBaselineSegmentsStatePath
+{
+    return [self.localEnsembleDirectory stringByAppendingPathComponent:kCDEBaselineSegmentsStateFilename];
+}
+
 
 #pragma mark Local Directory Structure
 
 - (void)createTransitCacheDirectories
 {
-    NSArray *dirs = @[localFileRoot, self.localDownloadDirectory, self.localUploadDirectory];
+    NSArray *dirs = @[localFileRoot, self.localDownloadDirectory, self.localUploadDirectory, self.localBaselineSegmentsDirectory];
     for (NSString *dir in dirs) {
         [fileManager createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:NULL];
     }
@@ -579,12 +1342,12 @@
 // Requires a snapshot already exist
 - (void)removeOutdatedRemoteFilesWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"removeOutdatedRemoteFilesWithCompletion... called off the main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"removeOutdatedRemoteFilesWithCompletion... called off the work queue");
     
     CDELog(CDELoggingLevelVerbose, @"Removing outdated files");
     
     if (!snapshotBaselineFilenames || !snapshotEventFilenames) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeMissingCloudSnapshot userInfo:nil];
             if (completion) completion(error);
         });
@@ -597,17 +1360,21 @@
     
     // Determine baselines to remove
     NSMutableSet *baselinesToRemove = [snapshotBaselineFilenames mutableCopy];
-    NSSet *baselineEventFilesForStore = [self eventFilesForEventsWithAllowedTypes:baselineTypes createdInStore:nil];
-    NSSet *baselineAliasesForStore = [baselineEventFilesForStore valueForKeyPath:@"@distinctUnionOfSets.aliases"];
+    NSSet *baselineAliasesForStore = [self eventFilenamesForEventsWithAllowedTypes:baselineTypes createdInStore:nil];
     [baselinesToRemove minusSet:baselineAliasesForStore];
     CDELog(CDELoggingLevelVerbose, @"Baseline files in cloud: %@", snapshotBaselineFilenames);
     CDELog(CDELoggingLevelVerbose, @"Aliases for baseline files in store: %@", baselineAliasesForStore);
     CDELog(CDELoggingLevelVerbose, @"Baseline files to remove: %@", baselinesToRemove);
     
+    // Determine baseline segments to remove
+    NSMutableSet *retainedBaselines = [snapshotBaselineFilenames mutableCopy];
+    [retainedBaselines minusSet:baselinesToRemove];
+    NSSet *baselineSegmentsToRemove = [self baselineSegmentsToRemoveRetainingBaselines:retainedBaselines];
+    CDELog(CDELoggingLevelVerbose, @"Baseline segments to remove: %@", baselineSegmentsToRemove);
+    
     // Determine non-baselines to remove
     NSMutableSet *nonBaselinesToRemove = [snapshotEventFilenames mutableCopy];
-    NSSet *nonBaselineEventFilesForStore = [self eventFilesForEventsWithAllowedTypes:nonBaselineTypes createdInStore:nil];
-    NSSet *nonBaselineAliasesForStore = [nonBaselineEventFilesForStore valueForKeyPath:@"@distinctUnionOfSets.aliases"];
+    NSSet *nonBaselineAliasesForStore = [self eventFilenamesForEventsWithAllowedTypes:nonBaselineTypes createdInStore:nil];
     [nonBaselinesToRemove minusSet:nonBaselineAliasesForStore];
     CDELog(CDELoggingLevelVerbose, @"Event files in cloud: %@", snapshotEventFilenames);
     CDELog(CDELoggingLevelVerbose, @"Aliases for event files in store: %@", nonBaselineAliasesForStore);
@@ -626,6 +1393,9 @@
     [baselinesToRemove enumerateObjectsUsingBlock:^(NSString *file, BOOL *stop) {
         [pathsToRemove addObject:[self.remoteBaselinesDirectory stringByAppendingPathComponent:file]];
     }];
+    [baselineSegmentsToRemove enumerateObjectsUsingBlock:^(NSString *file, BOOL *stop) {
+        [pathsToRemove addObject:[self.remoteBaselineSegmentsDirectory stringByAppendingPathComponent:file]];
+    }];
     [nonBaselinesToRemove enumerateObjectsUsingBlock:^(NSString *file, BOOL *stop) {
         [pathsToRemove addObject:[self.remoteEventsDirectory stringByAppendingPathComponent:file]];
     }];
@@ -634,16 +1404,39 @@
     }];
     CDELog(CDELoggingLevelVerbose, @"Removing cloud files: %@", [pathsToRemove componentsJoinedByString:@"\n"]);
     
+    // Records of removed events are only needed while their files remain in the cloud
+    NSMutableSet *remainingEventFilenames = [snapshotBaselineFilenames mutableCopy];
+    [remainingEventFilenames unionSet:snapshotEventFilenames];
+    [remainingEventFilenames minusSet:baselinesToRemove];
+    [remainingEventFilenames minusSet:nonBaselinesToRemove];
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    [moc performBlockAndWait:^{
+        [CDEEventFileRecord deleteRecordsOfRemovedEventsExcludingFilenames:remainingEventFilenames inManagedObjectContext:moc];
+        [self saveEventFileLedger];
+    }];
+    
+    if (pathsToRemove.count > 0) [self registerRemoteFilesModified];
+    
     // Queue up tasks
     NSMutableArray *tasks = [[NSMutableArray alloc] initWithCapacity:pathsToRemove.count];
-    for (NSString *path in pathsToRemove) {
+    if (pathsToRemove.count > 0 && [self.cloudFileSystem respondsToSelector:@selector(removeItemsAtPaths:completion:)]) {
         CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
-            [self.cloudFileSystem removeItemAtPath:path completion:^(NSError *error) {
+            [self.cloudFileSystem removeItemsAtPaths:pathsToRemove completion:^(NSError *error) {
                 next(error, NO);
             }];
         };
         [tasks addObject:block];
     }
+    else {
+        for (NSString *path in pathsToRemove) {
+            CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+                [self.cloudFileSystem removeItemAtPath:path completion:^(NSError *error) {
+                    next(error, NO);
+                }];
+            };
+            [tasks addObject:block];
+        }
+    }
     
     CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyCompleteAll completion:completion];
     [operationQueue addOperation:taskQueue];
@@ -672,25 +1465,40 @@
     return [self.remoteEnsembleDirectory stringByAppendingPathComponent:@"baselines"];
 }
 
+- (NSString *)remoteBaselineSegmentsDirectory
+{
+    return [self.remoteEnsembleDirectory stringByAppendingPathComponent:@"baselinesegments"];
+}
+
 - (NSString *)remoteDataDirectory
 {
     return [self.remoteEnsembleDirectory stringByAppendingPathComponent:@"data"];
 }
 
+- (NSString *)remoteManifestPath
+{
+    return [self.remoteEnsembleDirectory stringByAppendingPathComponent:kCDEManifestFilename];
+}
+
 - (void)createRemoteDirectoryStructureWithCompletion:(CDECompletionBlock)completion
 {
-    NSArray *dirs = @[self.remoteEnsembleDirectory, self.remoteStoresDirectory, self.remoteEventsDirectory, self.remoteBaselinesDirectory, self.remoteDataDirectory];
+    NSArray *dirs = @[self.remoteEnsembleDirectory, self.remoteStoresDirectory, self.remoteEventsDirectory, self.remoteBaselinesDirectory, self.remoteBaselineSegmentsDirectory, self.remoteDataDirectory];
     [self createRemoteDirectories:dirs withCompletion:completion];
 }
 
 - (void)createRemoteDirectories:(NSArray *)paths withCompletion:(CDECompletionBlock)completion
 {
     CDELog(CDELoggingLevelVerbose, @"Creating remote directories");
+    
+    if ([self.cloudFileSystem respondsToSelector:@selector(fileExistsAtPaths:completion:)]) {
+        [self createRemoteDirectoriesUsingBatchExistenceCheck:paths withCompletion:completion];
+        return;
+    }
 
     NSMutableArray *taskBlocks = [NSMutableArray array];
     for (NSString *path in paths) {
         CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 [self.cloudFileSystem fileExistsAtPath:path completion:^(BOOL exists, BOOL isDirectory, NSError *error) {
                     if (error) {
                         next(error, NO);
@@ -716,6 +1524,40 @@
     [operationQueue addOperation:taskQueue];
 }
 
+- (void)createRemoteDirectoriesUsingBatchExistenceCheck:(NSArray *)paths withCompletion:(CDECompletionBlock)completion
+{
+    NSMutableArray *taskBlocks = [NSMutableArray array];
+    
+    __block NSArray *existences = nil;
+    CDEAsynchronousTaskBlock existenceBlock = ^(CDEAsynchronousTaskCallbackBlock next) {
+        dispatch_async(CDEWorkQueue(), ^{
+            [self.cloudFileSystem fileExistsAtPaths:paths completion:^(NSArray *results, NSArray *directories, NSError *error) {
+                existences = results;
+                BOOL allExist = ![results containsObject:@NO];
+                next(error, allExist);
+            }];
+        });
+    };
+    [taskBlocks addObject:existenceBlock];
+    
+    // Create in the order given, so parents precede children
+    [paths enumerateObjectsUsingBlock:^(NSString *path, NSUInteger index, BOOL *stop) {
+        CDEAsynchronousTaskBlock block = ^(CDEAsynchronousTaskCallbackBlock next) {
+            if ([existences[index] boolValue]) {
+                next(nil, NO);
+                return;
+            }
+            [self.cloudFileSystem createDirectoryAtPath:path completion:^(NSError *error) {
+                next(error, NO);
+            }];
+        };
+        [taskBlocks addObject:block];
+    }];
+    
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:taskBlocks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:completion];
+    [operationQueue addOperation:taskQueue];
+}
+
 
 #pragma mark Store Registration Info
 
@@ -733,7 +1575,7 @@
     
     NSString *remotePath = [self.remoteStoresDirectory stringByAppendingPathComponent:identifier];
     NSString *localPath = [self.localDownloadDirectory stringByAppendingPathComponent:identifier];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         [self.cloudFileSystem fileExistsAtPath:remotePath completion:^(BOOL exists, BOOL isDirectory, NSError *error) {
             if (error || !exists) {
                 if (completion) completion(nil, error);
@@ -773,7 +1615,7 @@
     }
 
     NSString *remotePath = [self.remoteStoresDirectory stringByAppendingPathComponent:identifier];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         [self.cloudFileSystem uploadLocalFile:localPath toPath:remotePath completion:^(NSError *error) {
             [self->fileManager removeItemAtPath:localPath error:NULL];
             if (completion) completion(error);
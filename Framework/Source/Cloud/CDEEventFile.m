@@ -99,7 +99,7 @@
 {
     NSString *result = nil;
     if (baseline) {
-        NSString *storeSubstring = [persistentStoreIdentifier substringToIndex:8];
+        NSString *storeSubstring = [persistentStoreIdentifier substringToIndex:MIN(8, persistentStoreIdentifier.length)];
         result = [NSString stringWithFormat:@"%lli_%@_%@.cdeevent", globalCount, uniqueIdentifier, storeSubstring];
     }
     else {
@@ -112,7 +112,7 @@
 {
     NSSet *result = nil;
     if (baseline) {
-        NSString *storeSubstring = [persistentStoreIdentifier substringToIndex:8];
+        NSString *storeSubstring = [persistentStoreIdentifier substringToIndex:MIN(8, persistentStoreIdentifier.length)];
         NSString *s1 = [NSString stringWithFormat:@"%lli_%@_%@.cdeevent", globalCount, uniqueIdentifier, storeSubstring];
         NSString *s2 = [NSString stringWithFormat:@"%lli_%@.cdeevent", globalCount, uniqueIdentifier];
         result = [NSSet setWithObjects:s1, s2, nil];
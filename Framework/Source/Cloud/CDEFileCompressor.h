@@ -0,0 +1,27 @@
+//
+//  CDEFileCompressor.h
+//  Ensembles
+//
+//  Compresses files in the transit cache before upload, and restores them after download.
+//  Compressed files begin with a small header recording the codec and original length.
+//  Files without the header are left untouched, so older devices' uploads still import.
+//
+//  Created by Drew McCormack on 22/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "CDEDefines.h"
+
+@interface CDEFileCompressor : NSObject
+
++ (BOOL)isCompressedFileAtPath:(NSString *)path;
+
++ (BOOL)compressFileAtPath:(NSString *)fromPath toPath:(NSString *)toPath codec:(CDECompressionCodec)codec error:(NSError * __autoreleasing *)error;
++ (BOOL)decompressFileAtPath:(NSString *)fromPath toPath:(NSString *)toPath error:(NSError * __autoreleasing *)error;
+
+// In place. Compressing skips files already compressed; decompressing skips files that are not.
++ (BOOL)compressFileInPlaceAtPath:(NSString *)path codec:(CDECompressionCodec)codec error:(NSError * __autoreleasing *)error;
++ (BOOL)decompressFileInPlaceAtPath:(NSString *)path error:(NSError * __autoreleasing *)error;
+
+@end
@@ -0,0 +1,253 @@
+//
+//  CDEFileCompressor.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 22/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEFileCompressor.h"
+#import <zlib.h>
+
+static const uint8_t CDECompressedFileMagic[6] = {'C', 'D', 'E', 'C', 'M', 'P'};
+static const uint8_t CDECompressedFileVersion = 1;
+static const NSUInteger CDECompressedFileHeaderLength = 16;
+static const NSUInteger CDECompressionBufferLength = 64 * 1024;
+
+typedef struct {
+    uint8_t magic[6];
+    uint8_t version;
+    uint8_t codec;
+    uint64_t originalLength;
+} CDECompressedFileHeader;
+
+
+@implementation CDEFileCompressor
+
+#pragma mark Header
+
++ (BOOL)readHeader:(CDECompressedFileHeader *)header fromStream:(NSInputStream *)stream
+{
+    uint8_t bytes[CDECompressedFileHeaderLength];
+    NSUInteger total = 0;
+    while (total < CDECompressedFileHeaderLength) {
+        NSInteger result = [stream read:bytes + total maxLength:CDECompressedFileHeaderLength - total];
+        if (result <= 0) return NO;
+        total += result;
+    }
+
+    memcpy(header->magic, bytes, 6);
+    header->version = bytes[6];
+    header->codec = bytes[7];
+    uint64_t length;
+    memcpy(&length, bytes + 8, 8);
+    header->originalLength = CFSwapInt64BigToHost(length);
+
+    if (memcmp(header->magic, CDECompressedFileMagic, 6) != 0) return NO;
+    if (header->version != CDECompressedFileVersion) return NO;
+    return header->codec == CDECompressionCodecZlib || header->codec == CDECompressionCodecZlibFast;
+}
+
++ (BOOL)writeHeaderWithCodec:(CDECompressionCodec)codec originalLength:(uint64_t)originalLength toStream:(NSOutputStream *)stream
+{
+    uint8_t bytes[CDECompressedFileHeaderLength];
+    memcpy(bytes, CDECompressedFileMagic, 6);
+    bytes[6] = CDECompressedFileVersion;
+    bytes[7] = codec;
+    uint64_t length = CFSwapInt64HostToBig(originalLength);
+    memcpy(bytes + 8, &length, 8);
+    return [self writeBytes:bytes length:CDECompressedFileHeaderLength toStream:stream];
+}
+
++ (BOOL)writeBytes:(const uint8_t *)bytes length:(NSUInteger)length toStream:(NSOutputStream *)stream
+{
+    NSUInteger written = 0;
+    while (written < length) {
+        NSInteger result = [stream write:bytes + written maxLength:length - written];
+        if (result <= 0) return NO;
+        written += result;
+    }
+    return YES;
+}
+
++ (BOOL)isCompressedFileAtPath:(NSString *)path
+{
+    NSInputStream *stream = [NSInputStream inputStreamWithFileAtPath:path];
+    [stream open];
+    CDECompressedFileHeader header;
+    BOOL result = [self readHeader:&header fromStream:stream];
+    [stream close];
+    return result;
+}
+
+
+#pragma mark Compressing
+
++ (BOOL)compressFileAtPath:(NSString *)fromPath toPath:(NSString *)toPath codec:(CDECompressionCodec)codec error:(NSError * __autoreleasing *)error
+{
+    if (codec == CDECompressionCodecNone) {
+        return [[NSFileManager defaultManager] copyItemAtPath:fromPath toPath:toPath error:error];
+    }
+
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:fromPath error:error];
+    if (!attributes) return NO;
+    uint64_t originalLength = attributes.fileSize;
+
+    NSInputStream *inputStream = [NSInputStream inputStreamWithFileAtPath:fromPath];
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:toPath append:NO];
+    [inputStream open];
+    [outputStream open];
+
+    int level = codec == CDECompressionCodecZlibFast ? Z_BEST_SPEED : Z_DEFAULT_COMPRESSION;
+    z_stream zStream;
+    memset(&zStream, 0, sizeof(zStream));
+    BOOL success = deflateInit(&zStream, level) == Z_OK;
+    BOOL zStreamInitialized = success;
+
+    success = success && [self writeHeaderWithCodec:codec originalLength:originalLength toStream:outputStream];
+
+    uint8_t *inBuffer = malloc(CDECompressionBufferLength);
+    uint8_t *outBuffer = malloc(CDECompressionBufferLength);
+    int status = Z_OK;
+    while (success && status != Z_STREAM_END) {
+        NSInteger bytesRead = [inputStream read:inBuffer maxLength:CDECompressionBufferLength];
+        if (bytesRead < 0) {
+            success = NO;
+            break;
+        }
+
+        int flush = bytesRead == 0 ? Z_FINISH : Z_NO_FLUSH;
+        zStream.next_in = inBuffer;
+        zStream.avail_in = (uInt)bytesRead;
+        do {
+            zStream.next_out = outBuffer;
+            zStream.avail_out = (uInt)CDECompressionBufferLength;
+            status = deflate(&zStream, flush);
+            if (status == Z_STREAM_ERROR) {
+                success = NO;
+                break;
+            }
+            NSUInteger produced = CDECompressionBufferLength - zStream.avail_out;
+            success = [self writeBytes:outBuffer length:produced toStream:outputStream];
+        } while (success && zStream.avail_out == 0);
+    }
+
+    free(inBuffer);
+    free(outBuffer);
+    if (zStreamInitialized) deflateEnd(&zStream);
+    [inputStream close];
+    [outputStream close];
+
+    if (!success) {
+        [[NSFileManager defaultManager] removeItemAtPath:toPath error:NULL];
+        NSMutableDictionary *userInfo = [@{NSLocalizedDescriptionKey : @"Failed to compress file"} mutableCopy];
+        NSError *streamError = inputStream.streamError ? : outputStream.streamError;
+        if (streamError) userInfo[NSUnderlyingErrorKey] = streamError;
+        if (error) *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeFileAccessFailed userInfo:userInfo];
+        return NO;
+    }
+
+    return YES;
+}
+
++ (BOOL)compressFileInPlaceAtPath:(NSString *)path codec:(CDECompressionCodec)codec error:(NSError * __autoreleasing *)error
+{
+    if (codec == CDECompressionCodecNone || [self isCompressedFileAtPath:path]) return YES;
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSString *tempPath = [path stringByAppendingPathExtension:@"cdecompress"];
+    [fileManager removeItemAtPath:tempPath error:NULL];
+    if (![self compressFileAtPath:path toPath:tempPath codec:codec error:error]) return NO;
+
+    // Incompressible files, like images, are left as they are
+    unsigned long long originalSize = [[fileManager attributesOfItemAtPath:path error:NULL] fileSize];
+    unsigned long long compressedSize = [[fileManager attributesOfItemAtPath:tempPath error:NULL] fileSize];
+    if (compressedSize >= originalSize) {
+        [fileManager removeItemAtPath:tempPath error:NULL];
+        return YES;
+    }
+
+    if (![fileManager removeItemAtPath:path error:error]) return NO;
+    return [fileManager moveItemAtPath:tempPath toPath:path error:error];
+}
+
+
+#pragma mark Decompressing
+
++ (BOOL)decompressFileAtPath:(NSString *)fromPath toPath:(NSString *)toPath error:(NSError * __autoreleasing *)error
+{
+    NSInputStream *inputStream = [NSInputStream inputStreamWithFileAtPath:fromPath];
+    [inputStream open];
+
+    CDECompressedFileHeader header;
+    if (![self readHeader:&header fromStream:inputStream]) {
+        [inputStream close];
+        if (error) *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeDataCorruptionDetected userInfo:@{NSLocalizedDescriptionKey : @"File is not compressed, or uses an unknown codec"}];
+        return NO;
+    }
+
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:toPath append:NO];
+    [outputStream open];
+
+    z_stream zStream;
+    memset(&zStream, 0, sizeof(zStream));
+    BOOL success = inflateInit(&zStream) == Z_OK;
+    BOOL zStreamInitialized = success;
+
+    uint8_t *inBuffer = malloc(CDECompressionBufferLength);
+    uint8_t *outBuffer = malloc(CDECompressionBufferLength);
+    int status = Z_OK;
+    while (success && status != Z_STREAM_END) {
+        NSInteger bytesRead = [inputStream read:inBuffer maxLength:CDECompressionBufferLength];
+        if (bytesRead <= 0) {
+            // Truncated stream, or a read error
+            success = NO;
+            break;
+        }
+
+        zStream.next_in = inBuffer;
+        zStream.avail_in = (uInt)bytesRead;
+        do {
+            zStream.next_out = outBuffer;
+            zStream.avail_out = (uInt)CDECompressionBufferLength;
+            status = inflate(&zStream, Z_NO_FLUSH);
+            if (status == Z_BUF_ERROR) break; // Needs more input
+            if (status != Z_OK && status != Z_STREAM_END) {
+                success = NO;
+                break;
+            }
+            NSUInteger produced = CDECompressionBufferLength - zStream.avail_out;
+            success = [self writeBytes:outBuffer length:produced toStream:outputStream];
+        } while (success && zStream.avail_out == 0 && status != Z_STREAM_END);
+    }
+
+    success = success && zStream.total_out == header.originalLength;
+    free(inBuffer);
+    free(outBuffer);
+    if (zStreamInitialized) inflateEnd(&zStream);
+    [inputStream close];
+    [outputStream close];
+
+    if (!success) {
+        [[NSFileManager defaultManager] removeItemAtPath:toPath error:NULL];
+        if (error) *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeDataCorruptionDetected userInfo:@{NSLocalizedDescriptionKey : @"Failed to decompress file"}];
+        return NO;
+    }
+
+    return YES;
+}
+
++ (BOOL)decompressFileInPlaceAtPath:(NSString *)path error:(NSError * __autoreleasing *)error
+{
+    if (![self isCompressedFileAtPath:path]) return YES;
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSString *tempPath = [path stringByAppendingPathExtension:@"cdedecompress"];
+    [fileManager removeItemAtPath:tempPath error:NULL];
+    if (![self decompressFileAtPath:path toPath:tempPath error:error]) return NO;
+
+    if (![fileManager removeItemAtPath:path error:error]) return NO;
+    return [fileManager moveItemAtPath:tempPath toPath:path error:error];
+}
+
+@end
@@ -0,0 +1,48 @@
+//
+//  CDEMergeScheduler.h
+//  Ensembles
+//
+//  Decides when an ensemble merges. Requests that arrive close together are coalesced into one
+//  merge, and the merge waits for a quiet period so a burst of saves is not merged piecemeal.
+//  Failed merges back off exponentially. When merging automatically, the scheduler also polls,
+//  backing off while merges find nothing new in the cloud.
+//
+//  Created by Drew McCormack on 26/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "CDEDefines.h"
+
+typedef void (^CDEMergeSchedulerMergeCallback)(NSError *error, BOOL foundRemoteChanges);
+typedef void (^CDEMergeSchedulerMergeBlock)(CDEMergeSchedulerMergeCallback callback);
+
+@interface CDEMergeScheduler : NSObject
+
+@property (nonatomic, copy, readonly) CDEMergeSchedulerMergeBlock mergeBlock;
+
+@property (nonatomic, assign, readwrite) BOOL mergesAutomatically; // Merge after local saves and remote changes, and poll. Default NO.
+
+@property (nonatomic, assign, readwrite) NSTimeInterval debounceInterval; // Quiet period before merging. Default 2s.
+@property (nonatomic, assign, readwrite) NSTimeInterval maximumLatency; // Longest a request waits for quiet. Default 30s.
+@property (nonatomic, assign, readwrite) NSUInteger localChangeThreshold; // Changed objects that trigger a merge without waiting. Default 1000.
+@property (nonatomic, assign, readwrite) NSTimeInterval failureRetryBaseDelay; // Default 10s
+@property (nonatomic, assign, readwrite) NSTimeInterval minimumPollInterval; // Default 60s
+@property (nonatomic, assign, readwrite) NSTimeInterval maximumPollInterval; // Default 15 min
+
+@property (nonatomic, assign, readonly) NSUInteger consecutiveFailureCount;
+@property (nonatomic, assign, readonly) NSTimeInterval currentPollInterval;
+@property (nonatomic, strong, readonly) NSDate *scheduledMergeDate; // Nil when no merge is scheduled
+@property (nonatomic, assign, readonly, getter = isMerging) BOOL merging;
+
+// Call all methods on the work queue
+- (instancetype)initWithMergeBlock:(CDEMergeSchedulerMergeBlock)block;
+
+- (void)mergeSoonWithCompletion:(CDECompletionBlock)completion;
+
+- (void)registerLocalSaveWithChangedObjectCount:(NSUInteger)count; // Ignored unless merging automatically
+- (void)registerRemoteChanges; // Ignored unless merging automatically
+
+- (void)invalidate; // Cancels the scheduled merge, and stops polling
+
+@end
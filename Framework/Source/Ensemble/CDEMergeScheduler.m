@@ -0,0 +1,245 @@
+//
+//  CDEMergeScheduler.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 26/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEMergeScheduler.h"
+#import "CDEAsynchronousOperation.h"
+
+static const NSTimeInterval CDEDefaultDebounceInterval = 2.0;
+static const NSTimeInterval CDEDefaultMaximumLatency = 30.0;
+static const NSUInteger CDEDefaultLocalChangeThreshold = 1000;
+static const NSTimeInterval CDEDefaultFailureRetryBaseDelay = 10.0;
+static const NSTimeInterval CDEDefaultMinimumPollInterval = 60.0;
+static const NSTimeInterval CDEDefaultMaximumPollInterval = 900.0;
+
+@implementation CDEMergeScheduler {
+    NSMutableArray *pendingCompletions;
+    NSDate *firstRequestDate;
+    NSDate *retryDate;
+    NSUInteger pendingChangeCount;
+    NSUInteger scheduleGeneration;
+    BOOL requestedDuringMerge;
+    BOOL invalidated;
+}
+
+@synthesize mergeBlock = mergeBlock;
+@synthesize mergesAutomatically = mergesAutomatically;
+@synthesize debounceInterval = debounceInterval;
+@synthesize maximumLatency = maximumLatency;
+@synthesize localChangeThreshold = localChangeThreshold;
+@synthesize failureRetryBaseDelay = failureRetryBaseDelay;
+@synthesize minimumPollInterval = minimumPollInterval;
+@synthesize maximumPollInterval = maximumPollInterval;
+@synthesize consecutiveFailureCount = consecutiveFailureCount;
+@synthesize currentPollInterval = currentPollInterval;
+@synthesize scheduledMergeDate = scheduledMergeDate;
+@synthesize merging = merging;
+
+- (instancetype)initWithMergeBlock:(CDEMergeSchedulerMergeBlock)block
+{
+    NSParameterAssert(block != nil);
+    self = [super init];
+    if (self) {
+        mergeBlock = [block copy];
+        pendingCompletions = [[NSMutableArray alloc] init];
+        debounceInterval = CDEDefaultDebounceInterval;
+        maximumLatency = CDEDefaultMaximumLatency;
+        localChangeThreshold = CDEDefaultLocalChangeThreshold;
+        failureRetryBaseDelay = CDEDefaultFailureRetryBaseDelay;
+        minimumPollInterval = CDEDefaultMinimumPollInterval;
+        maximumPollInterval = CDEDefaultMaximumPollInterval;
+        currentPollInterval = minimumPollInterval;
+    }
+    return self;
+}
+
+- (void)setMinimumPollInterval:(NSTimeInterval)interval
+{
+    minimumPollInterval = interval;
+    currentPollInterval = interval;
+}
+
+- (void)setMergesAutomatically:(BOOL)yn
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Merge scheduler used off the work queue");
+    if (mergesAutomatically == yn) return;
+    mergesAutomatically = yn;
+
+    if (mergesAutomatically) {
+        [self schedulePoll];
+    }
+    else if (pendingCompletions.count == 0 && !firstRequestDate) {
+        [self cancelScheduledMerge];
+    }
+}
+
+
+#pragma mark Requests
+
+- (void)mergeSoonWithCompletion:(CDECompletionBlock)completion
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Merge scheduler used off the work queue");
+
+    if (invalidated) {
+        NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeCancelled userInfo:nil];
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(error);
+        });
+        return;
+    }
+
+    if (completion) [pendingCompletions addObject:[completion copy]];
+    [self requestMergeWithDebounceInterval:debounceInterval];
+}
+
+- (void)registerLocalSaveWithChangedObjectCount:(NSUInteger)count
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Merge scheduler used off the work queue");
+    if (!mergesAutomatically || invalidated) return;
+
+    // A large volume of changes is worth sending without waiting for the saves to stop
+    pendingChangeCount += count;
+    NSTimeInterval delay = pendingChangeCount >= localChangeThreshold ? 0.0 : debounceInterval;
+    [self requestMergeWithDebounceInterval:delay];
+}
+
+- (void)registerRemoteChanges
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Merge scheduler used off the work queue");
+    if (!mergesAutomatically || invalidated) return;
+
+    currentPollInterval = minimumPollInterval;
+    [self requestMergeWithDebounceInterval:debounceInterval];
+}
+
+- (void)requestMergeWithDebounceInterval:(NSTimeInterval)delay
+{
+    // Back-to-back requests are served by one more merge once the current one finishes
+    if (merging) {
+        requestedDuringMerge = YES;
+        return;
+    }
+
+    NSDate *now = [NSDate date];
+    if (!firstRequestDate) firstRequestDate = now;
+
+    // Each request postpones the merge, up to the maximum latency, but never before a retry is due
+    NSDate *date = [now dateByAddingTimeInterval:delay];
+    date = [date earlierDate:[firstRequestDate dateByAddingTimeInterval:maximumLatency]];
+    if (retryDate) date = [date laterDate:retryDate];
+
+    [self scheduleMergeAtDate:date];
+}
+
+
+#pragma mark Scheduling
+
+- (void)scheduleMergeAtDate:(NSDate *)date
+{
+    scheduledMergeDate = date;
+    NSUInteger generation = ++scheduleGeneration;
+
+    __weak typeof(self) weakSelf = self;
+    NSTimeInterval delay = MAX(0.0, [date timeIntervalSinceNow]);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), CDEWorkQueue(), ^{
+        typeof(self) strongSelf = weakSelf;
+        if (!strongSelf || strongSelf->scheduleGeneration != generation) return;
+        [strongSelf performMerge];
+    });
+}
+
+- (void)cancelScheduledMerge
+{
+    scheduleGeneration++;
+    scheduledMergeDate = nil;
+}
+
+- (void)schedulePoll
+{
+    if (!mergesAutomatically || invalidated || merging || scheduledMergeDate) return;
+    NSDate *date = retryDate ? : [NSDate dateWithTimeIntervalSinceNow:currentPollInterval];
+    [self scheduleMergeAtDate:date];
+}
+
+- (void)invalidate
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Merge scheduler used off the work queue");
+    invalidated = YES;
+    mergesAutomatically = NO;
+    requestedDuringMerge = NO;
+    [self cancelScheduledMerge];
+
+    NSArray *completions = [pendingCompletions copy];
+    [pendingCompletions removeAllObjects];
+    NSError *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeCancelled userInfo:nil];
+    dispatch_async(CDEWorkQueue(), ^{
+        for (CDECompletionBlock completion in completions) completion(error);
+    });
+}
+
+
+#pragma mark Merging
+
+- (void)performMerge
+{
+    NSArray *completions = [pendingCompletions copy];
+    [pendingCompletions removeAllObjects];
+    firstRequestDate = nil;
+    pendingChangeCount = 0;
+    scheduledMergeDate = nil;
+    merging = YES;
+
+    CDELog(CDELoggingLevelVerbose, @"Scheduled merge starting");
+
+    __weak typeof(self) weakSelf = self;
+    mergeBlock(^(NSError *error, BOOL foundRemoteChanges) {
+        dispatch_async(CDEWorkQueue(), ^{
+            typeof(self) strongSelf = weakSelf;
+            if (strongSelf) [strongSelf mergeDidFinishWithError:error foundRemoteChanges:foundRemoteChanges];
+            for (CDECompletionBlock completion in completions) completion(error);
+        });
+    });
+}
+
+- (void)mergeDidFinishWithError:(NSError *)error foundRemoteChanges:(BOOL)foundRemoteChanges
+{
+    merging = NO;
+    if (invalidated) return;
+
+    BOOL canContinue = YES;
+    if (!error) {
+        consecutiveFailureCount = 0;
+        retryDate = nil;
+
+        // Poll less often while there is nothing new in the cloud
+        currentPollInterval = foundRemoteChanges ? minimumPollInterval : MIN(currentPollInterval * 2.0, maximumPollInterval);
+    }
+    else if ([error.domain isEqualToString:CDEErrorDomain] && error.code == CDEErrorCodeSaveOccurredDuringMerge) {
+        // Not a failure. The save needs merging anyway.
+        requestedDuringMerge = YES;
+    }
+    else if ([error.domain isEqualToString:CDEErrorDomain] && (error.code == CDEErrorCodeCancelled || error.code == CDEErrorCodeDisallowedStateChange)) {
+        // Cancelled, or not leeched. Wait to be asked again.
+        canContinue = NO;
+    }
+    else {
+        NSTimeInterval delay = CDERetryDelayForAttempt(consecutiveFailureCount, failureRetryBaseDelay);
+        consecutiveFailureCount++;
+        retryDate = [NSDate dateWithTimeIntervalSinceNow:delay];
+        CDELog(CDELoggingLevelWarning, @"Scheduled merge failed. Not retrying for %.0fs: %@", delay, error);
+    }
+
+    if (requestedDuringMerge || pendingCompletions.count > 0) {
+        requestedDuringMerge = NO;
+        [self requestMergeWithDebounceInterval:debounceInterval];
+    }
+    else if (canContinue) {
+        [self schedulePoll];
+    }
+}
+
+@end
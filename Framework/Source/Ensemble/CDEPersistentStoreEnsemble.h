@@ -12,6 +12,8 @@
 
 
 @class CDEPersistentStoreEnsemble;
+@class CDERebasePolicy;
+@class CDEEventStoreStatistics;
 @protocol CDECloudFileSystem;
 
 
@@ -135,6 +137,26 @@ extern NSString * const CDEManagedObjectContextSaveNotificationKey;
 - (void)persistentStoreEnsemble:(CDEPersistentStoreEnsemble *)ensemble didSaveMergeChangesWithNotification:(NSNotification *)notification;
 
 
+///
+/// @name Rebasing
+///
+
+/**
+ Decide whether the event store should be rebased.
+ 
+ The ensemble's `rebasePolicy` proposes a result from statistics of the event store. You can implement this method to make the final decision, for example, to avoid uploading a new baseline while on a cellular connection. To change the thresholds, it is usually simpler to configure the `rebasePolicy`.
+ 
+ This method is invoked on a background thread.
+ 
+ @param ensemble The ensemble that may rebase
+ @param statistics Counts of the object changes in the event store
+ @param urgent Whether the rebase would happen during a merge, because compaction can't wait. When `rebasesInBackground` is `YES`, non-urgent rebases are performed when the ensemble is idle.
+ @param proposedResult The decision of the `rebasePolicy`
+ @return Whether to rebase
+ */
+- (BOOL)persistentStoreEnsemble:(CDEPersistentStoreEnsemble *)ensemble shouldRebaseWithStatistics:(CDEEventStoreStatistics *)statistics urgently:(BOOL)urgent proposedResult:(BOOL)proposedResult;
+
+
 ///
 /// @name Deleeching
 ///
@@ -204,6 +226,20 @@ extern NSString * const CDEManagedObjectContextSaveNotificationKey;
 @property (nonatomic, weak, readwrite) id <CDEPersistentStoreEnsembleDelegate> delegate;
 
 
+///
+/// @name Queues
+///
+
+/**
+ The queue on which completion blocks passed to the ensemble are called.
+ 
+ The ensemble runs on the work queue, which is the main queue unless another serial queue is passed to `CDESetWorkQueue`. Methods of the ensemble should be called on the work queue. Completion blocks are delivered on this queue instead, so an app can run the sync engine on a private queue, and still receive completions on the main queue.
+ 
+ The default is the main queue.
+ */
+@property (nonatomic, strong, readwrite) dispatch_queue_t completionQueue;
+
+
 ///
 /// @name Cloud File System
 ///
@@ -213,6 +249,67 @@ extern NSString * const CDEManagedObjectContextSaveNotificationKey;
  */
 @property (nonatomic, strong, readonly) id <CDECloudFileSystem> cloudFileSystem;
 
+/**
+ The codec used to compress event files and data files before they are uploaded.
+ 
+ Compressed files record their codec, and files downloaded from the cloud are always decompressed if needed, so devices with compression enabled and disabled can sync together. Devices running versions of the framework that predate compression cannot read compressed files, so only enable this when all devices have been updated.
+ 
+ The default is `CDECompressionCodecNone`.
+ */
+@property (nonatomic, assign, readwrite) CDECompressionCodec compressionCodec;
+
+/**
+ Whether events are uploaded as event streams, rather than as Core Data stores.
+ 
+ Event streams are written and read sequentially, without setting up a Core Data stack for each file, so they are faster to produce and import, and use less memory for large events. Both formats are always imported, but devices running versions of the framework that predate event streams cannot read them, so only enable this when all devices have been updated.
+ 
+ The default is `NO`.
+ */
+@property (nonatomic, assign, readwrite) BOOL usesStreamingEventFiles;
+
+/**
+ Whether baselines are uploaded in segments, rather than as a single file.
+ 
+ A segmented baseline is uploaded as a small index, and segments that each hold the changes of one entity in one range of global identifiers. Segments are named for their contents, so when a rebase leaves most of the baseline unchanged, only the segments that changed are uploaded. New devices download the segments concurrently. Both forms are always imported, but devices running versions of the framework that predate segments cannot read segmented baselines, so only enable this when all devices have been updated.
+ 
+ The default is `NO`.
+ */
+@property (nonatomic, assign, readwrite) BOOL usesSegmentedBaselines;
+
+/**
+ Whether very large data attributes are stored in chunks, rather than as a single data file.
+ 
+ Data values over 2MB are split into content-defined chunks, each uploaded as a data file named for its contents, so an edit to a large value only uploads the chunks around the edit. Chunked values are always read, but devices running versions of the framework that predate chunks read them as nil, so only enable this when all devices have been updated.
+ 
+ The default is `NO`.
+ */
+@property (nonatomic, assign, readwrite) BOOL usesChunkedDataFiles;
+
+/**
+ Whether the event store is compacted in the background, rather than during merges.
+ 
+ Rebasing folds old events into the baseline. Normally a merge rebases before integrating, and the merged changes wait for it. When this is `YES`, a merge only rebases if compaction is urgent, such as when there is no baseline, or the event store has grown very large. Otherwise the rebase is scheduled for when the ensemble is idle, and performed in slices, each saved as it completes, so merges can run in between.
+ 
+ The default is `NO`.
+ */
+@property (nonatomic, assign, readwrite) BOOL rebasesInBackground;
+
+/**
+ The time spent folding events into the baseline in each slice of a background rebase.
+ 
+ The default is 0.25 seconds.
+ */
+@property (nonatomic, assign, readwrite) NSTimeInterval backgroundRebaseSliceDuration;
+
+/**
+ The policy that decides when the event store is rebased.
+ 
+ The policy predicts the compaction gained by rebasing, and the cost of merging and uploading the new baseline, from statistics that are kept as the event store changes. Apps that save often can lower the thresholds to keep the event store small, and apps with a large baseline can raise them to upload it less often. The delegate can also override each decision.
+ 
+ The default is a `CDERebasePolicy` with default thresholds.
+ */
+@property (nonatomic, strong, readwrite) CDERebasePolicy *rebasePolicy;
+
 
 ///
 /// @name Storage for Ensemble
@@ -375,6 +472,34 @@ extern NSString * const CDEManagedObjectContextSaveNotificationKey;
 - (void)cancelMergeWithCompletion:(CDECompletionBlock)completion;
 
 
+///
+/// @name Scheduling Merges
+///
+
+/**
+ Whether the ensemble decides when to merge, rather than waiting for `mergeWithCompletion:` or `mergeSoonWithCompletion:` to be called.
+ 
+ The ensemble merges shortly after local saves, once they have stopped for a couple of seconds, and straight away after a large volume of changes. It also polls the cloud, less often while nothing changes there, and backs off after failures.
+ 
+ The default is `NO`.
+ */
+@property (nonatomic, assign, readwrite) BOOL mergesAutomatically;
+
+/**
+ Requests a merge in the near future.
+ 
+ Requests made close together are coalesced into a single merge, and a request made during a merge leads to one more merge when it finishes. After merges fail, requests wait for an exponentially increasing delay. Use this instead of `mergeWithCompletion:` when responding to frequent events, such as timers or app activation.
+ 
+ @param completion A block that is executed when the merge serving the request completes. It is passed nil upon a successful merge, and an `NSError` otherwise.
+ */
+- (void)mergeSoonWithCompletion:(CDECompletionBlock)completion;
+
+/**
+ Tells the ensemble that the cloud has changed, such as when a cloud file system reports remote changes. When merging automatically, this leads to a merge soon after, and resets polling to its shortest interval.
+ */
+- (void)registerRemoteChanges;
+
+
 ///
 /// @name Ensemble Discovery and Management
 ///
@@ -435,5 +560,6 @@ extern NSString * const CDEManagedObjectContextSaveNotificationKey;
 @interface CDEPersistentStoreEnsemble (Internal)
 
 - (NSArray *)globalIdentifiersForManagedObjects:(NSArray *)objects;
+- (void)registerLocalSaveWithChangedObjectCount:(NSUInteger)count; // Any thread
 
 @end
@@ -20,7 +20,9 @@
 #import "CDEEventBuilder.h"
 #import "CDEBaselineConsolidator.h"
 #import "CDERebaser.h"
+#import "CDERebasePolicy.h"
 #import "CDERevisionManager.h"
+#import "CDEMergeScheduler.h"
 
 
 static NSString * const kCDEIdentityTokenContext = @"kCDEIdentityTokenContext";
@@ -29,6 +31,10 @@ static NSString * const kCDEStoreIdentifierKey = @"storeIdentifier";
 static NSString * const kCDELeechDate = @"leechDate";
 
 static NSString * const kCDEMergeTaskInfo = @"Merge";
+static NSString * const kCDERebaseTaskInfo = @"Rebase";
+
+static const NSTimeInterval CDEBackgroundRebaseIdleDelay = 10.0;
+static const NSTimeInterval CDEBackgroundRebaseSliceInterval = 1.0;
 
 NSString * const CDEMonitoredManagedObjectContextWillSaveNotification = @"CDEMonitoredManagedObjectContextWillSaveNotification";
 NSString * const CDEMonitoredManagedObjectContextDidSaveNotification = @"CDEMonitoredManagedObjectContextDidSaveNotification";
@@ -52,6 +58,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 @property (nonatomic, strong, readwrite) CDEEventIntegrator *eventIntegrator;
 @property (nonatomic, strong, readwrite) CDEBaselineConsolidator *baselineConsolidator;
 @property (nonatomic, strong, readwrite) CDERebaser *rebaser;
+@property (nonatomic, strong, readwrite) CDEMergeScheduler *mergeScheduler;
 
 @end
 
@@ -60,6 +67,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     BOOL saveOccurredDuringImport;
     NSOperationQueue *operationQueue;
     BOOL observingIdentityToken;
+    BOOL backgroundRebaseScheduled;
 }
 
 @synthesize cloudFileSystem = cloudFileSystem;
@@ -74,6 +82,10 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 @synthesize managedObjectModelURL = managedObjectModelURL;
 @synthesize baselineConsolidator = baselineConsolidator;
 @synthesize rebaser = rebaser;
+@synthesize mergeScheduler = mergeScheduler;
+@synthesize completionQueue = completionQueue;
+@synthesize rebasesInBackground = rebasesInBackground;
+@synthesize backgroundRebaseSliceDuration = backgroundRebaseSliceDuration;
 
 #pragma mark - Initialization and Deallocation
 
@@ -86,6 +98,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     self = [super init];
     if (self) {
         persistentStoreOptions = storeOptions;
+        completionQueue = dispatch_get_main_queue();
         
         operationQueue = [[NSOperationQueue alloc] init];
         operationQueue.maxConcurrentOperationCount = 1;
@@ -95,6 +108,10 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
         
         observingIdentityToken = NO;
         
+        rebasesInBackground = NO;
+        backgroundRebaseSliceDuration = 0.25;
+        backgroundRebaseScheduled = NO;
+        
         self.ensembleIdentifier = identifier;
         self.storeURL = newStoreURL;
         self.managedObjectModelURL = modelURL;
@@ -122,6 +139,18 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
         self.rebaser = [[CDERebaser alloc] initWithEventStore:self.eventStore];
         self.rebaser.ensemble = self;
         
+        __weak typeof(self) weakSelf = self;
+        self.mergeScheduler = [[CDEMergeScheduler alloc] initWithMergeBlock:^(CDEMergeSchedulerMergeCallback callback) {
+            typeof(self) strongSelf = weakSelf;
+            if (!strongSelf) {
+                callback([NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeCancelled userInfo:nil], NO);
+                return;
+            }
+            [strongSelf mergeWithCompletion:^(NSError *error) {
+                callback(error, !strongSelf.cloudManager.snapshotIsUnchanged);
+            }];
+        }];
+        
         [self performInitialChecks];
     }
     return self;
@@ -200,6 +229,10 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     if (observingIdentityToken) [(id)self.cloudFileSystem removeObserver:self forKeyPath:@"identityToken"];
     [[NSNotificationCenter defaultCenter] removeObserver:self];
     [saveMonitor stopMonitoring];
+    CDEMergeScheduler *scheduler = mergeScheduler;
+    dispatch_async(CDEWorkQueue(), ^{
+        [scheduler invalidate];
+    });
     [eventStore dismantle];
     observingIdentityToken = NO;
 }
@@ -226,7 +259,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 {
     if (![self checkIncompleteEvents]) return;
     
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         [self checkCloudFileSystemIdentityWithCompletion:^(NSError *error) {
             if (!error) {
                 self->observingIdentityToken = YES;
@@ -241,7 +274,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     BOOL succeeded = YES;
     if (eventStore.incompleteMandatoryEventIdentifiers.count > 0) {
         // Delay until after init... returns, because we want to inform the delegate
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             [self deleechPersistentStoreWithCompletion:^(NSError *error) {
                 if (!error) {
                     if ([self.delegate respondsToSelector:@selector(persistentStoreEnsemble:didDeleechWithError:)]) {
@@ -293,7 +326,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 
 - (void)dispatchCompletion:(CDECompletionBlock)completion withError:(NSError *)error
 {
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(self.completionQueue ? : dispatch_get_main_queue(), ^{
         if (completion) completion(error);
     });
 }
@@ -303,7 +336,9 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 - (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context
 {
     if (context == (__bridge void *)kCDEIdentityTokenContext) {
-        [self checkCloudFileSystemIdentityWithCompletion:NULL];
+        dispatch_async(CDEWorkQueue(), ^{
+            [self checkCloudFileSystemIdentityWithCompletion:NULL];
+        });
     }
 }
 
@@ -312,7 +347,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 - (void)leechPersistentStoreWithCompletion:(CDECompletionBlock)completion;
 {
     NSAssert(self.cloudFileSystem, @"No cloud file system set");
-    NSAssert([NSThread isMainThread], @"leech method called off main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"leech method called off the work queue");
     
     NSMutableArray *tasks = [NSMutableArray array];
 
@@ -415,6 +450,13 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     };
     [tasks addObject:exportBaselinesTask];
     
+    CDEAsynchronousTaskBlock publishManifestTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self.cloudManager publishManifestWithCompletion:^(NSError *error) {
+            next(nil, NO); // Retried on the next merge
+        }];
+    };
+    [tasks addObject:publishManifestTask];
+    
     CDEAsynchronousTaskBlock completeLeechTask = ^(CDEAsynchronousTaskCallbackBlock next) {
         // Reset the event store
         [self.eventStore.managedObjectContext performBlockAndWait:^{
@@ -440,6 +482,13 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     
     CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:^(NSError *error) {
         [self dispatchCompletion:completion withError:error];
+        
+        // Pick up data from other devices straight away
+        if (!error) {
+            dispatch_async(CDEWorkQueue(), ^{
+                [self.mergeScheduler registerRemoteChanges];
+            });
+        }
     }];
     
     [operationQueue addOperation:taskQueue];
@@ -450,7 +499,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     NSError *error = nil;
     eventStore.cloudFileSystemIdentityToken = self.cloudFileSystem.identityToken;
     BOOL success = [eventStore prepareNewEventStore:&error];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         self.leeched = success;
         if (completion) completion(error);
     });
@@ -458,7 +507,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 
 - (void)deleechPersistentStoreWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"Deleech method called off main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"Deleech method called off the work queue");
     
     CDEAsynchronousTaskBlock deleechTask = ^(CDEAsynchronousTaskCallbackBlock next) {
         if (!self.isLeeched) {
@@ -535,14 +584,18 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
         if (completion) completion(deleechError);
     }
     else {
-        [self dispatchCompletion:completion withError:nil];
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(nil);
+        });
     }
 }
 
 - (void)checkStoreRegistrationInCloudWithCompletion:(CDECompletionBlock)completion
 {
     if (!self.eventStore.verifiesStoreRegistrationInCloud) {
-        [self dispatchCompletion:completion withError:nil];
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(nil);
+        });
         return;
     }
     
@@ -556,7 +609,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
         else {
             // If there was an error, can't conclude anything about registration state. Assume registered.
             // Don't want to deleech for no good reason.
-            [self dispatchCompletion:completion withError:nil];
+            if (completion) completion(nil);
         }
     }];
 }
@@ -568,11 +621,61 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     return [NSURL fileURLWithPath:self.eventStore.pathToEventDataRootDirectory];
 }
 
+- (CDECompressionCodec)compressionCodec
+{
+    return self.cloudManager.compressionCodec;
+}
+
+- (void)setCompressionCodec:(CDECompressionCodec)codec
+{
+    self.cloudManager.compressionCodec = codec;
+}
+
+- (BOOL)usesStreamingEventFiles
+{
+    return self.cloudManager.usesStreamingEventFiles;
+}
+
+- (void)setUsesStreamingEventFiles:(BOOL)flag
+{
+    self.cloudManager.usesStreamingEventFiles = flag;
+}
+
+- (BOOL)usesSegmentedBaselines
+{
+    return self.cloudManager.usesSegmentedBaselines;
+}
+
+- (void)setUsesSegmentedBaselines:(BOOL)flag
+{
+    self.cloudManager.usesSegmentedBaselines = flag;
+}
+
+- (BOOL)usesChunkedDataFiles
+{
+    return self.cloudManager.usesChunkedDataFiles;
+}
+
+- (void)setUsesChunkedDataFiles:(BOOL)flag
+{
+    self.cloudManager.usesChunkedDataFiles = flag;
+}
+
+- (CDERebasePolicy *)rebasePolicy
+{
+    return self.rebaser.policy;
+}
+
+- (void)setRebasePolicy:(CDERebasePolicy *)policy
+{
+    self.rebaser.policy = policy ? : [[CDERebasePolicy alloc] init];
+}
+
 #pragma mark Merging Changes
 
 - (void)mergeWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"Merge method called off main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"Merge method called off the work queue");
     
     NSMutableArray *tasks = [NSMutableArray array];
     
@@ -653,6 +756,10 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     [tasks addObject:removeOutOfDateNewlyImportedFiles];
     
     CDEAsynchronousTaskBlock importDataFilesTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        if (self.cloudManager.snapshotIsUnchanged) {
+            next(nil, NO);
+            return;
+        }
         [self.cloudManager importNewDataFilesWithCompletion:^(NSError *error) {
             next(error, NO);
         }];
@@ -660,6 +767,10 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     [tasks addObject:importDataFilesTask];
 
     CDEAsynchronousTaskBlock importBaselinesTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        if (self.cloudManager.snapshotIsUnchanged) {
+            next(nil, NO);
+            return;
+        }
         [self.cloudManager importNewBaselineEventsWithCompletion:^(NSError *error) {
             next(error, NO);
         }];
@@ -674,6 +785,10 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     [tasks addObject:mergeBaselinesTask];
     
     CDEAsynchronousTaskBlock importRemoteEventsTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        if (self.cloudManager.snapshotIsUnchanged) {
+            next(nil, NO);
+            return;
+        }
         [self.cloudManager importNewRemoteNonBaselineEventsWithCompletion:^(NSError *error) {
             next(error, NO);
         }];
@@ -689,18 +804,43 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     
     CDEAsynchronousTaskBlock rebaseTask = ^(CDEAsynchronousTaskCallbackBlock next) {
         [self.rebaser shouldRebaseWithCompletion:^(BOOL result) {
-            if (result) {
+            if (!result) {
+                next(nil, NO);
+                return;
+            }
+            
+            if (!self.rebasesInBackground) {
                 [self.rebaser rebaseWithCompletion:^(NSError *error) {
                     next(error, NO);
                 }];
+                return;
             }
-            else {
-                next(nil, NO);
-            }
+            
+            // Only hold up the merge if compaction can't wait
+            [self.rebaser shouldRebaseUrgentlyWithCompletion:^(BOOL urgent) {
+                if (urgent) {
+                    [self.rebaser rebaseWithCompletion:^(NSError *error) {
+                        next(error, NO);
+                    }];
+                }
+                else {
+                    [self scheduleBackgroundRebaseAfterDelay:CDEBackgroundRebaseIdleDelay];
+                    next(nil, NO);
+                }
+            }];
         }];
     };
     [tasks addObject:rebaseTask];
     
+    // Squash before merging, while local saves are still the most recent events
+    CDEAsynchronousTaskBlock squashEventsTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self.cloudManager squashUnexportedLocalEventsWithCompletion:^(NSError *error) {
+            if (error) CDELog(CDELoggingLevelWarning, @"Could not squash local events: %@", error);
+            next(nil, NO);
+        }];
+    };
+    [tasks addObject:squashEventsTask];
+    
     CDEAsynchronousTaskBlock mergeEventsTask = ^(CDEAsynchronousTaskCallbackBlock next) {
         [self.eventIntegrator mergeEventsWithCompletion:^(NSError *error) {
             // Store baseline id if everything went well
@@ -739,7 +879,15 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     };
     [tasks addObject:removeRemoteFiles];
     
+    CDEAsynchronousTaskBlock publishManifestTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        [self.cloudManager publishManifestWithCompletion:^(NSError *error) {
+            next(nil, NO); // Retried on the next merge
+        }];
+    };
+    [tasks addObject:publishManifestTask];
+    
     CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTasks:tasks terminationPolicy:CDETaskQueueTerminationPolicyStopOnError completion:^(NSError *error) {
+        if (!error) [self.cloudManager storeSnapshotForReuse];
         [self dispatchCompletion:completion withError:error];
         [self.eventIntegrator stopMonitoringSaves];
         self.merging = NO;
@@ -751,7 +899,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 
 - (void)cancelMergeWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"cancel merge method called off main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"cancel merge method called off the work queue");
     for (NSOperation *operation in operationQueue.operations) {
         if ([operation respondsToSelector:@selector(info)] && [[(id)operation info] isEqual:kCDEMergeTaskInfo]) {
             [operation cancel];
@@ -762,11 +910,99 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
     }];
 }
 
+#pragma mark Background Rebasing
+
+- (void)scheduleBackgroundRebaseAfterDelay:(NSTimeInterval)delay
+{
+    if (backgroundRebaseScheduled) return;
+    backgroundRebaseScheduled = YES;
+    
+    __weak typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), CDEWorkQueue(), ^{
+        typeof(self) strongSelf = weakSelf;
+        if (!strongSelf) return;
+        strongSelf->backgroundRebaseScheduled = NO;
+        [strongSelf rebaseSliceInBackground];
+    });
+}
+
+- (void)rebaseSliceInBackground
+{
+    if (!self.leeched || !self.rebasesInBackground) return;
+    
+    // Wait for the ensemble to be idle
+    if (self.merging) {
+        [self scheduleBackgroundRebaseAfterDelay:CDEBackgroundRebaseIdleDelay];
+        return;
+    }
+    
+    // Runs on the operation queue, so a merge requested meanwhile waits for one slice at most
+    __block BOOL finished = YES;
+    CDEAsynchronousTaskBlock sliceTask = ^(CDEAsynchronousTaskCallbackBlock next) {
+        if (!self.leeched) {
+            next(nil, NO);
+            return;
+        }
+        [self.rebaser rebaseWithTimeBudget:self.backgroundRebaseSliceDuration completion:^(BOOL sliceFinished, NSError *error) {
+            finished = sliceFinished;
+            next(error, NO);
+        }];
+    };
+    
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTask:sliceTask completion:^(NSError *error) {
+        if (error) {
+            CDELog(CDELoggingLevelWarning, @"Background rebase failed: %@", error);
+            return;
+        }
+        if (!finished) [self scheduleBackgroundRebaseAfterDelay:CDEBackgroundRebaseSliceInterval];
+    }];
+    taskQueue.info = kCDERebaseTaskInfo;
+    [operationQueue addOperation:taskQueue];
+}
+
+#pragma mark Scheduling Merges
+
+- (BOOL)mergesAutomatically
+{
+    return self.mergeScheduler.mergesAutomatically;
+}
+
+- (void)setMergesAutomatically:(BOOL)yn
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Merge scheduling changed off the work queue");
+    self.mergeScheduler.mergesAutomatically = yn;
+}
+
+- (void)mergeSoonWithCompletion:(CDECompletionBlock)completion
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Merge soon method called off the work queue");
+    dispatch_queue_t queue = self.completionQueue ? : dispatch_get_main_queue();
+    [self.mergeScheduler mergeSoonWithCompletion:^(NSError *error) {
+        dispatch_async(queue, ^{
+            if (completion) completion(error);
+        });
+    }];
+}
+
+- (void)registerRemoteChanges
+{
+    NSAssert(CDEIsOnWorkQueue(), @"Remote changes registered off the work queue");
+    [self.mergeScheduler registerRemoteChanges];
+}
+
+- (void)registerLocalSaveWithChangedObjectCount:(NSUInteger)count
+{
+    CDEMergeScheduler *scheduler = self.mergeScheduler;
+    dispatch_async(CDEWorkQueue(), ^{
+        [scheduler registerLocalSaveWithChangedObjectCount:count];
+    });
+}
+
 #pragma mark Prepare for app termination
 
 - (void)processPendingChangesWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"Process pending changes invoked off main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"Process pending changes called off the work queue");
     
     if (!self.leeched) {
         [self dispatchCompletion:completion withError:nil];
@@ -782,7 +1018,7 @@ NSString * const CDEManagedObjectContextSaveNotificationKey = @"managedObjectCon
 
 - (void)stopMonitoringSaves
 {
-    NSAssert([NSThread isMainThread], @"stop monitor method called off main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"stop monitor method called off the work queue");
     [saveMonitor stopMonitoring];
 }
 
@@ -54,7 +54,7 @@
     }];
     
     if (error) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (completion) completion(error);
         });
         return;
@@ -81,7 +81,7 @@
             NSError *localError = nil;
             NSArray *objects = [context executeFetchRequest:fetch error:&localError];
             if (!objects) {
-                dispatch_async(dispatch_get_main_queue(), ^{
+                dispatch_async(CDEWorkQueue(), ^{
                     if (completion) completion(localError);
                 });
                 return;
@@ -96,7 +96,7 @@
             [eventBuilder finalizeNewEvent];
             [eventContext save:&localError];
             
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (completion) completion(localError);
             });
         }];
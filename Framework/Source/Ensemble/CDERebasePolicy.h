@@ -0,0 +1,162 @@
+//
+//  CDERebasePolicy.h
+//  Ensembles
+//
+//  Created by Drew McCormack on 30/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ A summary of the contents of the event store, used to decide when to rebase.
+
+ The counts are kept up to date as events are saved, so they are cheap to retrieve. Counts of object changes outside the baseline exclude events that are still being imported. Byte counts are estimates of the size of the stored property values, and do not include data files.
+ */
+@interface CDEEventStoreStatistics : NSObject
+
+/**
+ Whether the event store has a baseline.
+ */
+@property (nonatomic, assign, readwrite) BOOL hasBaseline;
+
+/**
+ Whether the baseline includes revisions of every store in the ensemble.
+ */
+@property (nonatomic, assign, readwrite) BOOL baselineIncludesAllStores;
+
+/**
+ The number of events in the event store, including the baseline.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger eventCount;
+
+/**
+ The number of object changes in the baseline, and the estimated size of their values.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger baselineObjectChangeCount;
+@property (nonatomic, assign, readwrite) unsigned long long baselineByteCount;
+
+/**
+ The number of object changes outside the baseline, by type.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger insertCount;
+@property (nonatomic, assign, readwrite) NSUInteger updateCount;
+@property (nonatomic, assign, readwrite) NSUInteger deleteCount;
+
+/**
+ The number of updates outside the baseline to objects that had already been updated by an earlier event outside the baseline. Rebasing folds these into a single change.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger repeatedUpdateCount;
+
+/**
+ The estimated size of the values of object changes outside the baseline, and the part of that belonging to insertions.
+ */
+@property (nonatomic, assign, readwrite) unsigned long long byteCount;
+@property (nonatomic, assign, readwrite) unsigned long long insertByteCount;
+
+/**
+ The number of object changes outside the baseline for each entity. Keys are entity names, and values are `NSNumber` objects.
+ */
+@property (nonatomic, copy, readwrite) NSDictionary *objectChangeCountsByEntityName;
+
+/**
+ The time taken per object change by the most recent rebase of this ensemble, or zero if it has not been measured.
+ */
+@property (nonatomic, assign, readwrite) NSTimeInterval measuredSecondsPerObjectChange;
+
+/**
+ The total number of object changes, in the baseline and outside it.
+ */
+@property (nonatomic, assign, readonly) NSUInteger objectChangeCount;
+
+@end
+
+
+/**
+ Decides when the event store should be rebased, using a simple cost model.
+
+ Rebasing folds events into the baseline. The gain is a smaller event store, and fewer changes for new devices to download and integrate. The cost is the time taken to merge the events, and uploading the new baseline. The policy predicts each from the event store statistics, and compares them with its thresholds.
+
+ Apps that save often can lower the thresholds, so the event store stays small. Apps that save rarely, or have a large baseline, can raise them to avoid uploading the baseline for little gain. Subclasses can override the predictions or decisions.
+ */
+@interface CDERebasePolicy : NSObject
+
+///
+/// @name Thresholds
+///
+
+/**
+ Rebase when there are more events than this. The default is 50.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger eventCountThreshold;
+
+/**
+ Only consider compaction when there are at least this many object changes. The default is 500.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger objectChangeCountThreshold;
+
+/**
+ The predicted fraction of the event store that a rebase must remove. The default is 0.5.
+ */
+@property (nonatomic, assign, readwrite) float minimumCompaction;
+
+/**
+ The predicted bytes removed, as a fraction of the predicted size of the new baseline, that justifies uploading it. The default is 0, which ignores upload size.
+ */
+@property (nonatomic, assign, readwrite) float minimumByteSavingsPerUploadedByte;
+
+/**
+ The longest predicted duration of a rebase that is not urgent. Zero means there is no limit, which is the default.
+ */
+@property (nonatomic, assign, readwrite) NSTimeInterval maximumRebaseDuration;
+
+/**
+ Rebase urgently, even in the middle of a merge, when there are more events than this. The default is 500.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger urgentEventCountThreshold;
+
+/**
+ Rebase urgently when there are at least this many object changes. The default is 50000.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger urgentObjectChangeCountThreshold;
+
+/**
+ The time taken to merge one object change, used until a rebase has been measured. The default is 0.5 ms.
+ */
+@property (nonatomic, assign, readwrite) NSTimeInterval estimatedSecondsPerObjectChange;
+
+///
+/// @name Predictions
+///
+
+/**
+ The predicted fraction of the event store removed by rebasing, between 0 and 1.
+ */
+- (float)predictedCompactionForStatistics:(CDEEventStoreStatistics *)statistics;
+
+/**
+ The predicted size of the baseline after rebasing, which is what gets uploaded.
+ */
+- (unsigned long long)predictedBaselineByteCountForStatistics:(CDEEventStoreStatistics *)statistics;
+
+/**
+ The predicted time taken to merge all events into the baseline.
+ */
+- (NSTimeInterval)predictedRebaseDurationForStatistics:(CDEEventStoreStatistics *)statistics;
+
+///
+/// @name Decisions
+///
+
+/**
+ Whether to rebase. Rebasing happens when there is no baseline, the baseline is missing a store, there are many events, or the predicted gain outweighs the cost.
+ */
+- (BOOL)shouldRebaseWithStatistics:(CDEEventStoreStatistics *)statistics;
+
+/**
+ Whether to rebase without delay, rather than waiting for the ensemble to be idle. This is the case when there is no baseline, or the event store has grown well beyond the usual thresholds.
+ */
+- (BOOL)shouldRebaseUrgentlyWithStatistics:(CDEEventStoreStatistics *)statistics;
+
+@end
@@ -0,0 +1,139 @@
+//
+//  CDERebasePolicy.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 30/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDERebasePolicy.h"
+
+// Used when no byte counts are known. An update usually changes a subset of properties.
+static const float CDEUpdateWeightRelativeToInsert = 0.2f;
+
+
+@implementation CDEEventStoreStatistics
+
+@synthesize hasBaseline = hasBaseline;
+@synthesize baselineIncludesAllStores = baselineIncludesAllStores;
+@synthesize eventCount = eventCount;
+@synthesize baselineObjectChangeCount = baselineObjectChangeCount;
+@synthesize baselineByteCount = baselineByteCount;
+@synthesize insertCount = insertCount;
+@synthesize updateCount = updateCount;
+@synthesize deleteCount = deleteCount;
+@synthesize repeatedUpdateCount = repeatedUpdateCount;
+@synthesize byteCount = byteCount;
+@synthesize insertByteCount = insertByteCount;
+@synthesize objectChangeCountsByEntityName = objectChangeCountsByEntityName;
+@synthesize measuredSecondsPerObjectChange = measuredSecondsPerObjectChange;
+
+- (NSUInteger)objectChangeCount
+{
+    return baselineObjectChangeCount + insertCount + updateCount + deleteCount;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"%@ events: %lu, baseline changes: %lu (%llu bytes), inserts: %lu, updates: %lu (%lu repeated), deletes: %lu (%llu bytes)", [super description], (unsigned long)eventCount, (unsigned long)baselineObjectChangeCount, baselineByteCount, (unsigned long)insertCount, (unsigned long)updateCount, (unsigned long)repeatedUpdateCount, (unsigned long)deleteCount, byteCount];
+}
+
+@end
+
+
+@implementation CDERebasePolicy
+
+@synthesize eventCountThreshold = eventCountThreshold;
+@synthesize objectChangeCountThreshold = objectChangeCountThreshold;
+@synthesize minimumCompaction = minimumCompaction;
+@synthesize minimumByteSavingsPerUploadedByte = minimumByteSavingsPerUploadedByte;
+@synthesize maximumRebaseDuration = maximumRebaseDuration;
+@synthesize urgentEventCountThreshold = urgentEventCountThreshold;
+@synthesize urgentObjectChangeCountThreshold = urgentObjectChangeCountThreshold;
+@synthesize estimatedSecondsPerObjectChange = estimatedSecondsPerObjectChange;
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        eventCountThreshold = 50;
+        objectChangeCountThreshold = 500;
+        minimumCompaction = 0.5f;
+        minimumByteSavingsPerUploadedByte = 0.0f;
+        maximumRebaseDuration = 0.0;
+        urgentEventCountThreshold = 500;
+        urgentObjectChangeCountThreshold = 50000;
+        estimatedSecondsPerObjectChange = 0.0005;
+    }
+    return self;
+}
+
+
+#pragma mark Predictions
+
+- (float)predictedCompactionForStatistics:(CDEEventStoreStatistics *)statistics
+{
+    float currentSize, postRebaseSize;
+    if (statistics.baselineByteCount + statistics.byteCount > 0) {
+        // Updates are folded into the objects they change, and deletions remove objects
+        currentSize = statistics.baselineByteCount + statistics.byteCount;
+        postRebaseSize = [self predictedBaselineByteCountForStatistics:statistics];
+    }
+    else {
+        // Assume an insertion is 1 unit of data, and a deletion removes one insertion
+        currentSize = statistics.baselineObjectChangeCount + statistics.insertCount + CDEUpdateWeightRelativeToInsert * statistics.updateCount;
+        postRebaseSize = (float)statistics.baselineObjectChangeCount + statistics.insertCount - statistics.deleteCount;
+    }
+
+    float compaction = 1.0f - ( postRebaseSize / MAX(1.0f, currentSize) );
+    return MIN( MAX(compaction, 0.0f), 1.0f );
+}
+
+- (unsigned long long)predictedBaselineByteCountForStatistics:(CDEEventStoreStatistics *)statistics
+{
+    // Deletions remove objects of average size from the baseline and the insertions
+    NSUInteger objectCount = statistics.baselineObjectChangeCount + statistics.insertCount;
+    unsigned long long objectBytes = statistics.baselineByteCount + statistics.insertByteCount;
+    double bytesPerObject = objectBytes / (double)MAX(1, objectCount);
+    double deletedBytes = MIN(statistics.deleteCount, objectCount) * bytesPerObject;
+    return (unsigned long long)MAX(0.0, objectBytes - deletedBytes);
+}
+
+- (NSTimeInterval)predictedRebaseDurationForStatistics:(CDEEventStoreStatistics *)statistics
+{
+    NSTimeInterval secondsPerChange = statistics.measuredSecondsPerObjectChange > 0.0 ? statistics.measuredSecondsPerObjectChange : self.estimatedSecondsPerObjectChange;
+    NSUInteger changeCount = statistics.insertCount + statistics.updateCount + statistics.deleteCount;
+    return changeCount * secondsPerChange;
+}
+
+
+#pragma mark Decisions
+
+- (BOOL)shouldRebaseWithStatistics:(CDEEventStoreStatistics *)statistics
+{
+    if (!statistics.hasBaseline || !statistics.baselineIncludesAllStores) return YES;
+    if (statistics.eventCount > self.eventCountThreshold) return YES;
+    if (statistics.objectChangeCount < self.objectChangeCountThreshold) return NO;
+
+    // Gain
+    if ([self predictedCompactionForStatistics:statistics] <= self.minimumCompaction) return NO;
+
+    // Cost of uploading the new baseline
+    unsigned long long currentBytes = statistics.baselineByteCount + statistics.byteCount;
+    unsigned long long baselineBytes = [self predictedBaselineByteCountForStatistics:statistics];
+    double savedBytes = (double)currentBytes - (double)baselineBytes;
+    if (savedBytes < self.minimumByteSavingsPerUploadedByte * baselineBytes) return NO;
+
+    // Cost of merging
+    if (self.maximumRebaseDuration > 0.0 && [self predictedRebaseDurationForStatistics:statistics] > self.maximumRebaseDuration) return NO;
+
+    return YES;
+}
+
+- (BOOL)shouldRebaseUrgentlyWithStatistics:(CDEEventStoreStatistics *)statistics
+{
+    if (!statistics.hasBaseline) return YES;
+    return statistics.eventCount > self.urgentEventCountThreshold || statistics.objectChangeCount >= self.urgentObjectChangeCountThreshold;
+}
+
+@end
@@ -0,0 +1,23 @@
+//
+//  CDEDataChunker.h
+//  Ensembles
+//
+//  Splits data into content-defined chunks, using a rolling hash.
+//  Chunk boundaries depend only on nearby bytes, so an edit only
+//  changes the chunks around it, and the rest can be reused.
+//
+//  Created by Drew McCormack on 21/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@interface CDEDataChunker : NSObject
+
+@property (nonatomic, assign, readwrite) NSUInteger minimumChunkLength; // Default 256KB
+@property (nonatomic, assign, readwrite) NSUInteger averageChunkLength; // Rounded down to a power of two. Default 1MB.
+@property (nonatomic, assign, readwrite) NSUInteger maximumChunkLength; // Default 4MB
+
+- (NSArray *)rangesOfChunksInData:(NSData *)data; // NSValue ranges, in order, covering all data
+
+@end
@@ -0,0 +1,85 @@
+//
+//  CDEDataChunker.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 21/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEDataChunker.h"
+
+static uint64_t gearTable[256];
+
+
+@implementation CDEDataChunker
+
+@synthesize minimumChunkLength = minimumChunkLength;
+@synthesize averageChunkLength = averageChunkLength;
+@synthesize maximumChunkLength = maximumChunkLength;
+
++ (void)initialize
+{
+    if (self != [CDEDataChunker class]) return;
+    
+    // The table must be the same on every device, so it is generated from a fixed seed (splitmix64)
+    uint64_t state = 0x456E73656D626C65ULL;
+    for (NSUInteger i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gearTable[i] = z ^ (z >> 31);
+    }
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        minimumChunkLength = 256 * 1024;
+        averageChunkLength = 1024 * 1024;
+        maximumChunkLength = 4 * 1024 * 1024;
+    }
+    return self;
+}
+
+- (NSArray *)rangesOfChunksInData:(NSData *)data
+{
+    // A gear hash is updated for each byte. A boundary falls where the top bits of the hash are all zero,
+    // which happens on average once every averageChunkLength bytes. The top bits depend on the last 64 bytes.
+    NSUInteger maskBits = 0;
+    while ((2UL << maskBits) <= averageChunkLength) maskBits++;
+    uint64_t mask = maskBits == 0 ? 0 : (UINT64_MAX << (64 - maskBits));
+    
+    NSUInteger minimum = MAX(1, minimumChunkLength);
+    NSUInteger maximum = MAX(minimum, maximumChunkLength);
+    
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSMutableArray *ranges = [[NSMutableArray alloc] initWithCapacity:length / MAX(1, averageChunkLength) + 1];
+    
+    NSUInteger start = 0;
+    while (start < length) {
+        NSUInteger remaining = length - start;
+        NSUInteger chunkLength = MIN(remaining, maximum);
+        
+        // Bytes before the minimum length can't end a chunk, so are skipped
+        if (remaining > minimum) {
+            uint64_t hash = 0;
+            NSUInteger end = start + chunkLength;
+            for (NSUInteger i = start + minimum; i < end; i++) {
+                hash = (hash << 1) + gearTable[bytes[i]];
+                if ((hash & mask) == 0) {
+                    chunkLength = i + 1 - start;
+                    break;
+                }
+            }
+        }
+        
+        [ranges addObject:[NSValue valueWithRange:NSMakeRange(start, chunkLength)]];
+        start += chunkLength;
+    }
+    
+    return ranges;
+}
+
+@end
@@ -21,6 +21,8 @@
 #import "CDEPropertyChangeValue.h"
 #import "CDERevisionManager.h"
 
+static const NSUInteger CDEBootstrapBatchSize = 500;
+
 @interface CDEEventIntegrator ()
 
 @property (readwrite) NSManagedObjectContext *managedObjectContext;
@@ -130,7 +132,7 @@
 
 - (void)mergeEventsWithCompletion:(CDECompletionBlock)completion
 {
-    NSAssert([NSThread isMainThread], @"mergeEvents... called off main thread");
+    NSAssert(CDEIsOnWorkQueue(), @"mergeEvents... called off the work queue");
     
     newEventUniqueId = nil;
     
@@ -270,7 +272,7 @@
     newEventUniqueId = nil;
     managedObjectContext = nil;
     
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(error);
     });
 }
@@ -280,7 +282,7 @@
     if (newEventUniqueId) [self.eventStore deregisterIncompleteEventIdentifier:newEventUniqueId];
     newEventUniqueId = nil;
     managedObjectContext = nil;
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         if (completion) completion(nil);
     });
 }
@@ -318,6 +320,7 @@
     // Move to the event store queue
     __block BOOL success = YES;
     BOOL needFullIntegration = [self needsFullIntegration];
+    BOOL canBootstrap = needFullIntegration && [self persistentStoreIsEmpty];
     NSManagedObjectContext *eventStoreContext = self.eventStore.managedObjectContext;
     __block NSError *methodError = nil;
     [eventStoreContext performBlockAndWait:^{
@@ -369,8 +372,27 @@
         NSUInteger numberOfChanges = [[storeModEvents valueForKeyPath:@"@sum.objectChanges.@count"] unsignedIntegerValue];
         if (numberOfChanges == 0) return;
         
+        // An empty store can be built directly from the baseline, leaving only the later events to integrate.
+        // There are no existing objects, so there is also nothing unreferenced to delete afterwards.
+        // If bootstrapping fails, its objects are discarded, and the baseline is integrated like any other event.
+        CDEStoreModificationEvent *firstEvent = storeModEvents.firstObject;
+        BOOL trackInsertedObjects = needFullIntegration;
+        if (canBootstrap && firstEvent.type == CDEStoreModificationEventTypeBaseline) {
+            if ([self bootstrapStoreFromBaseline:firstEvent error:&blockError]) {
+                storeModEvents = [storeModEvents subarrayWithRange:NSMakeRange(1, storeModEvents.count-1)];
+                trackInsertedObjects = NO;
+            }
+            else {
+                CDELog(CDELoggingLevelWarning, @"Could not bootstrap store from baseline. Falling back to full integration: %@", blockError);
+                [self->managedObjectContext performBlockAndWait:^{
+                    [self->managedObjectContext reset];
+                }];
+                blockError = nil;
+            }
+        }
+        
         // Apply changes in the events, in order.
-        NSMutableDictionary *insertedObjectIDsByEntity = needFullIntegration ? [[NSMutableDictionary alloc] init] : nil;
+        NSMutableDictionary *insertedObjectIDsByEntity = trackInsertedObjects ? [[NSMutableDictionary alloc] init] : nil;
         @try {
             for (CDEStoreModificationEvent *storeModEvent in storeModEvents) {
                 @autoreleasepool {
@@ -397,7 +419,7 @@
                         appliedInsertsByEntity[entity.name] = appliedInsertChanges;
                         
                         // If full integration, track all inserted object ids, so we can delete unreferenced objects
-                        if (needFullIntegration) [self updateObjectIDsByEntity:insertedObjectIDsByEntity forEntity:entity insertChanges:appliedInsertChanges];
+                        if (trackInsertedObjects) [self updateObjectIDsByEntity:insertedObjectIDsByEntity forEntity:entity insertChanges:appliedInsertChanges];
                     }
                     
                     // Now that all objects exist, we can apply property changes.
@@ -428,7 +450,7 @@
         }
         
         // In a full integration, remove any objects that didn't get inserted
-        if (success && needFullIntegration) [self deleteUnreferencedObjectsInObjectIDsByEntity:insertedObjectIDsByEntity];
+        if (success && trackInsertedObjects) [self deleteUnreferencedObjectsInObjectIDsByEntity:insertedObjectIDsByEntity];
     }];
     
     if (error) *error = methodError;
@@ -522,6 +544,169 @@
 }
 
 
+#pragma mark Bootstrapping Empty Stores
+
+// Called on background queue
+- (BOOL)persistentStoreIsEmpty
+{
+    __block BOOL isEmpty = YES;
+    [managedObjectContext performBlockAndWait:^{
+        for (NSEntityDescription *entity in self->managedObjectModel) {
+            if (entity.isAbstract) continue;
+            NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:entity.name];
+            fetch.includesSubentities = NO;
+            fetch.fetchLimit = 1;
+            NSError *error = nil;
+            NSUInteger count = [self->managedObjectContext countForFetchRequest:fetch error:&error];
+            if (count == NSNotFound) CDELog(CDELoggingLevelError, @"Could not count objects in store: %@", error);
+            if (count != 0) {
+                isEmpty = NO;
+                break;
+            }
+        }
+    }];
+    return isEmpty;
+}
+
+// Entities referenced by to-one relationships come before the entities referencing them.
+// Cycles are broken arbitrarily. Relationships are set in a second pass, so order only affects locality.
+- (NSArray *)entitiesInDependencyOrder
+{
+    NSArray *entities = [managedObjectModel.entities sortedArrayUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"name" ascending:YES]]];
+    NSMutableArray *orderedEntities = [[NSMutableArray alloc] initWithCapacity:entities.count];
+    NSMutableSet *visitedEntityNames = [[NSMutableSet alloc] initWithCapacity:entities.count];
+    for (NSEntityDescription *entity in entities) {
+        [self addEntity:entity toDependencyOrder:orderedEntities visitedEntityNames:visitedEntityNames];
+    }
+    return orderedEntities;
+}
+
+- (void)addEntity:(NSEntityDescription *)entity toDependencyOrder:(NSMutableArray *)orderedEntities visitedEntityNames:(NSMutableSet *)visitedEntityNames
+{
+    if ([visitedEntityNames containsObject:entity.name]) return;
+    [visitedEntityNames addObject:entity.name];
+    
+    NSArray *relationshipNames = [entity.relationshipsByName.allKeys sortedArrayUsingSelector:@selector(compare:)];
+    for (NSString *name in relationshipNames) {
+        NSRelationshipDescription *relationship = entity.relationshipsByName[name];
+        if (relationship.isToMany || !relationship.destinationEntity) continue;
+        [self addEntity:relationship.destinationEntity toDependencyOrder:orderedEntities visitedEntityNames:visitedEntityNames];
+    }
+    
+    if (entity.isAbstract) {
+        for (NSEntityDescription *subentity in entity.subentities) {
+            [self addEntity:subentity toDependencyOrder:orderedEntities visitedEntityNames:visitedEntityNames];
+        }
+    }
+    else {
+        [orderedEntities addObject:entity];
+    }
+}
+
+// Called on event store context queue.
+// Builds an empty store straight from the baseline. Objects are inserted with their attributes entity by entity,
+// and relationships are set in a second pass, once every object exists, so nothing needs to be looked up.
+// Nothing is saved here. The objects are committed with the rest of the merge, so validation only
+// happens once relationships are in place, and the usual repair blocks get to see the changes.
+- (BOOL)bootstrapStoreFromBaseline:(CDEStoreModificationEvent *)baseline error:(NSError * __autoreleasing *)error
+{
+    CDELog(CDELoggingLevelVerbose, @"Bootstrapping empty store from baseline");
+    
+    NSArray *entities = [self entitiesInDependencyOrder];
+    NSMutableDictionary *changeIDsByEntityName = [[NSMutableDictionary alloc] initWithCapacity:entities.count];
+    for (NSEntityDescription *entity in entities) {
+        NSArray *changeIDs = [self fetchIDsOfObjectChangesInBaseline:baseline forEntity:entity error:error];
+        if (!changeIDs) return NO;
+        if (changeIDs.count > 0) changeIDsByEntityName[entity.name] = changeIDs;
+    }
+    
+    NSError *batchError = nil;
+    NSManagedObjectContext *eventStoreContext = self.eventStore.managedObjectContext;
+    for (NSUInteger pass = 0; pass < 2; pass++) {
+        BOOL insertingObjects = pass == 0;
+        for (NSEntityDescription *entity in entities) {
+            NSArray *changeIDs = changeIDsByEntityName[entity.name];
+            for (NSUInteger i = 0; i < changeIDs.count; i += CDEBootstrapBatchSize) {
+                @autoreleasepool {
+                    NSError *localError = nil;
+                    NSRange range = NSMakeRange(i, MIN(CDEBootstrapBatchSize, changeIDs.count-i));
+                    NSArray *changes = [self fetchObjectChangesWithIDs:[changeIDs subarrayWithRange:range] error:&localError];
+                    BOOL success = changes != nil;
+                    if (success && insertingObjects) {
+                        success = [self insertObjectsWithAttributesForEntity:entity objectChanges:changes error:&localError];
+                    }
+                    else if (success) {
+                        success = [self applyObjectPropertyChanges:changes includingAttributes:NO error:&localError];
+                    }
+                    if (!success) batchError = localError;
+                    
+                    // Only the global identifiers, which hold the new store URIs, are kept in memory
+                    for (CDEObjectChange *change in changes) [eventStoreContext refreshObject:change mergeChanges:NO];
+                }
+                if (batchError) {
+                    if (error) *error = batchError;
+                    return NO;
+                }
+            }
+        }
+    }
+    
+    return YES;
+}
+
+// Called on event store context queue
+- (NSArray *)fetchIDsOfObjectChangesInBaseline:(CDEStoreModificationEvent *)baseline forEntity:(NSEntityDescription *)entity error:(NSError * __autoreleasing *)error
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent = %@ && nameOfEntity = %@ && type = %d", baseline, entity.name, CDEObjectChangeTypeInsert];
+    fetch.resultType = NSManagedObjectIDResultType;
+    return [self.eventStore.managedObjectContext executeFetchRequest:fetch error:error];
+}
+
+// Called on event store context queue
+- (NSArray *)fetchObjectChangesWithIDs:(NSArray *)changeIDs error:(NSError * __autoreleasing *)error
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"SELF IN %@", changeIDs];
+    fetch.relationshipKeyPathsForPrefetching = @[@"globalIdentifier"];
+    return [self.eventStore.managedObjectContext executeFetchRequest:fetch error:error];
+}
+
+// Called on event store context queue
+- (BOOL)insertObjectsWithAttributesForEntity:(NSEntityDescription *)entity objectChanges:(NSArray *)changes error:(NSError * __autoreleasing *)error
+{
+    NSPredicate *attributePredicate = [NSPredicate predicateWithFormat:@"type = %d", CDEPropertyChangeTypeAttribute];
+    NSArray *attributeChangesForObjects = [changes cde_arrayByTransformingObjectsWithBlock:^id(CDEObjectChange *change) {
+        return [change.propertyChangeValues ? : @[] filteredArrayUsingPredicate:attributePredicate];
+    }];
+    
+    __block BOOL success = YES;
+    __block NSError *methodError = nil;
+    __block NSArray *uris = nil;
+    [managedObjectContext performBlockAndWait:^{
+        NSMutableArray *newObjects = [[NSMutableArray alloc] initWithCapacity:attributeChangesForObjects.count];
+        for (NSArray *attributeChanges in attributeChangesForObjects) {
+            NSManagedObject *newObject = [NSEntityDescription insertNewObjectForEntityForName:entity.name inManagedObjectContext:self->managedObjectContext];
+            [self applyAttributeChanges:attributeChanges toObject:newObject];
+            [newObjects addObject:newObject];
+        }
+        
+        NSError *localError = nil;
+        success = [self->managedObjectContext obtainPermanentIDsForObjects:newObjects error:&localError];
+        methodError = localError;
+        if (success) uris = [newObjects valueForKeyPath:@"objectID.URIRepresentation.absoluteString"];
+    }];
+    if (error) *error = methodError;
+    if (!success) return NO;
+    
+    [changes enumerateObjectsUsingBlock:^(CDEObjectChange *change, NSUInteger i, BOOL *stop) {
+        change.globalIdentifier.storeURI = uris[i];
+    }];
+    
+    return YES;
+}
+
+
 #pragma mark Applying Insertions
 
 // Called on event context queue
@@ -656,6 +841,12 @@
 
 // Called on event child context queue
 - (BOOL)applyObjectPropertyChanges:(NSArray *)changes error:(NSError * __autoreleasing *)error
+{
+    return [self applyObjectPropertyChanges:changes includingAttributes:YES error:error];
+}
+
+// Called on event child context queue
+- (BOOL)applyObjectPropertyChanges:(NSArray *)changes includingAttributes:(BOOL)includeAttributes error:(NSError * __autoreleasing *)error
 {
     if (changes.count == 0) return YES;
     
@@ -682,8 +873,10 @@
                 
                 [managedObjectContext performBlockAndWait:^{
                     // Attribute changes
-                    NSArray *attributeChanges = [propertyChangeValues filteredArrayUsingPredicate:attributePredicate];
-                    [self applyAttributeChanges:attributeChanges toObject:object];
+                    if (includeAttributes) {
+                        NSArray *attributeChanges = [propertyChangeValues filteredArrayUsingPredicate:attributePredicate];
+                        [self applyAttributeChanges:attributeChanges toObject:object];
+                    }
                     
                     // To-one relationship changes
                     NSArray *toOneChanges = [propertyChangeValues filteredArrayUsingPredicate:toOneRelationshipPredicate];
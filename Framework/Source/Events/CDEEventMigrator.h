@@ -13,18 +13,26 @@
 
 @class CDEEventStore;
 @class CDEPersistentStoreEnsemble;
+@class CDEBaselineIndex;
 
 @interface CDEEventMigrator : NSObject
 
 @property (nonatomic, strong, readonly) CDEEventStore *eventStore;
 @property (nonatomic, strong, readwrite) NSString *storeTypeForNewFiles;
 @property (nonatomic, weak, readwrite) CDEPersistentStoreEnsemble *ensemble;
+@property (nonatomic, assign, readwrite) NSUInteger maximumConcurrentExports; // Default is the number of active processors, up to 4
 
 - (instancetype)initWithEventStore:(CDEEventStore *)newStore;
 
 - (void)migrateLocalEventWithRevision:(CDERevisionNumber)revision toFile:(NSString *)path allowedTypes:(NSArray *)types completion:(CDECompletionBlock)completion;
 - (void)migrateLocalBaselineWithUniqueIdentifier:(NSString *)uniqueId globalCount:(CDEGlobalCount)count persistentStorePrefix:(NSString *)storePrefix toFile:(NSString *)path completion:(CDECompletionBlock)completion;
+- (void)migrateLocalEventsMatchingPredicates:(NSArray *)predicates toFiles:(NSArray *)paths completion:(CDECompletionBlock)completion; // One event per predicate, exported concurrently
 - (void)migrateNonBaselineEventsSinceRevision:(CDERevisionNumber)revision toFile:(NSString *)path completion:(CDECompletionBlock)completion;
 - (void)migrateEventsInFromFiles:(NSArray *)paths completion:(CDECompletionBlock)completion;
 
+// Baselines in segments, each holding the object changes of one entity in one range of global identifier hashes.
+// Segments are named for their contents, and only those missing from the existing filenames are written.
+- (void)migrateLocalBaselineMatchingPredicate:(NSPredicate *)predicate toSegmentsInDirectory:(NSString *)directory excludingSegmentFilenames:(NSSet *)existingFilenames completion:(void(^)(CDEBaselineIndex *index, NSError *error))completion;
+- (void)migrateBaselineWithIndex:(CDEBaselineIndex *)index inFromSegmentFiles:(NSArray *)paths completion:(CDECompletionBlock)completion;
+
 @end
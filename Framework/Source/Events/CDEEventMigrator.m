@@ -9,19 +9,134 @@
 #import "CDEEventMigrator.h"
 #import "CDEDefines.h"
 #import "NSMapTable+CDEAdditions.h"
+#import "NSManagedObjectModel+CDEAdditions.h"
 #import "CDEEventStore.h"
 #import "CDEGlobalIdentifier.h"
 #import "CDEEventRevision.h"
 #import "CDERevision.h"
 #import "CDEStoreModificationEvent.h"
 #import "CDEObjectChange.h"
+#import "CDEPropertyChangeValue.h"
+#import "CDEEventStream.h"
+#import "CDEDataFile.h"
+#import "CDEBaselineIndex.h"
+#import "CDEFoundationAdditions.h"
 
 static NSString *kCDEDefaultStoreType;
 
+static const NSUInteger CDEEventFileImportBatchSize = 25;
+static const NSUInteger CDEGlobalIdentifierFetchBatchSize = 500;
+static const NSUInteger CDEMaximumConcurrentExports = 4;
+static const NSUInteger CDEBaselineSegmentTargetSize = 2000;
+
+static NSString * const CDEBaselineSegmentFilenameExtension = @"cdesegment";
+
+// FNV-1a. Stable across launches and platforms, unlike -[NSString hash].
+static uint32_t CDEBaselineSegmentHash(NSString *string)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = string.UTF8String; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+@interface NSData (CDECanonicalEncoding)
+- (NSComparisonResult)cde_compareBytes:(NSData *)other;
+@end
+
+@implementation NSData (CDECanonicalEncoding)
+
+- (NSComparisonResult)cde_compareBytes:(NSData *)other
+{
+    int result = memcmp(self.bytes, other.bytes, MIN(self.length, other.length));
+    if (result == 0) return self.length == other.length ? NSOrderedSame : (self.length < other.length ? NSOrderedAscending : NSOrderedDescending);
+    return result < 0 ? NSOrderedAscending : NSOrderedDescending;
+}
+
+@end
+
+// Encodes a property value the same way regardless of how it was built, for naming segments by their contents.
+// Sets and dictionaries are sorted, and every part is tagged and prefixed by its length, so encodings can't run together.
+static NSData *CDECanonicalEncoding(id value)
+{
+    NSMutableData *encoding = [[NSMutableData alloc] init];
+    NSString *tag = nil;
+    NSData *body = nil;
+    if (!value || value == [NSNull null]) {
+        tag = @"-";
+    }
+    else if ([value isKindOfClass:[NSData class]]) {
+        tag = @"d";
+        body = value;
+    }
+    else if ([value isKindOfClass:[NSString class]]) {
+        tag = @"s";
+        body = [value dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    else if ([value isKindOfClass:[NSNumber class]]) {
+        const char *type = [value objCType];
+        BOOL isFloat = strcmp(type, @encode(float)) == 0 || strcmp(type, @encode(double)) == 0;
+        BOOL isUnsigned = strcmp(type, @encode(unsigned long long)) == 0 || strcmp(type, @encode(unsigned long)) == 0;
+        NSString *string = nil;
+        if (isFloat) string = [NSString stringWithFormat:@"%a", [value doubleValue]];
+        else if (isUnsigned) string = [NSString stringWithFormat:@"%llu", [value unsignedLongLongValue]];
+        else string = [NSString stringWithFormat:@"%lld", [value longLongValue]];
+        tag = @"n";
+        body = [string dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    else if ([value isKindOfClass:[NSDate class]]) {
+        tag = @"t";
+        body = [[NSString stringWithFormat:@"%a", [value timeIntervalSinceReferenceDate]] dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    else if ([value isKindOfClass:[NSUUID class]]) {
+        tag = @"u";
+        body = [[value UUIDString] dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    else if ([value isKindOfClass:[NSURL class]]) {
+        tag = @"l";
+        body = [[value absoluteString] dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    else if ([value isKindOfClass:[NSArray class]] || [value isKindOfClass:[NSSet class]]) {
+        BOOL ordered = [value isKindOfClass:[NSArray class]];
+        NSMutableArray *elements = [[NSMutableArray alloc] initWithCapacity:[value count]];
+        for (id element in value) [elements addObject:CDECanonicalEncoding(element)];
+        if (!ordered) [elements sortUsingSelector:@selector(cde_compareBytes:)];
+        tag = ordered ? @"a" : @"e";
+        NSMutableData *elementData = [[NSMutableData alloc] init];
+        for (NSData *element in elements) [elementData appendData:element];
+        body = elementData;
+    }
+    else if ([value isKindOfClass:[NSDictionary class]]) {
+        NSMutableArray *entries = [[NSMutableArray alloc] initWithCapacity:[value count]];
+        [value enumerateKeysAndObjectsUsingBlock:^(id key, id object, BOOL *stop) {
+            NSMutableData *entry = [CDECanonicalEncoding(key) mutableCopy];
+            [entry appendData:CDECanonicalEncoding(object)];
+            [entries addObject:entry];
+        }];
+        [entries sortUsingSelector:@selector(cde_compareBytes:)];
+        tag = @"m";
+        NSMutableData *entryData = [[NSMutableData alloc] init];
+        for (NSData *entry in entries) [entryData appendData:entry];
+        body = entryData;
+    }
+    else {
+        tag = @"o";
+        body = [[NSString stringWithFormat:@"%@ %@", NSStringFromClass([value class]), value] dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    
+    NSString *header = [NSString stringWithFormat:@"%@%lu:", tag, (unsigned long)body.length];
+    [encoding appendData:[header dataUsingEncoding:NSUTF8StringEncoding]];
+    if (body) [encoding appendData:body];
+    return encoding;
+}
+
 @implementation CDEEventMigrator
 
 @synthesize eventStore = eventStore;
 @synthesize storeTypeForNewFiles = storeTypeForNewFiles;
+@synthesize maximumConcurrentExports = maximumConcurrentExports;
 
 + (void)initialize
 {
@@ -36,6 +151,7 @@ static NSString *kCDEDefaultStoreType;
     if (self) {
         eventStore = newStore;
         storeTypeForNewFiles = kCDEDefaultStoreType;
+        maximumConcurrentExports = MIN([[NSProcessInfo processInfo] activeProcessorCount], CDEMaximumConcurrentExports);
     }
     return self;
 }
@@ -52,7 +168,7 @@ static NSString *kCDEDefaultStoreType;
         else {
             NSDictionary *info = @{NSLocalizedDescriptionKey : @"Failed to fetch local event in migrateLocalEventToTemporaryFilesForRevision..."};
             error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:info];
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (completion) completion(error);
             });
         }
@@ -72,7 +188,7 @@ static NSString *kCDEDefaultStoreType;
         else {
             NSDictionary *info = @{NSLocalizedDescriptionKey : @"Failed to fetch local event in migrateLocalBaselineWithUniqueIdentifier..."};
             error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:info];
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (completion) completion(error);
             });
         }
@@ -85,7 +201,7 @@ static NSString *kCDEDefaultStoreType;
         NSError *error = nil;
         NSArray *events = [self storeModificationEventsCreatedLocallySinceRevisionNumber:revision error:&error];
         if (!events) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 if (completion) completion(error);
             });
         }
@@ -96,24 +212,38 @@ static NSString *kCDEDefaultStoreType;
 }
 
 - (void)migrateStoreModificationEvents:(NSArray *)events toFile:(NSString *)path completion:(CDECompletionBlock)completion
+{
+    NSError *error = nil;
+    BOOL success = [self migrateStoreModificationEvents:events toFile:path error:&error];
+    dispatch_async(CDEWorkQueue(), ^{
+        if (completion) completion(success ? nil : error);
+    });
+}
+
+- (BOOL)migrateStoreModificationEvents:(NSArray *)events toFile:(NSString *)path error:(NSError * __autoreleasing *)error
 {
     CDELog(CDELoggingLevelVerbose, @"Migrating event store events to file");
     
+    if ([self.storeTypeForNewFiles isEqualToString:CDEEventStreamStoreType]) {
+        return [self writeStoreModificationEvents:events toEventStreamAtPath:path error:error];
+    }
+    
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated"
     NSManagedObjectContext *exportContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
 #pragma clang diagnostic pop
     NSPersistentStoreCoordinator *mainCoordinator = eventStore.managedObjectContext.persistentStoreCoordinator;
-    NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mainCoordinator.managedObjectModel];
+    NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mainCoordinator.managedObjectModel.cde_interchangeModel];
     exportContext.persistentStoreCoordinator = persistentStoreCoordinator;
     exportContext.undoManager = nil;
 
-    NSError *error = nil;
+    NSError *localError = nil;
+    BOOL success = YES;
     NSPersistentStore *fileStore = nil;
     @try {
         NSURL *fileURL = [NSURL fileURLWithPath:path];
         
-        fileStore = [persistentStoreCoordinator addPersistentStoreWithType:self.storeTypeForNewFiles configuration:nil URL:fileURL options:nil error:&error];
+        fileStore = [persistentStoreCoordinator addPersistentStoreWithType:self.storeTypeForNewFiles configuration:nil URL:fileURL options:nil error:&localError];
         if (!fileStore) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
         
         if (!events) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
@@ -124,19 +254,101 @@ static NSString *kCDEDefaultStoreType;
             [self migrateObject:event andRelatedObjectsToManagedObjectContext:exportContext withMigratedObjectsMap:toStoreObjectsByFromStoreObject];
         }
         
-        BOOL success = [exportContext save:&error];
+        success = [exportContext save:&localError];
         if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
     }
     @catch (NSException *exception) {
-        if (!error) error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey: exception.description}];
-        CDELog(CDELoggingLevelError, @"Failed to migrate modification events out to file: %@", error);
+        if (!localError) localError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey: exception.description}];
+        CDELog(CDELoggingLevelError, @"Failed to migrate modification events out to file: %@", localError);
+        success = NO;
     }
     @finally {
         [exportContext reset];
-        dispatch_async(dispatch_get_main_queue(), ^{
-            if (completion) completion(error);
+    }
+    
+    if (!success && error) *error = localError;
+    return success;
+}
+
+- (void)migrateLocalEventsMatchingPredicates:(NSArray *)predicates toFiles:(NSArray *)paths completion:(CDECompletionBlock)completion
+{
+    NSAssert(predicates.count == paths.count, @"Each file needs one predicate");
+    
+    // Each lane exports its share of the files serially, on its own read-only snapshot of the event store.
+    // A store that can't be opened a second time, like an in-memory store, is exported on one lane.
+    NSPersistentStoreCoordinator *mainCoordinator = eventStore.managedObjectContext.persistentStoreCoordinator;
+    NSPersistentStore *eventStoreStore = mainCoordinator.persistentStores.firstObject;
+    BOOL canOpenSnapshots = [eventStoreStore.type isEqualToString:NSSQLiteStoreType] && eventStoreStore.URL != nil;
+    NSUInteger laneCount = canOpenSnapshots ? MAX(self.maximumConcurrentExports, 1) : 1;
+    laneCount = MIN(laneCount, paths.count);
+    
+    CDELog(CDELoggingLevelVerbose, @"Exporting %lu events on %lu lanes", (unsigned long)paths.count, (unsigned long)laneCount);
+    
+    __block NSError *lastError = nil;
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    for (NSUInteger lane = 0; lane < laneCount; lane++) {
+        dispatch_group_async(group, queue, ^{
+            NSError *laneError = nil;
+            NSManagedObjectContext *context = self->eventStore.managedObjectContext;
+            if (canOpenSnapshots) context = [self newSnapshotContextForStoreAtURL:eventStoreStore.URL error:&laneError];
+            if (!context) {
+                @synchronized (self) { lastError = laneError; }
+                return;
+            }
+            
+            [context performBlockAndWait:^{
+                for (NSUInteger i = lane; i < paths.count; i += laneCount) {
+                    NSError *fileError = nil;
+                    BOOL success;
+                    @autoreleasepool {
+                        success = [self migrateLocalEventMatchingPredicate:predicates[i] inContext:context toFile:paths[i] error:&fileError];
+                        if (canOpenSnapshots) [context reset];
+                    }
+                    if (!success) {
+                        CDELog(CDELoggingLevelError, @"Failed to export event to file %@: %@", [paths[i] lastPathComponent], fileError);
+                        @synchronized (self) { lastError = fileError; }
+                    }
+                }
+            }];
         });
     }
+    
+    dispatch_group_notify(group, CDEWorkQueue(), ^{
+        if (completion) completion(lastError);
+    });
+}
+
+- (NSManagedObjectContext *)newSnapshotContextForStoreAtURL:(NSURL *)storeURL error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectModel *model = eventStore.managedObjectContext.persistentStoreCoordinator.managedObjectModel;
+    NSPersistentStoreCoordinator *coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+    NSDictionary *options = @{NSReadOnlyPersistentStoreOption: @YES};
+    NSPersistentStore *store = [coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:storeURL options:options error:error];
+    if (!store) return nil;
+    
+    NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+    [context performBlockAndWait:^{
+        context.persistentStoreCoordinator = coordinator;
+        context.undoManager = nil;
+    }];
+    return context;
+}
+
+- (BOOL)migrateLocalEventMatchingPredicate:(NSPredicate *)predicate inContext:(NSManagedObjectContext *)context toFile:(NSString *)path error:(NSError * __autoreleasing *)error
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    fetch.predicate = predicate;
+    NSArray *events = [context executeFetchRequest:fetch error:error];
+    if (!events) return NO;
+    
+    if (events.count != 1) {
+        NSString *description = [NSString stringWithFormat:@"Expected one local event for file, but found %lu", (unsigned long)events.count];
+        if (error) *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey : description}];
+        return NO;
+    }
+    
+    return [self migrateStoreModificationEvents:events toFile:path error:error];
 }
 
 - (void)migrateEventsInFromFiles:(NSArray *)paths completion:(CDECompletionBlock)completion
@@ -144,71 +356,452 @@ static NSString *kCDEDefaultStoreType;
     CDELog(CDELoggingLevelVerbose, @"Migrating file events to event store from paths: %@", paths);
     
     [self.eventStore.managedObjectContext performBlock:^{
+        NSError *error = nil;
+        NSMutableArray *storePaths = [[NSMutableArray alloc] initWithCapacity:paths.count];
+        for (NSString *path in paths) {
+            if ([CDEEventStreamReader isEventStreamAtPath:path]) {
+                NSError *streamError = nil;
+                if (![self importEventsFromEventStreamAtPath:path error:&streamError]) {
+                    CDELog(CDELoggingLevelError, @"Failed to import event stream: %@", streamError);
+                    error = streamError;
+                }
+            }
+            else {
+                [storePaths addObject:path];
+            }
+        }
+        
+        // Import store files several at a time, each batch in one transaction
+        for (NSUInteger i = 0; i < storePaths.count; i += CDEEventFileImportBatchSize) {
+            NSRange range = NSMakeRange(i, MIN(CDEEventFileImportBatchSize, storePaths.count - i));
+            NSArray *batch = [storePaths subarrayWithRange:range];
+            
+            NSError *batchError = nil;
+            BOOL success = [self migrateEventsInFromStoreFiles:batch error:&batchError];
+            if (success) continue;
+            
+            if (batch.count == 1) {
+                error = batchError;
+                continue;
+            }
+            
+            // A bad file shouldn't hold back the others, so retry one file at a time
+            CDELog(CDELoggingLevelWarning, @"Batch import failed. Retrying files individually. Error: %@", batchError);
+            for (NSString *path in batch) {
+                NSError *fileError = nil;
+                if (![self migrateEventsInFromStoreFiles:@[path] error:&fileError]) error = fileError;
+            }
+        }
+        
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(error);
+        });
+    }];
+}
+
+- (BOOL)migrateEventsInFromStoreFiles:(NSArray *)paths error:(NSError * __autoreleasing *)error
+{
+    // Load all files into one coordinator, so global identifiers are deduplicated across them in memory,
+    // and the event store is saved once for the whole batch
+    NSManagedObjectContext *eventStoreContext = self.eventStore.managedObjectContext;
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated"
-        NSManagedObjectContext *importContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
+    NSManagedObjectContext *importContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
 #pragma clang diagnostic pop
-        NSPersistentStoreCoordinator *mainCoordinator = self->eventStore.managedObjectContext.persistentStoreCoordinator;
-        NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mainCoordinator.managedObjectModel];
-        importContext.persistentStoreCoordinator = persistentStoreCoordinator;
-        importContext.undoManager = nil;
+    NSPersistentStoreCoordinator *mainCoordinator = eventStoreContext.persistentStoreCoordinator;
+    NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mainCoordinator.managedObjectModel.cde_interchangeModel];
+    importContext.persistentStoreCoordinator = persistentStoreCoordinator;
+    importContext.undoManager = nil;
+    
+    NSError *localError = nil;
+    BOOL success = YES;
+    @try {
+        @autoreleasepool {
+            success = [self addPersistentStoresForFiles:paths toCoordinator:persistentStoreCoordinator error:&localError];
+            if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+            
+            success = [self migrateObjectsInContext:importContext toContext:eventStoreContext error:&localError];
+            if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+            
+            success = [eventStoreContext save:&localError];
+            if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+        }
+    }
+    @catch (NSException *exception) {
+        if (!localError) localError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey: exception.description}];
+        CDELog(CDELoggingLevelError, @"Failed to migrate modification events: %@", localError);
+        [eventStoreContext rollback];
+        success = NO;
+    }
+    @finally {
+        [importContext reset];
+        for (NSPersistentStore *store in [persistentStoreCoordinator.persistentStores copy]) {
+            [persistentStoreCoordinator removePersistentStore:store error:NULL];
+        }
+    }
+    
+    if (!success && error) *error = localError;
+    return success;
+}
+
+- (BOOL)addPersistentStoresForFiles:(NSArray *)paths toCoordinator:(NSPersistentStoreCoordinator *)persistentStoreCoordinator error:(NSError * __autoreleasing *)error
+{
+    for (NSString *path in paths) {
+        NSURL *fileURL = [NSURL fileURLWithPath:path];
         
-        NSError *error = nil;
-        NSPersistentStore *fileStore = nil;
-        @try {
-            for (NSString *path in paths) {
-                @autoreleasepool {
-                    NSURL *fileURL = [NSURL fileURLWithPath:path];
-                    
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated"
-                    NSDictionary *metadata = [NSPersistentStoreCoordinator metadataForPersistentStoreOfType:nil URL:fileURL error:&error];
+        NSDictionary *metadata = [NSPersistentStoreCoordinator metadataForPersistentStoreOfType:nil URL:fileURL error:error];
 #pragma clang diagnostic pop
-                    NSString *storeType = metadata[NSStoreTypeKey];
-                    if (!storeType) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
-                  
-                    NSDictionary *options = nil;
-                    if (@available(macos 10.13, ios 11.0, tvos 11.0, watchos 4.0, *)) {
-                        options = @{NSMigratePersistentStoresAutomaticallyOption: @YES, NSInferMappingModelAutomaticallyOption: @YES, NSBinaryStoreInsecureDecodingCompatibilityOption: @YES};
-                    } else {
-                        // Fallback on earlier versions
-                        options = @{NSMigratePersistentStoresAutomaticallyOption: @YES, NSInferMappingModelAutomaticallyOption: @YES};
-                    }
-                  
-                    fileStore = [importContext.persistentStoreCoordinator addPersistentStoreWithType:storeType configuration:nil URL:fileURL options:options error:&error];
-                  
-                    if (!fileStore) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
-                    
-                    BOOL success = [self migrateObjectsInContext:importContext toContext:self.eventStore.managedObjectContext error:&error];
-                    if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
-                    
-                    success = [importContext.persistentStoreCoordinator removePersistentStore:fileStore error:&error];
-                    fileStore = nil;
-                    if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
-                    
-                    success = [self.eventStore.managedObjectContext save:&error];
-                    [importContext reset];
-                    if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
-                }
+        NSString *storeType = metadata[NSStoreTypeKey];
+        if (!storeType) return NO;
+        
+        NSDictionary *options = nil;
+        if (@available(macos 10.13, ios 11.0, tvos 11.0, watchos 4.0, *)) {
+            options = @{NSMigratePersistentStoresAutomaticallyOption: @YES, NSInferMappingModelAutomaticallyOption: @YES, NSBinaryStoreInsecureDecodingCompatibilityOption: @YES};
+        } else {
+            // Fallback on earlier versions
+            options = @{NSMigratePersistentStoresAutomaticallyOption: @YES, NSInferMappingModelAutomaticallyOption: @YES};
+        }
+        
+        NSPersistentStore *fileStore = [persistentStoreCoordinator addPersistentStoreWithType:storeType configuration:nil URL:fileURL options:options error:error];
+        if (!fileStore) return NO;
+    }
+    return YES;
+}
+
+- (BOOL)writeStoreModificationEvents:(NSArray *)events toEventStreamAtPath:(NSString *)path error:(NSError * __autoreleasing *)error
+{
+    NSError *localError = nil;
+    CDEEventStreamWriter *writer = [[CDEEventStreamWriter alloc] initWithPath:path];
+    BOOL success = events != nil && [writer open:&localError];
+    for (CDEStoreModificationEvent *event in events) {
+        if (!success) break;
+        success = [writer writeStoreModificationEvent:event error:&localError];
+    }
+    if (success) success = [writer close:&localError];
+    
+    if (!success) {
+        if (!localError) localError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:nil];
+        CDELog(CDELoggingLevelError, @"Failed to write modification events to event stream: %@", localError);
+        [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+        if (error) *error = localError;
+    }
+    
+    return success;
+}
+
+- (BOOL)importEventsFromEventStreamAtPath:(NSString *)path error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = self.eventStore.managedObjectContext;
+    CDEEventStreamReader *reader = [[CDEEventStreamReader alloc] initWithPath:path];
+    if (![reader open:error]) return NO;
+    
+    NSError *localError = nil;
+    BOOL success = YES;
+    while (success) {
+        @autoreleasepool {
+            NSError *readError = nil;
+            NSManagedObjectID *eventID = [reader importNextStoreModificationEventIntoContext:context error:&readError];
+            localError = readError;
+            success = readError == nil;
+            if (!eventID) break;
+        }
+    }
+    [reader close];
+    
+    if (!success && error) *error = localError;
+    return success;
+}
+
+
+#pragma mark Baseline Segments
+
+- (void)migrateLocalBaselineMatchingPredicate:(NSPredicate *)predicate toSegmentsInDirectory:(NSString *)directory excludingSegmentFilenames:(NSSet *)existingFilenames completion:(void(^)(CDEBaselineIndex *index, NSError *error))completion
+{
+    [eventStore.managedObjectContext performBlock:^{
+        NSError *error = nil;
+        CDEBaselineIndex *index = [self migrateLocalBaselineMatchingPredicate:predicate toSegmentsInDirectory:directory excludingSegmentFilenames:existingFilenames error:&error];
+        if (!index) CDELog(CDELoggingLevelError, @"Failed to export baseline segments: %@", error);
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(index, index ? nil : error);
+        });
+    }];
+}
+
+- (CDEBaselineIndex *)migrateLocalBaselineMatchingPredicate:(NSPredicate *)predicate toSegmentsInDirectory:(NSString *)directory excludingSegmentFilenames:(NSSet *)existingFilenames error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    fetch.predicate = predicate;
+    NSArray *events = [context executeFetchRequest:fetch error:error];
+    if (!events) return nil;
+    
+    if (events.count != 1) {
+        NSString *description = [NSString stringWithFormat:@"Expected one local baseline for segments, but found %lu", (unsigned long)events.count];
+        if (error) *error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey : description}];
+        return nil;
+    }
+    CDEStoreModificationEvent *baseline = events.lastObject;
+    
+    NSDictionary *objectIDsBySegmentKey = [self objectChangeIDsBySegmentKeyForStoreModificationEvent:baseline error:error];
+    if (!objectIDsBySegmentKey) return nil;
+    
+    NSMutableArray *filenames = [[NSMutableArray alloc] initWithCapacity:objectIDsBySegmentKey.count];
+    NSError *localError = nil;
+    for (NSString *segmentKey in [objectIDsBySegmentKey.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        BOOL success = YES;
+        @autoreleasepool {
+            NSFetchRequest *changesFetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+            changesFetch.predicate = [NSPredicate predicateWithFormat:@"SELF IN %@", objectIDsBySegmentKey[segmentKey]];
+            changesFetch.relationshipKeyPathsForPrefetching = @[@"globalIdentifier", @"dataFiles"];
+            NSArray *changes = [context executeFetchRequest:changesFetch error:&localError];
+            success = changes != nil;
+            
+            NSString *filename = success ? [self segmentFilenameForObjectChanges:changes segmentKey:segmentKey] : nil;
+            NSString *path = [directory stringByAppendingPathComponent:filename];
+            BOOL written = [existingFilenames containsObject:filename] || [[NSFileManager defaultManager] fileExistsAtPath:path];
+            if (success && !written) {
+                success = [self migrateObjectChanges:changes ofStoreModificationEvent:baseline toSegmentFile:path error:&localError];
             }
+            if (success) [filenames addObject:filename];
+            
+            for (CDEObjectChange *change in changes) [context refreshObject:change mergeChanges:NO];
         }
-        @catch (NSException *exception) {
-            if (!error) error = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey: exception.description}];
-            CDELog(CDELoggingLevelError, @"Failed to migrate modification events: %@", error);
+        if (!success) {
+            if (error) *error = localError;
+            return nil;
         }
-        @finally {
-            [importContext reset];
-            dispatch_async(dispatch_get_main_queue(), ^{
-                if (completion) completion(error);
-            });
+    }
+    
+    CDEBaselineIndex *index = [[CDEBaselineIndex alloc] initWithStoreModificationEvent:baseline];
+    index.segmentFilenames = filenames;
+    return index;
+}
+
+// Changes are grouped by entity, then by the leading bits of a hash of the global identifier. The number of bits
+// grows with the entity, so segments stay near the target size, and an object stays in the same segment between baselines.
+- (NSDictionary *)objectChangeIDsBySegmentKeyForStoreModificationEvent:(CDEStoreModificationEvent *)event error:(NSError * __autoreleasing *)error
+{
+    NSExpressionDescription *objectIDDescription = [[NSExpressionDescription alloc] init];
+    objectIDDescription.name = @"objectID";
+    objectIDDescription.expression = [NSExpression expressionForEvaluatedObject];
+    objectIDDescription.expressionResultType = NSObjectIDAttributeType;
+    
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent = %@", event];
+    fetch.propertiesToFetch = @[objectIDDescription, @"nameOfEntity", @"globalIdentifier.globalIdentifier"];
+    fetch.resultType = NSDictionaryResultType;
+    NSArray *rows = [eventStore.managedObjectContext executeFetchRequest:fetch error:error];
+    if (!rows) return nil;
+    
+    NSMutableDictionary *rowsByEntity = [[NSMutableDictionary alloc] init];
+    for (NSDictionary *row in rows) {
+        NSString *entityName = row[@"nameOfEntity"];
+        NSMutableArray *entityRows = rowsByEntity[entityName];
+        if (!entityRows) entityRows = rowsByEntity[entityName] = [[NSMutableArray alloc] init];
+        [entityRows addObject:row];
+    }
+    
+    NSMutableDictionary *objectIDsBySegmentKey = [[NSMutableDictionary alloc] init];
+    [rowsByEntity enumerateKeysAndObjectsUsingBlock:^(NSString *entityName, NSArray *entityRows, BOOL *stop) {
+        NSUInteger bits = 0;
+        while (bits < 16 && (entityRows.count >> bits) > CDEBaselineSegmentTargetSize) bits++;
+        
+        for (NSDictionary *row in entityRows) {
+            uint32_t range = bits == 0 ? 0 : CDEBaselineSegmentHash(row[@"globalIdentifier.globalIdentifier"]) >> (32 - bits);
+            NSString *segmentKey = [NSString stringWithFormat:@"%@_%lu_%u", entityName, (unsigned long)bits, range];
+            NSMutableArray *objectIDs = objectIDsBySegmentKey[segmentKey];
+            if (!objectIDs) objectIDs = objectIDsBySegmentKey[segmentKey] = [[NSMutableArray alloc] init];
+            [objectIDs addObject:row[@"objectID"]];
         }
     }];
+    
+    return objectIDsBySegmentKey;
 }
 
+// Named for the contents, so a segment that is unchanged in a new baseline has the same name, and is not uploaded again
+- (NSString *)segmentFilenameForObjectChanges:(NSArray *)changes segmentKey:(NSString *)segmentKey
+{
+    NSArray *sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"globalIdentifier.globalIdentifier" ascending:YES]];
+    NSMutableData *contents = [[segmentKey dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    for (CDEObjectChange *change in [changes sortedArrayUsingDescriptors:sortDescriptors]) {
+        NSArray *dataFilenames = [[change.dataFiles valueForKeyPath:@"filename"] allObjects];
+        NSString *description = [NSString stringWithFormat:@"\n%@\n%d\n%@\n", change.globalIdentifier.globalIdentifier, (int)change.type, [[dataFilenames sortedArrayUsingSelector:@selector(compare:)] componentsJoinedByString:@","]];
+        [contents appendData:[description dataUsingEncoding:NSUTF8StringEncoding]];
+        
+        // The order of property values depends on how the change was built, so they are sorted by name
+        NSArray *propertyNameSort = @[[NSSortDescriptor sortDescriptorWithKey:@"propertyName" ascending:YES], [NSSortDescriptor sortDescriptorWithKey:@"type" ascending:YES]];
+        for (CDEPropertyChangeValue *value in [change.propertyChangeValues sortedArrayUsingDescriptors:propertyNameSort]) {
+            NSArray *fields = @[CDENilToNSNull(value.propertyName), @(value.type), CDENilToNSNull(value.value), CDENilToNSNull(value.filename), CDENilToNSNull(value.chunkFilenames), CDENilToNSNull(value.relatedIdentifier), CDENilToNSNull(value.addedIdentifiers), CDENilToNSNull(value.removedIdentifiers), CDENilToNSNull(value.movedIdentifiersByIndex)];
+            [contents appendData:CDECanonicalEncoding(fields)];
+        }
+    }
+    return [contents.cde_SHA256String stringByAppendingPathExtension:CDEBaselineSegmentFilenameExtension];
+}
+
+- (BOOL)migrateObjectChanges:(NSArray *)changes ofStoreModificationEvent:(CDEStoreModificationEvent *)event toSegmentFile:(NSString *)path error:(NSError * __autoreleasing *)error
+{
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated"
+    NSManagedObjectContext *exportContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
+#pragma clang diagnostic pop
+    NSPersistentStoreCoordinator *mainCoordinator = eventStore.managedObjectContext.persistentStoreCoordinator;
+    NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mainCoordinator.managedObjectModel.cde_interchangeModel];
+    exportContext.persistentStoreCoordinator = persistentStoreCoordinator;
+    exportContext.undoManager = nil;
+    
+    NSError *localError = nil;
+    BOOL success = YES;
+    @try {
+        // Segments are always stores, because event streams only hold whole events
+        NSURL *fileURL = [NSURL fileURLWithPath:path];
+        NSPersistentStore *fileStore = [persistentStoreCoordinator addPersistentStoreWithType:kCDEDefaultStoreType configuration:nil URL:fileURL options:nil error:&localError];
+        if (!fileStore) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+        
+        // A placeholder stands in for the baseline, so the segment doesn't depend on which baseline it belongs to
+        CDEStoreModificationEvent *placeholder = [NSEntityDescription insertNewObjectForEntityForName:@"CDEStoreModificationEvent" inManagedObjectContext:exportContext];
+        placeholder.type = CDEStoreModificationEventTypeBaseline;
+        placeholder.uniqueIdentifier = path.lastPathComponent.stringByDeletingPathExtension;
+        placeholder.timestamp = 0.0;
+        placeholder.eventRevision = [CDEEventRevision makeEventRevisionForPersistentStoreIdentifier:event.eventRevision.persistentStoreIdentifier revisionNumber:0 inManagedObjectContext:exportContext];
+        
+        NSMapTable *toStoreObjectsByFromStoreObject = [NSMapTable cde_strongToStrongObjectsMapTable];
+        [toStoreObjectsByFromStoreObject setObject:placeholder forKey:event];
+        for (CDEObjectChange *change in changes) {
+            [self migrateObject:change andRelatedObjectsToManagedObjectContext:exportContext withMigratedObjectsMap:toStoreObjectsByFromStoreObject];
+        }
+        
+        success = [exportContext save:&localError];
+        if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+    }
+    @catch (NSException *exception) {
+        if (!localError) localError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey: exception.description}];
+        CDELog(CDELoggingLevelError, @"Failed to migrate object changes out to segment: %@", localError);
+        success = NO;
+    }
+    @finally {
+        [exportContext reset];
+    }
+    
+    if (!success && error) *error = localError;
+    return success;
+}
+
+- (void)migrateBaselineWithIndex:(CDEBaselineIndex *)index inFromSegmentFiles:(NSArray *)paths completion:(CDECompletionBlock)completion
+{
+    CDELog(CDELoggingLevelVerbose, @"Migrating baseline %@ in from %lu segments", index.uniqueIdentifier, (unsigned long)paths.count);
+    
+    [self.eventStore.managedObjectContext performBlock:^{
+        NSError *error = nil;
+        BOOL success = [self migrateBaselineWithIndex:index inFromSegmentFiles:paths error:&error];
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(success ? nil : error);
+        });
+    }];
+}
+
+- (BOOL)migrateBaselineWithIndex:(CDEBaselineIndex *)index inFromSegmentFiles:(NSArray *)paths error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = self.eventStore.managedObjectContext;
+    
+    // The baseline is incomplete until every segment is saved, so an interrupted import is discarded at launch
+    [self.eventStore registerIncompleteEventIdentifier:index.uniqueIdentifier isMandatory:NO];
+    CDEStoreModificationEvent *baseline = [NSEntityDescription insertNewObjectForEntityForName:@"CDEStoreModificationEvent" inManagedObjectContext:context];
+    baseline.type = CDEStoreModificationEventTypeIncomplete;
+    [index applyToStoreModificationEvent:baseline];
+    
+    NSError *localError = nil;
+    BOOL success = [context save:&localError];
+    for (NSUInteger i = 0; success && i < paths.count; i += CDEEventFileImportBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEEventFileImportBatchSize, paths.count - i));
+        @autoreleasepool {
+            success = [self migrateObjectChangesInSegmentFiles:[paths subarrayWithRange:range] intoStoreModificationEvent:baseline error:&localError];
+        }
+    }
+    
+    if (success) {
+        baseline.type = CDEStoreModificationEventTypeBaseline;
+        success = [context save:&localError];
+    }
+    
+    if (success) {
+        [self.eventStore deregisterIncompleteEventIdentifier:index.uniqueIdentifier];
+    }
+    else {
+        CDELog(CDELoggingLevelError, @"Failed to migrate baseline segments: %@", localError);
+        [context rollback];
+        if (!baseline.isDeleted && baseline.managedObjectContext) [context deleteObject:baseline];
+        if ([context save:NULL]) [self.eventStore deregisterIncompleteEventIdentifier:index.uniqueIdentifier];
+        if (error) *error = localError;
+    }
+    
+    return success;
+}
+
+- (BOOL)migrateObjectChangesInSegmentFiles:(NSArray *)paths intoStoreModificationEvent:(CDEStoreModificationEvent *)event error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *eventStoreContext = self.eventStore.managedObjectContext;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated"
+    NSManagedObjectContext *importContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
+#pragma clang diagnostic pop
+    NSPersistentStoreCoordinator *mainCoordinator = eventStoreContext.persistentStoreCoordinator;
+    NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mainCoordinator.managedObjectModel.cde_interchangeModel];
+    importContext.persistentStoreCoordinator = persistentStoreCoordinator;
+    importContext.undoManager = nil;
+    
+    NSError *localError = nil;
+    BOOL success = YES;
+    NSMapTable *toObjectsByFromObject = [NSMapTable cde_strongToStrongObjectsMapTable];
+    @try {
+        success = [self addPersistentStoresForFiles:paths toCoordinator:persistentStoreCoordinator error:&localError];
+        if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+        
+        NSMapTable *toGlobalIdsByFromGlobalId = [self migrateGlobalIdentifiersInContext:importContext toContext:eventStoreContext error:&localError];
+        if (!toGlobalIdsByFromGlobalId) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+        [toObjectsByFromObject cde_addEntriesFromMapTable:toGlobalIdsByFromGlobalId];
+        
+        // Changes are attached to the baseline in place of each segment's placeholder event
+        NSArray *placeholders = [importContext executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"] error:&localError];
+        if (!placeholders) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+        for (CDEStoreModificationEvent *placeholder in placeholders) [toObjectsByFromObject setObject:event forKey:placeholder];
+        
+        NSFetchRequest *changesFetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+        changesFetch.relationshipKeyPathsForPrefetching = @[@"dataFiles"];
+        NSArray *changes = [importContext executeFetchRequest:changesFetch error:&localError];
+        if (!changes) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+        for (CDEObjectChange *change in changes) {
+            [self migrateObject:change andRelatedObjectsToManagedObjectContext:eventStoreContext withMigratedObjectsMap:toObjectsByFromObject];
+        }
+        
+        success = [eventStoreContext save:&localError];
+        if (!success) @throw [[NSException alloc] initWithName:CDEException reason:@"" userInfo:nil];
+        
+        for (NSManagedObject *object in toObjectsByFromObject.objectEnumerator) {
+            if (object != event) [eventStoreContext refreshObject:object mergeChanges:NO];
+        }
+    }
+    @catch (NSException *exception) {
+        if (!localError) localError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeUnknown userInfo:@{NSLocalizedDescriptionKey: exception.description}];
+        success = NO;
+    }
+    @finally {
+        [importContext reset];
+        for (NSPersistentStore *store in [persistentStoreCoordinator.persistentStores copy]) {
+            [persistentStoreCoordinator removePersistentStore:store error:NULL];
+        }
+    }
+    
+    if (!success && error) *error = localError;
+    return success;
+}
+
+
 - (BOOL)migrateObjectsInContext:(NSManagedObjectContext *)fromContext toContext:(NSManagedObjectContext *)toContext error:(NSError * __autoreleasing *)error
 {
     // Migrate global identifiers. Enforce uniqueness.
-    NSMapTable *toGlobalIdsByFromGlobalId = [self migrateEntity:@"CDEGlobalIdentifier" inManagedObjectContext:fromContext toContext:toContext enforceUniquenessForAttributes:@[@"nameOfEntity", @"globalIdentifier"] error:error];
+    NSMapTable *toGlobalIdsByFromGlobalId = [self migrateGlobalIdentifiersInContext:fromContext toContext:toContext error:error];
     if (!toGlobalIdsByFromGlobalId) return NO;
     
     // Retrieve modification events
@@ -299,53 +892,47 @@ static NSString *kCDEDefaultStoreType;
     return fromContextObjects;
 }
 
-- (NSMapTable *)migrateEntity:(NSString *)entityName inManagedObjectContext:(NSManagedObjectContext *)fromContext toContext:(NSManagedObjectContext *)toContext enforceUniquenessForAttributes:(NSArray *)uniqueAttributes error:(NSError * __autoreleasing *)error
+- (NSMapTable *)migrateGlobalIdentifiersInContext:(NSManagedObjectContext *)fromContext toContext:(NSManagedObjectContext *)toContext error:(NSError * __autoreleasing *)error
 {
-    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:entityName];
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEGlobalIdentifier"];
     NSArray *fromContextObjects = [fromContext executeFetchRequest:fetch error:error];
     if (!fromContextObjects) return nil;
     
-    NSFetchRequest *toContextFetch = [NSFetchRequest fetchRequestWithEntityName:entityName];
-    NSArray *toContextObjects = [toContext executeFetchRequest:toContextFetch error:error];
-    if (!toContextObjects) return nil;
-    
-    NSArray *toStoreKeys = [self uniqueKeysForObjects:toContextObjects uniqueAttributes:uniqueAttributes];
-    NSArray *fromStoreKeys = [self uniqueKeysForObjects:fromContextObjects uniqueAttributes:uniqueAttributes];
-
-    NSDictionary *toStoreObjectsByUniqueValue = [[NSDictionary alloc] initWithObjects:toContextObjects forKeys:toStoreKeys];
-    NSDictionary *fromStoreObjectsByUniqueValue = [[NSDictionary alloc] initWithObjects:fromContextObjects forKeys:fromStoreKeys];
+    // Look up existing identifiers in chunks, rather than fetching every global identifier in the event store
+    NSArray *identifierStrings = [[NSSet setWithArray:[fromContextObjects valueForKeyPath:@"globalIdentifier"]] allObjects];
+    NSMutableDictionary *toContextObjectsByKey = [[NSMutableDictionary alloc] initWithCapacity:identifierStrings.count];
+    for (NSUInteger i = 0; i < identifierStrings.count; i += CDEGlobalIdentifierFetchBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEGlobalIdentifierFetchBatchSize, identifierStrings.count - i));
+        NSFetchRequest *toContextFetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEGlobalIdentifier"];
+        toContextFetch.predicate = [NSPredicate predicateWithFormat:@"globalIdentifier IN %@", [identifierStrings subarrayWithRange:range]];
+        NSArray *toContextObjects = [toContext executeFetchRequest:toContextFetch error:error];
+        if (!toContextObjects) return nil;
+        
+        for (CDEGlobalIdentifier *toContextObject in toContextObjects) {
+            NSString *key = [self uniqueKeyForGlobalIdentifier:toContextObject];
+            if (!toContextObjectsByKey[key]) toContextObjectsByKey[key] = toContextObject;
+        }
+    }
     
+    // Several files can share a global identifier, so map every one of them, creating each new identifier once
     NSMapTable *toObjectByFromObject = [NSMapTable cde_strongToStrongObjectsMapTable];
-    for (id uniqueValue in fromStoreObjectsByUniqueValue) {
-        NSManagedObject *toContextObject = toStoreObjectsByUniqueValue[uniqueValue];
-        NSManagedObject *fromContextObject = fromStoreObjectsByUniqueValue[uniqueValue];
-        
-        if (toContextObject) {
-            [toObjectByFromObject setObject:toContextObject forKey:fromContextObject];
-            continue;
+    for (CDEGlobalIdentifier *fromContextObject in fromContextObjects) {
+        NSString *key = [self uniqueKeyForGlobalIdentifier:fromContextObject];
+        NSManagedObject *toContextObject = toContextObjectsByKey[key];
+        if (!toContextObject) {
+            toContextObject = [NSEntityDescription insertNewObjectForEntityForName:fromContextObject.entity.name inManagedObjectContext:toContext];
+            [self copyAttributesFromObject:fromContextObject toObject:toContextObject];
+            toContextObjectsByKey[key] = toContextObject;
         }
-        
-        toContextObject = [NSEntityDescription insertNewObjectForEntityForName:fromContextObject.entity.name inManagedObjectContext:toContext];
-        [self copyAttributesFromObject:fromContextObject toObject:toContextObject];
-        
         [toObjectByFromObject setObject:toContextObject forKey:fromContextObject];
     }
     
     return toObjectByFromObject;
 }
 
-- (NSArray *)uniqueKeysForObjects:(NSArray *)objects uniqueAttributes:(NSArray *)uniqueAttributes
+- (NSString *)uniqueKeyForGlobalIdentifier:(CDEGlobalIdentifier *)globalIdentifier
 {
-    NSMutableArray *keys = [[NSMutableArray alloc] init];
-    for (id object in objects) {
-        NSMutableString *key = [[NSMutableString alloc] init];
-        for (NSString *attribute in uniqueAttributes) {
-            [key appendString:[[object valueForKeyPath:attribute] description]];
-            [key appendString:@"__"];
-        }
-        [keys addObject:key];
-    }
-    return keys;
+    return [NSString stringWithFormat:@"%@__%@__", globalIdentifier.nameOfEntity, globalIdentifier.globalIdentifier];
 }
 
 - (void)copyAttributesFromObject:(NSManagedObject *)fromObject toObject:(NSManagedObject *)toObject
@@ -0,0 +1,31 @@
+//
+//  CDEEventPurger.h
+//  Ensembles
+//
+//  Removes events from the event store, together with their object changes, data files, revisions,
+//  statistics and the global identifiers left unreferenced. Where the store supports it, rows are
+//  removed with batch deletes in the store, children before parents, so nothing is faulted into the
+//  context and an interrupted purge leaves no dangling references. The context is refreshed after.
+//
+//  Created by Drew McCormack on 31/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "CDEDefines.h"
+
+@class CDEEventStore;
+
+@interface CDEEventPurger : NSObject
+
+@property (nonatomic, strong, readonly) CDEEventStore *eventStore;
+
+- (instancetype)initWithEventStore:(CDEEventStore *)eventStore;
+
+// Call on the queue of the event store context. Pending changes in the context are saved first.
+- (BOOL)purgeStoreModificationEventsWithObjectIDs:(NSArray *)eventIDs error:(NSError * __autoreleasing *)error;
+- (BOOL)purgeStoreModificationEventsMatchingPredicate:(NSPredicate *)predicate error:(NSError * __autoreleasing *)error;
+- (BOOL)purgeUnreferencedGlobalIdentifiers:(NSError * __autoreleasing *)error;
+
+@end
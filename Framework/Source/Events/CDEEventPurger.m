@@ -0,0 +1,280 @@
+//
+//  CDEEventPurger.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 31/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEEventPurger.h"
+#import "CDEEventStore.h"
+#import "CDEStoreModificationEvent.h"
+#import "CDEGlobalIdentifier.h"
+#import "CDEEventFileRecord.h"
+
+static const NSUInteger CDEEventPurgerBatchSize = 500;
+
+@interface CDEEventPurger ()
+
+- (BOOL)batchDeleteEventsWithObjectIDs:(NSArray *)eventIDs error:(NSError * __autoreleasing *)error API_AVAILABLE(macos(10.11), ios(9.0), tvos(9.0), watchos(2.0));
+- (BOOL)batchDeleteObjectsOfEntityNamed:(NSString *)entityName matchingPredicate:(NSPredicate *)predicate deletedObjectIDs:(NSMutableArray *)deletedIDs error:(NSError * __autoreleasing *)error API_AVAILABLE(macos(10.11), ios(9.0), tvos(9.0), watchos(2.0));
+- (BOOL)batchDecrementReferenceCountsOfGlobalIdentifiersWithObjectIDs:(NSArray *)globalIdentifierIDs by:(int64_t)decrement updatedObjectIDs:(NSMutableArray *)updatedIDs error:(NSError * __autoreleasing *)error API_AVAILABLE(macos(10.11), ios(9.0), tvos(9.0), watchos(2.0));
+- (void)mergeDeletedObjectIDs:(NSArray *)deletedIDs updatedObjectIDs:(NSArray *)updatedIDs API_AVAILABLE(macos(10.11), ios(9.0), tvos(9.0), watchos(2.0));
+
+@end
+
+@implementation CDEEventPurger
+
+@synthesize eventStore = eventStore;
+
+- (instancetype)initWithEventStore:(CDEEventStore *)newStore
+{
+    self = [super init];
+    if (self) {
+        eventStore = newStore;
+    }
+    return self;
+}
+
+
+#pragma mark Purging Events
+
+- (BOOL)purgeStoreModificationEventsMatchingPredicate:(NSPredicate *)predicate error:(NSError * __autoreleasing *)error
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    fetch.predicate = predicate;
+    fetch.resultType = NSManagedObjectIDResultType;
+    fetch.includesPendingChanges = NO;
+    NSArray *eventIDs = [eventStore.managedObjectContext executeFetchRequest:fetch error:error];
+    if (!eventIDs) return NO;
+    return [self purgeStoreModificationEventsWithObjectIDs:eventIDs error:error];
+}
+
+- (BOOL)purgeStoreModificationEventsWithObjectIDs:(NSArray *)eventIDs error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    if (context.hasChanges && ![context save:error]) return NO;
+
+    // Events that were never saved have nothing in the store
+    NSMutableArray *storedEventIDs = [[NSMutableArray alloc] initWithCapacity:eventIDs.count];
+    for (NSManagedObjectID *eventID in eventIDs) {
+        if (!eventID.isTemporaryID) [storedEventIDs addObject:eventID];
+    }
+    eventIDs = storedEventIDs;
+    if (eventIDs.count == 0) return YES;
+
+    CDELog(CDELoggingLevelVerbose, @"Purging %lu events", (unsigned long)eventIDs.count);
+    if (![self retireEventFileRecordsOfEventsWithObjectIDs:eventIDs error:error]) return NO;
+
+    if (@available(macos 10.11, ios 9.0, tvos 9.0, watchos 2.0, *)) {
+        if ([self storeSupportsBatchDeletes]) return [self batchDeleteEventsWithObjectIDs:eventIDs error:error];
+    }
+    return [self deleteEventsInContextWithObjectIDs:eventIDs error:error];
+}
+
+- (BOOL)retireEventFileRecordsOfEventsWithObjectIDs:(NSArray *)eventIDs error:(NSError * __autoreleasing *)error
+{
+    // The ledger keeps records of removed events until their cloud files are gone
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    for (NSUInteger i = 0; i < eventIDs.count; i += CDEEventPurgerBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEEventPurgerBatchSize, eventIDs.count - i));
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventFileRecord"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent IN %@", [eventIDs subarrayWithRange:range]];
+        NSArray *records = [context executeFetchRequest:fetch error:error];
+        if (!records) return NO;
+
+        for (CDEEventFileRecord *record in records) {
+            record.storeModificationEvent = nil;
+            record.state = CDEEventFileStateDeleted;
+        }
+    }
+
+    return context.hasChanges ? [context save:error] : YES;
+}
+
+- (BOOL)deleteEventsInContextWithObjectIDs:(NSArray *)eventIDs error:(NSError * __autoreleasing *)error
+{
+    // Stores without batch deletes rely on the delete rules
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    NSError *localError = nil;
+    BOOL success = YES;
+    for (NSUInteger i = 0; success && i < eventIDs.count; i += CDEEventPurgerBatchSize) {
+        @autoreleasepool {
+            NSRange range = NSMakeRange(i, MIN(CDEEventPurgerBatchSize, eventIDs.count - i));
+            NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+            fetch.predicate = [NSPredicate predicateWithFormat:@"SELF IN %@", [eventIDs subarrayWithRange:range]];
+            fetch.relationshipKeyPathsForPrefetching = @[@"objectChanges", @"objectChanges.globalIdentifier", @"eventRevision", @"eventRevisionsOfOtherStores"];
+            NSArray *events = [context executeFetchRequest:fetch error:&localError];
+            success = events != nil;
+
+            NSMutableSet *globalIds = [[NSMutableSet alloc] init];
+            for (CDEStoreModificationEvent *event in events) {
+                [globalIds unionSet:[event.objectChanges valueForKeyPath:@"globalIdentifier"]];
+                [context deleteObject:event];
+            }
+            [context processPendingChanges];
+
+            for (CDEGlobalIdentifier *globalId in globalIds) {
+                if (!globalId.isDeleted && globalId.objectChanges.count == 0) [context deleteObject:globalId];
+            }
+
+            if (success) success = [context save:&localError];
+        }
+    }
+
+    if (!success && error) *error = localError;
+    return success;
+}
+
+
+#pragma mark Purging Global Identifiers
+
+- (BOOL)purgeUnreferencedGlobalIdentifiers:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    if (context.hasChanges && ![context save:error]) return NO;
+    
+    // Identifiers from before reference counting are counted once
+    if (![CDEGlobalIdentifier countReferencesOfUncountedGlobalIdentifiersInManagedObjectContext:context error:error]) return NO;
+
+    if (@available(macos 10.11, ios 9.0, tvos 9.0, watchos 2.0, *)) {
+        if ([self storeSupportsBatchDeletes]) {
+            NSMutableArray *deletedIDs = [[NSMutableArray alloc] init];
+            NSPredicate *predicate = [NSPredicate predicateWithFormat:@"referenceCount == 0 AND objectChanges.@count == 0"];
+            BOOL success = [self batchDeleteObjectsOfEntityNamed:@"CDEGlobalIdentifier" matchingPredicate:predicate deletedObjectIDs:deletedIDs error:error];
+            [self mergeDeletedObjectIDs:deletedIDs updatedObjectIDs:nil];
+            return success;
+        }
+    }
+
+    NSArray *unusedGlobalIds = [CDEGlobalIdentifier fetchUnreferencedGlobalIdentifiersInManagedObjectContext:context];
+    for (CDEGlobalIdentifier *globalId in unusedGlobalIds) [context deleteObject:globalId];
+    return context.hasChanges ? [context save:error] : YES;
+}
+
+
+#pragma mark Batch Deletes
+
+- (BOOL)storeSupportsBatchDeletes
+{
+    NSArray *stores = eventStore.managedObjectContext.persistentStoreCoordinator.persistentStores;
+    for (NSPersistentStore *store in stores) {
+        if (![store.type isEqualToString:NSSQLiteStoreType]) return NO;
+    }
+    return stores.count > 0;
+}
+
+- (BOOL)batchDeleteEventsWithObjectIDs:(NSArray *)eventIDs error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    NSMutableArray *deletedIDs = [[NSMutableArray alloc] init];
+    NSMutableArray *updatedIDs = [[NSMutableArray alloc] init];
+    NSMutableSet *globalIdentifierIDs = [[NSMutableSet alloc] init];
+    
+    NSExpressionDescription *countDescription = [[NSExpressionDescription alloc] init];
+    countDescription.name = @"count";
+    countDescription.expression = [NSExpression expressionForFunction:@"count:" arguments:@[[NSExpression expressionForKeyPath:@"type"]]];
+    countDescription.expressionResultType = NSInteger64AttributeType;
+
+    NSError *localError = nil;
+    BOOL success = YES;
+    for (NSUInteger i = 0; success && i < eventIDs.count; i += CDEEventPurgerBatchSize) {
+        @autoreleasepool {
+            NSRange range = NSMakeRange(i, MIN(CDEEventPurgerBatchSize, eventIDs.count - i));
+            NSArray *batchIDs = [eventIDs subarrayWithRange:range];
+
+            // References lost by each global identifier, grouped by the number lost
+            NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+            fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent IN %@", batchIDs];
+            fetch.resultType = NSDictionaryResultType;
+            fetch.propertiesToGroupBy = @[@"globalIdentifier"];
+            fetch.propertiesToFetch = @[@"globalIdentifier", countDescription];
+            fetch.includesPendingChanges = NO;
+            NSArray *results = [context executeFetchRequest:fetch error:&localError];
+            success = results != nil;
+            NSMutableDictionary *globalIdentifierIDsByCount = [[NSMutableDictionary alloc] init];
+            for (NSDictionary *result in results) {
+                id globalIdentifierID = result[@"globalIdentifier"];
+                if (!globalIdentifierID) continue;
+                [globalIdentifierIDs addObject:globalIdentifierID];
+                NSMutableArray *ids = globalIdentifierIDsByCount[result[@"count"]];
+                if (!ids) ids = globalIdentifierIDsByCount[result[@"count"]] = [[NSMutableArray alloc] init];
+                [ids addObject:globalIdentifierID];
+            }
+
+            // Children before parents, so an interrupted purge leaves no dangling references
+            success = success &&
+                [self batchDeleteObjectsOfEntityNamed:@"CDEDataFile" matchingPredicate:[NSPredicate predicateWithFormat:@"objectChange.storeModificationEvent IN %@", batchIDs] deletedObjectIDs:deletedIDs error:&localError] &&
+                [self batchDeleteObjectsOfEntityNamed:@"CDEObjectChange" matchingPredicate:[NSPredicate predicateWithFormat:@"storeModificationEvent IN %@", batchIDs] deletedObjectIDs:deletedIDs error:&localError] &&
+                [self batchDeleteObjectsOfEntityNamed:@"CDEObjectChangeStatistics" matchingPredicate:[NSPredicate predicateWithFormat:@"storeModificationEvent IN %@", batchIDs] deletedObjectIDs:deletedIDs error:&localError] &&
+                [self batchDeleteObjectsOfEntityNamed:@"CDEEventRevision" matchingPredicate:[NSPredicate predicateWithFormat:@"storeModificationEvent IN %@ OR storeModificationEventForOtherStores IN %@", batchIDs, batchIDs] deletedObjectIDs:deletedIDs error:&localError] &&
+                [self batchDeleteObjectsOfEntityNamed:@"CDEStoreModificationEvent" matchingPredicate:[NSPredicate predicateWithFormat:@"SELF IN %@", batchIDs] deletedObjectIDs:deletedIDs error:&localError];
+            
+            // Batch deletes bypass the context, so reference counts are updated here
+            for (NSNumber *count in globalIdentifierIDsByCount) {
+                if (!success) break;
+                success = [self batchDecrementReferenceCountsOfGlobalIdentifiersWithObjectIDs:globalIdentifierIDsByCount[count] by:count.longLongValue updatedObjectIDs:updatedIDs error:&localError];
+            }
+        }
+    }
+
+    // Global identifiers no longer referenced by any object change
+    NSArray *globalIdentifierIDArray = globalIdentifierIDs.allObjects;
+    for (NSUInteger i = 0; success && i < globalIdentifierIDArray.count; i += CDEEventPurgerBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEEventPurgerBatchSize, globalIdentifierIDArray.count - i));
+        NSPredicate *predicate = [NSPredicate predicateWithFormat:@"SELF IN %@ AND referenceCount == 0", [globalIdentifierIDArray subarrayWithRange:range]];
+        success = [self batchDeleteObjectsOfEntityNamed:@"CDEGlobalIdentifier" matchingPredicate:predicate deletedObjectIDs:deletedIDs error:&localError];
+    }
+
+    // Bring the context up to date, even after a partial purge
+    [self mergeDeletedObjectIDs:deletedIDs updatedObjectIDs:updatedIDs];
+
+    if (!success && error) *error = localError;
+    return success;
+}
+
+- (BOOL)batchDeleteObjectsOfEntityNamed:(NSString *)entityName matchingPredicate:(NSPredicate *)predicate deletedObjectIDs:(NSMutableArray *)deletedIDs error:(NSError * __autoreleasing *)error
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:entityName];
+    fetch.predicate = predicate;
+    NSBatchDeleteRequest *request = [[NSBatchDeleteRequest alloc] initWithFetchRequest:fetch];
+    request.resultType = NSBatchDeleteResultTypeObjectIDs;
+
+    NSBatchDeleteResult *result = [eventStore.managedObjectContext executeRequest:request error:error];
+    if (!result) {
+        CDELog(CDELoggingLevelError, @"Batch delete of %@ failed", entityName);
+        return NO;
+    }
+
+    [deletedIDs addObjectsFromArray:result.result];
+    return YES;
+}
+
+- (BOOL)batchDecrementReferenceCountsOfGlobalIdentifiersWithObjectIDs:(NSArray *)globalIdentifierIDs by:(int64_t)decrement updatedObjectIDs:(NSMutableArray *)updatedIDs error:(NSError * __autoreleasing *)error
+{
+    // Identifiers not yet counted are left to be counted from scratch
+    NSBatchUpdateRequest *request = [NSBatchUpdateRequest batchUpdateRequestWithEntityName:@"CDEGlobalIdentifier"];
+    request.predicate = [NSPredicate predicateWithFormat:@"SELF IN %@ AND referenceCount >= %lld", globalIdentifierIDs, decrement];
+    request.propertiesToUpdate = @{@"referenceCount" : [NSExpression expressionWithFormat:@"referenceCount - %lld", decrement]};
+    request.resultType = NSUpdatedObjectIDsResultType;
+    
+    NSBatchUpdateResult *result = [eventStore.managedObjectContext executeRequest:request error:error];
+    if (!result) {
+        CDELog(CDELoggingLevelError, @"Batch update of reference counts failed");
+        return NO;
+    }
+    
+    [updatedIDs addObjectsFromArray:result.result];
+    return YES;
+}
+
+- (void)mergeDeletedObjectIDs:(NSArray *)deletedIDs updatedObjectIDs:(NSArray *)updatedIDs
+{
+    if (deletedIDs.count == 0 && updatedIDs.count == 0) return;
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    NSDictionary *changes = @{NSDeletedObjectsKey : deletedIDs ? : @[], NSUpdatedObjectsKey : updatedIDs ? : @[]};
+    [NSManagedObjectContext mergeChangesFromRemoteContextSave:changes intoContexts:@[context]];
+    [context refreshAllObjects];
+}
+
+@end
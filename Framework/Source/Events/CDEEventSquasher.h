@@ -0,0 +1,29 @@
+//
+//  CDEEventSquasher.h
+//  Ensembles
+//
+//  Folds the save events this store made since it last exported into a single event, so other stores
+//  download one file with the net changes, rather than one file per save. Only the most recent run of
+//  save events is squashed, so no later event refers to a revision that is removed. The squashed event
+//  takes the revision of the first event in the run, keeping the revisions of the store contiguous.
+//
+//  Created by Drew McCormack on 02/04/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "CDEDefines.h"
+
+@class CDEEventStore;
+
+@interface CDEEventSquasher : NSObject
+
+@property (nonatomic, strong, readonly) CDEEventStore *eventStore;
+
+- (instancetype)initWithEventStore:(CDEEventStore *)eventStore;
+
+// Events recorded as exported, or with a file in the cloud filenames passed, are never squashed
+- (void)squashUnexportedSaveEventsExcludingCloudFilenames:(NSSet *)cloudFilenames completion:(CDECompletionBlock)completion;
+
+@end
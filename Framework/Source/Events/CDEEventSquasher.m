@@ -0,0 +1,172 @@
+//
+//  CDEEventSquasher.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 02/04/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEEventSquasher.h"
+#import "NSMapTable+CDEAdditions.h"
+#import "CDEEventStore.h"
+#import "CDEStoreModificationEvent.h"
+#import "CDEObjectChange.h"
+#import "CDEEventRevision.h"
+#import "CDERevisionSet.h"
+#import "CDERevision.h"
+#import "CDEEventFile.h"
+#import "CDEEventFileRecord.h"
+
+@implementation CDEEventSquasher
+
+@synthesize eventStore = eventStore;
+
+- (instancetype)initWithEventStore:(CDEEventStore *)newStore
+{
+    self = [super init];
+    if (self) {
+        eventStore = newStore;
+    }
+    return self;
+}
+
+
+#pragma mark Squashing
+
+- (void)squashUnexportedSaveEventsExcludingCloudFilenames:(NSSet *)cloudFilenames completion:(CDECompletionBlock)completion
+{
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    [context performBlock:^{
+        NSError *error = nil;
+        NSArray *events = [self squashableEventsExcludingCloudFilenames:cloudFilenames error:&error];
+        BOOL success = events != nil;
+        if (success && events.count > 1) {
+            CDELog(CDELoggingLevelVerbose, @"Squashing %lu save events", (unsigned long)events.count);
+            [self squashOrderedEvents:events];
+            success = [context save:&error];
+            if (!success) {
+                CDELog(CDELoggingLevelError, @"Failed to save squashed events: %@", error);
+                [context rollback];
+            }
+        }
+        
+        dispatch_async(CDEWorkQueue(), ^{
+            if (completion) completion(success ? nil : error);
+        });
+    }];
+}
+
+// Call on the event store context queue. Returns the events in revision order.
+- (NSArray *)squashableEventsExcludingCloudFilenames:(NSSet *)cloudFilenames error:(NSError * __autoreleasing *)error
+{
+    // An event being built already holds the next revision
+    if (eventStore.incompleteEventIdentifiers.count > 0) return @[];
+    
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    NSArray *types = @[@(CDEStoreModificationEventTypeSave), @(CDEStoreModificationEventTypeMerge)];
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    fetch.predicate = [CDEStoreModificationEvent predicateForAllowedTypes:types persistentStoreIdentifier:eventStore.persistentStoreIdentifier];
+    fetch.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"eventRevision.revisionNumber" ascending:NO]];
+    fetch.relationshipKeyPathsForPrefetching = @[@"eventRevision", @"eventFileRecords"];
+    fetch.fetchBatchSize = 100;
+    NSArray *events = [context executeFetchRequest:fetch error:error];
+    if (!events) return nil;
+    
+    // If anything refers to a later revision, such as a baseline, revisions could not be kept contiguous
+    CDEStoreModificationEvent *lastEvent = events.firstObject;
+    if (!lastEvent || lastEvent.eventRevision.revisionNumber != eventStore.lastRevisionSaved) return @[];
+    
+    CDERevisionNumber baselineRevision = eventStore.baselineRevision;
+    NSMutableArray *run = [[NSMutableArray alloc] init];
+    for (CDEStoreModificationEvent *event in events) {
+        CDERevisionNumber revisionNumber = event.eventRevision.revisionNumber;
+        if (event.type != CDEStoreModificationEventTypeSave) break;
+        if (revisionNumber <= baselineRevision) break;
+        if (run.count > 0 && [run.lastObject eventRevision].revisionNumber != revisionNumber + 1) break;
+        if (event.modelVersion != lastEvent.modelVersion && ![event.modelVersion isEqualToString:lastEvent.modelVersion]) break;
+        if ([self storeModificationEvent:event hasBeenExportedToCloudFilenames:cloudFilenames]) break;
+        [run addObject:event];
+    }
+    
+    return run.reverseObjectEnumerator.allObjects;
+}
+
+- (BOOL)storeModificationEvent:(CDEStoreModificationEvent *)event hasBeenExportedToCloudFilenames:(NSSet *)cloudFilenames
+{
+    for (CDEEventFileRecord *record in event.eventFileRecords) {
+        if (record.state == CDEEventFileStateExported) return YES;
+    }
+    
+    CDEEventFile *file = [[CDEEventFile alloc] initWithStoreModificationEvent:event];
+    return [file.aliases intersectsSet:cloudFilenames];
+}
+
+- (void)squashOrderedEvents:(NSArray *)events
+{
+    NSManagedObjectContext *context = eventStore.managedObjectContext;
+    NSString *persistentStoreId = eventStore.persistentStoreIdentifier;
+    CDEStoreModificationEvent *firstEvent = events.firstObject;
+    CDEStoreModificationEvent *lastEvent = events.lastObject;
+    
+    // A new event, so it gets its own filename. It takes the revision of the first event, and
+    // the global count and revisions of other stores from the last.
+    CDERevisionSet *revisionSet = lastEvent.revisionSet;
+    [revisionSet removeRevisionForPersistentStoreIdentifier:persistentStoreId];
+    [revisionSet addRevision:[[CDERevision alloc] initWithPersistentStoreIdentifier:persistentStoreId revisionNumber:firstEvent.eventRevision.revisionNumber]];
+    
+    CDEStoreModificationEvent *squashedEvent = [NSEntityDescription insertNewObjectForEntityForName:@"CDEStoreModificationEvent" inManagedObjectContext:context];
+    squashedEvent.type = CDEStoreModificationEventTypeSave;
+    squashedEvent.globalCount = lastEvent.globalCount;
+    squashedEvent.timestamp = lastEvent.timestamp;
+    squashedEvent.modelVersion = lastEvent.modelVersion;
+    [squashedEvent setRevisionSet:revisionSet forPersistentStoreIdentifier:persistentStoreId];
+    
+    // Fold changes in order, each later change taking priority
+    NSMapTable *objectChangesByGlobalId = [NSMapTable cde_strongToStrongObjectsMapTable];
+    for (CDEStoreModificationEvent *event in events) {
+        [CDEStoreModificationEvent prefetchRelatedObjectsForStoreModificationEvents:@[event]];
+        for (CDEObjectChange *change in event.objectChanges.allObjects) {
+            CDEObjectChange *earlierChange = [objectChangesByGlobalId objectForKey:change.globalIdentifier];
+            [self mergeChange:change withSubordinateChange:earlierChange addToEvent:squashedEvent withObjectChangesByGlobalId:objectChangesByGlobalId];
+        }
+    }
+    
+    for (CDEStoreModificationEvent *event in events) [context deleteObject:event];
+}
+
+// Like merging into a baseline in the rebaser, except the squashed event may also hold updates and deletes.
+// An object inserted and deleted before export is dropped altogether.
+- (void)mergeChange:(CDEObjectChange *)change withSubordinateChange:(CDEObjectChange *)subordinateChange addToEvent:(CDEStoreModificationEvent *)squashedEvent withObjectChangesByGlobalId:(NSMapTable *)objectChangesByGlobalId
+{
+    NSManagedObjectContext *context = change.managedObjectContext;
+    switch (change.type) {
+        case CDEObjectChangeTypeDelete:
+            if (subordinateChange) [context deleteObject:subordinateChange];
+            if (subordinateChange.type == CDEObjectChangeTypeInsert) {
+                [objectChangesByGlobalId removeObjectForKey:change.globalIdentifier];
+                [context deleteObject:change];
+            }
+            else {
+                change.storeModificationEvent = squashedEvent;
+                [objectChangesByGlobalId setObject:change forKey:change.globalIdentifier];
+            }
+            break;
+        
+        case CDEObjectChangeTypeInsert:
+        case CDEObjectChangeTypeUpdate:
+            if (subordinateChange) {
+                if (subordinateChange.type != CDEObjectChangeTypeDelete) [change mergeValuesFromSubordinateObjectChange:subordinateChange];
+                if (subordinateChange.type == CDEObjectChangeTypeInsert) change.type = CDEObjectChangeTypeInsert;
+                [context deleteObject:subordinateChange];
+            }
+            change.storeModificationEvent = squashedEvent;
+            [objectChangesByGlobalId setObject:change forKey:change.globalIdentifier];
+            break;
+        
+        default:
+            @throw [NSException exceptionWithName:CDEException reason:@"Invalid object change type" userInfo:nil];
+            break;
+    }
+}
+
+@end
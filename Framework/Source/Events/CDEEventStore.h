@@ -10,6 +10,8 @@
 #import "CDEDefines.h"
 #import <CoreData/CoreData.h>
 
+@class CDERevision;
+
 @interface CDEEventStore : NSObject
 
 @property (nonatomic, strong, readonly) NSString *ensembleIdentifier;
@@ -36,6 +38,8 @@
 @property (nonatomic, copy, readwrite) NSString *identifierOfBaselineUsedToConstructStore;
 @property (nonatomic, copy, readonly) NSString *currentBaselineIdentifier;
 
+@property (nonatomic, assign, readwrite) BOOL splitsLargeDataIntoChunks; // Default NO. Earlier versions can't read chunked data values.
+
 +(void)setDefaultPathToEventDataRootDirectory:(NSString *)newPath;
 +(NSString *)defaultPathToEventDataRootDirectory;
 
@@ -53,6 +57,9 @@
 - (void)registerIncompleteEventIdentifier:(NSString *)identifier isMandatory:(BOOL)mandatory;
 - (void)deregisterIncompleteEventIdentifier:(NSString *)identifier;
 
+// Returns when this store first saw the revision for the revision's store, recording the current time if it is new
+- (NSTimeInterval)timestampOfFirstObservationOfRevision:(CDERevision *)revision;
+
 - (void)removeUnusedDataWithCompletion:(CDECompletionBlock)completion;
 
 - (BOOL)importDataFile:(NSString *)path;
@@ -60,6 +67,9 @@
 - (BOOL)exportDataFile:(NSString *)filename toDirectory:(NSString *)dirPath;
 - (NSData *)dataForFile:(NSString *)filename;
 
+- (NSArray *)storeDataInChunkedFiles:(NSData *)data; // Returns chunk filenames, in order
+- (NSData *)dataForChunkedFiles:(NSArray *)filenames;
+
 - (BOOL)removePreviouslyReferencedDataFile:(NSString *)filename;
 - (BOOL)removeNewlyImportedDataFile:(NSString *)filename;
 - (void)removeUnreferencedDataFiles;
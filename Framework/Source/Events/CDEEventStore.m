@@ -13,13 +13,17 @@
 #import "CDERevision.h"
 #import "CDEGlobalIdentifier.h"
 #import "CDEDataFile.h"
+#import "CDEFoundationAdditions.h"
+#import "CDEDataChunker.h"
 #import "CDEPropertyChangeValue.h"
+#import "CDEEventPurger.h"
 
 NSString * const kCDEPersistentStoreIdentifierKey = @"persistentStoreIdentifier";
 NSString * const kCDECloudFileSystemIdentityKey = @"cloudFileSystemIdentity";
 NSString * const kCDEIncompleteEventIdentifiersKey = @"incompleteEventIdentifiers";
 NSString * const kCDEVerifiesStoreRegistrationInCloudKey = @"verifiesStoreRegistrationInCloud";
 NSString * const kCDEIdentifierOfBaselineUsedToConstructStore = @"identifierOfBaselineUsedToConstructStore";
+NSString * const kCDERevisionObservationsKey = @"revisionObservations";
 
 static NSString *defaultPathToEventDataRootDirectory = nil;
 
@@ -32,12 +36,14 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
 @property (nonatomic, strong, readonly) NSString *pathToNewlyImportedDataFileDirectory;
 @property (nonatomic, strong, readonly) NSString *pathToStoreInfoFile;
 @property (nonatomic, copy, readwrite) NSString *persistentStoreIdentifier;
+@property (nonatomic, strong, readwrite) NSManagedObjectContext *managedObjectContext;
 
 @end
 
 
 @implementation CDEEventStore {
     NSMutableDictionary *incompleteEventIdentifiers;
+    NSMutableDictionary *revisionObservations;
     NSFileManager *fileManager;
 }
 
@@ -49,6 +55,7 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
 @synthesize verifiesStoreRegistrationInCloud = verifiesStoreRegistrationInCloud;
 @synthesize identifierOfBaselineUsedToConstructStore = identifierOfBaselineUsedToConstructStore;
 @synthesize currentBaselineIdentifier = currentBaselineIdentifier;
+@synthesize splitsLargeDataIntoChunks = splitsLargeDataIntoChunks;
 
 + (void)initialize
 {
@@ -114,6 +121,7 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
            kCDEPersistentStoreIdentifierKey : self.persistentStoreIdentifier,
            kCDECloudFileSystemIdentityKey : identityData,
            kCDEIncompleteEventIdentifiersKey : incompleteEventIdentifiers,
+           kCDERevisionObservationsKey : revisionObservations,
            kCDEVerifiesStoreRegistrationInCloudKey : @(self.verifiesStoreRegistrationInCloud)
         }];
         
@@ -141,6 +149,7 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
 #pragma clang diagnostic pop
         persistentStoreIdentifier = storeMetadata[kCDEPersistentStoreIdentifierKey];
         incompleteEventIdentifiers = [storeMetadata[kCDEIncompleteEventIdentifiersKey] mutableCopy];
+        revisionObservations = [storeMetadata[kCDERevisionObservationsKey] mutableCopy];
         identifierOfBaselineUsedToConstructStore = storeMetadata[kCDEIdentifierOfBaselineUsedToConstructStore];
         
         NSNumber *value = storeMetadata[kCDEVerifiesStoreRegistrationInCloudKey];
@@ -150,6 +159,7 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
         cloudFileSystemIdentityToken = nil;
         persistentStoreIdentifier = nil;
         incompleteEventIdentifiers = nil;
+        revisionObservations = nil;
         identifierOfBaselineUsedToConstructStore = nil;
         verifiesStoreRegistrationInCloud = YES;
     }
@@ -157,6 +167,10 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     if (!incompleteEventIdentifiers) {
         incompleteEventIdentifiers = [NSMutableDictionary dictionary];
     }
+    
+    if (!revisionObservations) {
+        revisionObservations = [NSMutableDictionary dictionary];
+    }
 }
 
 
@@ -199,6 +213,24 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
 }
 
 
+#pragma mark - Revision Observations
+
+// Only the latest revision seen of each store is kept, so a store that has not moved on keeps its first timestamp
+- (NSTimeInterval)timestampOfFirstObservationOfRevision:(CDERevision *)revision
+{
+    @synchronized (self) {
+        NSString *storeId = revision.persistentStoreIdentifier;
+        NSArray *observation = revisionObservations[storeId];
+        if (observation && [observation[0] longLongValue] == revision.revisionNumber) return [observation[1] doubleValue];
+        
+        NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+        revisionObservations[storeId] = @[@(revision.revisionNumber), @(now)];
+        [self saveStoreMetadata];
+        return now;
+    }
+}
+
+
 #pragma mark - Revisions
 
 - (CDERevisionNumber)lastRevisionNumberSavedForEventRevisionPredicate:(NSPredicate *)predicate
@@ -283,10 +315,9 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     // Delete unused global ids
     [self.managedObjectContext performBlock:^{
         NSError *error;
-        NSArray *unusedGlobalIds = [CDEGlobalIdentifier fetchUnreferencedGlobalIdentifiersInManagedObjectContext:self.managedObjectContext];
-        for (CDEGlobalIdentifier *globalId in unusedGlobalIds) [self.managedObjectContext deleteObject:globalId];
-        BOOL success = [self.managedObjectContext save:&error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        CDEEventPurger *purger = [[CDEEventPurger alloc] initWithEventStore:self];
+        BOOL success = [purger purgeUnreferencedGlobalIdentifiers:&error];
+        dispatch_async(CDEWorkQueue(), ^{
             if (completion) completion(success ? nil : error);
         });
     }];
@@ -321,6 +352,14 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     NSError *error;
     NSString *filename = [fromPath lastPathComponent];
     NSString *toPath = [self.pathToNewlyImportedDataFileDirectory stringByAppendingPathComponent:filename];
+    
+    // Files are named by their contents, so if the file is already here, it is a duplicate
+    NSString *existingPath = [self.pathToDataFileDirectory stringByAppendingPathComponent:filename];
+    if ([fileManager fileExistsAtPath:toPath] || [fileManager fileExistsAtPath:existingPath]) {
+        [fileManager removeItemAtPath:fromPath error:NULL];
+        return YES;
+    }
+    
     BOOL success = [fileManager moveItemAtPath:fromPath toPath:toPath error:&error];
     if (!success) CDELog(CDELoggingLevelError, @"Could not move file to event store data directory: %@", error);
     return success;
@@ -328,8 +367,22 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
 
 - (NSString *)storeDataInFile:(NSData *)data
 {
-    NSString *filename = [[NSProcessInfo processInfo] globallyUniqueString];
+    // Name the file by a hash of its contents. Identical data, whether saved again or
+    // created on another device, shares one file, and is only stored and transferred once.
+    // Files from older versions have random names, and are still read and exported as before.
+    NSString *filename = [data cde_SHA256String];
     NSString *toPath = [self.pathToDataFileDirectory stringByAppendingPathComponent:filename];
+    NSString *newlyImportedPath = [self.pathToNewlyImportedDataFileDirectory stringByAppendingPathComponent:filename];
+    
+    if ([fileManager fileExistsAtPath:toPath]) return filename;
+    
+    NSError *error;
+    if ([fileManager fileExistsAtPath:newlyImportedPath]) {
+        BOOL success = [fileManager moveItemAtPath:newlyImportedPath toPath:toPath error:&error];
+        if (success) return filename;
+        CDELog(CDELoggingLevelError, @"Could not move newly imported data file: %@", error);
+    }
+    
     BOOL success = [data writeToFile:toPath atomically:YES];
     if (!success) filename = nil;
     return filename;
@@ -363,6 +416,61 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     return data;
 }
 
+- (NSArray *)storeDataInChunkedFiles:(NSData *)data
+{
+    // Each chunk is a data file named by its contents, so chunks unchanged by an edit are not stored or transferred again
+    CDEDataChunker *chunker = [[CDEDataChunker alloc] init];
+    NSArray *ranges = [chunker rangesOfChunksInData:data];
+    
+    NSMutableArray *filenames = [[NSMutableArray alloc] initWithCapacity:ranges.count];
+    for (NSValue *rangeValue in ranges) {
+        @autoreleasepool {
+            NSRange range = rangeValue.rangeValue;
+            NSData *chunk = [NSData dataWithBytesNoCopy:(void *)(data.bytes + range.location) length:range.length freeWhenDone:NO];
+            NSString *filename = [self storeDataInFile:chunk];
+            if (!filename) return nil;
+            [filenames addObject:filename];
+        }
+    }
+    
+    return filenames;
+}
+
+- (NSData *)dataForChunkedFiles:(NSArray *)filenames
+{
+    // Reassemble one chunk at a time into a temporary file, and map it, so the whole blob is never in memory
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+    NSOutputStream *stream = [NSOutputStream outputStreamToFileAtPath:path append:NO];
+    [stream open];
+    
+    BOOL success = YES;
+    for (NSString *filename in filenames) {
+        @autoreleasepool {
+            NSData *chunk = [self dataForFile:filename];
+            const uint8_t *bytes = chunk.bytes;
+            NSUInteger written = 0;
+            while (chunk && written < chunk.length) {
+                NSInteger result = [stream write:bytes + written maxLength:chunk.length - written];
+                if (result <= 0) break;
+                written += result;
+            }
+            success = chunk && written == chunk.length;
+        }
+        if (!success) break;
+    }
+    [stream close];
+    
+    NSError *error = nil;
+    NSData *data = nil;
+    if (success) data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:&error];
+    if (!data) CDELog(CDELoggingLevelError, @"Failed to reassemble chunked data: %@", error ? : stream.streamError);
+    
+    // The mapping remains valid after the file is removed
+    [fileManager removeItemAtPath:path error:NULL];
+    
+    return data;
+}
+
 - (BOOL)removePreviouslyReferencedDataFile:(NSString *)filename
 {
     NSString *path = [self.pathToDataFileDirectory stringByAppendingPathComponent:filename];
@@ -382,9 +490,10 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
 - (void)removeUnreferencedDataFiles
 {
     [self.managedObjectContext performBlockAndWait:^{
-        NSSet *contextFilenames = [CDEDataFile allFilenamesInManagedObjectContext:self.managedObjectContext];
+        // Remove files with a reference count of zero
+        NSDictionary *referenceCounts = [CDEDataFile referenceCountsByFilenameInManagedObjectContext:self.managedObjectContext];
         NSMutableSet *filenames = [self.previouslyReferencedDataFilenames mutableCopy];
-        [filenames minusSet:contextFilenames];
+        [filenames minusSet:[NSSet setWithArray:referenceCounts.allKeys]];
         for (NSString *filename in filenames) [self removePreviouslyReferencedDataFile:filename];
     }];
 }
@@ -399,7 +508,7 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     [self.managedObjectContext performBlock:^{
         NSError *error = nil;
         success = [self->managedObjectContext save:&error];
-        dispatch_async(dispatch_get_main_queue(), ^{
+        dispatch_async(CDEWorkQueue(), ^{
             if (completion) completion(success ? nil : error);
         });
     }];
@@ -424,6 +533,7 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     persistentStoreIdentifier = [[NSProcessInfo processInfo] globallyUniqueString];
     identifierOfBaselineUsedToConstructStore = nil;
     incompleteEventIdentifiers = [NSMutableDictionary dictionary];
+    revisionObservations = [NSMutableDictionary dictionary];
     [self saveStoreMetadata];
     
     return YES;
@@ -446,6 +556,7 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     [managedObjectContext performBlockAndWait:^{
         self.persistentStoreIdentifier = nil;
         self->incompleteEventIdentifiers = nil;
+        self->revisionObservations = nil;
         [self tearDownCoreDataStack];
     }];
 }
@@ -562,25 +673,39 @@ static NSString *defaultPathToEventDataRootDirectory = nil;
     NSPersistentStore *store = [coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:storeURL options:options error:error];
     if (!store) return NO;
     
-    managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
-    [managedObjectContext performBlockAndWait:^{
-        self->managedObjectContext.persistentStoreCoordinator = coordinator;
-        self->managedObjectContext.mergePolicy = NSMergeByPropertyObjectTrumpMergePolicy;
-        self->managedObjectContext.undoManager = nil;
+    // Set through the property, so key-value observers of the context are informed
+    NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+    [context performBlockAndWait:^{
+        context.persistentStoreCoordinator = coordinator;
+        context.mergePolicy = NSMergeByPropertyObjectTrumpMergePolicy;
+        context.undoManager = nil;
     }];
+    self.managedObjectContext = context;
     
     BOOL success = managedObjectContext != nil;
-    if (success) [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(managedObjectContextDidSave:) name:NSManagedObjectContextDidSaveNotification object:nil];
+    if (success) {
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(managedObjectContextWillSave:) name:NSManagedObjectContextWillSaveNotification object:managedObjectContext];
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(managedObjectContextDidSave:) name:NSManagedObjectContextDidSaveNotification object:nil];
+    }
     return success;
 }
 
 - (void)tearDownCoreDataStack
 {
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:NSManagedObjectContextWillSaveNotification object:managedObjectContext];
     [[NSNotificationCenter defaultCenter] removeObserver:self name:NSManagedObjectContextDidSaveNotification object:nil];
     [managedObjectContext performBlockAndWait:^{
         [self->managedObjectContext reset];
     }];
-    managedObjectContext = nil;
+    self.managedObjectContext = nil;
+}
+
+
+#pragma mark - Reference Counts
+
+- (void)managedObjectContextWillSave:(NSNotification *)notif
+{
+    [CDEGlobalIdentifier updateReferenceCountsForChangesInManagedObjectContext:notif.object];
 }
 
 
@@ -0,0 +1,52 @@
+//
+//  CDEEventStream.h
+//  Ensembles
+//
+//  A compact event file format, written and read sequentially, with no Core Data stack on the file side.
+//  After the header, each event has a marker byte, its properties, the revision vector, a table of
+//  global identifiers, and its object changes, each prefixed with its length. A zero marker ends the file.
+//
+//  Created by Drew McCormack on 23/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "CDEDefines.h"
+
+@class CDEStoreModificationEvent;
+
+extern NSString * const CDEEventStreamStoreType;
+
+@interface CDEEventStreamWriter : NSObject
+
+@property (nonatomic, copy, readonly) NSString *path;
+
+- (instancetype)initWithPath:(NSString *)path;
+
+- (BOOL)open:(NSError * __autoreleasing *)error;
+- (BOOL)close:(NSError * __autoreleasing *)error;
+
+// Call on the queue of the event's context
+- (BOOL)writeStoreModificationEvent:(CDEStoreModificationEvent *)event error:(NSError * __autoreleasing *)error;
+
+@end
+
+
+@interface CDEEventStreamReader : NSObject
+
+@property (nonatomic, copy, readonly) NSString *path;
+@property (nonatomic, assign, readwrite) NSUInteger saveBatchSize;
+
++ (BOOL)isEventStreamAtPath:(NSString *)path;
+
+- (instancetype)initWithPath:(NSString *)path;
+
+- (BOOL)open:(NSError * __autoreleasing *)error;
+- (void)close;
+
+// Inserts the next event into the context, saving in batches. Returns nil with no error at the end of the file.
+// The event has the incomplete type until all of its changes are saved. Call on the queue of the context.
+- (NSManagedObjectID *)importNextStoreModificationEventIntoContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error;
+
+@end
@@ -0,0 +1,618 @@
+//
+//  CDEEventStream.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 23/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEEventStream.h"
+#import "CDEStoreModificationEvent.h"
+#import "CDEEventRevision.h"
+#import "CDEGlobalIdentifier.h"
+#import "CDEObjectChange.h"
+#import "CDEDataFile.h"
+
+NSString * const CDEEventStreamStoreType = @"CDEEventStream";
+
+static const uint8_t CDEEventStreamMagic[8] = {'C', 'D', 'E', 'E', 'V', 'S', 'T', 'M'};
+static const uint8_t CDEEventStreamVersion = 1;
+static const uint8_t CDEEventStreamEndMarker = 0;
+static const uint8_t CDEEventStreamEventMarker = 1;
+
+static const NSUInteger CDEEventStreamBufferLength = 64 * 1024;
+static const NSUInteger CDEEventStreamFetchBatchSize = 500;
+static const uint64_t CDEEventStreamMaximumFieldLength = 256 * 1024 * 1024;
+
+
+#pragma mark Encoding
+
+static NSError *CDEEventStreamError(NSString *description)
+{
+    return [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeDataCorruptionDetected userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+static void CDEAppendUnsigned(NSMutableData *data, uint64_t value)
+{
+    uint8_t bytes[10];
+    NSUInteger length = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value) byte |= 0x80;
+        bytes[length++] = byte;
+    } while (value);
+    [data appendBytes:bytes length:length];
+}
+
+static void CDEAppendInteger(NSMutableData *data, int64_t value)
+{
+    // Zig-zag, so small negative numbers, like a revision of -1, stay short
+    CDEAppendUnsigned(data, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void CDEAppendDouble(NSMutableData *data, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, 8);
+    bits = CFSwapInt64HostToBig(bits);
+    [data appendBytes:&bits length:8];
+}
+
+static void CDEAppendData(NSMutableData *data, NSData *value)
+{
+    // Length is offset by one, so zero can represent nil
+    CDEAppendUnsigned(data, value ? value.length + 1 : 0);
+    if (value) [data appendData:value];
+}
+
+static void CDEAppendString(NSMutableData *data, NSString *value)
+{
+    CDEAppendData(data, [value dataUsingEncoding:NSUTF8StringEncoding]);
+}
+
+
+#pragma mark - Writer
+
+@implementation CDEEventStreamWriter {
+    NSOutputStream *outputStream;
+    NSMutableData *buffer;
+}
+
+@synthesize path = path;
+
+- (instancetype)initWithPath:(NSString *)newPath
+{
+    self = [super init];
+    if (self) {
+        path = [newPath copy];
+        buffer = [[NSMutableData alloc] initWithCapacity:CDEEventStreamBufferLength];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [outputStream close];
+}
+
+#pragma mark Opening and Closing
+
+- (BOOL)open:(NSError * __autoreleasing *)error
+{
+    outputStream = [NSOutputStream outputStreamToFileAtPath:path append:NO];
+    [outputStream open];
+    if (outputStream.streamStatus != NSStreamStatusOpen) {
+        if (error) *error = outputStream.streamError ? : [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeFailedToWriteFile userInfo:nil];
+        return NO;
+    }
+
+    [buffer appendBytes:CDEEventStreamMagic length:sizeof(CDEEventStreamMagic)];
+    [buffer appendBytes:&CDEEventStreamVersion length:1];
+    return [self flush:error];
+}
+
+- (BOOL)close:(NSError * __autoreleasing *)error
+{
+    [buffer appendBytes:&CDEEventStreamEndMarker length:1];
+    BOOL success = [self flush:error];
+    [outputStream close];
+    outputStream = nil;
+    return success;
+}
+
+- (BOOL)flush:(NSError * __autoreleasing *)error
+{
+    const uint8_t *bytes = buffer.bytes;
+    NSUInteger written = 0;
+    while (written < buffer.length) {
+        NSInteger result = [outputStream write:bytes + written maxLength:buffer.length - written];
+        if (result <= 0) {
+            if (error) *error = outputStream.streamError ? : [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeFailedToWriteFile userInfo:nil];
+            return NO;
+        }
+        written += result;
+    }
+    buffer.length = 0;
+    return YES;
+}
+
+#pragma mark Writing Events
+
+- (BOOL)writeStoreModificationEvent:(CDEStoreModificationEvent *)event error:(NSError * __autoreleasing *)error
+{
+    NSManagedObjectContext *context = event.managedObjectContext;
+
+    // Event properties and revision vector
+    [buffer appendBytes:&CDEEventStreamEventMarker length:1];
+    CDEAppendString(buffer, event.uniqueIdentifier);
+    CDEAppendInteger(buffer, event.type);
+    CDEAppendInteger(buffer, event.globalCount);
+    CDEAppendDouble(buffer, event.timestamp);
+    CDEAppendString(buffer, event.modelVersion);
+    CDEAppendString(buffer, event.eventRevision.persistentStoreIdentifier);
+    CDEAppendInteger(buffer, event.eventRevision.revisionNumber);
+
+    NSSet *otherRevisions = event.eventRevisionsOfOtherStores;
+    CDEAppendUnsigned(buffer, otherRevisions.count);
+    for (CDEEventRevision *revision in otherRevisions) {
+        CDEAppendString(buffer, revision.persistentStoreIdentifier);
+        CDEAppendInteger(buffer, revision.revisionNumber);
+    }
+
+    // Fetch changes in batches, rather than through the relationship, so they can be turned back into faults
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent = %@", event];
+    fetch.fetchBatchSize = CDEEventStreamFetchBatchSize;
+    NSArray *changes = [context executeFetchRequest:fetch error:error];
+    if (!changes) return NO;
+
+    // Global identifier table. Changes refer to entries by index.
+    NSMutableDictionary *indexesByGlobalIdentifierID = [[NSMutableDictionary alloc] init];
+    NSMutableData *table = [[NSMutableData alloc] init];
+    for (CDEObjectChange *change in changes) {
+        @autoreleasepool {
+            CDEGlobalIdentifier *globalIdentifier = change.globalIdentifier;
+            if (!indexesByGlobalIdentifierID[globalIdentifier.objectID]) {
+                indexesByGlobalIdentifierID[globalIdentifier.objectID] = @(indexesByGlobalIdentifierID.count);
+                CDEAppendString(table, globalIdentifier.nameOfEntity);
+                CDEAppendString(table, globalIdentifier.globalIdentifier);
+            }
+            if (!change.hasChanges) [context refreshObject:change mergeChanges:NO];
+        }
+    }
+    CDEAppendUnsigned(buffer, indexesByGlobalIdentifierID.count);
+    [buffer appendData:table];
+    table = nil;
+
+    // Object changes, each prefixed with its length
+    CDEAppendUnsigned(buffer, changes.count);
+    NSMutableData *record = [[NSMutableData alloc] init];
+    NSError *localError = nil;
+    BOOL success = YES;
+    for (CDEObjectChange *change in changes) {
+        @autoreleasepool {
+            record.length = 0;
+            CDEAppendInteger(record, change.type);
+            CDEAppendString(record, change.nameOfEntity);
+            CDEAppendUnsigned(record, [indexesByGlobalIdentifierID[change.globalIdentifier.objectID] unsignedLongLongValue]);
+            CDEAppendData(record, [self archivedPropertyChangeValues:change.propertyChangeValues]);
+
+            NSSet *dataFiles = change.dataFiles;
+            CDEAppendUnsigned(record, dataFiles.count);
+            for (CDEDataFile *dataFile in dataFiles) CDEAppendString(record, dataFile.filename);
+
+            if (!change.hasChanges) [context refreshObject:change mergeChanges:NO];
+
+            if (record.length > UINT32_MAX) {
+                localError = CDEEventStreamError(@"Object change too large for event stream");
+                success = NO;
+            }
+            else {
+                uint32_t length = CFSwapInt32HostToBig((uint32_t)record.length);
+                [buffer appendBytes:&length length:4];
+                [buffer appendData:record];
+
+                NSError *flushError = nil;
+                if (buffer.length >= CDEEventStreamBufferLength) success = [self flush:&flushError];
+                localError = flushError;
+            }
+        }
+        if (!success) break;
+    }
+
+    if (!success) {
+        if (error) *error = localError;
+        return NO;
+    }
+
+    return [self flush:error];
+}
+
+- (NSData *)archivedPropertyChangeValues:(NSArray *)values
+{
+    if (!values) return nil;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated"
+    return [NSKeyedArchiver archivedDataWithRootObject:values];
+#pragma clang diagnostic pop
+}
+
+@end
+
+
+#pragma mark - Reader
+
+@implementation CDEEventStreamReader {
+    NSInputStream *inputStream;
+    uint8_t *buffer;
+    NSUInteger bufferLength;
+    NSUInteger bufferPosition;
+    uint64_t bytesRead;
+}
+
+@synthesize path = path;
+@synthesize saveBatchSize = saveBatchSize;
+
++ (BOOL)isEventStreamAtPath:(NSString *)path
+{
+    NSInputStream *stream = [NSInputStream inputStreamWithFileAtPath:path];
+    [stream open];
+    uint8_t magic[sizeof(CDEEventStreamMagic)];
+    NSInteger length = [stream read:magic maxLength:sizeof(magic)];
+    [stream close];
+    return length == sizeof(magic) && memcmp(magic, CDEEventStreamMagic, sizeof(magic)) == 0;
+}
+
+- (instancetype)initWithPath:(NSString *)newPath
+{
+    self = [super init];
+    if (self) {
+        path = [newPath copy];
+        saveBatchSize = 1000;
+        buffer = malloc(CDEEventStreamBufferLength);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [inputStream close];
+    free(buffer);
+}
+
+#pragma mark Opening and Closing
+
+- (BOOL)open:(NSError * __autoreleasing *)error
+{
+    inputStream = [NSInputStream inputStreamWithFileAtPath:path];
+    [inputStream open];
+    bufferLength = bufferPosition = 0;
+    bytesRead = 0;
+
+    uint8_t magic[sizeof(CDEEventStreamMagic)];
+    uint8_t version;
+    BOOL success = [self readBytes:magic length:sizeof(magic)] && [self readBytes:&version length:1];
+    if (!success || memcmp(magic, CDEEventStreamMagic, sizeof(magic)) != 0) {
+        if (error) *error = CDEEventStreamError(@"File is not an event stream");
+        return NO;
+    }
+
+    if (version > CDEEventStreamVersion) {
+        if (error) *error = CDEEventStreamError(@"Event stream was written by a newer version of the framework");
+        return NO;
+    }
+
+    return YES;
+}
+
+- (void)close
+{
+    [inputStream close];
+    inputStream = nil;
+}
+
+#pragma mark Decoding
+
+- (BOOL)readBytes:(void *)bytes length:(NSUInteger)length
+{
+    uint8_t *destination = bytes;
+    while (length > 0) {
+        if (bufferPosition == bufferLength) {
+            NSInteger result = [inputStream read:buffer maxLength:CDEEventStreamBufferLength];
+            if (result <= 0) return NO;
+            bufferLength = result;
+            bufferPosition = 0;
+        }
+        NSUInteger count = MIN(length, bufferLength - bufferPosition);
+        memcpy(destination, buffer + bufferPosition, count);
+        destination += count;
+        bufferPosition += count;
+        length -= count;
+        bytesRead += count;
+    }
+    return YES;
+}
+
+- (BOOL)readUnsigned:(uint64_t *)value
+{
+    uint64_t result = 0;
+    for (NSUInteger shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        if (![self readBytes:&byte length:1]) return NO;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (BOOL)readInteger:(int64_t *)value
+{
+    uint64_t encoded;
+    if (![self readUnsigned:&encoded]) return NO;
+    *value = (int64_t)(encoded >> 1) ^ -(int64_t)(encoded & 1);
+    return YES;
+}
+
+- (BOOL)readDouble:(double *)value
+{
+    uint64_t bits;
+    if (![self readBytes:&bits length:8]) return NO;
+    bits = CFSwapInt64BigToHost(bits);
+    memcpy(value, &bits, 8);
+    return YES;
+}
+
+- (BOOL)readData:(NSData * __autoreleasing *)data
+{
+    uint64_t length;
+    if (![self readUnsigned:&length]) return NO;
+    if (length == 0) {
+        *data = nil;
+        return YES;
+    }
+
+    length -= 1;
+    if (length > CDEEventStreamMaximumFieldLength) return NO;
+    NSMutableData *result = [[NSMutableData alloc] initWithLength:(NSUInteger)length];
+    if (![self readBytes:result.mutableBytes length:(NSUInteger)length]) return NO;
+    *data = result;
+    return YES;
+}
+
+- (BOOL)readString:(NSString * __autoreleasing *)string
+{
+    NSData *data;
+    if (![self readData:&data]) return NO;
+    *string = data ? [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] : nil;
+    return data == nil || *string != nil;
+}
+
+#pragma mark Importing Events
+
+- (NSManagedObjectID *)importNextStoreModificationEventIntoContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    if (error) *error = nil;
+
+    uint8_t marker;
+    if (![self readBytes:&marker length:1]) {
+        if (error) *error = CDEEventStreamError(@"Event stream is truncated");
+        return nil;
+    }
+    if (marker == CDEEventStreamEndMarker) return nil;
+    if (marker != CDEEventStreamEventMarker) {
+        if (error) *error = CDEEventStreamError(@"Unexpected marker in event stream");
+        return nil;
+    }
+
+    // Event properties and revision vector
+    NSString *uniqueIdentifier, *modelVersion, *persistentStoreIdentifier;
+    int64_t type, globalCount, revisionNumber;
+    double timestamp;
+    uint64_t numberOfOtherRevisions;
+    BOOL success = [self readString:&uniqueIdentifier] && [self readInteger:&type] && [self readInteger:&globalCount] && [self readDouble:&timestamp] && [self readString:&modelVersion] && [self readString:&persistentStoreIdentifier] && [self readInteger:&revisionNumber] && [self readUnsigned:&numberOfOtherRevisions];
+    if (!success || !persistentStoreIdentifier) {
+        if (error) *error = CDEEventStreamError(@"Could not read event from stream");
+        return nil;
+    }
+
+    CDEStoreModificationEvent *event = [NSEntityDescription insertNewObjectForEntityForName:@"CDEStoreModificationEvent" inManagedObjectContext:context];
+    event.uniqueIdentifier = uniqueIdentifier;
+    event.type = CDEStoreModificationEventTypeIncomplete;
+    event.globalCount = globalCount;
+    event.timestamp = timestamp;
+    event.modelVersion = modelVersion;
+    event.eventRevision = [CDEEventRevision makeEventRevisionForPersistentStoreIdentifier:persistentStoreIdentifier revisionNumber:revisionNumber inManagedObjectContext:context];
+
+    NSMutableSet *otherRevisions = [[NSMutableSet alloc] init];
+    for (uint64_t i = 0; i < numberOfOtherRevisions && success; i++) {
+        NSString *storeIdentifier;
+        int64_t number;
+        success = [self readString:&storeIdentifier] && [self readInteger:&number] && storeIdentifier;
+        if (success) [otherRevisions addObject:[CDEEventRevision makeEventRevisionForPersistentStoreIdentifier:storeIdentifier revisionNumber:number inManagedObjectContext:context]];
+    }
+    event.eventRevisionsOfOtherStores = otherRevisions;
+
+    NSError *localError = nil;
+    if (!success) localError = CDEEventStreamError(@"Could not read revisions from stream");
+
+    // Save so the event has a permanent identifier. It stays incomplete until all changes are imported.
+    if (success) success = [context save:&localError];
+
+    NSManagedObjectID *eventID = event.objectID;
+    NSArray *globalIdentifierIDs = nil;
+    if (success) globalIdentifierIDs = [self importGlobalIdentifierTableIntoContext:context error:&localError];
+    if (success) success = globalIdentifierIDs != nil;
+    if (success) success = [self importObjectChangesForEventWithID:eventID globalIdentifierIDs:globalIdentifierIDs intoContext:context error:&localError];
+
+    if (success) {
+        event.type = (CDEStoreModificationEventType)type;
+        success = [context save:&localError];
+    }
+
+    if (!success) {
+        [context deleteObject:event];
+        NSError *saveError = nil;
+        if (![context save:&saveError]) CDELog(CDELoggingLevelError, @"Could not remove partially imported event: %@", saveError);
+        if (error) *error = localError;
+        return nil;
+    }
+
+    return eventID;
+}
+
+- (NSArray *)importGlobalIdentifierTableIntoContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    uint64_t count;
+    if (![self readUnsigned:&count]) {
+        if (error) *error = CDEEventStreamError(@"Could not read global identifier table");
+        return nil;
+    }
+
+    NSMutableArray *objectIDs = [[NSMutableArray alloc] init];
+    NSMutableArray *entityNames = [[NSMutableArray alloc] init];
+    NSMutableArray *identifierStrings = [[NSMutableArray alloc] init];
+    NSError *localError = nil;
+    BOOL success = YES;
+    for (uint64_t i = 0; i < count && success; i++) {
+        NSString *entityName, *identifierString;
+        success = [self readString:&entityName] && [self readString:&identifierString] && entityName && identifierString;
+        if (!success) {
+            localError = CDEEventStreamError(@"Could not read global identifier table");
+            break;
+        }
+
+        [entityNames addObject:entityName];
+        [identifierStrings addObject:identifierString];
+        if (identifierStrings.count >= saveBatchSize || i == count-1) {
+            @autoreleasepool {
+                NSError *batchError = nil;
+                NSArray *batchIDs = [self globalIdentifierIDsForIdentifierStrings:identifierStrings entityNames:entityNames inContext:context error:&batchError];
+                if (batchIDs) [objectIDs addObjectsFromArray:batchIDs];
+                localError = batchError;
+                success = batchIDs != nil;
+            }
+            [entityNames removeAllObjects];
+            [identifierStrings removeAllObjects];
+        }
+    }
+
+    if (!success) {
+        if (error) *error = localError;
+        return nil;
+    }
+
+    return objectIDs;
+}
+
+- (NSArray *)globalIdentifierIDsForIdentifierStrings:(NSArray *)identifierStrings entityNames:(NSArray *)entityNames inContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    // Reuse existing global identifiers, and create the rest
+    NSArray *globalIdentifiers = [CDEGlobalIdentifier fetchGlobalIdentifiersForIdentifierStrings:identifierStrings withEntityNames:entityNames inManagedObjectContext:context];
+    if (!globalIdentifiers) {
+        if (error) *error = CDEEventStreamError(@"Could not fetch global identifiers");
+        return nil;
+    }
+
+    NSMutableArray *resolved = [[NSMutableArray alloc] initWithCapacity:globalIdentifiers.count];
+    NSMutableDictionary *insertedByKey = [[NSMutableDictionary alloc] init];
+    for (NSUInteger i = 0; i < globalIdentifiers.count; i++) {
+        CDEGlobalIdentifier *globalIdentifier = globalIdentifiers[i];
+        if (globalIdentifier == (id)[NSNull null]) {
+            NSString *key = [NSString stringWithFormat:@"%@__%@", entityNames[i], identifierStrings[i]];
+            globalIdentifier = insertedByKey[key];
+            if (!globalIdentifier) {
+                globalIdentifier = [NSEntityDescription insertNewObjectForEntityForName:@"CDEGlobalIdentifier" inManagedObjectContext:context];
+                globalIdentifier.nameOfEntity = entityNames[i];
+                globalIdentifier.globalIdentifier = identifierStrings[i];
+                insertedByKey[key] = globalIdentifier;
+            }
+        }
+        [resolved addObject:globalIdentifier];
+    }
+
+    if (![context save:error]) return nil;
+    return [resolved valueForKeyPath:@"objectID"];
+}
+
+- (BOOL)importObjectChangesForEventWithID:(NSManagedObjectID *)eventID globalIdentifierIDs:(NSArray *)globalIdentifierIDs intoContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    uint64_t count;
+    if (![self readUnsigned:&count]) {
+        if (error) *error = CDEEventStreamError(@"Could not read object changes");
+        return NO;
+    }
+
+    NSError *localError = nil;
+    BOOL success = YES;
+    for (uint64_t i = 0; i < count && success; i++) {
+        @autoreleasepool {
+            uint32_t length;
+            success = [self readBytes:&length length:4];
+            length = CFSwapInt32BigToHost(length);
+            uint64_t recordStart = bytesRead;
+
+            int64_t type;
+            NSString *entityName;
+            uint64_t globalIdentifierIndex, numberOfDataFiles;
+            NSData *archivedValues;
+            success = success && [self readInteger:&type] && [self readString:&entityName] && [self readUnsigned:&globalIdentifierIndex] && [self readData:&archivedValues] && [self readUnsigned:&numberOfDataFiles];
+            success = success && entityName && globalIdentifierIndex < globalIdentifierIDs.count;
+
+            NSMutableArray *filenames = [[NSMutableArray alloc] init];
+            for (uint64_t f = 0; f < numberOfDataFiles && success; f++) {
+                NSString *filename;
+                success = [self readString:&filename] && filename;
+                if (success) [filenames addObject:filename];
+            }
+
+            success = success && bytesRead - recordStart == length;
+            if (!success) localError = CDEEventStreamError(@"Could not read object change");
+
+            NSArray *values = nil;
+            if (success && archivedValues) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated"
+                values = [NSKeyedUnarchiver unarchiveObjectWithData:archivedValues];
+#pragma clang diagnostic pop
+                success = values != nil;
+                if (!success) localError = CDEEventStreamError(@"Could not unarchive property changes");
+            }
+
+            if (success) {
+                CDEObjectChange *change = [NSEntityDescription insertNewObjectForEntityForName:@"CDEObjectChange" inManagedObjectContext:context];
+                change.type = (CDEObjectChangeType)type;
+                change.nameOfEntity = entityName;
+                change.globalIdentifier = (id)[context objectWithID:globalIdentifierIDs[(NSUInteger)globalIdentifierIndex]];
+                change.storeModificationEvent = (id)[context objectWithID:eventID];
+                change.propertyChangeValues = values;
+
+                for (NSString *filename in filenames) {
+                    CDEDataFile *dataFile = [NSEntityDescription insertNewObjectForEntityForName:@"CDEDataFile" inManagedObjectContext:context];
+                    dataFile.filename = filename;
+                    dataFile.objectChange = change;
+                }
+            }
+
+            // Save in batches, and turn the event back into a fault, so memory use doesn't grow with the event
+            if (success && (i+1) % MAX(saveBatchSize, 1) == 0) {
+                NSError *saveError = nil;
+                success = [context save:&saveError];
+                localError = saveError;
+                if (success) [context refreshObject:[context objectWithID:eventID] mergeChanges:NO];
+            }
+        }
+    }
+
+    if (!success) {
+        if (error) *error = localError;
+        return NO;
+    }
+
+    return YES;
+}
+
+@end
@@ -28,6 +28,7 @@ typedef NS_ENUM(NSInteger, CDEPropertyChangeType) {
 // depending on the context. When saved to the event store, they are global ids.
 @property (nonatomic, strong, readwrite) id value; // for attributes
 @property (nonatomic, strong, readwrite) NSString *filename; // for large binary data attributes
+@property (nonatomic, strong, readwrite) NSArray *chunkFilenames; // for very large binary data attributes, split into chunks
 @property (nonatomic, strong, readwrite) id relatedIdentifier; // for to-one relationships
 @property (nonatomic, strong, readwrite) NSSet *addedIdentifiers, *removedIdentifiers; // for to-many relationships
 @property (nonatomic, strong, readwrite) NSDictionary *movedIdentifiersByIndex; // for ordered to-many relationships
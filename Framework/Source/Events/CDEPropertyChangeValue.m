@@ -22,6 +22,8 @@
 
 Class secureTransformerClass = nil;
 
+static const NSUInteger CDEChunkedDataThreshold = 2 * 1024 * 1024;
+
 
 @implementation CDEPropertyChangeValue
 
@@ -74,6 +76,7 @@ Class secureTransformerClass = nil;
         self.objectID = nil;
         self.value = nil;
         self.filename = nil;
+        self.chunkFilenames = nil;
         self.relatedIdentifier = nil;
         self.addedIdentifiers = nil;
         self.removedIdentifiers = nil;
@@ -96,6 +99,7 @@ Class secureTransformerClass = nil;
         self.propertyName = [aDecoder decodeObjectForKey:@"propertyName"];
         self.type = [aDecoder decodeIntegerForKey:@"type"];
         self.filename = [aDecoder decodeObjectForKey:@"filename"];
+        self.chunkFilenames = [aDecoder decodeObjectForKey:@"chunkFilenames"];
         self.value = [aDecoder decodeObjectForKey:@"value"];
         self.relatedIdentifier = [aDecoder decodeObjectForKey:@"relatedIdentifier"];
         self.addedIdentifiers = [aDecoder decodeObjectForKey:@"addedIdentifiers"];
@@ -107,13 +111,15 @@ Class secureTransformerClass = nil;
 
 - (void)encodeWithCoder:(NSCoder *)aCoder
 {
-    static const NSInteger classVersion = 1;
+    // Version 2 adds chunked data, which earlier versions can't read
+    NSInteger classVersion = self.chunkFilenames ? 2 : 1;
     [aCoder encodeInteger:classVersion forKey:@"classVersion"];
     [aCoder encodeObject:self.propertyName forKey:@"propertyName"];
     [aCoder encodeInteger:self.type forKey:@"type"];
 
     if (self.value) [aCoder encodeObject:self.value forKey:@"value"];
     if (self.filename) [aCoder encodeObject:self.filename forKey:@"filename"];
+    if (self.chunkFilenames) [aCoder encodeObject:self.chunkFilenames forKey:@"chunkFilenames"];
     if (self.relatedIdentifier) [aCoder encodeObject:self.relatedIdentifier forKey:@"relatedIdentifier"];
     if (self.addedIdentifiers) [aCoder encodeObject:self.addedIdentifiers forKey:@"addedIdentifiers"];
     if (self.removedIdentifiers) [aCoder encodeObject:self.removedIdentifiers forKey:@"removedIdentifiers"];
@@ -221,6 +227,17 @@ Class secureTransformerClass = nil;
         newValue = [keyedTransformer reverseTransformedValue:newValue];
     }
         
+    // Split data bigger than 2MB into chunks, so an edit only changes the chunks around it.
+    // Only when enabled, because devices that predate chunks would read the value as nil.
+    self.chunkFilenames = nil;
+    if (self.eventStore.splitsLargeDataIntoChunks && [newValue isKindOfClass:[NSData class]] && [(NSData *)newValue length] > CDEChunkedDataThreshold) {
+        NSAssert(self.eventStore, @"Storing large data attribute requires event store");
+        self.chunkFilenames = [self.eventStore storeDataInChunkedFiles:newValue];
+        self.filename = nil;
+        self.value = nil;
+        if (self.chunkFilenames) return; // If success, return. Otherwise try a single file below.
+    }
+    
     // Put data bigger than 10KB or so in an external file
     if ([newValue isKindOfClass:[NSData class]] && [(NSData *)newValue length] > 10e3) {
         NSAssert(self.eventStore, @"Storing large data attribute requires event store");
@@ -309,7 +326,11 @@ Class secureTransformerClass = nil;
 - (id)attributeValueForAttributeDescription:(NSAttributeDescription *)attribute
 {
     id returnValue = nil;
-    if (self.filename) {
+    if (self.chunkFilenames) {
+        NSAssert(self.eventStore, @"Retrieving attribute requires event store");
+        returnValue = [self.eventStore dataForChunkedFiles:self.chunkFilenames];
+    }
+    else if (self.filename) {
         NSAssert(self.eventStore, @"Retrieving attribute requires event store");
         returnValue = [self.eventStore dataForFile:self.filename];
     }
@@ -438,7 +459,7 @@ Class secureTransformerClass = nil;
 
 - (NSString *)description
 {
-    NSString *result = [NSString stringWithFormat:@"Name: %@\rType: %d\rObjectID: %@\rValue: %@\rFilename: %@\rRelated: %@\rAdded: %@\rRemoved: %@\nMoved: %@\nRelated IDs: %@", self.propertyName, (int)self.type, self.objectID, self.value, self.filename, self.relatedIdentifier, self.addedIdentifiers, self.removedIdentifiers, self.movedIdentifiersByIndex, self.relatedObjectIDs];
+    NSString *result = [NSString stringWithFormat:@"Name: %@\rType: %d\rObjectID: %@\rValue: %@\rFilename: %@\rChunks: %@\rRelated: %@\rAdded: %@\rRemoved: %@\nMoved: %@\nRelated IDs: %@", self.propertyName, (int)self.type, self.objectID, self.value, self.filename, self.chunkFilenames, self.relatedIdentifier, self.addedIdentifiers, self.removedIdentifiers, self.movedIdentifiersByIndex, self.relatedObjectIDs];
     return result;
 }
 
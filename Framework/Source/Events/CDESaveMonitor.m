@@ -171,6 +171,9 @@
     // Store changes
     [self asynchronouslyStoreChangesForContext:context changedObjectsDictionary:notif.userInfo];
     
+    NSUInteger changeCount = [notif.userInfo[NSInsertedObjectsKey] count] + [notif.userInfo[NSUpdatedObjectsKey] count] + [notif.userInfo[NSDeletedObjectsKey] count];
+    [self.ensemble registerLocalSaveWithChangedObjectCount:changeCount];
+    
     // Notification
     NSDictionary *userInfo = self.ensemble ? @{@"persistentStoreEnsemble" : self.ensemble} : nil;
     [[NSNotificationCenter defaultCenter] postNotificationName:CDEMonitoredManagedObjectContextDidSaveNotification object:context userInfo:userInfo];
@@ -14,3 +14,14 @@
 - (void)endAsynchronousTask; // Call on completion of task
 
 @end
+
+
+// Exponential backoff, with jitter so clients that failed together don't retry together
+NSTimeInterval CDERetryDelayForAttempt(NSUInteger attempt, NSTimeInterval baseDelay);
+
+// Failures worth retrying, such as a dropped connection or an overloaded server
+BOOL CDEErrorIsTransient(NSError *error);
+BOOL CDEHTTPStatusCodeIsTransient(NSInteger statusCode);
+
+// Starts a connection that calls its delegate on the work queue
+NSURLConnection *CDEURLConnectionOnWorkQueue(NSURLRequest *request, id delegate);
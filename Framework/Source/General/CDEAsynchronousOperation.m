@@ -7,6 +7,9 @@
 //
 
 #import "CDEAsynchronousOperation.h"
+#import "CDEDefines.h"
+
+static const NSTimeInterval CDEMaximumRetryDelay = 60.0;
 
 @implementation CDEAsynchronousOperation {
     BOOL isFinished, isExecuting;
@@ -33,8 +36,10 @@
 
 - (void)start
 {
-    if (![NSThread isMainThread]) {
-        [self performSelectorOnMainThread:@selector(start) withObject:nil waitUntilDone:NO];
+    if (!CDEIsOnWorkQueue()) {
+        dispatch_async(CDEWorkQueue(), ^{
+            [self start];
+        });
         return;
     }
     
@@ -68,4 +73,60 @@
     }
 }
 
-@end
\ No newline at end of file
+@end
+
+
+#pragma mark Retrying
+
+NSTimeInterval CDERetryDelayForAttempt(NSUInteger attempt, NSTimeInterval baseDelay)
+{
+    NSTimeInterval delay = MIN(baseDelay * pow(2.0, (double)MIN(attempt, 16)), CDEMaximumRetryDelay);
+    double jitter = 0.5 + 0.5 * arc4random_uniform(1001) / 1000.0;
+    return delay * jitter;
+}
+
+BOOL CDEErrorIsTransient(NSError *error)
+{
+    if (![error.domain isEqualToString:NSURLErrorDomain]) return NO;
+    switch (error.code) {
+        case NSURLErrorTimedOut:
+        case NSURLErrorNetworkConnectionLost:
+        case NSURLErrorCannotConnectToHost:
+        case NSURLErrorCannotFindHost:
+        case NSURLErrorDNSLookupFailed:
+        case NSURLErrorNotConnectedToInternet:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+BOOL CDEHTTPStatusCodeIsTransient(NSInteger statusCode)
+{
+    return statusCode >= 500 || statusCode == 408 || statusCode == 429;
+}
+
+
+#pragma mark Connections
+
+NSURLConnection *CDEURLConnectionOnWorkQueue(NSURLRequest *request, id delegate)
+{
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated"
+    NSURLConnection *connection = [[NSURLConnection alloc] initWithRequest:request delegate:delegate startImmediately:NO];
+#pragma clang diagnostic pop
+    
+    // A private work queue has no run loop, so callbacks go through an operation queue that targets it
+    NSOperationQueue *delegateQueue = [[NSOperationQueue alloc] init];
+    if (CDEWorkQueue() != dispatch_get_main_queue() && [delegateQueue respondsToSelector:@selector(setUnderlyingQueue:)]) {
+        delegateQueue.maxConcurrentOperationCount = 1;
+        delegateQueue.underlyingQueue = CDEWorkQueue();
+        [connection setDelegateQueue:delegateQueue];
+    }
+    else {
+        [connection scheduleInRunLoop:[NSRunLoop mainRunLoop] forMode:NSDefaultRunLoopMode];
+    }
+    
+    [connection start];
+    return connection;
+}
@@ -61,8 +61,8 @@
 
 - (void)start
 {
-    if (![NSThread isMainThread]) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+    if (!CDEIsOnWorkQueue()) {
+        dispatch_async(CDEWorkQueue(), ^{
             [self start];
         });
         return;
@@ -80,7 +80,7 @@
     self.numberOfTasksCompleted = 0;
 
     taskEnumerator = [tasks objectEnumerator];
-    dispatch_async(dispatch_get_main_queue(), ^{
+    dispatch_async(CDEWorkQueue(), ^{
         [self startNextTask];
     });
 }
@@ -99,8 +99,8 @@
 
 - (void)startNextTask
 {
-    if (![NSThread isMainThread]) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+    if (!CDEIsOnWorkQueue()) {
+        dispatch_async(CDEWorkQueue(), ^{
             [self startNextTask];
         });
         return;
@@ -108,7 +108,7 @@
     
     @autoreleasepool {
         if (self.isCancelled) {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 [self finish];
             });
             return;
@@ -127,12 +127,12 @@
                 [self->errors addObject:(error ? : [NSNull null])];
                 if (stop) shouldStop = YES;
                 if (shouldStop) {
-                    dispatch_async(dispatch_get_main_queue(), ^{
+                    dispatch_async(CDEWorkQueue(), ^{
                         [self finish];
                     });
                 }
                 else {
-                    dispatch_async(dispatch_get_main_queue(), ^{
+                    dispatch_async(CDEWorkQueue(), ^{
                         [self startNextTask];
                     });
                 }
@@ -140,7 +140,7 @@
             block(next);
         }
         else {
-            dispatch_async(dispatch_get_main_queue(), ^{
+            dispatch_async(CDEWorkQueue(), ^{
                 [self finish];
             });
         }
@@ -149,8 +149,8 @@
 
 - (void)finish
 {
-    if (![NSThread isMainThread]) {
-        dispatch_async(dispatch_get_main_queue(), ^{
+    if (!CDEIsOnWorkQueue()) {
+        dispatch_async(CDEWorkQueue(), ^{
             [self finish];
         });
         return;
@@ -97,6 +97,20 @@ typedef NS_ENUM(NSInteger, CDEErrorCode) {
 };
 
 
+#pragma mark Compression
+
+typedef NS_ENUM(uint8_t, CDECompressionCodec) {
+    /// Files are transferred as is.
+    CDECompressionCodecNone     = 0,
+    
+    /// zlib deflate at the default level. Best ratio.
+    CDECompressionCodecZlib     = 1,
+    
+    /// zlib deflate at the fastest level. Better throughput, slightly larger files.
+    CDECompressionCodecZlibFast = 2
+};
+
+
 #pragma mark Logging
 
 typedef NS_ENUM(NSUInteger, CDELoggingLevel) {
@@ -143,10 +157,27 @@ typedef void (^CDECompletionBlock)(NSError *error);
 
 #pragma mark Functions
 
+/**
+ Deliver a completion on the main queue. These always use the main queue, even when a different work queue has been set with `CDESetWorkQueue`, so apps can use them to return results to their UI. The engine itself dispatches to `CDEWorkQueue()`.
+ */
 void CDEDispatchCompletionBlockToMainQueue(CDECompletionBlock block, NSError *error);
 CDECompletionBlock CDEMainQueueCompletionFromCompletion(CDECompletionBlock block);
 
 
+#pragma mark Work Queue
+
+/**
+ Sets the serial queue that the sync engine runs on.
+ 
+ By default, the engine runs on the main queue. Apps with a busy main thread, and processes without a main run loop, can pass a dedicated serial queue instead. Ensembles, and cloud file systems, then expect their methods to be called on that queue, and cloud file systems call their completion blocks on it.
+ 
+ Set the queue before any ensembles are created, and don't change it while they exist. Passing `NULL` restores the main queue.
+ */
+void CDESetWorkQueue(dispatch_queue_t queue);
+dispatch_queue_t CDEWorkQueue(void);
+BOOL CDEIsOnWorkQueue(void);
+
+
 #pragma mark Useful Macros
 
 #define CDENSNullToNil(object) ((id)object == (id)[NSNull null] ? nil : object)
@@ -15,6 +15,9 @@ NSUInteger currentLoggingLevel = CDELoggingLevelError;
 
 CDELogCallbackFunction CDECurrentLogCallbackFunction = NSLog;
 
+static dispatch_queue_t workQueue = nil;
+static void * const CDEWorkQueueKey = (void *)&CDEWorkQueueKey;
+
 void CDESetCurrentLoggingLevel(NSUInteger newLevel)
 {
     currentLoggingLevel = newLevel;
@@ -50,4 +53,24 @@ CDECompletionBlock CDEMainQueueCompletionFromCompletion(CDECompletionBlock block
             block(error);
         });
     };
-}
\ No newline at end of file
+}
+
+void CDESetWorkQueue(dispatch_queue_t queue)
+{
+    if (queue == dispatch_get_main_queue()) queue = nil;
+    if (workQueue) dispatch_queue_set_specific(workQueue, CDEWorkQueueKey, NULL, NULL);
+    workQueue = queue;
+    if (workQueue) dispatch_queue_set_specific(workQueue, CDEWorkQueueKey, CDEWorkQueueKey, NULL);
+}
+
+dispatch_queue_t CDEWorkQueue(void)
+{
+    return workQueue ? : dispatch_get_main_queue();
+}
+
+BOOL CDEIsOnWorkQueue(void)
+{
+    // Run loop callbacks on the main thread don't carry the main queue's specifics, so check the thread instead
+    if (!workQueue) return [NSThread isMainThread];
+    return dispatch_get_specific(CDEWorkQueueKey) == CDEWorkQueueKey;
+}
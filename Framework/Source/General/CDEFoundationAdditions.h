@@ -20,5 +20,6 @@
 @interface NSData (CDEFoundationAdditions)
 
 - (NSString *)cde_base64String;
+- (NSString *)cde_SHA256String; // Lowercase hexadecimal
 
 @end
@@ -7,6 +7,7 @@
 //
 
 #import "CDEFoundationAdditions.h"
+#import <CommonCrypto/CommonDigest.h>
 
 @implementation NSArray (CDEFoundationAdditions)
 
@@ -53,4 +54,16 @@
     return string;
 }
 
+- (NSString *)cde_SHA256String
+{
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(self.bytes, (CC_LONG)self.length, digest);
+    
+    NSMutableString *string = [[NSMutableString alloc] initWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [string appendFormat:@"%02x", digest[i]];
+    }
+    return string;
+}
+
 @end
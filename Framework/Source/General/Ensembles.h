@@ -22,5 +22,6 @@
 #import <Ensembles/CDEICloudFileSystem.h>
 #import <Ensembles/CDELocalCloudFileSystem.h>
 #import <Ensembles/CDEPersistentStoreEnsemble.h>
+#import <Ensembles/CDERebasePolicy.h>
 #import <Ensembles/NSMapTable+CDEAdditions.h>
 #import <Ensembles/NSManagedObjectModel+CDEAdditions.h>
\ No newline at end of file
@@ -15,4 +15,8 @@
 - (NSString *)cde_entityHashesPropertyList; // XML Dictionary
 + (NSDictionary *)cde_entityHashesByNameFromPropertyList:(NSString *)propertyList; 
 
+// Copy without the entities and properties marked localOnly in their user info.
+// Event files use it, so devices with an older event store model can still read them.
+- (NSManagedObjectModel *)cde_interchangeModel;
+
 @end
@@ -8,6 +8,9 @@
 
 #import "NSManagedObjectModel+CDEAdditions.h"
 #import "CDEDefines.h"
+#import <objc/runtime.h>
+
+static NSString * const CDELocalOnlyUserInfoKey = @"localOnly";
 
 @implementation NSManagedObjectModel (CDEAdditions)
 
@@ -55,4 +58,31 @@
     return entitiesByName;
 }
 
+- (NSManagedObjectModel *)cde_interchangeModel
+{
+    @synchronized (self) {
+        NSManagedObjectModel *interchangeModel = objc_getAssociatedObject(self, _cmd);
+        if (interchangeModel) return interchangeModel;
+        
+        interchangeModel = [self copy];
+        NSMutableArray *entities = [[NSMutableArray alloc] initWithCapacity:interchangeModel.entities.count];
+        for (NSEntityDescription *entity in interchangeModel.entities) {
+            if ([entity.userInfo[CDELocalOnlyUserInfoKey] boolValue]) continue;
+            
+            NSMutableArray *properties = [[NSMutableArray alloc] initWithCapacity:entity.properties.count];
+            for (NSPropertyDescription *property in entity.properties) {
+                if ([property.userInfo[CDELocalOnlyUserInfoKey] boolValue]) continue;
+                [properties addObject:property];
+            }
+            if (properties.count != entity.properties.count) entity.properties = properties;
+            
+            [entities addObject:entity];
+        }
+        interchangeModel.entities = entities;
+        
+        objc_setAssociatedObject(self, _cmd, interchangeModel, OBJC_ASSOCIATION_RETAIN);
+        return interchangeModel;
+    }
+}
+
 @end
@@ -21,4 +21,9 @@
 
 + (NSSet *)unreferencedFilenamesInManagedObjectContext:(NSManagedObjectContext *)context;
 
+// Data files are named by a hash of their contents, so several object changes can share one file.
+// The reference count is the number of object changes using the file. Files with no references can be deleted.
++ (NSDictionary *)referenceCountsByFilenameInManagedObjectContext:(NSManagedObjectContext *)context;
++ (NSUInteger)referenceCountForFilename:(NSString *)filename inManagedObjectContext:(NSManagedObjectContext *)context;
+
 @end
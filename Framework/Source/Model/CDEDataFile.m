@@ -18,15 +18,8 @@
 
 + (NSSet *)allFilenamesInManagedObjectContext:(NSManagedObjectContext *)context
 {
-    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEDataFile"];
-    fetch.predicate = [NSPredicate predicateWithFormat:@"objectChange != NIL"];
-    
-    NSError *error;
-    NSArray *results = [context executeFetchRequest:fetch error:&error];
-    if (!results) CDELog(CDELoggingLevelError, @"Could not fetch data files: %@", error);
-    
-    NSSet *filenames = [NSSet setWithArray:[results valueForKeyPath:@"filename"]];
-    return filenames;
+    NSDictionary *referenceCounts = [self referenceCountsByFilenameInManagedObjectContext:context];
+    return [NSSet setWithArray:referenceCounts.allKeys];
 }
 
 + (NSSet *)filenamesInStoreModificationEvents:(NSArray *)events
@@ -54,8 +47,69 @@
     NSArray *results = [context executeFetchRequest:fetch error:&error];
     if (!results) CDELog(CDELoggingLevelError, @"Could not fetch data files: %@", error);
     
-    NSSet *filenames = [NSSet setWithArray:[results valueForKeyPath:@"filename"]];
+    // A file may be orphaned by one object change, but still used by another
+    NSMutableSet *filenames = [NSMutableSet setWithArray:[results valueForKeyPath:@"filename"]];
+    [filenames minusSet:[self allFilenamesInManagedObjectContext:context]];
     return filenames;
 }
 
+
+#pragma mark Reference Counting
+
++ (NSDictionary *)referenceCountsByFilenameInManagedObjectContext:(NSManagedObjectContext *)context
+{
+    // Grouped fetches ignore unsaved changes, so count objects in memory if there are any
+    if (context.hasChanges) {
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEDataFile"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"objectChange != NIL"];
+        
+        NSError *error;
+        NSArray *results = [context executeFetchRequest:fetch error:&error];
+        if (!results) CDELog(CDELoggingLevelError, @"Could not fetch data files: %@", error);
+        
+        NSCountedSet *filenames = [[NSCountedSet alloc] initWithArray:[results valueForKeyPath:@"filename"]];
+        NSMutableDictionary *countsByFilename = [[NSMutableDictionary alloc] initWithCapacity:filenames.count];
+        for (NSString *filename in filenames) countsByFilename[filename] = @([filenames countForObject:filename]);
+        return countsByFilename;
+    }
+    
+    NSExpressionDescription *countDescription = [[NSExpressionDescription alloc] init];
+    countDescription.name = @"referenceCount";
+    countDescription.expression = [NSExpression expressionForFunction:@"count:" arguments:@[[NSExpression expressionForKeyPath:@"filename"]]];
+    countDescription.expressionResultType = NSInteger64AttributeType;
+    
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEDataFile"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"objectChange != NIL"];
+    fetch.resultType = NSDictionaryResultType;
+    fetch.propertiesToFetch = @[@"filename", countDescription];
+    fetch.propertiesToGroupBy = @[@"filename"];
+    
+    NSError *error;
+    NSArray *results = [context executeFetchRequest:fetch error:&error];
+    if (!results) CDELog(CDELoggingLevelError, @"Could not fetch data file reference counts: %@", error);
+    
+    NSMutableDictionary *countsByFilename = [[NSMutableDictionary alloc] initWithCapacity:results.count];
+    for (NSDictionary *result in results) {
+        NSString *filename = result[@"filename"];
+        if (filename) countsByFilename[filename] = result[@"referenceCount"];
+    }
+    
+    return countsByFilename;
+}
+
++ (NSUInteger)referenceCountForFilename:(NSString *)filename inManagedObjectContext:(NSManagedObjectContext *)context
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEDataFile"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"filename = %@ AND objectChange != NIL", filename];
+    
+    NSError *error;
+    NSUInteger count = [context countForFetchRequest:fetch error:&error];
+    if (count == NSNotFound) {
+        CDELog(CDELoggingLevelError, @"Could not count data file references: %@", error);
+        count = 0;
+    }
+    
+    return count;
+}
+
 @end
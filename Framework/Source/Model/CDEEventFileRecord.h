@@ -0,0 +1,47 @@
+//
+//  CDEEventFileRecord.h
+//  Ensembles
+//
+//  A ledger of the cloud filenames of events in the event store. It is kept up to date as events
+//  are created, imported and removed, so the cloud manager can compare with the cloud listing
+//  using indexed fetches, rather than fetching every event and deriving its filenames.
+//
+//  Created by Drew McCormack on 24/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "CDEDefines.h"
+#import "CDEStoreModificationEvent.h"
+
+typedef NS_ENUM(int16_t, CDEEventFileState) {
+    CDEEventFileStateLocalOnly  = 0, // Created by this store, and not yet seen in the cloud
+    CDEEventFileStateExported   = 1, // Created by this store, and uploaded
+    CDEEventFileStateImported   = 2, // Created by another store
+    CDEEventFileStateDeleted    = 3  // Event is gone. Kept until the cloud file is removed.
+};
+
+@interface CDEEventFileRecord : NSManagedObject
+
+@property (nonatomic, strong, readwrite) NSString *filename;
+@property (nonatomic, strong, readwrite) NSString *persistentStoreIdentifier;
+@property (nonatomic, assign, readwrite) BOOL preferred; // Baselines also have a legacy alias
+@property (nonatomic, assign, readwrite) CDEEventFileState state;
+@property (nonatomic, assign, readwrite) CDEStoreModificationEventType type;
+@property (nonatomic, strong, readwrite) CDEStoreModificationEvent *storeModificationEvent;
+
+// Maintaining the ledger. Call on the queue of the context.
++ (void)updateRecordsForChangesInManagedObjectContext:(NSManagedObjectContext *)context localPersistentStoreIdentifier:(NSString *)localStoreId; // Before saving
++ (BOOL)updateRecordsForAllEventsInManagedObjectContext:(NSManagedObjectContext *)context localPersistentStoreIdentifier:(NSString *)localStoreId error:(NSError * __autoreleasing *)error; // Adds missing records, and marks records of removed events
+
+// Filenames of events present in the store. Pass nil for the store to include all stores.
++ (NSSet *)filenamesForEventTypes:(NSArray *)types persistentStoreIdentifier:(NSString *)storeIdOrNil inManagedObjectContext:(NSManagedObjectContext *)context;
+
+// Preferred filenames of events with no alias in the filenames passed. Records found in the filenames are marked exported.
++ (NSArray *)preferredFilenamesForEventTypes:(NSArray *)types persistentStoreIdentifier:(NSString *)storeId missingFromFilenames:(NSSet *)filenames inManagedObjectContext:(NSManagedObjectContext *)context;
+
++ (void)markFilenames:(NSArray *)filenames exportedInManagedObjectContext:(NSManagedObjectContext *)context;
++ (void)deleteRecordsOfRemovedEventsExcludingFilenames:(NSSet *)filenames inManagedObjectContext:(NSManagedObjectContext *)context;
+
+@end
@@ -0,0 +1,216 @@
+//
+//  CDEEventFileRecord.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 24/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEEventFileRecord.h"
+#import "CDEEventRevision.h"
+#import "CDEEventFile.h"
+
+static const NSUInteger CDEEventFileRecordFetchBatchSize = 500;
+
+@implementation CDEEventFileRecord
+
+@dynamic filename;
+@dynamic persistentStoreIdentifier;
+@dynamic preferred;
+@dynamic state;
+@dynamic type;
+@dynamic storeModificationEvent;
+
+
+#pragma mark Maintaining the Ledger
+
++ (void)updateRecordsForChangesInManagedObjectContext:(NSManagedObjectContext *)context localPersistentStoreIdentifier:(NSString *)localStoreId
+{
+    // Propagate deletions first, so records of deleted events have lost their event
+    [context processPendingChanges];
+
+    NSSet *eventKeys = [NSSet setWithObjects:@"type", @"globalCount", @"uniqueIdentifier", @"eventRevision", nil];
+    NSSet *revisionKeys = [NSSet setWithObjects:@"persistentStoreIdentifier", @"revisionNumber", @"storeModificationEvent", nil];
+
+    NSMutableSet *events = [[NSMutableSet alloc] init];
+    for (NSManagedObject *object in context.insertedObjects) {
+        if ([object isKindOfClass:[CDEStoreModificationEvent class]]) [events addObject:object];
+    }
+
+    for (NSManagedObject *object in context.updatedObjects) {
+        if ([object isKindOfClass:[CDEStoreModificationEvent class]]) {
+            NSSet *changedKeys = [NSSet setWithArray:object.changedValues.allKeys];
+            if ([changedKeys intersectsSet:eventKeys]) [events addObject:object];
+        }
+        else if ([object isKindOfClass:[CDEEventRevision class]]) {
+            NSSet *changedKeys = [NSSet setWithArray:object.changedValues.allKeys];
+            CDEStoreModificationEvent *event = [(CDEEventRevision *)object storeModificationEvent];
+            if (event && [changedKeys intersectsSet:revisionKeys]) [events addObject:event];
+        }
+        else if ([object isKindOfClass:[CDEEventFileRecord class]]) {
+            CDEEventFileRecord *record = (id)object;
+            if (!record.storeModificationEvent && record.state != CDEEventFileStateDeleted) record.state = CDEEventFileStateDeleted;
+        }
+    }
+
+    [self updateRecordsForStoreModificationEvents:events localPersistentStoreIdentifier:localStoreId];
+}
+
++ (BOOL)updateRecordsForAllEventsInManagedObjectContext:(NSManagedObjectContext *)context localPersistentStoreIdentifier:(NSString *)localStoreId error:(NSError * __autoreleasing *)error
+{
+    // Events without records, such as those saved before the ledger existed
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"type != %d AND eventFileRecords.@count = 0", CDEStoreModificationEventTypeIncomplete];
+    fetch.relationshipKeyPathsForPrefetching = @[@"eventRevision"];
+    NSArray *events = [context executeFetchRequest:fetch error:error];
+    if (!events) return NO;
+    if (events.count > 0) CDELog(CDELoggingLevelVerbose, @"Adding %lu events to the event file ledger", (unsigned long)events.count);
+    [self updateRecordsForStoreModificationEvents:events localPersistentStoreIdentifier:localStoreId];
+
+    // Records of events removed without the ledger seeing it
+    fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventFileRecord"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent = NIL AND state != %d", CDEEventFileStateDeleted];
+    NSArray *records = [context executeFetchRequest:fetch error:error];
+    if (!records) return NO;
+    for (CDEEventFileRecord *record in records) record.state = CDEEventFileStateDeleted;
+
+    return YES;
+}
+
++ (void)updateRecordsForStoreModificationEvents:(id <NSFastEnumeration>)events localPersistentStoreIdentifier:(NSString *)localStoreId
+{
+    NSMutableDictionary *eventsByMissingFilename = [[NSMutableDictionary alloc] init];
+    NSMutableSet *preferredFilenames = [[NSMutableSet alloc] init];
+    for (CDEStoreModificationEvent *event in events) {
+        if (event.isDeleted || event.type == CDEStoreModificationEventTypeIncomplete || !event.eventRevision) continue;
+
+        CDEEventFile *eventFile = [[CDEEventFile alloc] initWithStoreModificationEvent:event];
+        NSSet *aliases = eventFile.aliases;
+        [preferredFilenames addObject:eventFile.preferredFilename];
+
+        // Records of filenames the event no longer has, such as after a baseline is consolidated, are retired
+        NSMutableSet *recordedFilenames = [[NSMutableSet alloc] init];
+        for (CDEEventFileRecord *record in [event.eventFileRecords copy]) {
+            if ([aliases containsObject:record.filename]) {
+                if (record.type != event.type) record.type = event.type;
+                [recordedFilenames addObject:record.filename];
+            }
+            else {
+                record.storeModificationEvent = nil;
+                record.state = CDEEventFileStateDeleted;
+            }
+        }
+
+        for (NSString *alias in aliases) {
+            if (![recordedFilenames containsObject:alias]) eventsByMissingFilename[alias] = event;
+        }
+    }
+
+    if (eventsByMissingFilename.count == 0) return;
+
+    // Reuse records retired earlier, such as when an event is imported again
+    NSManagedObjectContext *context = [[eventsByMissingFilename.allValues lastObject] managedObjectContext];
+    NSArray *missingFilenames = eventsByMissingFilename.allKeys;
+    NSMutableDictionary *retiredRecordsByFilename = [[NSMutableDictionary alloc] init];
+    for (NSUInteger i = 0; i < missingFilenames.count; i += CDEEventFileRecordFetchBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEEventFileRecordFetchBatchSize, missingFilenames.count - i));
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventFileRecord"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"filename IN %@ AND storeModificationEvent = NIL", [missingFilenames subarrayWithRange:range]];
+
+        NSError *error;
+        NSArray *records = [context executeFetchRequest:fetch error:&error];
+        if (!records) CDELog(CDELoggingLevelError, @"Could not fetch event file records: %@", error);
+        for (CDEEventFileRecord *record in records) retiredRecordsByFilename[record.filename] = record;
+    }
+
+    [eventsByMissingFilename enumerateKeysAndObjectsUsingBlock:^(NSString *filename, CDEStoreModificationEvent *event, BOOL *stop) {
+        CDEEventFileRecord *record = retiredRecordsByFilename[filename];
+        if (!record) record = [NSEntityDescription insertNewObjectForEntityForName:@"CDEEventFileRecord" inManagedObjectContext:context];
+
+        NSString *storeId = event.eventRevision.persistentStoreIdentifier;
+        record.filename = filename;
+        record.storeModificationEvent = event;
+        record.type = event.type;
+        record.persistentStoreIdentifier = storeId;
+        record.preferred = [preferredFilenames containsObject:filename];
+        record.state = [storeId isEqualToString:localStoreId] ? CDEEventFileStateLocalOnly : CDEEventFileStateImported;
+    }];
+}
+
+
+#pragma mark Lookups
+
++ (NSArray *)fetchRecordsForEventTypes:(NSArray *)types persistentStoreIdentifier:(NSString *)storeIdOrNil inManagedObjectContext:(NSManagedObjectContext *)context
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventFileRecord"];
+    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"type IN %@ AND state != %d", types, CDEEventFileStateDeleted];
+    if (storeIdOrNil) {
+        NSPredicate *storePredicate = [NSPredicate predicateWithFormat:@"persistentStoreIdentifier = %@", storeIdOrNil];
+        predicate = [NSCompoundPredicate andPredicateWithSubpredicates:@[predicate, storePredicate]];
+    }
+    fetch.predicate = predicate;
+
+    NSError *error;
+    NSArray *records = [context executeFetchRequest:fetch error:&error];
+    if (!records) CDELog(CDELoggingLevelError, @"Could not fetch event file records: %@", error);
+
+    return records;
+}
+
++ (NSSet *)filenamesForEventTypes:(NSArray *)types persistentStoreIdentifier:(NSString *)storeIdOrNil inManagedObjectContext:(NSManagedObjectContext *)context
+{
+    NSArray *records = [self fetchRecordsForEventTypes:types persistentStoreIdentifier:storeIdOrNil inManagedObjectContext:context];
+    return [NSSet setWithArray:[records valueForKeyPath:@"filename"]];
+}
+
++ (NSArray *)preferredFilenamesForEventTypes:(NSArray *)types persistentStoreIdentifier:(NSString *)storeId missingFromFilenames:(NSSet *)filenames inManagedObjectContext:(NSManagedObjectContext *)context
+{
+    NSArray *records = [self fetchRecordsForEventTypes:types persistentStoreIdentifier:storeId inManagedObjectContext:context];
+
+    // An event is present if any of its aliases is
+    NSMutableSet *presentEventIDs = [[NSMutableSet alloc] init];
+    for (CDEEventFileRecord *record in records) {
+        if (!record.storeModificationEvent || ![filenames containsObject:record.filename]) continue;
+        [presentEventIDs addObject:record.storeModificationEvent.objectID];
+        if (record.state == CDEEventFileStateLocalOnly) record.state = CDEEventFileStateExported;
+    }
+
+    NSMutableArray *missing = [[NSMutableArray alloc] init];
+    for (CDEEventFileRecord *record in records) {
+        if (!record.preferred || !record.storeModificationEvent) continue;
+        if ([presentEventIDs containsObject:record.storeModificationEvent.objectID]) continue;
+        [missing addObject:record.filename];
+    }
+
+    return missing;
+}
+
++ (void)markFilenames:(NSArray *)filenames exportedInManagedObjectContext:(NSManagedObjectContext *)context
+{
+    for (NSUInteger i = 0; i < filenames.count; i += CDEEventFileRecordFetchBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEEventFileRecordFetchBatchSize, filenames.count - i));
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventFileRecord"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"filename IN %@ AND state = %d", [filenames subarrayWithRange:range], CDEEventFileStateLocalOnly];
+
+        NSError *error;
+        NSArray *records = [context executeFetchRequest:fetch error:&error];
+        if (!records) CDELog(CDELoggingLevelError, @"Could not fetch event file records: %@", error);
+        for (CDEEventFileRecord *record in records) record.state = CDEEventFileStateExported;
+    }
+}
+
++ (void)deleteRecordsOfRemovedEventsExcludingFilenames:(NSSet *)filenames inManagedObjectContext:(NSManagedObjectContext *)context
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventFileRecord"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"state = %d", CDEEventFileStateDeleted];
+
+    NSError *error;
+    NSArray *records = [context executeFetchRequest:fetch error:&error];
+    if (!records) CDELog(CDELoggingLevelError, @"Could not fetch event file records: %@", error);
+
+    for (CDEEventFileRecord *record in records) {
+        if (![filenames containsObject:record.filename]) [context deleteObject:record];
+    }
+}
+
+@end
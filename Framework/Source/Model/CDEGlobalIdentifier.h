@@ -15,10 +15,15 @@
 @property (nonatomic, retain) NSString *globalIdentifier;
 @property (nonatomic, retain) NSString *storeURI;
 @property (nonatomic, retain) NSString *nameOfEntity;
+@property (nonatomic, assign) int64_t referenceCount; // Object changes using the identifier. -1 until counted.
 
 + (NSArray *)fetchGlobalIdentifiersForObjectIDs:(NSArray *)uris inManagedObjectContext:(NSManagedObjectContext *)context;
 + (NSArray *)fetchGlobalIdentifiersForIdentifierStrings:(NSArray *)strings withEntityNames:(NSArray *)entityNames inManagedObjectContext:(NSManagedObjectContext *)context;
 
+// Maintaining reference counts. Call on the queue of the context.
++ (void)updateReferenceCountsForChangesInManagedObjectContext:(NSManagedObjectContext *)context; // Before saving
++ (BOOL)countReferencesOfUncountedGlobalIdentifiersInManagedObjectContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error;
+
 + (NSArray *)fetchUnreferencedGlobalIdentifiersInManagedObjectContext:(NSManagedObjectContext *)context;
 
 @end
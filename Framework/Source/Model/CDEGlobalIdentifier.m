@@ -8,6 +8,10 @@
 
 #import "CDEGlobalIdentifier.h"
 #import "CDEDefines.h"
+#import "CDEObjectChange.h"
+
+static const int64_t CDEUncountedReferenceCount = -1;
+static const NSUInteger CDEReferenceCountBatchSize = 500;
 
 
 @implementation CDEGlobalIdentifier
@@ -15,6 +19,7 @@
 @dynamic globalIdentifier;
 @dynamic storeURI;
 @dynamic nameOfEntity;
+@dynamic referenceCount;
 
 - (void)awakeFromInsert
 {
@@ -86,9 +91,10 @@
 
 + (NSArray *)fetchUnreferencedGlobalIdentifiersInManagedObjectContext:(NSManagedObjectContext *)context
 {
+    // The count finds candidates through its index. The relationship only confirms them.
     NSError *error = nil;
     NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEGlobalIdentifier"];
-    fetch.predicate = [NSPredicate predicateWithFormat:@"objectChanges.@count == 0"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"referenceCount == 0 AND objectChanges.@count == 0"];
     NSArray *globalIds = [context executeFetchRequest:fetch error:&error];
     if (!globalIds) {
         CDELog(CDELoggingLevelError, @"Fetch for global ids failed: %@", error);
@@ -98,4 +104,98 @@
     return globalIds;
 }
 
+
+#pragma mark Reference Counts
+
++ (void)updateReferenceCountsForChangesInManagedObjectContext:(NSManagedObjectContext *)context
+{
+    NSMapTable *deltasByGlobalId = [NSMapTable strongToStrongObjectsMapTable];
+    void (^addDelta)(CDEGlobalIdentifier *, int64_t) = ^(CDEGlobalIdentifier *globalId, int64_t delta) {
+        if (!globalId || globalId.isDeleted) return;
+        NSNumber *total = [deltasByGlobalId objectForKey:globalId];
+        [deltasByGlobalId setObject:@(total.longLongValue + delta) forKey:globalId];
+    };
+    
+    for (NSManagedObject *object in context.insertedObjects) {
+        if ([object isKindOfClass:[CDEGlobalIdentifier class]]) {
+            addDelta((id)object, 0);
+        }
+        else if ([object isKindOfClass:[CDEObjectChange class]]) {
+            addDelta([(CDEObjectChange *)object globalIdentifier], 1);
+        }
+    }
+    
+    // Deleted changes may already be detached, so the saved relationship is used
+    for (NSManagedObject *object in context.deletedObjects) {
+        if (![object isKindOfClass:[CDEObjectChange class]]) continue;
+        id globalId = [object committedValuesForKeys:@[@"globalIdentifier"]][@"globalIdentifier"];
+        if (globalId != [NSNull null]) addDelta(globalId, -1);
+    }
+    
+    for (NSManagedObject *object in context.updatedObjects) {
+        if (![object isKindOfClass:[CDEObjectChange class]]) continue;
+        if (!object.changedValues[@"globalIdentifier"]) continue;
+        id oldGlobalId = [object committedValuesForKeys:@[@"globalIdentifier"]][@"globalIdentifier"];
+        if (oldGlobalId != [NSNull null]) addDelta(oldGlobalId, -1);
+        addDelta([(CDEObjectChange *)object globalIdentifier], 1);
+    }
+    
+    // New identifiers start from zero. Those not yet counted are left for reconciliation.
+    for (CDEGlobalIdentifier *globalId in deltasByGlobalId) {
+        int64_t delta = [[deltasByGlobalId objectForKey:globalId] longLongValue];
+        int64_t count = globalId.referenceCount;
+        if (globalId.isInserted && count == CDEUncountedReferenceCount) count = 0;
+        if (count == CDEUncountedReferenceCount) continue;
+        int64_t newCount = MAX(0, count + delta);
+        if (newCount != globalId.referenceCount) globalId.referenceCount = newCount;
+    }
+}
+
++ (BOOL)countReferencesOfUncountedGlobalIdentifiersInManagedObjectContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    NSExpressionDescription *countDescription = [[NSExpressionDescription alloc] init];
+    countDescription.name = @"count";
+    countDescription.expression = [NSExpression expressionForFunction:@"count:" arguments:@[[NSExpression expressionForKeyPath:@"type"]]];
+    countDescription.expressionResultType = NSInteger64AttributeType;
+    
+    NSFetchRequest *uncountedFetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEGlobalIdentifier"];
+    uncountedFetch.predicate = [NSPredicate predicateWithFormat:@"referenceCount == %lld", CDEUncountedReferenceCount];
+    uncountedFetch.fetchLimit = CDEReferenceCountBatchSize;
+    
+    // Each pass counts a batch and saves, so the loop ends when none are left uncounted
+    NSError *localError = nil;
+    BOOL success = YES;
+    while (success) {
+        @autoreleasepool {
+            NSArray *globalIds = [context executeFetchRequest:uncountedFetch error:&localError];
+            success = globalIds != nil;
+            if (globalIds.count == 0) break;
+            
+            NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+            fetch.predicate = [NSPredicate predicateWithFormat:@"globalIdentifier IN %@", globalIds];
+            fetch.resultType = NSDictionaryResultType;
+            fetch.propertiesToGroupBy = @[@"globalIdentifier"];
+            fetch.propertiesToFetch = @[@"globalIdentifier", countDescription];
+            fetch.includesPendingChanges = NO;
+            NSArray *results = [context executeFetchRequest:fetch error:&localError];
+            success = results != nil;
+            if (!success) break;
+            
+            NSMutableDictionary *countsByGlobalIdentifierID = [[NSMutableDictionary alloc] initWithCapacity:results.count];
+            for (NSDictionary *result in results) {
+                id globalIdentifierID = result[@"globalIdentifier"];
+                if (globalIdentifierID) countsByGlobalIdentifierID[globalIdentifierID] = result[@"count"];
+            }
+            
+            for (CDEGlobalIdentifier *globalId in globalIds) {
+                globalId.referenceCount = [countsByGlobalIdentifierID[globalId.objectID] longLongValue];
+            }
+            success = [context save:&localError];
+        }
+    }
+    
+    if (!success && error) *error = localError;
+    return success;
+}
+
 @end
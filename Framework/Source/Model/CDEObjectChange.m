@@ -57,6 +57,10 @@
             if (!newFilenames) newFilenames = [[NSMutableSet alloc] init];
             [newFilenames addObject:value.filename];
         }
+        if (value.chunkFilenames) {
+            if (!newFilenames) newFilenames = [[NSMutableSet alloc] init];
+            [newFilenames addObjectsFromArray:value.chunkFilenames];
+        }
     }
     
     if (self.dataFiles.count == 0 && newFilenames.count == 0) return;
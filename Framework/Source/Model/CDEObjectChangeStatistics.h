@@ -0,0 +1,38 @@
+//
+//  CDEObjectChangeStatistics.h
+//  Ensembles
+//
+//  Counts of the object changes in each event, per entity, used to decide when to rebase. They are kept
+//  up to date as the event store saves, so the totals can be summed from a few rows, rather than
+//  counted from the object changes. Byte counts are estimates of the size of the stored values.
+//
+//  Created by Drew McCormack on 30/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+#import "CDEDefines.h"
+
+@class CDEStoreModificationEvent;
+@class CDEEventStoreStatistics;
+
+@interface CDEObjectChangeStatistics : NSManagedObject
+
+@property (nonatomic, strong, readwrite) NSString *nameOfEntity;
+@property (nonatomic, assign, readwrite) int64_t insertCount;
+@property (nonatomic, assign, readwrite) int64_t updateCount;
+@property (nonatomic, assign, readwrite) int64_t deleteCount;
+@property (nonatomic, assign, readwrite) int64_t repeatedUpdateCount; // Updates to objects already updated outside the baseline
+@property (nonatomic, assign, readwrite) int64_t byteCount;
+@property (nonatomic, assign, readwrite) int64_t insertByteCount;
+@property (nonatomic, strong, readwrite) CDEStoreModificationEvent *storeModificationEvent;
+
+// Maintaining the statistics. Call on the queue of the context.
++ (void)updateStatisticsForChangesInManagedObjectContext:(NSManagedObjectContext *)context; // Before saving
++ (BOOL)updateStatisticsForAllEventsInManagedObjectContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error; // Adds statistics for events that have none
+
+// Totals for the event store. Whether the baseline includes all stores is left to the caller.
++ (CDEEventStoreStatistics *)eventStoreStatisticsInManagedObjectContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error;
+
+@end
@@ -0,0 +1,409 @@
+//
+//  CDEObjectChangeStatistics.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 30/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEObjectChangeStatistics.h"
+#import "NSMapTable+CDEAdditions.h"
+#import "CDEStoreModificationEvent.h"
+#import "CDEObjectChange.h"
+#import "CDEGlobalIdentifier.h"
+#import "CDEPropertyChangeValue.h"
+#import "CDERebasePolicy.h"
+
+static const NSUInteger CDEObjectChangeStatisticsFetchBatchSize = 500;
+static const int64_t CDEEstimatedObjectChangeByteCount = 256; // Used when values are not at hand
+static const int64_t CDEEstimatedIdentifierByteCount = 36; // Length of a UUID string
+static const int64_t CDEEstimatedScalarByteCount = 8;
+
+
+#pragma mark Estimating Size
+
+static int64_t CDEEstimatedByteCountOfPropertyChangeValues(NSArray *propertyChangeValues)
+{
+    int64_t count = 0;
+    for (CDEPropertyChangeValue *propertyValue in propertyChangeValues) {
+        count += propertyValue.propertyName.length;
+
+        id value = propertyValue.value;
+        if ([value isKindOfClass:[NSData class]]) count += [value length];
+        else if ([value isKindOfClass:[NSString class]]) count += [value length];
+        else if (value) count += CDEEstimatedScalarByteCount;
+
+        count += propertyValue.filename.length;
+        count += propertyValue.chunkFilenames.count * CDEEstimatedIdentifierByteCount;
+
+        id relatedIdentifier = propertyValue.relatedIdentifier;
+        if ([relatedIdentifier isKindOfClass:[NSString class]]) count += [relatedIdentifier length];
+        else if (relatedIdentifier) count += CDEEstimatedIdentifierByteCount;
+
+        count += (propertyValue.addedIdentifiers.count + propertyValue.removedIdentifiers.count) * CDEEstimatedIdentifierByteCount;
+        count += propertyValue.movedIdentifiersByIndex.count * (CDEEstimatedIdentifierByteCount + CDEEstimatedScalarByteCount);
+    }
+    return count;
+}
+
+
+#pragma mark Deltas
+
+// Changes to the statistics of one entity in one event, gathered before the rows are fetched
+@interface CDEObjectChangeStatisticsDelta : NSObject {
+    @public
+    int64_t insertCount, updateCount, deleteCount;
+    int64_t removedInsertCount, removedUpdateCount, removedDeleteCount;
+    int64_t repeatedUpdateCount;
+    int64_t byteCount, insertByteCount;
+}
+@end
+
+@implementation CDEObjectChangeStatisticsDelta
+@end
+
+
+@implementation CDEObjectChangeStatistics
+
+@dynamic nameOfEntity;
+@dynamic insertCount;
+@dynamic updateCount;
+@dynamic deleteCount;
+@dynamic repeatedUpdateCount;
+@dynamic byteCount;
+@dynamic insertByteCount;
+@dynamic storeModificationEvent;
+
+
+#pragma mark Maintaining the Statistics
+
++ (void)updateStatisticsForChangesInManagedObjectContext:(NSManagedObjectContext *)context
+{
+    // Propagate deletions first, so cascaded object changes are included
+    [context processPendingChanges];
+
+    NSMapTable *deltasByEvent = [NSMapTable cde_strongToStrongObjectsMapTable];
+    NSSet *changeKeys = [NSSet setWithObjects:@"storeModificationEvent", @"type", @"nameOfEntity", @"propertyChangeValues", nil];
+    NSArray *committedKeys = @[@"storeModificationEvent", @"type", @"nameOfEntity"];
+    NSMutableArray *insertedUpdates = [[NSMutableArray alloc] init];
+
+    for (NSManagedObject *object in context.insertedObjects) {
+        if (![object isKindOfClass:[CDEObjectChange class]]) continue;
+        CDEObjectChange *change = (id)object;
+        [self addObjectChange:change toDeltas:deltasByEvent];
+        if (change.type == CDEObjectChangeTypeUpdate) [insertedUpdates addObject:change];
+    }
+
+    for (NSManagedObject *object in context.updatedObjects) {
+        if (![object isKindOfClass:[CDEObjectChange class]]) continue;
+        NSSet *changedKeys = [NSSet setWithArray:object.changedValues.allKeys];
+        if (![changedKeys intersectsSet:changeKeys]) continue;
+
+        // Moved between events, such as when rebasing, or values merged
+        NSDictionary *committedValues = [object committedValuesForKeys:committedKeys];
+        [self removeObjectChangeWithCommittedValues:committedValues fromDeltas:deltasByEvent];
+        [self addObjectChange:(id)object toDeltas:deltasByEvent];
+    }
+
+    for (NSManagedObject *object in context.deletedObjects) {
+        if (![object isKindOfClass:[CDEObjectChange class]]) continue;
+        NSDictionary *committedValues = [object committedValuesForKeys:committedKeys];
+        [self removeObjectChangeWithCommittedValues:committedValues fromDeltas:deltasByEvent];
+    }
+
+    [self addRepeatedUpdatesInObjectChanges:insertedUpdates toDeltas:deltasByEvent];
+    [self applyDeltas:deltasByEvent inManagedObjectContext:context];
+}
+
++ (CDEObjectChangeStatisticsDelta *)deltaForEvent:(CDEStoreModificationEvent *)event nameOfEntity:(NSString *)entityName inDeltas:(NSMapTable *)deltasByEvent
+{
+    if (!event || event.isDeleted || !entityName) return nil;
+
+    NSMutableDictionary *deltasByEntity = [deltasByEvent objectForKey:event];
+    if (!deltasByEntity) {
+        deltasByEntity = [[NSMutableDictionary alloc] init];
+        [deltasByEvent setObject:deltasByEntity forKey:event];
+    }
+
+    CDEObjectChangeStatisticsDelta *delta = deltasByEntity[entityName];
+    if (!delta) {
+        delta = [[CDEObjectChangeStatisticsDelta alloc] init];
+        deltasByEntity[entityName] = delta;
+    }
+
+    return delta;
+}
+
++ (void)addObjectChange:(CDEObjectChange *)change toDeltas:(NSMapTable *)deltasByEvent
+{
+    CDEObjectChangeStatisticsDelta *delta = [self deltaForEvent:change.storeModificationEvent nameOfEntity:change.nameOfEntity inDeltas:deltasByEvent];
+    if (!delta) return;
+
+    int64_t bytes = CDEEstimatedByteCountOfPropertyChangeValues(change.propertyChangeValues);
+    delta->byteCount += bytes;
+    switch (change.type) {
+        case CDEObjectChangeTypeInsert:
+            delta->insertCount++;
+            delta->insertByteCount += bytes;
+            break;
+        case CDEObjectChangeTypeUpdate:
+            delta->updateCount++;
+            break;
+        case CDEObjectChangeTypeDelete:
+            delta->deleteCount++;
+            break;
+    }
+}
+
++ (void)removeObjectChangeWithCommittedValues:(NSDictionary *)committedValues fromDeltas:(NSMapTable *)deltasByEvent
+{
+    // Changes of deleted events go with the statistics of the event. The values of removed changes are not
+    // decoded. Their size is taken to be the average of the event, when the delta is applied.
+    id event = committedValues[@"storeModificationEvent"];
+    id entityName = committedValues[@"nameOfEntity"];
+    if (event == [NSNull null] || entityName == [NSNull null]) return;
+
+    CDEObjectChangeStatisticsDelta *delta = [self deltaForEvent:event nameOfEntity:entityName inDeltas:deltasByEvent];
+    if (!delta) return;
+
+    switch ([committedValues[@"type"] shortValue]) {
+        case CDEObjectChangeTypeInsert:
+            delta->removedInsertCount++;
+            break;
+        case CDEObjectChangeTypeUpdate:
+            delta->removedUpdateCount++;
+            break;
+        case CDEObjectChangeTypeDelete:
+            delta->removedDeleteCount++;
+            break;
+    }
+}
+
++ (void)addRepeatedUpdatesInObjectChanges:(NSArray *)updates toDeltas:(NSMapTable *)deltasByEvent
+{
+    NSMutableArray *outsideBaseline = [[NSMutableArray alloc] init];
+    NSMutableSet *storedGlobalIds = [[NSMutableSet alloc] init];
+    for (CDEObjectChange *change in updates) {
+        if (change.storeModificationEvent.type == CDEStoreModificationEventTypeBaseline) continue;
+        [outsideBaseline addObject:change];
+        NSManagedObjectID *globalId = change.globalIdentifier.objectID;
+        if (globalId && !globalId.isTemporaryID) [storedGlobalIds addObject:globalId];
+    }
+    if (outsideBaseline.count == 0) return;
+
+    // Objects already updated by stored events outside the baseline
+    NSManagedObjectContext *context = [outsideBaseline.lastObject managedObjectContext];
+    NSMutableSet *updatedGlobalIds = [[NSMutableSet alloc] init];
+    NSArray *globalIdArray = storedGlobalIds.allObjects;
+    for (NSUInteger i = 0; i < globalIdArray.count; i += CDEObjectChangeStatisticsFetchBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEObjectChangeStatisticsFetchBatchSize, globalIdArray.count - i));
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"type = %d AND storeModificationEvent.type != %d AND globalIdentifier IN %@", CDEObjectChangeTypeUpdate, CDEStoreModificationEventTypeBaseline, [globalIdArray subarrayWithRange:range]];
+        fetch.resultType = NSDictionaryResultType;
+        fetch.propertiesToFetch = @[@"globalIdentifier"];
+        fetch.returnsDistinctResults = YES;
+        fetch.includesPendingChanges = NO;
+
+        NSError *error;
+        NSArray *results = [context executeFetchRequest:fetch error:&error];
+        if (!results) CDELog(CDELoggingLevelError, @"Could not fetch updated objects: %@", error);
+        for (NSDictionary *result in results) [updatedGlobalIds addObject:result[@"globalIdentifier"]];
+    }
+
+    // Later updates in the same save also repeat
+    for (CDEObjectChange *change in outsideBaseline) {
+        NSManagedObjectID *globalId = change.globalIdentifier.objectID;
+        if (!globalId) continue;
+        if ([updatedGlobalIds containsObject:globalId]) {
+            CDEObjectChangeStatisticsDelta *delta = [self deltaForEvent:change.storeModificationEvent nameOfEntity:change.nameOfEntity inDeltas:deltasByEvent];
+            if (delta) delta->repeatedUpdateCount++;
+        }
+        [updatedGlobalIds addObject:globalId];
+    }
+}
+
++ (void)applyDeltas:(NSMapTable *)deltasByEvent inManagedObjectContext:(NSManagedObjectContext *)context
+{
+    if (deltasByEvent.count == 0) return;
+
+    // Existing rows
+    NSArray *events = deltasByEvent.cde_allKeys;
+    NSMapTable *rowsByEvent = [NSMapTable cde_strongToStrongObjectsMapTable];
+    for (NSUInteger i = 0; i < events.count; i += CDEObjectChangeStatisticsFetchBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEObjectChangeStatisticsFetchBatchSize, events.count - i));
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChangeStatistics"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent IN %@", [events subarrayWithRange:range]];
+
+        NSError *error;
+        NSArray *rows = [context executeFetchRequest:fetch error:&error];
+        if (!rows) CDELog(CDELoggingLevelError, @"Could not fetch object change statistics: %@", error);
+        for (CDEObjectChangeStatistics *row in rows) {
+            NSMutableDictionary *rowsByEntity = [rowsByEvent objectForKey:row.storeModificationEvent];
+            if (!rowsByEntity) {
+                rowsByEntity = [[NSMutableDictionary alloc] init];
+                [rowsByEvent setObject:rowsByEntity forKey:row.storeModificationEvent];
+            }
+            rowsByEntity[row.nameOfEntity] = row;
+        }
+    }
+
+    for (CDEStoreModificationEvent *event in events) {
+        NSDictionary *deltasByEntity = [deltasByEvent objectForKey:event];
+        NSDictionary *rowsByEntity = [rowsByEvent objectForKey:event];
+        [deltasByEntity enumerateKeysAndObjectsUsingBlock:^(NSString *entityName, CDEObjectChangeStatisticsDelta *delta, BOOL *stop) {
+            CDEObjectChangeStatistics *row = rowsByEntity[entityName];
+            BOOL adds = delta->insertCount + delta->updateCount + delta->deleteCount > 0;
+            if (!row) {
+                // Events saved before the statistics existed are left for updateStatisticsForAllEvents...
+                if (!adds) return;
+                row = [NSEntityDescription insertNewObjectForEntityForName:@"CDEObjectChangeStatistics" inManagedObjectContext:context];
+                row.storeModificationEvent = event;
+                row.nameOfEntity = entityName;
+            }
+            [row applyDelta:delta];
+        }];
+    }
+}
+
+- (void)applyDelta:(CDEObjectChangeStatisticsDelta *)delta
+{
+    int64_t changeCount = self.insertCount + self.updateCount + self.deleteCount;
+    int64_t removedCount = delta->removedInsertCount + delta->removedUpdateCount + delta->removedDeleteCount;
+
+    int64_t inserts = self.insertCount, updates = self.updateCount, deletes = self.deleteCount;
+    int64_t bytes = self.byteCount, insertBytes = self.insertByteCount;
+    if (removedCount > 0 && changeCount > 0) {
+        bytes -= bytes * MIN(removedCount, changeCount) / changeCount;
+        if (inserts > 0) insertBytes -= insertBytes * MIN(delta->removedInsertCount, inserts) / inserts;
+    }
+    inserts = MAX(0, inserts - delta->removedInsertCount) + delta->insertCount;
+    updates = MAX(0, updates - delta->removedUpdateCount) + delta->updateCount;
+    deletes = MAX(0, deletes - delta->removedDeleteCount) + delta->deleteCount;
+
+    self.insertCount = inserts;
+    self.updateCount = updates;
+    self.deleteCount = deletes;
+    self.byteCount = MAX(0, bytes) + delta->byteCount;
+    self.insertByteCount = MAX(0, insertBytes) + delta->insertByteCount;
+    self.repeatedUpdateCount = MIN(self.repeatedUpdateCount + delta->repeatedUpdateCount, updates);
+}
+
++ (BOOL)updateStatisticsForAllEventsInManagedObjectContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    // Events without statistics, such as those saved before the statistics existed
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"objectChangeStatistics.@count = 0 AND objectChanges.@count > 0"];
+    fetch.includesPendingChanges = NO;
+    NSArray *events = [context executeFetchRequest:fetch error:error];
+    if (!events) return NO;
+    if (events.count == 0) return YES;
+    CDELog(CDELoggingLevelVerbose, @"Adding object change statistics for %lu events", (unsigned long)events.count);
+
+    // Counts are grouped in the store. Values are not decoded, so sizes are estimated.
+    NSExpressionDescription *countDescription = [[NSExpressionDescription alloc] init];
+    countDescription.name = @"count";
+    countDescription.expression = [NSExpression expressionForFunction:@"count:" arguments:@[[NSExpression expressionForKeyPath:@"type"]]];
+    countDescription.expressionResultType = NSInteger64AttributeType;
+
+    for (NSUInteger i = 0; i < events.count; i += CDEObjectChangeStatisticsFetchBatchSize) {
+        NSRange range = NSMakeRange(i, MIN(CDEObjectChangeStatisticsFetchBatchSize, events.count - i));
+        fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent IN %@", [events subarrayWithRange:range]];
+        fetch.resultType = NSDictionaryResultType;
+        fetch.propertiesToGroupBy = @[@"storeModificationEvent", @"nameOfEntity", @"type"];
+        fetch.propertiesToFetch = @[@"storeModificationEvent", @"nameOfEntity", @"type", countDescription];
+        fetch.includesPendingChanges = NO;
+        NSArray *results = [context executeFetchRequest:fetch error:error];
+        if (!results) return NO;
+
+        NSMutableDictionary *rowsByKey = [[NSMutableDictionary alloc] init];
+        for (NSDictionary *result in results) {
+            NSManagedObjectID *eventID = result[@"storeModificationEvent"];
+            NSString *entityName = result[@"nameOfEntity"];
+            if (!eventID || !entityName) continue;
+
+            NSArray *key = @[eventID, entityName];
+            CDEObjectChangeStatistics *row = rowsByKey[key];
+            if (!row) {
+                row = [NSEntityDescription insertNewObjectForEntityForName:@"CDEObjectChangeStatistics" inManagedObjectContext:context];
+                row.storeModificationEvent = (id)[context objectWithID:eventID];
+                row.nameOfEntity = entityName;
+                rowsByKey[key] = row;
+            }
+
+            int64_t count = [result[@"count"] longLongValue];
+            row.byteCount += count * CDEEstimatedObjectChangeByteCount;
+            switch ([result[@"type"] shortValue]) {
+                case CDEObjectChangeTypeInsert:
+                    row.insertCount += count;
+                    row.insertByteCount += count * CDEEstimatedObjectChangeByteCount;
+                    break;
+                case CDEObjectChangeTypeUpdate:
+                    row.updateCount += count;
+                    break;
+                case CDEObjectChangeTypeDelete:
+                    row.deleteCount += count;
+                    break;
+            }
+        }
+    }
+
+    return YES;
+}
+
+
+#pragma mark Totals
+
++ (CDEEventStoreStatistics *)eventStoreStatisticsInManagedObjectContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    NSUInteger eventCount = [context countForFetchRequest:fetch error:error];
+    if (eventCount == NSNotFound) return nil;
+
+    fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChangeStatistics"];
+    fetch.relationshipKeyPathsForPrefetching = @[@"storeModificationEvent"];
+    NSArray *rows = [context executeFetchRequest:fetch error:error];
+    if (!rows) return nil;
+
+    CDEEventStoreStatistics *statistics = [[CDEEventStoreStatistics alloc] init];
+    statistics.eventCount = eventCount;
+
+    NSUInteger baselineCount = 0, inserts = 0, updates = 0, deletes = 0, repeats = 0;
+    unsigned long long baselineBytes = 0, bytes = 0, insertBytes = 0;
+    NSMutableDictionary *countsByEntity = [[NSMutableDictionary alloc] init];
+    for (CDEObjectChangeStatistics *row in rows) {
+        CDEStoreModificationEventType type = row.storeModificationEvent.type;
+        if (!row.storeModificationEvent || type == CDEStoreModificationEventTypeIncomplete) continue;
+
+        if (type == CDEStoreModificationEventTypeBaseline) {
+            baselineCount += row.insertCount + row.updateCount + row.deleteCount;
+            baselineBytes += row.byteCount;
+            continue;
+        }
+
+        inserts += row.insertCount;
+        updates += row.updateCount;
+        deletes += row.deleteCount;
+        repeats += row.repeatedUpdateCount;
+        bytes += row.byteCount;
+        insertBytes += row.insertByteCount;
+
+        NSUInteger entityCount = [countsByEntity[row.nameOfEntity] unsignedIntegerValue];
+        entityCount += row.insertCount + row.updateCount + row.deleteCount;
+        countsByEntity[row.nameOfEntity] = @(entityCount);
+    }
+
+    statistics.baselineObjectChangeCount = baselineCount;
+    statistics.baselineByteCount = baselineBytes;
+    statistics.insertCount = inserts;
+    statistics.updateCount = updates;
+    statistics.deleteCount = deletes;
+    statistics.repeatedUpdateCount = repeats;
+    statistics.byteCount = bytes;
+    statistics.insertByteCount = insertBytes;
+    statistics.objectChangeCountsByEntityName = countsByEntity;
+
+    return statistics;
+}
+
+@end
@@ -31,6 +31,8 @@ typedef NS_ENUM(int16_t, CDEStoreModificationEventType) {
 @property (nonatomic, assign, readwrite) NSTimeInterval timestamp;
 @property (nonatomic, strong, readwrite) NSString *modelVersion;
 @property (nonatomic, strong, readwrite) NSSet *objectChanges;
+@property (nonatomic, strong, readwrite) NSSet *eventFileRecords;
+@property (nonatomic, strong, readwrite) NSSet *objectChangeStatistics;
 
 @property (nonatomic, copy, readwrite) CDERevisionSet *revisionSetOfOtherStoresAtCreation;
 @property (nonatomic, strong, readonly) CDERevisionSet *revisionSet;
@@ -51,6 +53,7 @@ typedef NS_ENUM(int16_t, CDEStoreModificationEventType) {
 // Fetching non-baseline events
 + (NSArray *)fetchNonBaselineEventsForPersistentStoreIdentifier:(NSString *)persistentStoreId sinceRevisionNumber:(CDERevisionNumber)revision inManagedObjectContext:(NSManagedObjectContext *)context;
 + (NSArray *)fetchNonBaselineEventsUpToGlobalCount:(CDEGlobalCount)globalCount inManagedObjectContext:(NSManagedObjectContext *)context;
++ (NSArray *)fetchNonBaselineEventsUpToGlobalCount:(CDEGlobalCount)globalCount limit:(NSUInteger)limit inManagedObjectContext:(NSManagedObjectContext *)context; // Earliest events. May exceed limit to include all events with the last global count.
 + (NSArray *)fetchNonBaselineEventsInManagedObjectContext:(NSManagedObjectContext *)context;
 
 // Fetching baseline events
@@ -24,6 +24,8 @@
 @dynamic eventRevisionsOfOtherStores;
 @dynamic modelVersion;
 @dynamic objectChanges;
+@dynamic eventFileRecords;
+@dynamic objectChangeStatistics;
 @dynamic globalCount;
 
 
@@ -236,12 +238,30 @@
 }
 
 + (NSArray *)fetchNonBaselineEventsUpToGlobalCount:(CDEGlobalCount)globalCount inManagedObjectContext:(NSManagedObjectContext *)context
+{
+    return [self fetchNonBaselineEventsUpToGlobalCount:globalCount limit:0 inManagedObjectContext:context];
+}
+
++ (NSArray *)fetchNonBaselineEventsUpToGlobalCount:(CDEGlobalCount)globalCount limit:(NSUInteger)limit inManagedObjectContext:(NSManagedObjectContext *)context
 {
     NSError *error;
     NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
     fetch.predicate = [NSPredicate predicateWithFormat:@"type != %d AND type != %d AND globalCount <= %lld", CDEStoreModificationEventTypeBaseline, CDEStoreModificationEventTypeIncomplete, globalCount];
+    fetch.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"globalCount" ascending:YES]];
+    fetch.fetchLimit = limit;
     NSArray *events = [context executeFetchRequest:fetch error:&error];
     if (!events) CDELog(CDELoggingLevelError, @"Could not fetch events: %@", error);
+    
+    // Events sharing a global count are never split
+    if (limit > 0 && events.count == limit) {
+        CDEStoreModificationEvent *lastEvent = events.lastObject;
+        fetch.predicate = [NSPredicate predicateWithFormat:@"type != %d AND type != %d AND globalCount = %lld AND NOT SELF IN %@", CDEStoreModificationEventTypeBaseline, CDEStoreModificationEventTypeIncomplete, lastEvent.globalCount, events];
+        fetch.fetchLimit = 0;
+        NSArray *sameCountEvents = [context executeFetchRequest:fetch error:&error];
+        if (!sameCountEvents) CDELog(CDELoggingLevelError, @"Could not fetch events: %@", error);
+        events = sameCountEvents ? [events arrayByAddingObjectsFromArray:sameCountEvents] : nil;
+    }
+    
     return [CDERevisionManager sortStoreModificationEvents:events];
 }
 
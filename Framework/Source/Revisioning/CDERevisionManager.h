@@ -19,6 +19,7 @@
 @property (nonatomic, strong, readonly) CDEEventStore *eventStore;
 @property (nonatomic, strong, readonly) NSManagedObjectContext *eventManagedObjectContext;
 @property (nonatomic, strong, readwrite) NSURL *managedObjectModelURL; 
+@property (nonatomic, assign, readwrite) NSTimeInterval persistentStoreRetirementInterval; // Default is 90 days
 
 - (instancetype)initWithEventStore:(CDEEventStore *)eventStore eventManagedObjectContext:(NSManagedObjectContext *)context;
 - (instancetype)initWithEventStore:(CDEEventStore *)eventStore;
@@ -42,6 +43,10 @@
 - (CDERevisionSet *)revisionSetOfMostRecentEvents;
 - (NSSet *)allPersistentStoreIdentifiers;
 
+// Stores covered by the baseline that have not been seen to advance for the retirement interval.
+// They are left out of revision sets of new events, but the baseline keeps them, to show what it covers.
+- (NSSet *)retiredPersistentStoreIdentifiers;
+
 - (CDERevisionSet *)revisionSetForLastMergeOrBaseline;
 
 + (NSArray *)sortStoreModificationEvents:(NSArray *)events;
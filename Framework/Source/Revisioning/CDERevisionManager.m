@@ -15,10 +15,13 @@
 #import "CDEEventRevision.h"
 #import "CDEStoreModificationEvent.h"
 
+static const NSTimeInterval CDEDefaultPersistentStoreRetirementInterval = 90.0 * 24.0 * 3600.0;
+
 @implementation CDERevisionManager
 
 @synthesize eventStore = eventStore;
 @synthesize eventManagedObjectContext = eventManagedObjectContext;
+@synthesize persistentStoreRetirementInterval = persistentStoreRetirementInterval;
 
 #pragma mark Initialization
 
@@ -28,6 +31,7 @@
     if (self) {
         eventStore = newStore;
         eventManagedObjectContext = newContext;
+        persistentStoreRetirementInterval = CDEDefaultPersistentStoreRetirementInterval;
     }
     return self;
 }
@@ -69,8 +73,13 @@
         NSMutableSet *missingStoreIds = [NSMutableSet setWithSet:allStoreIds];
         [missingStoreIds minusSet:lastMergeStoreIds];
         
+        // Retired stores have no events to fetch
+        NSSet *retiredStoreIds = [self retiredPersistentStoreIdentifiersWithBaselineRevisionSet:baselineRevisionSet];
+        [missingStoreIds minusSet:retiredStoreIds];
+        
         NSMutableArray *events = [[NSMutableArray alloc] init];
         for (CDEEventRevision *revision in fromRevisionSet.revisions) {
+            if ([retiredStoreIds containsObject:revision.persistentStoreIdentifier]) continue;
             NSArray *recentEvents = [CDEStoreModificationEvent fetchNonBaselineEventsForPersistentStoreIdentifier:revision.persistentStoreIdentifier sinceRevisionNumber:revision.revisionNumber inManagedObjectContext:self->eventManagedObjectContext];
             [events addObjectsFromArray:recentEvents];
         }
@@ -114,6 +123,7 @@
         NSSet *allStoreIds = [CDEEventRevision fetchPersistentStoreIdentifiersInManagedObjectContext:context];
         NSMutableSet *missingStoreIds = [NSMutableSet setWithSet:allStoreIds];
         [missingStoreIds minusSet:minSet.persistentStoreIdentifiers];
+        [missingStoreIds minusSet:[self retiredPersistentStoreIdentifiersWithBaselineRevisionSet:baselineRevisionSet]];
         
         // Add events from the missing stores
         for (NSString *persistentStoreId in missingStoreIds) {
@@ -356,8 +366,15 @@
         // Check for merge events newer than baseline. Ignore save events, because they may get generated at any time, and could be based on a newly imported baseline.
         NSArray *localMergeEvents = [CDEStoreModificationEvent fetchStoreModificationEventsWithTypes:@[@(CDEStoreModificationEventTypeMerge)] persistentStoreIdentifier:self.eventStore.persistentStoreIdentifier inManagedObjectContext:self->eventManagedObjectContext];
         CDEStoreModificationEvent *baseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:self->eventManagedObjectContext];
+        
+        // Merge events leave out retired stores, so compare without them
+        CDERevisionSet *baselineRevisionSet = baseline.revisionSet;
+        for (NSString *storeId in [self retiredPersistentStoreIdentifiersWithBaselineRevisionSet:baselineRevisionSet]) {
+            [baselineRevisionSet removeRevisionForPersistentStoreIdentifier:storeId];
+        }
+        
         for (CDEStoreModificationEvent *event in localMergeEvents) {
-            if ([event.revisionSet compare:baseline.revisionSet] == NSOrderedDescending) {
+            if ([event.revisionSet compare:baselineRevisionSet] == NSOrderedDescending) {
                 // This event comes after baseline, so store is not abandoned
                 passed = YES;
                 return;
@@ -391,26 +408,38 @@
 {
     __block CDERevisionSet *set = nil;
     [eventManagedObjectContext performBlockAndWait:^{
-        NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventRevision"];
-        request.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent != NIL OR storeModificationEventForOtherStores.type = %d", CDEStoreModificationEventTypeBaseline];
-        
-        NSError *error;
-        NSArray *allRevisions = [self->eventManagedObjectContext executeFetchRequest:request error:&error];
-        if (!allRevisions) @throw [NSException exceptionWithName:CDEException reason:@"Fetch of revisions failed" userInfo:nil];
-        
-        set = [[CDERevisionSet alloc] init];
-        for (CDEEventRevision *eventRevision in allRevisions) {
-            NSString *identifier = eventRevision.persistentStoreIdentifier;
-            CDERevision *currentRecentRevision = [set revisionForPersistentStoreIdentifier:identifier];
-            if (!currentRecentRevision || currentRecentRevision.revisionNumber < eventRevision.revisionNumber) {
-                if (currentRecentRevision) [set removeRevision:currentRecentRevision];
-                [set addRevision:eventRevision.revision];
-            }
+        CDEStoreModificationEvent *baseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:self->eventManagedObjectContext];
+        set = [self fetchRevisionSetOfMostRecentEvents];
+        NSSet *retiredStoreIds = [self retiredPersistentStoreIdentifiersWithBaselineRevisionSet:baseline.revisionSet latestRevisionSet:set];
+        for (NSString *storeId in retiredStoreIds) {
+            [set removeRevisionForPersistentStoreIdentifier:storeId];
         }
     }];
     return set;
 }
 
+// Call on the event context queue. Includes retired stores.
+- (CDERevisionSet *)fetchRevisionSetOfMostRecentEvents
+{
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventRevision"];
+    request.predicate = [NSPredicate predicateWithFormat:@"storeModificationEvent != NIL OR storeModificationEventForOtherStores.type = %d", CDEStoreModificationEventTypeBaseline];
+    
+    NSError *error;
+    NSArray *allRevisions = [eventManagedObjectContext executeFetchRequest:request error:&error];
+    if (!allRevisions) @throw [NSException exceptionWithName:CDEException reason:@"Fetch of revisions failed" userInfo:nil];
+    
+    CDERevisionSet *set = [[CDERevisionSet alloc] init];
+    for (CDEEventRevision *eventRevision in allRevisions) {
+        NSString *identifier = eventRevision.persistentStoreIdentifier;
+        CDERevision *currentRecentRevision = [set revisionForPersistentStoreIdentifier:identifier];
+        if (!currentRecentRevision || currentRecentRevision.revisionNumber < eventRevision.revisionNumber) {
+            if (currentRecentRevision) [set removeRevision:currentRecentRevision];
+            [set addRevision:eventRevision.revision];
+        }
+    }
+    return set;
+}
+
 #pragma mark Checkpoint Revisions
 
 - (CDERevisionSet *)revisionSetForLastMergeOrBaseline
@@ -421,15 +450,19 @@
         NSString *persistentStoreId = self.eventStore.persistentStoreIdentifier;
         CDEStoreModificationEvent *lastMergeEvent = [CDEStoreModificationEvent fetchNonBaselineEventForPersistentStoreIdentifier:persistentStoreId revisionNumber:lastMergeRevision inManagedObjectContext:self->eventManagedObjectContext];
         
+        CDEStoreModificationEvent *baseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:self->eventManagedObjectContext];
         newRevisionSet = lastMergeEvent.revisionSet;
         if (!newRevisionSet) {
             // No previous merge exists. Try baseline.
-            CDEStoreModificationEvent *baseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:self->eventManagedObjectContext];
             if (baseline)
                 newRevisionSet = baseline.revisionSet;
             else
                 newRevisionSet = [[CDERevisionSet alloc] init];
         }
+        
+        for (NSString *storeId in [self retiredPersistentStoreIdentifiersWithBaselineRevisionSet:baseline.revisionSet]) {
+            [newRevisionSet removeRevisionForPersistentStoreIdentifier:storeId];
+        }
     }];
     return newRevisionSet;
 }
@@ -442,4 +475,47 @@
     return latestRevisionSet.persistentStoreIdentifiers;
 }
 
+#pragma mark Retiring Stores
+
+- (NSSet *)retiredPersistentStoreIdentifiers
+{
+    __block NSSet *result = nil;
+    [eventManagedObjectContext performBlockAndWait:^{
+        CDEStoreModificationEvent *baseline = [CDEStoreModificationEvent fetchMostRecentBaselineStoreModificationEventInManagedObjectContext:self->eventManagedObjectContext];
+        result = [self retiredPersistentStoreIdentifiersWithBaselineRevisionSet:baseline.revisionSet];
+    }];
+    return result;
+}
+
+// Call on the event context queue
+- (NSSet *)retiredPersistentStoreIdentifiersWithBaselineRevisionSet:(CDERevisionSet *)baselineRevisionSet
+{
+    if (!baselineRevisionSet) return [NSSet set];
+    CDERevisionSet *latestRevisionSet = [self fetchRevisionSetOfMostRecentEvents];
+    return [self retiredPersistentStoreIdentifiersWithBaselineRevisionSet:baselineRevisionSet latestRevisionSet:latestRevisionSet];
+}
+
+// A store is retired when it has no events beyond the baseline, and has not advanced for the retirement interval.
+// If it saves again, its revision passes the baseline, and it is no longer retired.
+- (NSSet *)retiredPersistentStoreIdentifiersWithBaselineRevisionSet:(CDERevisionSet *)baselineRevisionSet latestRevisionSet:(CDERevisionSet *)latestRevisionSet
+{
+    NSMutableSet *retiredStoreIds = [[NSMutableSet alloc] init];
+    if (!baselineRevisionSet) return retiredStoreIds;
+    
+    NSString *localStoreId = eventStore.persistentStoreIdentifier;
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    for (CDERevision *revision in latestRevisionSet.revisions) {
+        NSString *storeId = revision.persistentStoreIdentifier;
+        if ([storeId isEqualToString:localStoreId]) continue;
+        
+        CDERevision *baselineRevision = [baselineRevisionSet revisionForPersistentStoreIdentifier:storeId];
+        if (!baselineRevision || baselineRevision.revisionNumber < revision.revisionNumber) continue;
+        
+        NSTimeInterval firstObserved = [eventStore timestampOfFirstObservationOfRevision:revision];
+        if (now - firstObserved >= persistentStoreRetirementInterval) [retiredStoreIds addObject:storeId];
+    }
+    
+    return retiredStoreIds;
+}
+
 @end
@@ -233,6 +233,64 @@
     [self waitForAsyncOpToFinish];
 }
 
+- (void)testMergingLargeOverlappingBaselines
+{
+    // Enough changes to span several fetch pages, with ranges overlapping between baselines
+    CDEStoreModificationEvent *baseline0 = [[self addBaselineEventsForStoreId:@"123" globalCounts:@[@(10)] revisions:@[@(10)]] lastObject];
+    CDEStoreModificationEvent *baseline1 = [[self addBaselineEventsForStoreId:@"234" globalCounts:@[@(20)] revisions:@[@(10)]] lastObject];
+    CDEStoreModificationEvent *baseline2 = [[self addBaselineEventsForStoreId:@"345" globalCounts:@[@(30)] revisions:@[@(10)]] lastObject];
+    [context performBlockAndWait:^{
+        NSArray *baselines = @[baseline0, baseline1, baseline2];
+        NSArray *ranges = @[[NSValue valueWithRange:NSMakeRange(0, 700)], [NSValue valueWithRange:NSMakeRange(300, 700)], [NSValue valueWithRange:NSMakeRange(900, 300)]];
+        NSMutableDictionary *globalIds = [NSMutableDictionary dictionary];
+        for (NSUInteger b = 0; b < baselines.count; b++) {
+            NSRange range = [ranges[b] rangeValue];
+            for (NSUInteger i = range.location; i < NSMaxRange(range); i++) {
+                CDEGlobalIdentifier *globalId = globalIds[@(i)];
+                if (!globalId) {
+                    globalId = [NSEntityDescription insertNewObjectForEntityForName:@"CDEGlobalIdentifier" inManagedObjectContext:context];
+                    globalId.globalIdentifier = [NSString stringWithFormat:@"%04lu", (unsigned long)i];
+                    globalId.nameOfEntity = @"Parent";
+                    globalIds[@(i)] = globalId;
+                }
+                CDEObjectChange *change = [self objectChangeForGlobalId:globalId valuesByKey:@{@"strength":@(b)}];
+                change.storeModificationEvent = baselines[b];
+            }
+        }
+        
+        NSError *error;
+        XCTAssertTrue([context save:&error], @"Failed to save");
+    }];
+    
+    [consolidator consolidateBaselineWithCompletion:^(NSError *error) {
+        XCTAssertNil(error, @"Error was not nil");
+        [context performBlock:^{
+            NSArray *events = [self storeModEvents];
+            XCTAssertEqual(events.count, (NSUInteger)1, @"Should be one baseline");
+            
+            CDEStoreModificationEvent *event = events.lastObject;
+            NSSet *changes = event.objectChanges;
+            XCTAssertEqual(changes.count, (NSUInteger)1200, @"Wrong number of changes");
+            
+            // The most recent baseline takes precedence
+            for (CDEObjectChange *change in changes) {
+                NSInteger index = change.globalIdentifier.globalIdentifier.integerValue;
+                NSNumber *expected = index >= 900 ? @2 : (index >= 300 ? @1 : @0);
+                CDEPropertyChangeValue *value = [change propertyChangeValueForPropertyName:@"strength"];
+                XCTAssertEqualObjects(value.value, expected, @"Wrong value for %@", change.globalIdentifier.globalIdentifier);
+            }
+            
+            NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+            XCTAssertEqual([context countForFetchRequest:fetch error:NULL], (NSUInteger)1200, @"Merged changes should be deleted");
+
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [self stopAsyncOp];
+            });
+        }];
+    }];
+    [self waitForAsyncOpToFinish];
+}
+
 - (CDEObjectChange *)objectChangeForGlobalId:(CDEGlobalIdentifier *)globalId valuesByKey:(NSDictionary *)valuesByKey
 {
     CDEObjectChange *change = [NSEntityDescription insertNewObjectForEntityForName:@"CDEObjectChange" inManagedObjectContext:context];
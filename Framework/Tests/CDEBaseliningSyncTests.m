@@ -9,13 +9,15 @@
 #import "CDESyncTest.h"
 #import "CDEEventStore.h"
 #import "CDEPersistentStoreEnsemble.h"
+#import "NSManagedObjectModel+CDEAdditions.h"
+#import "CDEBaselineIndex.h"
 
 @interface CDEBaseliningSyncTests : CDESyncTest
 
 @end
 
 @implementation CDEBaseliningSyncTests {
-    NSString *cloudBaselinesDir, *cloudEventsDir;
+    NSString *cloudBaselinesDir, *cloudEventsDir, *cloudBaselineSegmentsDir;
 }
 
 - (void)setUp
@@ -23,6 +25,7 @@
     [super setUp];
     cloudBaselinesDir = [cloudRootDir stringByAppendingPathComponent:@"com.ensembles.synctest/baselines"];
     cloudEventsDir = [cloudRootDir stringByAppendingPathComponent:@"com.ensembles.synctest/events"];
+    cloudBaselineSegmentsDir = [cloudRootDir stringByAppendingPathComponent:@"com.ensembles.synctest/baselinesegments"];
 }
 
 - (void)testCloudBaselineUniquenessWithNoInitialData
@@ -125,6 +128,75 @@
     XCTAssertEqual(parents.count, (NSUInteger)2, @"Should be a parent object in context2");
 }
 
+- (void)testSegmentedBaselineSync
+{
+    ensemble1.usesSegmentedBaselines = YES;
+    ensemble2.usesSegmentedBaselines = YES;
+    
+    for (NSUInteger i = 0; i < 20; i++) {
+        NSManagedObject *parent = [NSEntityDescription insertNewObjectForEntityForName:@"Parent" inManagedObjectContext:context1];
+        [parent setValue:[NSString stringWithFormat:@"bob%lu", (unsigned long)i] forKey:@"name"];
+        NSManagedObject *child = [NSEntityDescription insertNewObjectForEntityForName:@"Child" inManagedObjectContext:context1];
+        [child setValue:@"tom" forKey:@"name"];
+    }
+    XCTAssertTrue([context1 save:NULL], @"Could not save");
+    
+    [self leechStores];
+    [self mergeEnsemble:ensemble1];
+    
+    NSArray *baselineFiles = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:cloudBaselinesDir error:NULL];
+    XCTAssertEqual(baselineFiles.count, (NSUInteger)1, @"Should be one baseline");
+    NSString *indexPath = [cloudBaselinesDir stringByAppendingPathComponent:baselineFiles.lastObject];
+    XCTAssertTrue([CDEBaselineIndex isBaselineIndexAtPath:indexPath], @"Baseline should be uploaded as an index");
+    
+    CDEBaselineIndex *index = [CDEBaselineIndex baselineIndexWithContentsOfFile:indexPath error:NULL];
+    XCTAssertEqual(index.segmentFilenames.count, (NSUInteger)2, @"Should be a segment for each entity");
+    NSArray *segmentFiles = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:cloudBaselineSegmentsDir error:NULL];
+    XCTAssertTrue([[NSSet setWithArray:segmentFiles] isSupersetOfSet:[NSSet setWithArray:index.segmentFilenames]], @"Segments of the index should be in the cloud");
+    
+    XCTAssertNil([self syncChanges], @"Sync failed");
+    
+    NSArray *parents = [context2 executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"Parent"] error:NULL];
+    NSArray *children = [context2 executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"Child"] error:NULL];
+    XCTAssertEqual(parents.count, (NSUInteger)20, @"Wrong number of parents in second context");
+    XCTAssertEqual(children.count, (NSUInteger)20, @"Wrong number of children in second context");
+}
+
+- (void)testRebasingOnlyUploadsChangedBaselineSegments
+{
+    ensemble1.usesSegmentedBaselines = YES;
+    ensemble2.usesSegmentedBaselines = YES;
+    
+    NSManagedObject *parent = nil;
+    for (NSUInteger i = 0; i < 20; i++) {
+        parent = [NSEntityDescription insertNewObjectForEntityForName:@"Parent" inManagedObjectContext:context1];
+        [parent setValue:@"bob" forKey:@"name"];
+        [NSEntityDescription insertNewObjectForEntityForName:@"Child" inManagedObjectContext:context1];
+    }
+    XCTAssertTrue([context1 save:NULL], @"Could not save");
+    
+    [self leechStores];
+    XCTAssertNil([self syncChanges], @"Sync failed");
+    NSSet *segmentsBefore = [NSSet setWithArray:[[NSFileManager defaultManager] contentsOfDirectoryAtPath:cloudBaselineSegmentsDir error:NULL]];
+    XCTAssertTrue(segmentsBefore.count > 0, @"Should be segments in the cloud");
+    
+    // Only the parent segment changes
+    [parent setValue:@"john" forKey:@"name"];
+    XCTAssertTrue([context1 save:NULL], @"Could not save");
+    [ensemble1 setValue:@YES forKeyPath:@"rebaser.forceRebase"];
+    XCTAssertNil([self mergeEnsemble:ensemble1], @"Merge failed");
+    [ensemble1 setValue:@NO forKeyPath:@"rebaser.forceRebase"];
+    
+    NSMutableSet *segmentsAdded = [NSMutableSet setWithArray:[[NSFileManager defaultManager] contentsOfDirectoryAtPath:cloudBaselineSegmentsDir error:NULL]];
+    [segmentsAdded minusSet:segmentsBefore];
+    XCTAssertEqual(segmentsAdded.count, (NSUInteger)1, @"Only the changed segment should be uploaded");
+    
+    XCTAssertNil([self mergeEnsemble:ensemble2], @"Merge failed");
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Parent"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"name = %@", @"john"];
+    XCTAssertEqual([context2 executeFetchRequest:fetch error:NULL].count, (NSUInteger)1, @"Update should reach the second context");
+}
+
 - (void)testRebasingIsTriggered
 {
     [self leechStores];
@@ -353,7 +425,7 @@
     NSManagedObjectContext *baselineContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSConfinementConcurrencyType];
     NSURL *modelURL = [[NSBundle bundleForClass:[CDEEventStore class]] URLForResource:@"CDEEventStoreModel" withExtension:@"momd"];
     NSManagedObjectModel *eventModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
-    NSPersistentStoreCoordinator *coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:eventModel];
+    NSPersistentStoreCoordinator *coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:eventModel.cde_interchangeModel];
     baselineContext.persistentStoreCoordinator = coordinator;
     NSDictionary *options = nil;
   
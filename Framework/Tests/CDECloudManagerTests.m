@@ -13,6 +13,8 @@
 #import "CDECloudFileSystem.h"
 #import "CDECloudFile.h"
 #import "CDEMockCloudFileSystem.h"
+#import "CDELocalCloudFileSystem.h"
+#import "CDEFoundationAdditions.h"
 
 @interface CDECloudManager (TestMethods)
 
@@ -318,4 +320,102 @@
     XCTAssertEqualObjects(sortedFiles[2], files[0], @"Wrong 3rd");
 }
 
+- (void)snapshotPublishAndStoreWithCompletion:(CDECompletionBlock)completion
+{
+    [cloudManager createRemoteDirectoryStructureWithCompletion:^(NSError *error) {
+        XCTAssertNil(error, @"Error creating directories");
+        [cloudManager snapshotRemoteFilesWithCompletion:^(NSError *error) {
+            XCTAssertNil(error, @"Error snapshotting without manifest");
+            XCTAssertFalse(cloudManager.snapshotIsUnchanged, @"Should not reuse snapshot without a manifest");
+            [cloudManager publishManifestWithCompletion:^(NSError *error) {
+                XCTAssertNil(error, @"Error publishing manifest");
+                [cloudManager snapshotRemoteFilesWithCompletion:^(NSError *error) {
+                    XCTAssertNil(error, @"Error snapshotting with manifest");
+                    XCTAssertFalse(cloudManager.snapshotIsUnchanged, @"Should not reuse snapshot that was never stored");
+                    [cloudManager storeSnapshotForReuse];
+                    completion(nil);
+                }];
+            }];
+        }];
+    }];
+}
+
+- (void)testSnapshotIsReusedWhenManifestIsUnchanged
+{
+    CDEMockCloudFileSystem *mockFileSystem = (id)cloudFileSystem;
+    [self snapshotPublishAndStoreWithCompletion:^(NSError *error) {
+        NSString *eventPath = [remoteEnsemblesDir stringByAppendingPathComponent:@"events/0_store2_0.cdeevent"];
+        CDEMockItem *item = [CDEMockItem new];
+        item.path = eventPath;
+        mockFileSystem.itemsByRemotePath[eventPath] = item;
+        
+        [cloudManager snapshotRemoteFilesWithCompletion:^(NSError *error) {
+            XCTAssertNil(error, @"Error snapshotting");
+            XCTAssertTrue(cloudManager.snapshotIsUnchanged, @"Snapshot should be reused");
+            XCTAssertEqual(cloudManager.snapshotEventFilenames.count, (NSUInteger)0, @"Unpublished file should not be listed");
+            [self stopWaiting];
+        }];
+    }];
+    [self waitForAsyncOperation];
+}
+
+- (void)testSnapshotIsNotReusedWhenManifestChanges
+{
+    CDEMockCloudFileSystem *mockFileSystem = (id)cloudFileSystem;
+    [self snapshotPublishAndStoreWithCompletion:^(NSError *error) {
+        NSString *eventPath = [remoteEnsemblesDir stringByAppendingPathComponent:@"events/0_store2_0.cdeevent"];
+        CDEMockItem *item = [CDEMockItem new];
+        item.path = eventPath;
+        mockFileSystem.itemsByRemotePath[eventPath] = item;
+        
+        NSString *manifestPath = [remoteEnsemblesDir stringByAppendingPathComponent:@"manifest"];
+        NSDictionary *manifest = @{@"generation" : @2, @"identifier" : @"other", @"storeIdentifier" : @"store2", @"date" : [NSDate date]};
+        CDEMockItem *manifestItem = mockFileSystem.itemsByRemotePath[manifestPath];
+        manifestItem.data = [NSPropertyListSerialization dataWithPropertyList:manifest format:NSPropertyListXMLFormat_v1_0 options:0 error:NULL];
+        
+        [cloudManager snapshotRemoteFilesWithCompletion:^(NSError *error) {
+            XCTAssertNil(error, @"Error snapshotting");
+            XCTAssertFalse(cloudManager.snapshotIsUnchanged, @"Snapshot should not be reused");
+            XCTAssertEqualObjects(cloudManager.snapshotEventFilenames, [NSSet setWithObject:@"0_store2_0.cdeevent"], @"New file should be listed");
+            [self stopWaiting];
+        }];
+    }];
+    [self waitForAsyncOperation];
+}
+
+- (void)testBatchDirectoryCreationAndUpload
+{
+    NSString *cloudDir = [rootDir stringByAppendingPathComponent:@"cloud"];
+    [fileManager createDirectoryAtPath:cloudDir withIntermediateDirectories:YES attributes:nil error:NULL];
+    cloudFileSystem = [[CDELocalCloudFileSystem alloc] initWithRootDirectory:cloudDir];
+    cloudManager = [[CDECloudManager alloc] initWithEventStore:(id)self.eventStore cloudFileSystem:cloudFileSystem];
+    
+    NSArray *files = @[@"0_store1_0.cdeevent", @"1_store1_1.cdeevent"];
+    for (NSString *file in files) {
+        NSString *path = [cloudManager.localUploadDirectory stringByAppendingPathComponent:file];
+        [[file dataUsingEncoding:NSUTF8StringEncoding] writeToFile:path atomically:YES];
+    }
+    
+    [cloudManager createRemoteDirectoryStructureWithCompletion:^(NSError *error) {
+        XCTAssertNil(error, @"Error creating directories");
+        [cloudManager createRemoteDirectoryStructureWithCompletion:^(NSError *error) {
+            XCTAssertNil(error, @"Error creating directories that exist");
+            [cloudManager transferFilesInTransitCacheToRemoteDirectory:cloudManager.remoteEventsDirectory completion:^(NSError *error) {
+                XCTAssertNil(error, @"Error uploading");
+                
+                NSArray *remotePaths = [files cde_arrayByTransformingObjectsWithBlock:^id(NSString *file) {
+                    return [cloudManager.remoteEventsDirectory stringByAppendingPathComponent:file];
+                }];
+                [cloudFileSystem fileExistsAtPaths:remotePaths completion:^(NSArray *existences, NSArray *directories, NSError *error) {
+                    XCTAssertEqualObjects(existences, (@[@YES, @YES]), @"Files not uploaded");
+                    XCTAssertEqualObjects(directories, (@[@NO, @NO]), @"Files should not be directories");
+                    XCTAssertEqual([[fileManager contentsOfDirectoryAtPath:cloudManager.localUploadDirectory error:NULL] count], (NSUInteger)0, @"Uploaded files should be removed");
+                    [self stopWaiting];
+                }];
+            }];
+        }];
+    }];
+    [self waitForAsyncOperation];
+}
+
 @end
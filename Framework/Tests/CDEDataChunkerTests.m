@@ -0,0 +1,87 @@
+//
+//  CDEDataChunkerTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 21/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "CDEDataChunker.h"
+
+@interface CDEDataChunkerTests : XCTestCase
+
+@end
+
+@implementation CDEDataChunkerTests {
+    CDEDataChunker *chunker;
+    NSMutableData *data;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    chunker = [[CDEDataChunker alloc] init];
+    chunker.minimumChunkLength = 1024;
+    chunker.averageChunkLength = 4096;
+    chunker.maximumChunkLength = 16384;
+    
+    data = [[NSMutableData alloc] initWithLength:500000];
+    arc4random_buf(data.mutableBytes, data.length);
+}
+
+- (NSArray *)chunksOfData:(NSData *)someData
+{
+    NSArray *ranges = [chunker rangesOfChunksInData:someData];
+    NSMutableArray *chunks = [NSMutableArray array];
+    for (NSValue *range in ranges) [chunks addObject:[someData subdataWithRange:range.rangeValue]];
+    return chunks;
+}
+
+- (void)testChunksCoverData
+{
+    NSArray *ranges = [chunker rangesOfChunksInData:data];
+    XCTAssertTrue(ranges.count > 1, @"Should be several chunks");
+    
+    NSUInteger location = 0;
+    for (NSValue *rangeValue in ranges) {
+        NSRange range = rangeValue.rangeValue;
+        XCTAssertEqual(range.location, location, @"Chunks should be contiguous");
+        XCTAssertTrue(range.length <= 16384, @"Chunk longer than maximum");
+        if (rangeValue != ranges.lastObject) XCTAssertTrue(range.length > 1024, @"Chunk shorter than minimum");
+        location = NSMaxRange(range);
+    }
+    XCTAssertEqual(location, data.length, @"Chunks should cover all data");
+}
+
+- (void)testChunkingIsDeterministic
+{
+    CDEDataChunker *otherChunker = [[CDEDataChunker alloc] init];
+    otherChunker.minimumChunkLength = 1024;
+    otherChunker.averageChunkLength = 4096;
+    otherChunker.maximumChunkLength = 16384;
+    XCTAssertEqualObjects([chunker rangesOfChunksInData:data], [otherChunker rangesOfChunksInData:data], @"Chunks should not vary");
+}
+
+- (void)testSmallDataIsOneChunk
+{
+    NSData *smallData = [data subdataWithRange:NSMakeRange(0, 1000)];
+    NSArray *ranges = [chunker rangesOfChunksInData:smallData];
+    XCTAssertEqualObjects(ranges, @[[NSValue valueWithRange:NSMakeRange(0, 1000)]], @"Should be one chunk");
+    XCTAssertEqual([chunker rangesOfChunksInData:[NSData data]].count, (NSUInteger)0, @"Empty data should have no chunks");
+}
+
+- (void)testInsertionOnlyChangesNearbyChunks
+{
+    NSArray *originalChunks = [self chunksOfData:data];
+    
+    NSMutableData *editedData = [data mutableCopy];
+    [editedData replaceBytesInRange:NSMakeRange(data.length / 2, 0) withBytes:"Inserted bytes" length:14];
+    NSArray *editedChunks = [self chunksOfData:editedData];
+    
+    NSMutableSet *newChunks = [NSMutableSet setWithArray:editedChunks];
+    [newChunks minusSet:[NSSet setWithArray:originalChunks]];
+    XCTAssertTrue(newChunks.count <= 3, @"Too many chunks changed: %lu of %lu", (unsigned long)newChunks.count, (unsigned long)editedChunks.count);
+}
+
+@end
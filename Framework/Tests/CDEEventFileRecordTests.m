@@ -0,0 +1,169 @@
+//
+//  CDEEventFileRecordTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 24/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import "CDEEventStoreTestCase.h"
+#import "CDEEventFileRecord.h"
+#import "CDEEventRevision.h"
+
+@interface CDEEventFileRecordTests : CDEEventStoreTestCase
+
+@end
+
+@implementation CDEEventFileRecordTests {
+    NSManagedObjectContext *moc;
+    NSArray *nonBaselineTypes;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    moc = self.eventStore.managedObjectContext;
+    nonBaselineTypes = @[@(CDEStoreModificationEventTypeSave), @(CDEStoreModificationEventTypeMerge)];
+}
+
+- (void)saveWithLedger
+{
+    [CDEEventFileRecord updateRecordsForChangesInManagedObjectContext:moc localPersistentStoreIdentifier:self.eventStore.persistentStoreIdentifier];
+    NSError *error;
+    XCTAssertTrue([moc save:&error], @"%@", error);
+}
+
+- (NSArray *)records
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEEventFileRecord"];
+    fetch.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"filename" ascending:YES]];
+    return [moc executeFetchRequest:fetch error:NULL];
+}
+
+- (void)testRecordsAreAddedOnSave
+{
+    [moc performBlockAndWait:^{
+        [self addModEventForStore:@"store1" revision:0 globalCount:0 timestamp:0.0];
+        [self addModEventForStore:@"store2" revision:3 globalCount:1 timestamp:0.0];
+        [self saveWithLedger];
+
+        NSArray *records = [self records];
+        XCTAssertEqual(records.count, (NSUInteger)2);
+        XCTAssertEqualObjects([records[0] filename], @"0_store1_0.cdeevent");
+        XCTAssertEqual([records[0] state], CDEEventFileStateLocalOnly);
+        XCTAssertEqualObjects([records[1] filename], @"1_store2_3.cdeevent");
+        XCTAssertEqual([records[1] state], CDEEventFileStateImported);
+        XCTAssertTrue([records[1] preferred]);
+    }];
+}
+
+- (void)testIncompleteEventsAreNotRecorded
+{
+    [moc performBlockAndWait:^{
+        CDEStoreModificationEvent *event = [self addModEventForStore:@"store2" revision:0 globalCount:0 timestamp:0.0];
+        event.type = CDEStoreModificationEventTypeIncomplete;
+        [self saveWithLedger];
+        XCTAssertEqual([self records].count, (NSUInteger)0);
+
+        event.type = CDEStoreModificationEventTypeSave;
+        [self saveWithLedger];
+        XCTAssertEqual([self records].count, (NSUInteger)1);
+    }];
+}
+
+- (void)testRecordsOfDeletedEventsAreMarkedDeleted
+{
+    [moc performBlockAndWait:^{
+        CDEStoreModificationEvent *event = [self addModEventForStore:@"store2" revision:0 globalCount:0 timestamp:0.0];
+        [self saveWithLedger];
+
+        [moc deleteObject:event];
+        [self saveWithLedger];
+
+        NSArray *records = [self records];
+        XCTAssertEqual(records.count, (NSUInteger)1);
+        XCTAssertEqual([records.lastObject state], CDEEventFileStateDeleted);
+        XCTAssertEqual([CDEEventFileRecord filenamesForEventTypes:nonBaselineTypes persistentStoreIdentifier:nil inManagedObjectContext:moc].count, (NSUInteger)0);
+
+        [CDEEventFileRecord deleteRecordsOfRemovedEventsExcludingFilenames:[NSSet setWithObject:@"0_store2_0.cdeevent"] inManagedObjectContext:moc];
+        XCTAssertEqual([self records].count, (NSUInteger)1, @"Should keep record while the file is in the cloud");
+
+        [CDEEventFileRecord deleteRecordsOfRemovedEventsExcludingFilenames:[NSSet set] inManagedObjectContext:moc];
+        XCTAssertEqual([self records].count, (NSUInteger)0);
+    }];
+}
+
+- (void)testChangedGlobalCountRenamesRecord
+{
+    [moc performBlockAndWait:^{
+        CDEStoreModificationEvent *event = [self addModEventForStore:@"store2" revision:0 globalCount:0 timestamp:0.0];
+        [self saveWithLedger];
+
+        event.globalCount = 5;
+        [self saveWithLedger];
+
+        NSSet *filenames = [CDEEventFileRecord filenamesForEventTypes:nonBaselineTypes persistentStoreIdentifier:nil inManagedObjectContext:moc];
+        XCTAssertEqualObjects(filenames, [NSSet setWithObject:@"5_store2_0.cdeevent"]);
+    }];
+}
+
+- (void)testExistingEventsAreAddedToLedger
+{
+    [moc performBlockAndWait:^{
+        [self addModEventForStore:@"store1" revision:0 globalCount:0 timestamp:0.0];
+        [self addModEventForStore:@"store2" revision:0 globalCount:1 timestamp:0.0];
+        NSError *error;
+        XCTAssertTrue([moc save:&error], @"%@", error);
+        XCTAssertEqual([self records].count, (NSUInteger)0);
+
+        XCTAssertTrue([CDEEventFileRecord updateRecordsForAllEventsInManagedObjectContext:moc localPersistentStoreIdentifier:@"store1" error:&error], @"%@", error);
+        XCTAssertEqual([self records].count, (NSUInteger)2);
+
+        NSSet *filenames = [CDEEventFileRecord filenamesForEventTypes:nonBaselineTypes persistentStoreIdentifier:@"store1" inManagedObjectContext:moc];
+        XCTAssertEqualObjects(filenames, [NSSet setWithObject:@"0_store1_0.cdeevent"]);
+    }];
+}
+
+- (void)testPreferredFilenamesMissingFromCloud
+{
+    [moc performBlockAndWait:^{
+        [self addModEventForStore:@"store1" revision:0 globalCount:0 timestamp:0.0];
+        [self addModEventForStore:@"store1" revision:1 globalCount:1 timestamp:0.0];
+        [self addModEventForStore:@"store2" revision:0 globalCount:2 timestamp:0.0];
+        [self saveWithLedger];
+
+        NSSet *cloudFiles = [NSSet setWithObject:@"0_store1_0.cdeevent"];
+        NSArray *missing = [CDEEventFileRecord preferredFilenamesForEventTypes:nonBaselineTypes persistentStoreIdentifier:@"store1" missingFromFilenames:cloudFiles inManagedObjectContext:moc];
+        XCTAssertEqualObjects(missing, @[@"1_store1_1.cdeevent"]);
+
+        NSArray *records = [self records];
+        XCTAssertEqual([records[0] state], CDEEventFileStateExported, @"Record found in cloud should be exported");
+        XCTAssertEqual([records[1] state], CDEEventFileStateLocalOnly);
+
+        [CDEEventFileRecord markFilenames:missing exportedInManagedObjectContext:moc];
+        XCTAssertEqual([records[1] state], CDEEventFileStateExported);
+    }];
+}
+
+- (void)testBaselineHasPreferredFilenameAndAlias
+{
+    [moc performBlockAndWait:^{
+        CDEStoreModificationEvent *event = [self addModEventForStore:@"123456789" revision:0 globalCount:4 timestamp:0.0];
+        event.type = CDEStoreModificationEventTypeBaseline;
+        event.uniqueIdentifier = @"base";
+        [self saveWithLedger];
+
+        NSArray *baselineTypes = @[@(CDEStoreModificationEventTypeBaseline)];
+        NSSet *filenames = [CDEEventFileRecord filenamesForEventTypes:baselineTypes persistentStoreIdentifier:nil inManagedObjectContext:moc];
+        NSSet *expected = [NSSet setWithObjects:@"4_base_12345678.cdeevent", @"4_base.cdeevent", nil];
+        XCTAssertEqualObjects(filenames, expected);
+
+        NSArray *missing = [CDEEventFileRecord preferredFilenamesForEventTypes:baselineTypes persistentStoreIdentifier:@"123456789" missingFromFilenames:[NSSet set] inManagedObjectContext:moc];
+        XCTAssertEqualObjects(missing, @[@"4_base_12345678.cdeevent"]);
+
+        missing = [CDEEventFileRecord preferredFilenamesForEventTypes:baselineTypes persistentStoreIdentifier:@"123456789" missingFromFilenames:[NSSet setWithObject:@"4_base.cdeevent"] inManagedObjectContext:moc];
+        XCTAssertEqual(missing.count, (NSUInteger)0, @"Legacy alias in cloud should count");
+    }];
+}
+
+@end
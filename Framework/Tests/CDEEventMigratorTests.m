@@ -13,6 +13,16 @@
 #import "CDEGlobalIdentifier.h"
 #import "CDEEventRevision.h"
 #import "CDEEventMigrator.h"
+#import "CDEEventStream.h"
+#import "CDEPropertyChangeValue.h"
+#import "NSManagedObjectModel+CDEAdditions.h"
+
+@interface CDEEventMigrator (TestMethods)
+
+- (NSString *)segmentFilenameForObjectChanges:(NSArray *)changes segmentKey:(NSString *)segmentKey;
+
+@end
+
 
 @interface CDEEventMigratorTests : CDEEventStoreTestCase
 
@@ -114,7 +124,7 @@
 {
     NSURL *url = [NSURL fileURLWithPath:exportedEventsFile];
     NSManagedObjectModel *model = self.eventStore.managedObjectContext.persistentStoreCoordinator.managedObjectModel;
-    NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+    NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model.cde_interchangeModel];
     NSDictionary *options = nil;
   
     if (@available(iOS 11.0, macOS 10.13, *)) {
@@ -281,4 +291,256 @@
     }];
 }
 
+- (void)importExportedFileExpectingSuccess:(BOOL)expectSuccess
+{
+    finishedAsyncOp = NO;
+    [migrator migrateEventsInFromFiles:@[exportedEventsFile] completion:^(NSError *error) {
+        finishedAsyncOp = YES;
+        if (expectSuccess)
+            XCTAssertNil(error, @"Error migrating in from file");
+        else
+            XCTAssertNotNil(error, @"Import should fail");
+    }];
+    [self waitForAsyncOpToFinish];
+}
+
+- (void)removeModificationEvent
+{
+    [moc performBlockAndWait:^{
+        [moc deleteObject:modEvent];
+        XCTAssertTrue([moc save:NULL], @"Failed save");
+    }];
+}
+
+- (void)testMigrationToEventStream
+{
+    migrator.storeTypeForNewFiles = CDEEventStreamStoreType;
+    [self migrateToFileFromRevision:-1];
+    XCTAssertTrue([CDEEventStreamReader isEventStreamAtPath:exportedEventsFile], @"Should be an event stream");
+}
+
+- (void)testEventStreamRoundTrip
+{
+    migrator.storeTypeForNewFiles = CDEEventStreamStoreType;
+    [self migrateToFileFromRevision:-1];
+    [self removeModificationEvent];
+    [self importExportedFileExpectingSuccess:YES];
+    
+    [moc performBlockAndWait:^{
+        NSArray *events = [moc executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"] error:NULL];
+        XCTAssertEqual(events.count, (NSUInteger)1, @"Wrong number of events");
+        
+        CDEStoreModificationEvent *event = events.lastObject;
+        XCTAssertEqual(event.type, CDEStoreModificationEventTypeMerge, @"Wrong type");
+        XCTAssertEqual(event.timestamp, (NSTimeInterval)123, @"Wrong timestamp");
+        XCTAssertEqualObjects(event.eventRevision.persistentStoreIdentifier, self.eventStore.persistentStoreIdentifier, @"Wrong store");
+        XCTAssertEqual(event.eventRevision.revisionNumber, (CDERevisionNumber)0, @"Wrong revision");
+        XCTAssertEqual(event.objectChanges.count, (NSUInteger)3, @"Wrong number of changes");
+        
+        NSPredicate *predicate = [NSPredicate predicateWithFormat:@"globalIdentifier.globalIdentifier = \"1234\" AND globalIdentifier.nameOfEntity = \"Blah\""];
+        CDEObjectChange *change = [[event.objectChanges filteredSetUsingPredicate:predicate] anyObject];
+        XCTAssertEqual(change.type, CDEObjectChangeTypeDelete, @"Wrong change type");
+        XCTAssertEqualObjects(change.globalIdentifier, globalId3, @"Existing global identifier should be reused");
+        
+        NSArray *globalIds = [moc executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEGlobalIdentifier"] error:NULL];
+        XCTAssertEqual(globalIds.count, (NSUInteger)3, @"Global identifiers should not be duplicated");
+    }];
+}
+
+- (void)testEventStreamImportInSmallBatches
+{
+    migrator.storeTypeForNewFiles = CDEEventStreamStoreType;
+    [self migrateToFileFromRevision:-1];
+    [self removeModificationEvent];
+    
+    __block NSManagedObjectID *eventID = nil;
+    [moc performBlockAndWait:^{
+        CDEEventStreamReader *reader = [[CDEEventStreamReader alloc] initWithPath:exportedEventsFile];
+        reader.saveBatchSize = 1;
+        XCTAssertTrue([reader open:NULL], @"Could not open stream");
+        
+        NSError *error = nil;
+        eventID = [reader importNextStoreModificationEventIntoContext:moc error:&error];
+        XCTAssertNil(error, @"Error importing");
+        XCTAssertNil([reader importNextStoreModificationEventIntoContext:moc error:&error], @"Should be at end of stream");
+        XCTAssertNil(error, @"End of stream is not an error");
+        [reader close];
+        
+        CDEStoreModificationEvent *event = (id)[moc existingObjectWithID:eventID error:NULL];
+        XCTAssertEqual(event.type, CDEStoreModificationEventTypeMerge, @"Event should be complete");
+        XCTAssertEqual(event.objectChanges.count, (NSUInteger)3, @"Wrong number of changes");
+    }];
+}
+
+- (void)testTruncatedEventStreamLeavesNoEvent
+{
+    migrator.storeTypeForNewFiles = CDEEventStreamStoreType;
+    [self migrateToFileFromRevision:-1];
+    [self removeModificationEvent];
+    
+    NSData *data = [NSData dataWithContentsOfFile:exportedEventsFile];
+    [[data subdataWithRange:NSMakeRange(0, data.length - 10)] writeToFile:exportedEventsFile atomically:YES];
+    [self importExportedFileExpectingSuccess:NO];
+    
+    [moc performBlockAndWait:^{
+        NSArray *events = [moc executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"] error:NULL];
+        XCTAssertEqual(events.count, (NSUInteger)0, @"Partial event should be removed");
+        NSArray *changes = [moc executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"] error:NULL];
+        XCTAssertEqual(changes.count, (NSUInteger)0, @"Partial changes should be removed");
+    }];
+}
+
+- (NSString *)exportedFileCopyForStore:(NSString *)storeIdentifier
+{
+    fileContext = nil;
+    NSArray *events = [self eventsInFile];
+    CDEStoreModificationEvent *event = events.lastObject;
+    event.eventRevision.persistentStoreIdentifier = storeIdentifier;
+    XCTAssertTrue([fileContext save:NULL], @"Save failed");
+    [fileContext reset];
+    fileContext = nil;
+    
+    NSString *path = [exportedEventsFile stringByAppendingString:storeIdentifier];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    XCTAssertTrue([[NSFileManager defaultManager] copyItemAtPath:exportedEventsFile toPath:path error:NULL]);
+    return path;
+}
+
+- (void)testBatchImportSharesGlobalIdentifiers
+{
+    [self migrateToFileFromRevision:-1];
+    NSString *path1 = [self exportedFileCopyForStore:@"otherstore1"];
+    NSString *path2 = [self exportedFileCopyForStore:@"otherstore2"];
+    
+    finishedAsyncOp = NO;
+    [migrator migrateEventsInFromFiles:@[path1, path2] completion:^(NSError *error) {
+        finishedAsyncOp = YES;
+        XCTAssertNil(error, @"Error migrating in from files");
+    }];
+    [self waitForAsyncOpToFinish];
+    
+    [moc performBlockAndWait:^{
+        NSArray *events = [moc executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"] error:NULL];
+        XCTAssertEqual(events.count, (NSUInteger)3, @"Wrong number of events");
+        
+        NSArray *globalIds = [moc executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEGlobalIdentifier"] error:NULL];
+        XCTAssertEqual(globalIds.count, (NSUInteger)3, @"Global identifiers should not be duplicated");
+    }];
+    
+    [[NSFileManager defaultManager] removeItemAtPath:path1 error:NULL];
+    [[NSFileManager defaultManager] removeItemAtPath:path2 error:NULL];
+}
+
+- (void)testBadFileInBatchDoesNotBlockOthers
+{
+    [self migrateToFileFromRevision:-1];
+    NSString *goodPath = [self exportedFileCopyForStore:@"otherstore"];
+    NSString *badPath = [exportedEventsFile stringByAppendingString:@"bad"];
+    [[@"Not an event file" dataUsingEncoding:NSUTF8StringEncoding] writeToFile:badPath atomically:YES];
+    
+    finishedAsyncOp = NO;
+    [migrator migrateEventsInFromFiles:@[badPath, goodPath] completion:^(NSError *error) {
+        finishedAsyncOp = YES;
+        XCTAssertNotNil(error, @"Bad file should give an error");
+    }];
+    [self waitForAsyncOpToFinish];
+    
+    [moc performBlockAndWait:^{
+        NSArray *events = [moc executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"] error:NULL];
+        XCTAssertEqual(events.count, (NSUInteger)2, @"Good file should still be imported");
+    }];
+    
+    [[NSFileManager defaultManager] removeItemAtPath:goodPath error:NULL];
+    [[NSFileManager defaultManager] removeItemAtPath:badPath error:NULL];
+}
+
+- (void)testConcurrentExportOfSeveralEvents
+{
+    [moc performBlockAndWait:^{
+        CDEStoreModificationEvent *secondEvent = [NSEntityDescription insertNewObjectForEntityForName:@"CDEStoreModificationEvent" inManagedObjectContext:moc];
+        secondEvent.timestamp = 124;
+        secondEvent.type = CDEStoreModificationEventTypeSave;
+        secondEvent.eventRevision = [CDEEventRevision makeEventRevisionForPersistentStoreIdentifier:self.eventStore.persistentStoreIdentifier revisionNumber:1 inManagedObjectContext:moc];
+        XCTAssertTrue([moc save:NULL], @"Failed save");
+    }];
+    
+    NSString *secondFile = [exportedEventsFile stringByAppendingString:@"2"];
+    [[NSFileManager defaultManager] removeItemAtPath:secondFile error:NULL];
+    NSArray *predicates = @[[NSPredicate predicateWithFormat:@"eventRevision.revisionNumber = 0"], [NSPredicate predicateWithFormat:@"eventRevision.revisionNumber = 1"]];
+    
+    finishedAsyncOp = NO;
+    migrator.maximumConcurrentExports = 2;
+    [migrator migrateLocalEventsMatchingPredicates:predicates toFiles:@[exportedEventsFile, secondFile] completion:^(NSError *error) {
+        finishedAsyncOp = YES;
+        XCTAssertNil(error, @"Error exporting events");
+    }];
+    [self waitForAsyncOpToFinish];
+    
+    NSArray *events = [self eventsInFile];
+    XCTAssertEqual(events.count, (NSUInteger)1, @"Each file should hold one event");
+    XCTAssertEqual([events.lastObject eventRevision].revisionNumber, (CDERevisionNumber)0, @"Wrong event in file");
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:secondFile], @"Second file not exported");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:secondFile error:NULL];
+}
+
+- (void)testConcurrentExportFailsForMissingEvent
+{
+    finishedAsyncOp = NO;
+    NSArray *predicates = @[[NSPredicate predicateWithFormat:@"eventRevision.revisionNumber = 10"]];
+    [migrator migrateLocalEventsMatchingPredicates:predicates toFiles:@[exportedEventsFile] completion:^(NSError *error) {
+        finishedAsyncOp = YES;
+        XCTAssertNotNil(error, @"Missing event should give an error");
+    }];
+    [self waitForAsyncOpToFinish];
+}
+
+- (NSArray *)propertyChangeValuesWithIdentifiers:(NSArray *)identifiers reversed:(BOOL)reversed
+{
+    NSArray *orderedIdentifiers = reversed ? identifiers.reverseObjectEnumerator.allObjects : identifiers;
+    
+    CDEPropertyChangeValue *name = [[CDEPropertyChangeValue alloc] initWithType:CDEPropertyChangeTypeAttribute propertyName:@"name"];
+    name.value = @"Segment";
+    
+    CDEPropertyChangeValue *friends = [[CDEPropertyChangeValue alloc] initWithType:CDEPropertyChangeTypeToManyRelationship propertyName:@"friends"];
+    NSMutableSet *added = [[NSMutableSet alloc] init];
+    for (NSString *identifier in orderedIdentifiers) [added addObject:identifier];
+    friends.addedIdentifiers = added;
+    friends.removedIdentifiers = [NSSet set];
+    
+    CDEPropertyChangeValue *children = [[CDEPropertyChangeValue alloc] initWithType:CDEPropertyChangeTypeOrderedToManyRelationship propertyName:@"children"];
+    NSMutableDictionary *moved = [[NSMutableDictionary alloc] init];
+    [orderedIdentifiers enumerateObjectsUsingBlock:^(NSString *identifier, NSUInteger i, BOOL *stop) {
+        moved[@([identifiers indexOfObject:identifier])] = identifier;
+    }];
+    children.movedIdentifiersByIndex = moved;
+    
+    NSArray *values = @[name, friends, children];
+    return reversed ? values.reverseObjectEnumerator.allObjects : values;
+}
+
+- (void)testIdenticalSegmentsBuiltInDifferentOrdersHaveTheSameFilename
+{
+    NSMutableArray *identifiers = [[NSMutableArray alloc] init];
+    for (NSUInteger i = 0; i < 50; i++) [identifiers addObject:[NSString stringWithFormat:@"friend%lu", (unsigned long)i]];
+    
+    __block NSString *filename = nil, *reorderedFilename = nil, *changedFilename = nil;
+    [moc performBlockAndWait:^{
+        objectChange1.propertyChangeValues = [self propertyChangeValuesWithIdentifiers:identifiers reversed:NO];
+        objectChange2.propertyChangeValues = [self propertyChangeValuesWithIdentifiers:identifiers reversed:NO];
+        filename = [migrator segmentFilenameForObjectChanges:@[objectChange1, objectChange2] segmentKey:@"Hello_0_0"];
+        
+        objectChange1.propertyChangeValues = [self propertyChangeValuesWithIdentifiers:identifiers reversed:YES];
+        objectChange2.propertyChangeValues = [self propertyChangeValuesWithIdentifiers:identifiers reversed:YES];
+        reorderedFilename = [migrator segmentFilenameForObjectChanges:@[objectChange2, objectChange1] segmentKey:@"Hello_0_0"];
+        
+        CDEPropertyChangeValue *name = objectChange2.propertyChangeValues.lastObject;
+        name.value = @"Changed";
+        changedFilename = [migrator segmentFilenameForObjectChanges:@[objectChange1, objectChange2] segmentKey:@"Hello_0_0"];
+    }];
+    
+    XCTAssertEqualObjects(filename, reorderedFilename, @"Identical segments should have the same name");
+    XCTAssertNotEqualObjects(filename, changedFilename, @"Changed segment should have a new name");
+}
+
 @end
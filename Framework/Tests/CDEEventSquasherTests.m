@@ -0,0 +1,139 @@
+//
+//  CDEEventSquasherTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 02/04/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "CDEEventStoreTestCase.h"
+#import "CDEEventSquasher.h"
+#import "CDEStoreModificationEvent.h"
+#import "CDEGlobalIdentifier.h"
+#import "CDEEventRevision.h"
+#import "CDEEventFile.h"
+#import "CDEPropertyChangeValue.h"
+
+@interface CDEEventSquasherTests : CDEEventStoreTestCase
+
+@end
+
+@implementation CDEEventSquasherTests {
+    NSManagedObjectContext *context;
+    CDEEventSquasher *squasher;
+    NSArray *events;
+    CDEGlobalIdentifier *globalIdA, *globalIdB, *globalIdC;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    context = self.eventStore.managedObjectContext;
+    squasher = [[CDEEventSquasher alloc] initWithEventStore:(id)self.eventStore];
+
+    // a is inserted and updated twice, b is inserted and deleted, c is inserted last
+    [context performBlockAndWait:^{
+        NSMutableArray *newEvents = [NSMutableArray array];
+        for (NSInteger i = 0; i < 3; i++) {
+            [newEvents addObject:[self addModEventForStore:@"store1" revision:i globalCount:i+1 timestamp:10.0+i]];
+        }
+        self->events = newEvents;
+
+        self->globalIdA = [self addGlobalIdentifier:@"a" forEntity:@"A"];
+        self->globalIdB = [self addGlobalIdentifier:@"b" forEntity:@"A"];
+        self->globalIdC = [self addGlobalIdentifier:@"c" forEntity:@"A"];
+
+        [self addChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:self->globalIdA values:@{@"name" : @"first", @"count" : @1} toEvent:newEvents[0]];
+        [self addChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:self->globalIdB values:@{@"name" : @"b"} toEvent:newEvents[0]];
+        [self addChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:self->globalIdA values:@{@"name" : @"second"} toEvent:newEvents[1]];
+        [self addChangeOfType:CDEObjectChangeTypeDelete globalIdentifier:self->globalIdB values:nil toEvent:newEvents[1]];
+        [self addChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:self->globalIdA values:@{@"count" : @3} toEvent:newEvents[2]];
+        [self addChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:self->globalIdC values:@{@"name" : @"c"} toEvent:newEvents[2]];
+
+        XCTAssertTrue([self->context save:NULL]);
+    }];
+
+    self.eventStore.lastRevisionSaved = 2;
+}
+
+- (CDEObjectChange *)addChangeOfType:(CDEObjectChangeType)type globalIdentifier:(CDEGlobalIdentifier *)globalId values:(NSDictionary *)values toEvent:(CDEStoreModificationEvent *)event
+{
+    CDEObjectChange *change = [self addObjectChangeOfType:type withGlobalIdentifier:globalId toEvent:event];
+    NSMutableArray *propertyValues = [NSMutableArray array];
+    for (NSString *name in values) [propertyValues addObject:[self attributeChangeForName:name value:values[name]]];
+    change.propertyChangeValues = propertyValues;
+    return change;
+}
+
+- (void)squashExcludingCloudFilenames:(NSSet *)filenames
+{
+    [squasher squashUnexportedSaveEventsExcludingCloudFilenames:filenames completion:^(NSError *error) {
+        XCTAssertNil(error);
+        [self performSelectorOnMainThread:@selector(stopAsyncOp) withObject:nil waitUntilDone:NO];
+    }];
+    CFRunLoopRun();
+}
+
+- (void)stopAsyncOp
+{
+    CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+- (NSArray *)fetchEvents
+{
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+    fetch.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"eventRevision.revisionNumber" ascending:YES]];
+    return [context executeFetchRequest:fetch error:NULL];
+}
+
+- (void)testSquashingFoldsChangesIntoOneEvent
+{
+    [self squashExcludingCloudFilenames:[NSSet set]];
+    [context performBlockAndWait:^{
+        NSArray *squashedEvents = [self fetchEvents];
+        XCTAssertEqual(squashedEvents.count, (NSUInteger)1);
+
+        CDEStoreModificationEvent *event = squashedEvents.lastObject;
+        XCTAssertEqual(event.type, CDEStoreModificationEventTypeSave);
+        XCTAssertEqual(event.eventRevision.revisionNumber, (CDERevisionNumber)0, @"Should take the revision of the first event");
+        XCTAssertEqual(event.globalCount, (CDEGlobalCount)3, @"Should take the global count of the last event");
+        XCTAssertEqualObjects([event.objectChanges valueForKeyPath:@"globalIdentifier.globalIdentifier"], ([NSSet setWithObjects:@"a", @"c", nil]), @"Insert of b was deleted");
+
+        CDEObjectChange *changeA = [[event.objectChanges filteredSetUsingPredicate:[NSPredicate predicateWithFormat:@"globalIdentifier.globalIdentifier = 'a'"]] anyObject];
+        XCTAssertEqual(changeA.type, CDEObjectChangeTypeInsert);
+        XCTAssertEqualObjects([changeA propertyChangeValueForPropertyName:@"name"].value, @"second");
+        XCTAssertEqualObjects([changeA propertyChangeValueForPropertyName:@"count"].value, @3);
+    }];
+}
+
+- (void)testExportedEventsAreNotSquashed
+{
+    __block NSString *filename = nil;
+    [context performBlockAndWait:^{
+        filename = [[CDEEventFile alloc] initWithStoreModificationEvent:self->events[0]].preferredFilename;
+    }];
+
+    [self squashExcludingCloudFilenames:[NSSet setWithObject:filename]];
+    [context performBlockAndWait:^{
+        NSArray *squashedEvents = [self fetchEvents];
+        XCTAssertEqual(squashedEvents.count, (NSUInteger)2);
+        XCTAssertEqualObjects([squashedEvents valueForKeyPath:@"eventRevision.revisionNumber"], (@[@0, @1]), @"Revisions should stay contiguous");
+
+        CDEStoreModificationEvent *event = squashedEvents.lastObject;
+        XCTAssertEqual(event.globalCount, (CDEGlobalCount)3);
+        NSSet *types = [event.objectChanges valueForKeyPath:@"type"];
+        XCTAssertEqualObjects(types, ([NSSet setWithObjects:@(CDEObjectChangeTypeUpdate), @(CDEObjectChangeTypeDelete), @(CDEObjectChangeTypeInsert), nil]), @"Delete of exported b should be kept");
+    }];
+}
+
+- (void)testEventsFollowedByLaterRevisionsAreNotSquashed
+{
+    self.eventStore.lastRevisionSaved = 3;
+    [self squashExcludingCloudFilenames:[NSSet set]];
+    [context performBlockAndWait:^{
+        XCTAssertEqual([self fetchEvents].count, (NSUInteger)3);
+    }];
+}
+
+@end
@@ -14,6 +14,7 @@
 @class CDEEventRevision;
 @class CDEStoreModificationEvent;
 @class CDEGlobalIdentifier;
+@class CDERevision;
 
 
 @interface CDEMockEventStore : NSObject 
@@ -24,6 +25,8 @@
 @property (nonatomic) NSString *identifierOfBaselineUsedToConstructStore;
 @property (nonatomic) NSString *currentBaselineIdentifier;
 @property (readwrite) CDERevisionNumber lastRevisionSaved, lastSaveRevisionSaved, lastMergeRevisionSaved;
+@property (readwrite) CDERevisionNumber baselineRevision;
+@property (readonly) NSArray *incompleteEventIdentifiers;
 @property (readwrite) NSString *pathToEventDataRootDirectory;
 @property (readwrite) NSSet *allDataFilenames;
 
@@ -33,6 +36,8 @@
 - (void)registerIncompleteEventIdentifier:(NSString *)identifier isMandatory:(BOOL)mandatory;
 - (void)deregisterIncompleteEventIdentifier:(NSString *)identifier;
 
+- (NSTimeInterval)timestampOfFirstObservationOfRevision:(CDERevision *)revision;
+
 @end
 
 
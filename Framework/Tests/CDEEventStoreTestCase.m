@@ -26,6 +26,7 @@ static NSString *testStoreFile;
     _lastRevisionSaved = -1;
     _lastSaveRevisionSaved = -1;
     _lastMergeRevisionSaved = -1;
+    _baselineRevision = -1;
     _identifierOfBaselineUsedToConstructStore = @"store1baseline";
     _currentBaselineIdentifier = @"store1";
     _allDataFilenames = [NSSet set];
@@ -64,6 +65,16 @@ static NSString *testStoreFile;
 {
 }
 
+- (NSArray *)incompleteEventIdentifiers
+{
+    return @[];
+}
+
+- (NSTimeInterval)timestampOfFirstObservationOfRevision:(CDERevision *)revision
+{
+    return [NSDate timeIntervalSinceReferenceDate];
+}
+
 @end
 
 
@@ -10,6 +10,10 @@
 #import "CDEEventStore.h"
 #import "CDEObjectChange.h"
 #import "CDEDataFile.h"
+#import "CDEStoreModificationEvent.h"
+#import "CDEEventRevision.h"
+#import "CDEGlobalIdentifier.h"
+#import "CDEFoundationAdditions.h"
 
 static NSString *rootTestDirectory;
 
@@ -257,4 +261,133 @@ static NSString *rootTestDirectory;
     XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:storePath4], @"Should have file 789, because is newly imported");
 }
 
+- (void)testStoringDataNamesFileByContentHash
+{
+    [store prepareNewEventStore:NULL];
+    NSData *data = [@"Hi there" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *filename = [store storeDataInFile:data];
+    XCTAssertEqualObjects(filename, @"8328c36d18b7834a38118f6ec924ae143c10263f2519c723ccb36ca14e7461fb", @"Filename should be SHA-256 of contents");
+    XCTAssertEqualObjects([store dataForFile:filename], data, @"Wrong data");
+}
+
+- (void)testStoringDuplicateDataSharesFile
+{
+    [store prepareNewEventStore:NULL];
+    NSData *data = [@"Hi there" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *filename1 = [store storeDataInFile:data];
+    NSString *filename2 = [store storeDataInFile:[data mutableCopy]];
+    NSString *filename3 = [store storeDataInFile:[@"Bye" dataUsingEncoding:NSUTF8StringEncoding]];
+    XCTAssertEqualObjects(filename1, filename2, @"Identical data should share a file");
+    XCTAssertNotEqualObjects(filename1, filename3, @"Different data should use different files");
+    XCTAssertEqual(store.allDataFilenames.count, (NSUInteger)2, @"Wrong file count");
+}
+
+- (void)testStoringDataAlreadyImportedReusesFile
+{
+    [store prepareNewEventStore:NULL];
+    NSData *data = [@"Hi there" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *file = [NSTemporaryDirectory() stringByAppendingPathComponent:[data cde_SHA256String]];
+    [data writeToFile:file atomically:NO];
+    XCTAssertTrue([store importDataFile:file], @"Import failed");
+    
+    NSString *filename = [store storeDataInFile:data];
+    XCTAssertEqualObjects(filename, file.lastPathComponent, @"Should reuse the imported file");
+    XCTAssertEqualObjects(store.previouslyReferencedDataFilenames, [NSSet setWithObject:filename], @"File should be moved out of new data");
+    XCTAssertEqual(store.newlyImportedDataFilenames.count, (NSUInteger)0, @"Should be no newly imported files");
+    
+    [data writeToFile:file atomically:NO];
+    XCTAssertTrue([store importDataFile:file], @"Importing a duplicate should succeed");
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:file], @"Duplicate should be removed");
+    XCTAssertEqual(store.allDataFilenames.count, (NSUInteger)1, @"Duplicate should not be imported");
+}
+
+- (void)testLegacyDataFilesAreReadable
+{
+    [store prepareNewEventStore:NULL];
+    NSString *legacyFilename = [[NSProcessInfo processInfo] globallyUniqueString];
+    NSString *storePath = [store.pathToEventDataRootDirectory stringByAppendingPathComponent:[@"test/data" stringByAppendingPathComponent:legacyFilename]];
+    NSData *data = [@"Hi there" dataUsingEncoding:NSUTF8StringEncoding];
+    [data writeToFile:storePath atomically:NO];
+    XCTAssertEqualObjects([store dataForFile:legacyFilename], data, @"Legacy file should be readable");
+}
+
+- (void)testStoringChunkedData
+{
+    [store prepareNewEventStore:NULL];
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:10 * 1024 * 1024];
+    arc4random_buf(data.mutableBytes, data.length);
+    
+    NSArray *filenames = [store storeDataInChunkedFiles:data];
+    XCTAssertTrue(filenames.count > 1, @"Should be several chunks");
+    XCTAssertEqualObjects(store.allDataFilenames, [NSSet setWithArray:filenames], @"Each chunk should have a file");
+    XCTAssertEqualObjects([store dataForChunkedFiles:filenames], data, @"Reassembled data differs");
+    
+    [data replaceBytesInRange:NSMakeRange(data.length / 2, 4) withBytes:"Edit" length:4];
+    NSArray *editedFilenames = [store storeDataInChunkedFiles:data];
+    NSMutableSet *newFilenames = [NSMutableSet setWithArray:editedFilenames];
+    [newFilenames minusSet:[NSSet setWithArray:filenames]];
+    XCTAssertTrue(newFilenames.count <= 2, @"Only chunks near the edit should change");
+    XCTAssertEqualObjects([store dataForChunkedFiles:editedFilenames], data, @"Reassembled edited data differs");
+}
+
+- (CDEObjectChange *)addObjectChangeReferencingDataFile:(NSString *)filename
+{
+    NSManagedObjectContext *context = store.managedObjectContext;
+    CDEStoreModificationEvent *event = [NSEntityDescription insertNewObjectForEntityForName:@"CDEStoreModificationEvent" inManagedObjectContext:context];
+    event.type = CDEStoreModificationEventTypeSave;
+    event.timestamp = [NSDate timeIntervalSinceReferenceDate];
+    event.eventRevision = [NSEntityDescription insertNewObjectForEntityForName:@"CDEEventRevision" inManagedObjectContext:context];
+    event.eventRevision.persistentStoreIdentifier = @"store1";
+    
+    CDEGlobalIdentifier *globalId = [NSEntityDescription insertNewObjectForEntityForName:@"CDEGlobalIdentifier" inManagedObjectContext:context];
+    globalId.globalIdentifier = [[NSProcessInfo processInfo] globallyUniqueString];
+    globalId.nameOfEntity = @"Parent";
+    
+    CDEObjectChange *change = [NSEntityDescription insertNewObjectForEntityForName:@"CDEObjectChange" inManagedObjectContext:context];
+    change.nameOfEntity = @"Parent";
+    change.type = CDEObjectChangeTypeDelete;
+    change.storeModificationEvent = event;
+    change.globalIdentifier = globalId;
+    
+    CDEDataFile *dataFile = [NSEntityDescription insertNewObjectForEntityForName:@"CDEDataFile" inManagedObjectContext:context];
+    dataFile.filename = filename;
+    dataFile.objectChange = change;
+    
+    return change;
+}
+
+- (void)testReferenceCountingOfSharedDataFiles
+{
+    [store prepareNewEventStore:NULL];
+    NSManagedObjectContext *context = store.managedObjectContext;
+    NSString *storePath = [store.pathToEventDataRootDirectory stringByAppendingPathComponent:@"test/data/123"];
+    [@"Hi" writeToFile:storePath atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    
+    __block CDEObjectChange *change1, *change2;
+    [context performBlockAndWait:^{
+        change1 = [self addObjectChangeReferencingDataFile:@"123"];
+        change2 = [self addObjectChangeReferencingDataFile:@"123"];
+        XCTAssertEqual([CDEDataFile referenceCountForFilename:@"123" inManagedObjectContext:context], (NSUInteger)2, @"Wrong count before save");
+        XCTAssertEqualObjects([CDEDataFile referenceCountsByFilenameInManagedObjectContext:context], @{@"123" : @2}, @"Wrong counts before save");
+        
+        NSError *error;
+        XCTAssertTrue([context save:&error], @"Save failed: %@", error);
+        XCTAssertEqualObjects([CDEDataFile referenceCountsByFilenameInManagedObjectContext:context], @{@"123" : @2}, @"Wrong counts after save");
+        
+        [context deleteObject:change1];
+        XCTAssertTrue([context save:&error], @"Save failed: %@", error);
+        XCTAssertEqual([CDEDataFile referenceCountForFilename:@"123" inManagedObjectContext:context], (NSUInteger)1, @"Wrong count after removing a reference");
+    }];
+    
+    [store removeUnreferencedDataFiles];
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:storePath], @"File still has a reference");
+    
+    [context performBlockAndWait:^{
+        [context deleteObject:change2];
+        [context save:NULL];
+    }];
+    [store removeUnreferencedDataFiles];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:storePath], @"File has no references, and should be removed");
+}
+
 @end
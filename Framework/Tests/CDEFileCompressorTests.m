@@ -0,0 +1,119 @@
+//
+//  CDEFileCompressorTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 22/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "CDEFileCompressor.h"
+
+@interface CDEFileCompressorTests : XCTestCase
+
+@end
+
+@implementation CDEFileCompressorTests {
+    NSString *rootDir;
+    NSString *path;
+    NSData *eventLikeData;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    rootDir = [NSTemporaryDirectory() stringByAppendingPathComponent:@"CDEFileCompressorTests"];
+    [[NSFileManager defaultManager] removeItemAtPath:rootDir error:NULL];
+    [[NSFileManager defaultManager] createDirectoryAtPath:rootDir withIntermediateDirectories:YES attributes:nil error:NULL];
+    path = [rootDir stringByAppendingPathComponent:@"0_store1_0.cdeevent"];
+
+    // Like an event file: entity and property names, and lots of identifiers
+    NSMutableString *string = [NSMutableString string];
+    for (NSUInteger i = 0; i < 5000; i++) {
+        [string appendFormat:@"CDEObjectChange Parent %@ name=%@ children=%@ %lu\n", [[NSProcessInfo processInfo] globallyUniqueString], [[NSUUID UUID] UUIDString], [[NSUUID UUID] UUIDString], (unsigned long)i];
+    }
+    eventLikeData = [string dataUsingEncoding:NSUTF8StringEncoding];
+    [eventLikeData writeToFile:path atomically:YES];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtPath:rootDir error:NULL];
+    [super tearDown];
+}
+
+- (unsigned long long)sizeOfFileAtPath:(NSString *)filePath
+{
+    return [[NSFileManager defaultManager] attributesOfItemAtPath:filePath error:NULL].fileSize;
+}
+
+- (void)testRoundTrip
+{
+    NSError *error;
+    XCTAssertTrue([CDEFileCompressor compressFileInPlaceAtPath:path codec:CDECompressionCodecZlib error:&error], @"%@", error);
+    XCTAssertTrue([CDEFileCompressor isCompressedFileAtPath:path], @"Should be compressed");
+    XCTAssertLessThan([self sizeOfFileAtPath:path], eventLikeData.length / 2, @"Event-like data should compress well");
+
+    XCTAssertTrue([CDEFileCompressor decompressFileInPlaceAtPath:path error:&error], @"%@", error);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], eventLikeData, @"Round trip changed the data");
+}
+
+- (void)testFastCodecRoundTrip
+{
+    NSError *error;
+    XCTAssertTrue([CDEFileCompressor compressFileInPlaceAtPath:path codec:CDECompressionCodecZlibFast error:&error], @"%@", error);
+    XCTAssertTrue([CDEFileCompressor decompressFileInPlaceAtPath:path error:&error], @"%@", error);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], eventLikeData, @"Round trip changed the data");
+}
+
+- (void)testCompressingTwiceHasNoEffect
+{
+    [CDEFileCompressor compressFileInPlaceAtPath:path codec:CDECompressionCodecZlib error:NULL];
+    NSData *compressed = [NSData dataWithContentsOfFile:path];
+    XCTAssertTrue([CDEFileCompressor compressFileInPlaceAtPath:path codec:CDECompressionCodecZlib error:NULL]);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], compressed, @"Should not compress again");
+}
+
+- (void)testUncompressedFilesAreLeftAsIs
+{
+    NSError *error;
+    XCTAssertFalse([CDEFileCompressor isCompressedFileAtPath:path], @"Should not be compressed");
+    XCTAssertTrue([CDEFileCompressor decompressFileInPlaceAtPath:path error:&error], @"%@", error);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], eventLikeData, @"Uncompressed file should be untouched");
+}
+
+- (void)testIncompressibleFilesAreLeftAsIs
+{
+    NSMutableData *randomData = [[NSMutableData alloc] initWithLength:100000];
+    arc4random_buf(randomData.mutableBytes, randomData.length);
+    [randomData writeToFile:path atomically:YES];
+
+    XCTAssertTrue([CDEFileCompressor compressFileInPlaceAtPath:path codec:CDECompressionCodecZlib error:NULL]);
+    XCTAssertFalse([CDEFileCompressor isCompressedFileAtPath:path], @"Should not be compressed");
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], randomData, @"Should be untouched");
+}
+
+- (void)testTruncatedFileFailsToDecompress
+{
+    [CDEFileCompressor compressFileInPlaceAtPath:path codec:CDECompressionCodecZlib error:NULL];
+    NSData *compressed = [NSData dataWithContentsOfFile:path];
+    [[compressed subdataWithRange:NSMakeRange(0, compressed.length / 2)] writeToFile:path atomically:YES];
+
+    NSError *error;
+    XCTAssertFalse([CDEFileCompressor decompressFileInPlaceAtPath:path error:&error], @"Should fail");
+    XCTAssertEqual(error.code, CDEErrorCodeDataCorruptionDetected);
+}
+
+- (void)testCompressionThroughput
+{
+    NSString *toPath = [rootDir stringByAppendingPathComponent:@"compressed"];
+    __block unsigned long long compressedSize = 0;
+    [self measureBlock:^{
+        [[NSFileManager defaultManager] removeItemAtPath:toPath error:NULL];
+        [CDEFileCompressor compressFileAtPath:path toPath:toPath codec:CDECompressionCodecZlibFast error:NULL];
+        compressedSize = [self sizeOfFileAtPath:toPath];
+    }];
+    XCTAssertLessThan(compressedSize, eventLikeData.length / 2, @"Fast codec should still compress event-like data well");
+}
+
+@end
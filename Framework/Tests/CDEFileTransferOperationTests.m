@@ -0,0 +1,350 @@
+//
+//  CDEFileTransferOperationTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 25/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <CommonCrypto/CommonDigest.h>
+#import "CDEFileDownloadOperation.h"
+#import "CDEFileUploadOperation.h"
+#import "CDEFoundationAdditions.h"
+
+static NSString * const kCDEStandInHost = @"transfer.standin.local";
+static NSString * const kCDEStandInETag = @"\"v1\"";
+static NSData *standInBody = nil;
+static NSUInteger standInDisconnects = 0;
+static NSUInteger standInUnavailableResponses = 0;
+static NSUInteger standInCorruptResponses = 0;
+static BOOL standInSupportsRanges = NO;
+static NSString *standInDigest = nil;
+static NSMutableArray *standInRangeHeaders = nil;
+static NSMutableArray *standInUploads = nil;
+
+
+// Serves a single file, and drops the connection halfway through while disconnects remain
+@interface CDETransferStandInURLProtocol : NSURLProtocol
+@end
+
+@implementation CDETransferStandInURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return [request.URL.host isEqualToString:kCDEStandInHost];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (NSData *)bodyData
+{
+    if (self.request.HTTPBody) return self.request.HTTPBody;
+
+    NSInputStream *stream = self.request.HTTPBodyStream;
+    if (!stream) return nil;
+
+    NSMutableData *data = [NSMutableData data];
+    uint8_t buffer[4096];
+    [stream open];
+    NSInteger length;
+    while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+        [data appendBytes:buffer length:length];
+    }
+    [stream close];
+    return data;
+}
+
+- (void)respondWithStatus:(NSInteger)status headers:(NSDictionary *)headers
+{
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:status HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+}
+
+- (void)disconnect
+{
+    standInDisconnects--;
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil];
+    [self.client URLProtocol:self didFailWithError:error];
+}
+
+- (void)startLoading
+{
+    if (standInUnavailableResponses > 0) {
+        standInUnavailableResponses--;
+        [self respondWithStatus:503 headers:nil];
+        [self.client URLProtocolDidFinishLoading:self];
+        return;
+    }
+
+    if ([self.request.HTTPMethod isEqualToString:@"PUT"]) {
+        NSData *data = [self bodyData];
+        if (standInDisconnects > 0) {
+            [self disconnect];
+            return;
+        }
+        [standInUploads addObject:data ? : [NSData data]];
+        [self respondWithStatus:201 headers:nil];
+        [self.client URLProtocolDidFinishLoading:self];
+        return;
+    }
+
+    NSString *range = [self.request valueForHTTPHeaderField:@"Range"];
+    [standInRangeHeaders addObject:range ? : [NSNull null]];
+
+    NSUInteger start = 0;
+    NSInteger status = 200;
+    NSMutableDictionary *headers = [NSMutableDictionary dictionary];
+    if (standInSupportsRanges) {
+        headers[@"Accept-Ranges"] = @"bytes";
+        headers[@"ETag"] = kCDEStandInETag;
+        NSString *ifRange = [self.request valueForHTTPHeaderField:@"If-Range"];
+        if (range && [ifRange isEqualToString:kCDEStandInETag]) {
+            NSScanner *scanner = [NSScanner scannerWithString:range];
+            NSInteger first = 0;
+            [scanner scanString:@"bytes=" intoString:NULL];
+            [scanner scanInteger:&first];
+            start = first;
+            status = 206;
+            headers[@"Content-Range"] = [NSString stringWithFormat:@"bytes %lu-%lu/%lu", (unsigned long)start, (unsigned long)standInBody.length - 1, (unsigned long)standInBody.length];
+        }
+    }
+    if (standInDigest) headers[@"Digest"] = [@"SHA-256=" stringByAppendingString:standInDigest];
+
+    NSData *content = [standInBody subdataWithRange:NSMakeRange(start, standInBody.length - start)];
+    if (standInCorruptResponses > 0) {
+        // Same length, different bytes
+        standInCorruptResponses--;
+        NSMutableData *corrupted = [content mutableCopy];
+        ((uint8_t *)corrupted.mutableBytes)[corrupted.length / 2] ^= 0xFF;
+        content = corrupted;
+    }
+    headers[@"Content-Length"] = [NSString stringWithFormat:@"%lu", (unsigned long)content.length];
+    [self respondWithStatus:status headers:headers];
+
+    if (standInDisconnects > 0) {
+        [self.client URLProtocol:self didLoadData:[content subdataWithRange:NSMakeRange(0, content.length / 2)]];
+        [self disconnect];
+        return;
+    }
+
+    [self.client URLProtocol:self didLoadData:content];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+
+@interface CDEFileTransferOperationTests : XCTestCase
+
+@end
+
+@implementation CDEFileTransferOperationTests {
+    NSString *rootDirectory;
+    NSString *localPath;
+    NSURLRequest *request;
+    NSOperationQueue *queue;
+    NSURLSession *session;
+    NSError *transferError;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    rootDirectory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"CDEFileTransferOperationTests"];
+    [[NSFileManager defaultManager] removeItemAtPath:rootDirectory error:NULL];
+    [[NSFileManager defaultManager] createDirectoryAtPath:rootDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+    localPath = [rootDirectory stringByAppendingPathComponent:@"0_store1_0.cdeevent"];
+
+    NSMutableData *body = [[NSMutableData alloc] initWithLength:100000];
+    arc4random_buf(body.mutableBytes, body.length);
+    standInBody = body;
+    standInDisconnects = 0;
+    standInUnavailableResponses = 0;
+    standInCorruptResponses = 0;
+    standInSupportsRanges = YES;
+    standInDigest = [self base64DigestOfData:body];
+    standInRangeHeaders = [NSMutableArray array];
+    standInUploads = [NSMutableArray array];
+    [NSURLProtocol registerClass:[CDETransferStandInURLProtocol class]];
+
+    NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://%@/file", kCDEStandInHost]];
+    request = [NSURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalAndRemoteCacheData timeoutInterval:10.0];
+    queue = [[NSOperationQueue alloc] init];
+    transferError = nil;
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[CDETransferStandInURLProtocol class]];
+    session = [NSURLSession sessionWithConfiguration:configuration];
+}
+
+- (void)tearDown
+{
+    [session invalidateAndCancel];
+    [NSURLProtocol unregisterClass:[CDETransferStandInURLProtocol class]];
+    [[NSFileManager defaultManager] removeItemAtPath:rootDirectory error:NULL];
+    [super tearDown];
+}
+
+- (NSString *)base64DigestOfData:(NSData *)data
+{
+    NSMutableData *digest = [[NSMutableData alloc] initWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(data.bytes, (CC_LONG)data.length, digest.mutableBytes);
+    return digest.cde_base64String;
+}
+
+- (void)runOperation:(CDEAsynchronousOperation *)operation
+{
+    [(id)operation setRetryBaseDelay:0.01];
+    [(id)operation setCompletion:^(NSError *error) {
+        self->transferError = error;
+        CFRunLoopStop(CFRunLoopGetCurrent());
+    }];
+    [queue addOperation:operation];
+    CFRunLoopRun();
+}
+
+- (void)testDownload
+{
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:localPath], standInBody);
+}
+
+- (void)testDownloadResumesAfterDisconnect
+{
+    standInDisconnects = 2;
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:localPath], standInBody);
+
+    NSArray *expectedRanges = @[[NSNull null], @"bytes=50000-", @"bytes=75000-"];
+    XCTAssertEqualObjects(standInRangeHeaders, expectedRanges, @"Should ask for the remainder each time");
+}
+
+- (void)testDownloadStartsOverWithoutRangeSupport
+{
+    standInSupportsRanges = NO;
+    standInDisconnects = 1;
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:localPath], standInBody);
+    XCTAssertEqualObjects(standInRangeHeaders, (@[[NSNull null], [NSNull null]]));
+}
+
+- (void)testDownloadFailsWhenRetriesRunOut
+{
+    standInDisconnects = 10;
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    operation.maximumRetryCount = 2;
+    [self runOperation:operation];
+    XCTAssertEqual(transferError.code, NSURLErrorNetworkConnectionLost);
+    XCTAssertEqual(standInRangeHeaders.count, (NSUInteger)3);
+    XCTAssertEqual([[NSFileManager defaultManager] contentsOfDirectoryAtPath:rootDirectory error:NULL].count, (NSUInteger)0, @"Should leave no files");
+}
+
+- (void)testDownloadRetriesServerErrors
+{
+    standInUnavailableResponses = 1;
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:localPath], standInBody);
+}
+
+- (void)testCorruptDownloadNeverReachesLocalPath
+{
+    standInDigest = [self base64DigestOfData:[NSData data]];
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    operation.maximumRetryCount = 1;
+    [self runOperation:operation];
+    XCTAssertEqual(transferError.code, CDEErrorCodeDataCorruptionDetected);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:localPath]);
+}
+
+- (void)testExpectedChecksumIsVerified
+{
+    standInDigest = nil;
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    operation.expectedSHA256String = standInBody.cde_SHA256String;
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+
+    [[NSFileManager defaultManager] removeItemAtPath:localPath error:NULL];
+    operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    operation.expectedSHA256String = [NSData data].cde_SHA256String;
+    operation.maximumRetryCount = 0;
+    [self runOperation:operation];
+    XCTAssertEqual(transferError.code, CDEErrorCodeDataCorruptionDetected);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:localPath]);
+}
+
+- (void)testCorruptBodyWithCorrectLengthIsRejected
+{
+    standInDigest = nil;
+    standInCorruptResponses = 10;
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath session:session];
+    operation.expectedSHA256String = standInBody.cde_SHA256String;
+    operation.maximumRetryCount = 1;
+    [self runOperation:operation];
+    XCTAssertEqual(transferError.code, CDEErrorCodeDataCorruptionDetected);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:localPath]);
+    
+    // The server digest alone also catches it, and a clean retry succeeds
+    [[NSFileManager defaultManager] removeItemAtPath:localPath error:NULL];
+    standInDigest = [self base64DigestOfData:standInBody];
+    standInCorruptResponses = 1;
+    operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath];
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:localPath], standInBody);
+}
+
+- (void)testSessionDownloadRetriesAfterDisconnect
+{
+    standInDisconnects = 1;
+    CDEFileDownloadOperation *operation = [[CDEFileDownloadOperation alloc] initWithURLRequest:request localPath:localPath session:session];
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:localPath], standInBody);
+}
+
+- (void)testUploadRetriesAfterDisconnect
+{
+    [standInBody writeToFile:localPath atomically:YES];
+    NSMutableURLRequest *putRequest = [request mutableCopy];
+    putRequest.HTTPMethod = @"PUT";
+
+    standInDisconnects = 1;
+    CDEFileUploadOperation *operation = [[CDEFileUploadOperation alloc] initWithURLRequest:putRequest localPath:localPath];
+    [self runOperation:operation];
+    XCTAssertNil(transferError);
+    XCTAssertEqualObjects(standInUploads, @[standInBody]);
+}
+
+- (void)testSessionUploadGivesUpWhenRetriesRunOut
+{
+    [standInBody writeToFile:localPath atomically:YES];
+    NSMutableURLRequest *putRequest = [request mutableCopy];
+    putRequest.HTTPMethod = @"PUT";
+
+    standInUnavailableResponses = 5;
+    CDEFileUploadOperation *operation = [[CDEFileUploadOperation alloc] initWithURLRequest:putRequest localPath:localPath session:session];
+    operation.maximumRetryCount = 1;
+    [self runOperation:operation];
+    XCTAssertEqual(transferError.code, CDEErrorCodeServerError);
+    XCTAssertEqual(standInUnavailableResponses, (NSUInteger)3, @"Should try twice");
+}
+
+@end
@@ -9,6 +9,7 @@
 #import <XCTest/XCTest.h>
 #import "CDEEventStoreTestCase.h"
 #import "CDEGlobalIdentifier.h"
+#import "CDEStoreModificationEvent.h"
 
 @interface CDEGlobalIdentifierTests : CDEEventStoreTestCase
 
@@ -77,4 +78,57 @@
     XCTAssertEqualObjects(ids[1], globalId3, @"Wrong second object");
 }
 
+- (void)saveWithReferenceCounts
+{
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    [CDEGlobalIdentifier updateReferenceCountsForChangesInManagedObjectContext:moc];
+    XCTAssertTrue([moc save:NULL]);
+}
+
+- (void)testReferenceCountsFollowObjectChanges
+{
+    [self.eventStore.managedObjectContext performBlockAndWait:^{
+        CDEStoreModificationEvent *event = [self addModEventForStore:@"store1" revision:0 timestamp:10.0];
+        CDEObjectChange *change = [self addObjectChangeOfType:CDEObjectChangeTypeInsert withGlobalIdentifier:globalId1 toEvent:event];
+        [self addObjectChangeOfType:CDEObjectChangeTypeUpdate withGlobalIdentifier:globalId1 toEvent:event];
+        [self addObjectChangeOfType:CDEObjectChangeTypeInsert withGlobalIdentifier:globalId2 toEvent:event];
+        [self saveWithReferenceCounts];
+        XCTAssertEqual(globalId1.referenceCount, (int64_t)2);
+        XCTAssertEqual(globalId2.referenceCount, (int64_t)1);
+        XCTAssertEqual(globalId3.referenceCount, (int64_t)0);
+        
+        change.globalIdentifier = globalId3;
+        [self saveWithReferenceCounts];
+        XCTAssertEqual(globalId1.referenceCount, (int64_t)1);
+        XCTAssertEqual(globalId3.referenceCount, (int64_t)1);
+        
+        [self.eventStore.managedObjectContext deleteObject:change];
+        [self saveWithReferenceCounts];
+        XCTAssertEqual(globalId3.referenceCount, (int64_t)0);
+        
+        NSArray *unreferenced = [CDEGlobalIdentifier fetchUnreferencedGlobalIdentifiersInManagedObjectContext:self.eventStore.managedObjectContext];
+        XCTAssertEqualObjects(unreferenced, @[globalId3]);
+    }];
+}
+
+- (void)testUncountedGlobalIdentifiersAreCounted
+{
+    [self.eventStore.managedObjectContext performBlockAndWait:^{
+        CDEStoreModificationEvent *event = [self addModEventForStore:@"store1" revision:0 timestamp:10.0];
+        [self addObjectChangeOfType:CDEObjectChangeTypeInsert withGlobalIdentifier:globalId1 toEvent:event];
+        [self addObjectChangeOfType:CDEObjectChangeTypeUpdate withGlobalIdentifier:globalId1 toEvent:event];
+        XCTAssertTrue([self.eventStore.managedObjectContext save:NULL]);
+        XCTAssertEqual(globalId1.referenceCount, (int64_t)-1, @"Should not be counted without the event store");
+        
+        NSArray *unreferenced = [CDEGlobalIdentifier fetchUnreferencedGlobalIdentifiersInManagedObjectContext:self.eventStore.managedObjectContext];
+        XCTAssertEqual(unreferenced.count, (NSUInteger)0, @"Uncounted identifiers should never be unreferenced");
+        
+        NSError *error = nil;
+        XCTAssertTrue([CDEGlobalIdentifier countReferencesOfUncountedGlobalIdentifiersInManagedObjectContext:self.eventStore.managedObjectContext error:&error], @"%@", error);
+        XCTAssertEqual(globalId1.referenceCount, (int64_t)2);
+        XCTAssertEqual(globalId2.referenceCount, (int64_t)0);
+        XCTAssertEqual(globalId3.referenceCount, (int64_t)0);
+    }];
+}
+
 @end
@@ -129,6 +129,80 @@
     }];
 }
 
+- (void)testEmptyStoreIsBootstrappedFromBaseline
+{
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    [moc performBlockAndWait:^{
+        modEvent.type = CDEStoreModificationEventTypeBaseline;
+        [moc save:NULL];
+        self.eventStore.currentBaselineIdentifier = modEvent.uniqueIdentifier;
+    }];
+    
+    // Relationships are set before anything is saved, so the store is saved once
+    __block NSUInteger saveCount = 0;
+    CDEEventIntegratorDidSaveBlock didSaveBlock = self.integrator.didSaveBlock;
+    self.integrator.didSaveBlock = ^(NSManagedObjectContext *context, NSDictionary *info) {
+        saveCount++;
+        didSaveBlock(context, info);
+    };
+    
+    [self mergeEvents];
+    XCTAssertEqual(saveCount, (NSUInteger)1, @"Store should be saved once");
+    
+    NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"Parent"];
+    fetch.predicate = [NSPredicate predicateWithFormat:@"name = \"parent1\""];
+    NSArray *parents = [self.testManagedObjectContext executeFetchRequest:fetch error:NULL];
+    XCTAssertEqual(parents.count, (NSUInteger)1, @"Wrong number of parents");
+    id parent = parents.lastObject;
+    XCTAssertEqualObjects([parent valueForKey:@"date"], [NSDate dateWithTimeIntervalSinceReferenceDate:0], @"Wrong date attribute");
+    XCTAssertNotNil([parent valueForKey:@"child"], @"Should have a child object");
+    XCTAssertEqual([[parent valueForKeyPath:@"child.parent"] objectID], [parent objectID], @"Inverse should be set");
+    
+    [moc performBlockAndWait:^{
+        [moc refreshObject:globalId1 mergeChanges:NO];
+        XCTAssertNotNil(globalId1.storeURI, @"Global identifier should record the store object");
+        
+        NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
+        fetch.predicate = [NSPredicate predicateWithFormat:@"type = %d", CDEStoreModificationEventTypeMerge];
+        XCTAssertEqual([moc countForFetchRequest:fetch error:NULL], (NSUInteger)1, @"Should be a merge event");
+    }];
+}
+
+- (void)testBootstrapSetsRequiredRelationshipsBeforeSaving
+{
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    [moc performBlockAndWait:^{
+        modEvent.type = CDEStoreModificationEventTypeBaseline;
+        [moc save:NULL];
+        self.eventStore.currentBaselineIdentifier = modEvent.uniqueIdentifier;
+    }];
+    
+    // A store for a model in which every child must have a parent
+    NSManagedObjectModel *model = [self.integrator.managedObjectModel copy];
+    NSRelationshipDescription *parentRelationship = model.entitiesByName[@"Child"].relationshipsByName[@"parent"];
+    parentRelationship.optional = NO;
+    NSURL *storeURL = [self.testStoreURL.URLByDeletingLastPathComponent URLByAppendingPathComponent:@"requiredparent.sql"];
+    self.integrator = [[CDEEventIntegrator alloc] initWithStoreURL:storeURL managedObjectModel:model eventStore:(id)self.eventStore];
+    
+    __block NSError *mergeError = nil;
+    [self.integrator mergeEventsWithCompletion:^(NSError *error) {
+        mergeError = error;
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+    XCTAssertNil(mergeError, @"Bootstrapping should not fail validation");
+    
+    NSPersistentStoreCoordinator *coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+    [coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:storeURL options:nil error:NULL];
+    NSManagedObjectContext *context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+    [context performBlockAndWait:^{
+        context.persistentStoreCoordinator = coordinator;
+        NSArray *children = [context executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"Child"] error:NULL];
+        XCTAssertEqual(children.count, (NSUInteger)1, @"Wrong number of children");
+        XCTAssertEqualObjects([children.lastObject valueForKeyPath:@"parent.name"], @"parent1", @"Child should have its parent");
+    }];
+}
+
 - (void)testNilBaselineIdRequiresFullIntegration
 {
     self.eventStore.identifierOfBaselineUsedToConstructStore = nil;
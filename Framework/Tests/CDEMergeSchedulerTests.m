@@ -0,0 +1,187 @@
+//
+//  CDEMergeSchedulerTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 26/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "CDEMergeScheduler.h"
+
+@interface CDEMergeSchedulerTests : XCTestCase
+
+@end
+
+@implementation CDEMergeSchedulerTests {
+    CDEMergeScheduler *scheduler;
+    NSUInteger mergeCount;
+    NSTimeInterval mergeDuration;
+    NSError *mergeError;
+    BOOL mergeFindsRemoteChanges;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    mergeCount = 0;
+    mergeDuration = 0.0;
+    mergeError = nil;
+    mergeFindsRemoteChanges = YES;
+
+    __weak typeof(self) weakSelf = self;
+    scheduler = [[CDEMergeScheduler alloc] initWithMergeBlock:^(CDEMergeSchedulerMergeCallback callback) {
+        typeof(self) strongSelf = weakSelf;
+        strongSelf->mergeCount++;
+        NSError *error = strongSelf->mergeError;
+        BOOL found = strongSelf->mergeFindsRemoteChanges;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(strongSelf->mergeDuration * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            callback(error, found);
+        });
+    }];
+    scheduler.debounceInterval = 0.05;
+    scheduler.maximumLatency = 0.2;
+    scheduler.failureRetryBaseDelay = 0.2;
+    scheduler.minimumPollInterval = 0.1;
+    scheduler.maximumPollInterval = 0.4;
+}
+
+- (void)tearDown
+{
+    [scheduler invalidate];
+    [super tearDown];
+}
+
+- (void)waitForInterval:(NSTimeInterval)interval
+{
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:interval]];
+}
+
+- (void)testRequestsAreCoalesced
+{
+    __block NSUInteger completionCount = 0;
+    for (NSUInteger i = 0; i < 3; i++) {
+        [scheduler mergeSoonWithCompletion:^(NSError *error) {
+            XCTAssertNil(error);
+            completionCount++;
+        }];
+    }
+    [self waitForInterval:0.3];
+    XCTAssertEqual(mergeCount, (NSUInteger)1);
+    XCTAssertEqual(completionCount, (NSUInteger)3);
+}
+
+- (void)testRequestsDuringMergeLeadToOneMoreMerge
+{
+    mergeDuration = 0.2;
+    [scheduler mergeSoonWithCompletion:nil];
+    [self waitForInterval:0.1];
+    XCTAssertTrue(scheduler.isMerging);
+
+    for (NSUInteger i = 0; i < 5; i++) [scheduler mergeSoonWithCompletion:nil];
+    [self waitForInterval:0.6];
+    XCTAssertEqual(mergeCount, (NSUInteger)2);
+}
+
+- (void)testSavesAreDebouncedUntilMaximumLatency
+{
+    scheduler.mergesAutomatically = YES;
+    scheduler.minimumPollInterval = 10.0;
+
+    NSDate *start = [NSDate date];
+    while ([start timeIntervalSinceNow] > -0.3) {
+        [scheduler registerLocalSaveWithChangedObjectCount:1];
+        [self waitForInterval:0.02];
+    }
+    XCTAssertEqual(mergeCount, (NSUInteger)1, @"Continuous saves should only postpone the merge up to the maximum latency");
+}
+
+- (void)testLargeSaveMergesWithoutWaiting
+{
+    scheduler.mergesAutomatically = YES;
+    scheduler.debounceInterval = 10.0;
+    scheduler.localChangeThreshold = 100;
+
+    [scheduler registerLocalSaveWithChangedObjectCount:10];
+    [self waitForInterval:0.02];
+    XCTAssertEqual(mergeCount, (NSUInteger)0);
+
+    [scheduler registerLocalSaveWithChangedObjectCount:200];
+    [self waitForInterval:0.02];
+    XCTAssertEqual(mergeCount, (NSUInteger)1);
+}
+
+- (void)testSavesAreIgnoredUnlessMergingAutomatically
+{
+    [scheduler registerLocalSaveWithChangedObjectCount:1];
+    [scheduler registerRemoteChanges];
+    [self waitForInterval:0.3];
+    XCTAssertEqual(mergeCount, (NSUInteger)0);
+    XCTAssertNil(scheduler.scheduledMergeDate);
+}
+
+- (void)testFailuresBackOff
+{
+    mergeError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeServerError userInfo:nil];
+    scheduler.failureRetryBaseDelay = 0.4;
+    [scheduler mergeSoonWithCompletion:nil];
+    [self waitForInterval:0.1];
+    XCTAssertEqual(scheduler.consecutiveFailureCount, (NSUInteger)1);
+
+    // The next request waits for the retry delay, rather than the debounce interval
+    NSDate *requestDate = [NSDate date];
+    [scheduler mergeSoonWithCompletion:nil];
+    XCTAssertGreaterThan([scheduler.scheduledMergeDate timeIntervalSinceDate:requestDate], 0.08);
+
+    [self waitForInterval:0.5];
+    XCTAssertEqual(mergeCount, (NSUInteger)2);
+    XCTAssertEqual(scheduler.consecutiveFailureCount, (NSUInteger)2);
+
+    mergeError = nil;
+    [scheduler mergeSoonWithCompletion:nil];
+    [self waitForInterval:1.0];
+    XCTAssertEqual(scheduler.consecutiveFailureCount, (NSUInteger)0, @"Success should reset the failures");
+}
+
+- (void)testPollingBacksOffWhileNothingChanges
+{
+    mergeFindsRemoteChanges = NO;
+    scheduler.mergesAutomatically = YES;
+    XCTAssertNotNil(scheduler.scheduledMergeDate);
+
+    [self waitForInterval:0.15];
+    XCTAssertEqual(mergeCount, (NSUInteger)1);
+    XCTAssertEqualWithAccuracy(scheduler.currentPollInterval, 0.2, 1.0e-6);
+
+    [self waitForInterval:0.25];
+    XCTAssertEqual(mergeCount, (NSUInteger)2);
+    XCTAssertEqualWithAccuracy(scheduler.currentPollInterval, 0.4, 1.0e-6);
+
+    [scheduler registerRemoteChanges];
+    XCTAssertEqualWithAccuracy(scheduler.currentPollInterval, 0.1, 1.0e-6, @"Remote changes should reset polling");
+}
+
+- (void)testUnleechedEnsembleStopsPolling
+{
+    mergeError = [NSError errorWithDomain:CDEErrorDomain code:CDEErrorCodeDisallowedStateChange userInfo:nil];
+    scheduler.mergesAutomatically = YES;
+    [self waitForInterval:0.15];
+    XCTAssertEqual(mergeCount, (NSUInteger)1);
+    XCTAssertNil(scheduler.scheduledMergeDate);
+    XCTAssertEqual(scheduler.consecutiveFailureCount, (NSUInteger)0);
+}
+
+- (void)testInvalidateCancelsPendingRequests
+{
+    __block NSError *completionError = nil;
+    [scheduler mergeSoonWithCompletion:^(NSError *error) {
+        completionError = error;
+    }];
+    [scheduler invalidate];
+    [self waitForInterval:0.2];
+    XCTAssertEqual(mergeCount, (NSUInteger)0);
+    XCTAssertEqual(completionError.code, CDEErrorCodeCancelled);
+}
+
+@end
@@ -0,0 +1,253 @@
+//
+//  CDENodeCloudFileSystemTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 14/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "CDENodeCloudFileSystem.h"
+
+static NSString * const kCDEStandInHost = @"standin.local";
+static NSString *standInRootDirectory = nil;
+static NSCountedSet *standInRequestCounts = nil;
+
+
+// Stands in for the Node server, storing files in a local directory.
+// Signed URLs point back at the stand-in, with the path as a query parameter.
+@interface CDENodeStandInURLProtocol : NSURLProtocol
+@end
+
+@implementation CDENodeStandInURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return [request.URL.host isEqualToString:kCDEStandInHost];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (NSData *)bodyData
+{
+    if (self.request.HTTPBody) return self.request.HTTPBody;
+
+    NSInputStream *stream = self.request.HTTPBodyStream;
+    if (!stream) return nil;
+
+    NSMutableData *data = [NSMutableData data];
+    uint8_t buffer[4096];
+    [stream open];
+    NSInteger length;
+    while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+        [data appendBytes:buffer length:length];
+    }
+    [stream close];
+    return data;
+}
+
+- (NSString *)fullPathForPath:(NSString *)path
+{
+    return [standInRootDirectory stringByAppendingPathComponent:path];
+}
+
+- (void)startLoading
+{
+    NSString *endpoint = self.request.URL.lastPathComponent;
+    [standInRequestCounts addObject:endpoint];
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSDictionary *body = nil;
+    NSData *bodyData = [self bodyData];
+    if (bodyData.length > 0 && [self.request.HTTPMethod isEqualToString:@"POST"]) {
+        body = [NSJSONSerialization JSONObjectWithData:bodyData options:0 error:NULL];
+    }
+
+    NSInteger status = 200;
+    NSData *responseData = nil;
+    NSMutableDictionary *json = [@{@"success" : @YES} mutableCopy];
+
+    if ([endpoint isEqualToString:@"login"]) {
+    }
+    else if ([endpoint isEqualToString:@"fileexists"]) {
+        NSArray *paths = body[@"paths"] ? : @[body[@"path"]];
+        NSMutableArray *existences = [NSMutableArray array];
+        NSMutableArray *directories = [NSMutableArray array];
+        for (NSString *path in paths) {
+            BOOL isDir = NO;
+            BOOL exists = [fileManager fileExistsAtPath:[self fullPathForPath:path] isDirectory:&isDir];
+            [existences addObject:@(exists)];
+            [directories addObject:@(isDir)];
+        }
+        json[@"exists"] = body[@"paths"] ? existences : existences.lastObject;
+        json[@"isdir"] = body[@"paths"] ? directories : directories.lastObject;
+    }
+    else if ([endpoint isEqualToString:@"listdir"]) {
+        NSArray *files = [fileManager contentsOfDirectoryAtPath:[self fullPathForPath:body[@"path"]] error:NULL];
+        json[@"files"] = files ? : @[];
+    }
+    else if ([@[@"uploadurls", @"downloadurls", @"deleteurls"] containsObject:endpoint]) {
+        NSMutableArray *urls = [NSMutableArray array];
+        for (NSString *path in body[@"paths"]) {
+            NSURLComponents *components = [[NSURLComponents alloc] initWithString:[NSString stringWithFormat:@"http://%@/file", kCDEStandInHost]];
+            components.queryItems = @[[NSURLQueryItem queryItemWithName:@"path" value:path]];
+            [urls addObject:components.URL.absoluteString];
+        }
+        json[@"urls"] = urls;
+    }
+    else if ([endpoint isEqualToString:@"file"]) {
+        NSURLComponents *components = [NSURLComponents componentsWithURL:self.request.URL resolvingAgainstBaseURL:NO];
+        NSString *fullPath = [self fullPathForPath:[components.queryItems.firstObject value]];
+        json = nil;
+        if ([self.request.HTTPMethod isEqualToString:@"PUT"]) {
+            [fileManager createDirectoryAtPath:fullPath.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+            [bodyData writeToFile:fullPath atomically:YES];
+        }
+        else if ([self.request.HTTPMethod isEqualToString:@"DELETE"]) {
+            [fileManager removeItemAtPath:fullPath error:NULL];
+        }
+        else {
+            responseData = [NSData dataWithContentsOfFile:fullPath];
+            if (!responseData) status = 404;
+        }
+    }
+    else {
+        status = 404;
+    }
+
+    if (json) responseData = [NSJSONSerialization dataWithJSONObject:json options:0 error:NULL];
+
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:status HTTPVersion:@"HTTP/1.1" headerFields:nil];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    if (responseData) [self.client URLProtocol:self didLoadData:responseData];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+
+@interface CDENodeCloudFileSystemTests : XCTestCase
+
+@end
+
+@implementation CDENodeCloudFileSystemTests {
+    CDENodeCloudFileSystem *cloudFileSystem;
+    NSString *localDirectory;
+    NSFileManager *fileManager;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    fileManager = [[NSFileManager alloc] init];
+
+    NSString *rootDirectory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"CDENodeCloudFileSystemTests"];
+    [fileManager removeItemAtPath:rootDirectory error:NULL];
+
+    standInRootDirectory = [rootDirectory stringByAppendingPathComponent:@"server"];
+    standInRequestCounts = [[NSCountedSet alloc] init];
+    localDirectory = [rootDirectory stringByAppendingPathComponent:@"local"];
+    [fileManager createDirectoryAtPath:[standInRootDirectory stringByAppendingPathComponent:@"ensemble/events"] withIntermediateDirectories:YES attributes:nil error:NULL];
+    [fileManager createDirectoryAtPath:localDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[CDENodeStandInURLProtocol class]];
+    NSURL *baseURL = [NSURL URLWithString:[NSString stringWithFormat:@"http://%@/api", kCDEStandInHost]];
+    cloudFileSystem = [[CDENodeCloudFileSystem alloc] initWithBaseURL:baseURL sessionConfiguration:configuration];
+    cloudFileSystem.username = @"user";
+    cloudFileSystem.password = @"password";
+}
+
+- (void)tearDown
+{
+    cloudFileSystem = nil;
+    [fileManager removeItemAtPath:standInRootDirectory.stringByDeletingLastPathComponent error:NULL];
+    [super tearDown];
+}
+
+- (void)waitForAsync
+{
+    CFRunLoopRun();
+}
+
+- (void)completeAsync
+{
+    CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+- (void)testLogin
+{
+    [cloudFileSystem connect:^(NSError *error) {
+        XCTAssertNil(error, @"Error logging in");
+        XCTAssertTrue(cloudFileSystem.isConnected, @"Should be connected");
+        [self completeAsync];
+    }];
+    [self waitForAsync];
+}
+
+- (void)testBatchFileExistence
+{
+    NSArray *paths = @[@"/ensemble", @"/ensemble/events", @"/ensemble/missing"];
+    [cloudFileSystem fileExistsAtPaths:paths completion:^(NSArray *existences, NSArray *directories, NSError *error) {
+        XCTAssertNil(error, @"Error checking existence");
+        XCTAssertEqualObjects(existences, (@[@YES, @YES, @NO]), @"Wrong existence");
+        XCTAssertEqualObjects(directories, (@[@YES, @YES, @NO]), @"Wrong directories");
+        XCTAssertEqual([standInRequestCounts countForObject:@"fileexists"], (NSUInteger)1, @"Should use a single request");
+        [self completeAsync];
+    }];
+    [self waitForAsync];
+}
+
+- (void)testTransfersRequestSignedURLsInBatches
+{
+    NSUInteger numberOfFiles = 120;
+    NSMutableArray *localPaths = [NSMutableArray array];
+    NSMutableArray *remotePaths = [NSMutableArray array];
+    NSMutableArray *downloadPaths = [NSMutableArray array];
+    for (NSUInteger i = 0; i < numberOfFiles; i++) {
+        NSString *filename = [NSString stringWithFormat:@"%lu_store1_%lu.cdeevent", (unsigned long)i, (unsigned long)i];
+        NSString *localPath = [localDirectory stringByAppendingPathComponent:filename];
+        [[filename dataUsingEncoding:NSUTF8StringEncoding] writeToFile:localPath atomically:YES];
+        [localPaths addObject:localPath];
+        [remotePaths addObject:[@"/ensemble/events" stringByAppendingPathComponent:filename]];
+        [downloadPaths addObject:[localPath stringByAppendingPathExtension:@"download"]];
+    }
+
+    [cloudFileSystem uploadLocalFiles:localPaths toPaths:remotePaths completion:^(NSError *error) {
+        XCTAssertNil(error, @"Error uploading");
+        XCTAssertEqual([standInRequestCounts countForObject:@"uploadurls"], (NSUInteger)3, @"Signed URLs should be batched");
+        XCTAssertEqual([standInRequestCounts countForObject:@"file"], numberOfFiles, @"Wrong number of uploads");
+
+        [cloudFileSystem downloadFromPaths:remotePaths toLocalFiles:downloadPaths completion:^(NSError *error) {
+            XCTAssertNil(error, @"Error downloading");
+            XCTAssertEqual([standInRequestCounts countForObject:@"downloadurls"], (NSUInteger)3, @"Signed URLs should be batched");
+            for (NSUInteger i = 0; i < numberOfFiles; i++) {
+                NSData *original = [NSData dataWithContentsOfFile:localPaths[i]];
+                NSData *downloaded = [NSData dataWithContentsOfFile:downloadPaths[i]];
+                XCTAssertEqualObjects(original, downloaded, @"Downloaded file differs");
+            }
+
+            [cloudFileSystem removeItemsAtPaths:remotePaths completion:^(NSError *error) {
+                XCTAssertNil(error, @"Error removing");
+                XCTAssertEqual([standInRequestCounts countForObject:@"deleteurls"], (NSUInteger)3, @"Signed URLs should be batched");
+
+                [cloudFileSystem contentsOfDirectoryAtPath:@"/ensemble/events" completion:^(NSArray *contents, NSError *error) {
+                    XCTAssertNil(error, @"Error listing");
+                    XCTAssertEqual(contents.count, (NSUInteger)0, @"Files should be removed");
+                    [self completeAsync];
+                }];
+            }];
+        }];
+    }];
+    [self waitForAsync];
+}
+
+@end
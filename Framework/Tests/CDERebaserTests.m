@@ -15,6 +15,7 @@
 #import "CDERevisionSet.h"
 #import "CDEPropertyChangeValue.h"
 #import "CDERevision.h"
+#import "CDERebasePolicy.h"
 
 @interface CDERebaser (TestMethods)
 
@@ -204,6 +205,43 @@
     [self waitForAsyncOpToFinish];
 }
 
+- (void)testDeletingRedundantEventsPurgesUnreferencedGlobalIdentifiers
+{
+    NSArray *baselines = [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@0] revisions:@[@10]];
+    NSArray *events = [self addEventsForType:CDEStoreModificationEventTypeSave storeId:@"store1" globalCounts:@[@1, @2] revisions:@[@9, @11]];
+    
+    [context performBlockAndWait:^{
+        NSMutableDictionary *globalIds = [NSMutableDictionary dictionary];
+        for (NSString *identifier in @[@"a", @"b"]) {
+            CDEGlobalIdentifier *globalId = [NSEntityDescription insertNewObjectForEntityForName:@"CDEGlobalIdentifier" inManagedObjectContext:context];
+            globalId.globalIdentifier = identifier;
+            globalId.nameOfEntity = @"A";
+            globalIds[identifier] = globalId;
+        }
+        
+        // a is only referenced by the event preceding the baseline
+        [self addObjectChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:globalIds[@"a"] value:@0 toEvent:events[0]];
+        [self addObjectChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:globalIds[@"b"] value:@0 toEvent:events[0]];
+        [self addObjectChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:globalIds[@"b"] value:@1 toEvent:baselines.lastObject];
+        [context save:NULL];
+    }];
+    
+    [rebaser deleteEventsPrecedingBaselineWithCompletion:^(NSError *error) {
+        XCTAssertNil(error, @"Deleting failed");
+        [context performBlockAndWait:^{
+            NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEGlobalIdentifier"];
+            NSArray *globalIds = [context executeFetchRequest:fetch error:NULL];
+            XCTAssertEqualObjects([globalIds valueForKeyPath:@"globalIdentifier"], @[@"b"]);
+            
+            fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEObjectChange"];
+            XCTAssertEqual([context countForFetchRequest:fetch error:NULL], (NSUInteger)1);
+            XCTAssertEqual([[self storeModEvents] count], (NSUInteger)2, @"Should have baseline and 1 other");
+        }];
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+}
+
 - (void)testRebasingAttribute
 {
     NSArray *baselines = [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@10] revisions:@[@110]];
@@ -254,6 +292,251 @@
     [self waitForAsyncOpToFinish];
 }
 
+- (void)testRebasingOnlyTouchesChangedObjectsInBaseline
+{
+    NSArray *baselines = [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@10] revisions:@[@110]];
+    CDEStoreModificationEvent *baseline = baselines.lastObject;
+    NSArray *events = [self addEventsForType:CDEStoreModificationEventTypeSave storeId:@"store1" globalCounts:@[@20, @21] revisions:@[@111, @112]];
+    
+    [context performBlockAndWait:^{
+        NSMutableDictionary *globalIds = [NSMutableDictionary dictionary];
+        for (NSString *identifier in @[@"a", @"b", @"c"]) {
+            CDEGlobalIdentifier *globalId = [NSEntityDescription insertNewObjectForEntityForName:@"CDEGlobalIdentifier" inManagedObjectContext:context];
+            globalId.globalIdentifier = identifier;
+            globalId.nameOfEntity = @"A";
+            globalIds[identifier] = globalId;
+            [self addObjectChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:globalId value:@0 toEvent:baseline];
+        }
+        
+        // Update b in both events, and delete c in the second
+        [self addObjectChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:globalIds[@"b"] value:@1 toEvent:events[0]];
+        [self addObjectChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:globalIds[@"b"] value:@2 toEvent:events[1]];
+        [self addObjectChangeOfType:CDEObjectChangeTypeDelete globalIdentifier:globalIds[@"c"] value:nil toEvent:events[1]];
+        
+        [context save:NULL];
+    }];
+    
+    [rebaser rebaseWithCompletion:^(NSError *error) {
+        XCTAssertNil(error);
+        [context performBlockAndWait:^{
+            CDEStoreModificationEvent *baseline = [self fetchBaseline];
+            XCTAssertEqual(baseline.objectChanges.count, (NSUInteger)2, @"Wrong number of object changes");
+            
+            for (CDEObjectChange *change in baseline.objectChanges) {
+                NSString *identifier = change.globalIdentifier.globalIdentifier;
+                CDEPropertyChangeValue *value = [change propertyChangeValueForPropertyName:@"property"];
+                XCTAssertEqual(change.type, CDEObjectChangeTypeInsert);
+                if ([identifier isEqualToString:@"a"]) XCTAssertEqualObjects(value.value, @0, @"Untouched object should be unchanged");
+                else if ([identifier isEqualToString:@"b"]) XCTAssertEqualObjects(value.value, @2, @"Most recent update should win");
+                else XCTFail(@"Deleted object should not be in baseline");
+            }
+        }];
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+}
+
+- (void)testRebasingInSlicesCommitsProgress
+{
+    NSArray *baselines = [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@10] revisions:@[@110]];
+    CDEStoreModificationEvent *baseline = baselines.lastObject;
+    NSArray *events = [self addEventsForType:CDEStoreModificationEventTypeSave storeId:@"store1" globalCounts:@[@20, @21, @22] revisions:@[@111, @112, @113]];
+    
+    [context performBlockAndWait:^{
+        CDEGlobalIdentifier *globalId = [NSEntityDescription insertNewObjectForEntityForName:@"CDEGlobalIdentifier" inManagedObjectContext:context];
+        globalId.globalIdentifier = @"unique";
+        globalId.nameOfEntity = @"A";
+        [self addObjectChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:globalId value:@0 toEvent:baseline];
+        for (NSUInteger i = 0; i < events.count; i++) {
+            [self addObjectChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:globalId value:@(i+1) toEvent:events[i]];
+        }
+        [context save:NULL];
+    }];
+    
+    // A tiny budget merges one event per slice
+    for (NSUInteger slice = 0; slice < events.count; slice++) {
+        __block BOOL sliceFinished = NO;
+        [rebaser rebaseWithTimeBudget:1.0e-6 completion:^(BOOL finished, NSError *error) {
+            XCTAssertNil(error);
+            sliceFinished = finished;
+            [self stopAsyncOp];
+        }];
+        [self waitForAsyncOpToFinish];
+        
+        XCTAssertEqual(sliceFinished, slice == events.count-1, @"Should only finish on the last slice");
+        [context performBlockAndWait:^{
+            CDEStoreModificationEvent *baseline = [self fetchBaseline];
+            XCTAssertEqual(baseline.globalCount, (CDEGlobalCount)(20+slice), @"Baseline should reach the last merged event");
+            XCTAssertEqual(baseline.eventRevision.revisionNumber, (CDERevisionNumber)(111+slice), @"Wrong baseline revision");
+            XCTAssertEqual(self.storeModEvents.count, events.count-slice, @"Merged events should be deleted");
+            
+            CDEPropertyChangeValue *value = [baseline.objectChanges.anyObject propertyChangeValueForPropertyName:@"property"];
+            XCTAssertEqualObjects(value.value, @(slice+1), @"Wrong value after slice");
+        }];
+    }
+}
+
+- (void)testRebaseSlicesTakeABoundedNumberOfEvents
+{
+    [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@0] revisions:@[@0]];
+    NSMutableArray *globalCounts = [NSMutableArray array];
+    NSMutableArray *revisions = [NSMutableArray array];
+    for (NSInteger i = 1; i <= 250; i++) {
+        [globalCounts addObject:@(i)];
+        [revisions addObject:@(i)];
+    }
+    [self addEventsForType:CDEStoreModificationEventTypeSave storeId:@"store1" globalCounts:globalCounts revisions:revisions];
+    
+    // Ample time, but a slice still stops at its share of the backlog
+    __block BOOL sliceFinished = YES;
+    [rebaser rebaseWithTimeBudget:1000.0 completion:^(BOOL finished, NSError *error) {
+        XCTAssertNil(error);
+        sliceFinished = finished;
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+    XCTAssertFalse(sliceFinished, @"Slice should leave later events for the next slice");
+    
+    [context performBlockAndWait:^{
+        NSUInteger remaining = self.storeModEvents.count - 1;
+        XCTAssertGreaterThan(remaining, (NSUInteger)0);
+        XCTAssertLessThan(remaining, (NSUInteger)250);
+    }];
+    
+    [rebaser rebaseWithTimeBudget:1000.0 completion:^(BOOL finished, NSError *error) {
+        XCTAssertNil(error);
+        sliceFinished = finished;
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+    XCTAssertTrue(sliceFinished, @"Second slice should merge the rest");
+}
+
+- (void)testUrgentRebasing
+{
+    __block BOOL urgent = NO;
+    [rebaser shouldRebaseUrgentlyWithCompletion:^(BOOL result) {
+        urgent = result;
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+    XCTAssertTrue(urgent, @"Store without a baseline should rebase urgently");
+    
+    [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@0] revisions:@[@0]];
+    [self addEventsForType:CDEStoreModificationEventTypeMerge storeId:@"123" globalCounts:@[@1, @2] revisions:@[@1, @2]];
+    [rebaser shouldRebaseUrgentlyWithCompletion:^(BOOL result) {
+        urgent = result;
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+    XCTAssertFalse(urgent, @"Missing store in baseline should not be urgent");
+    XCTAssertTrue([self shouldRebase], @"Missing store in baseline should still rebase");
+}
+
+- (CDEEventStoreStatistics *)fetchStatistics
+{
+    __block CDEEventStoreStatistics *statistics = nil;
+    [rebaser fetchEventStoreStatisticsWithCompletion:^(CDEEventStoreStatistics *result, NSError *error) {
+        XCTAssertNil(error);
+        statistics = result;
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+    return statistics;
+}
+
+- (void)testObjectChangeStatisticsAreMaintainedAsEventsChange
+{
+    NSArray *baselines = [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@10] revisions:@[@110]];
+    CDEStoreModificationEvent *baseline = baselines.lastObject;
+    NSArray *events = [self addEventsForType:CDEStoreModificationEventTypeSave storeId:@"store1" globalCounts:@[@20, @21] revisions:@[@111, @112]];
+    
+    [context performBlockAndWait:^{
+        NSMutableDictionary *globalIds = [NSMutableDictionary dictionary];
+        for (NSString *identifier in @[@"a", @"b"]) {
+            CDEGlobalIdentifier *globalId = [NSEntityDescription insertNewObjectForEntityForName:@"CDEGlobalIdentifier" inManagedObjectContext:context];
+            globalId.globalIdentifier = identifier;
+            globalId.nameOfEntity = @"A";
+            globalIds[identifier] = globalId;
+            [self addObjectChangeOfType:CDEObjectChangeTypeInsert globalIdentifier:globalId value:@"value" toEvent:baseline];
+        }
+        
+        // Update b in both events, and delete a in the second
+        [self addObjectChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:globalIds[@"b"] value:@1 toEvent:events[0]];
+        [self addObjectChangeOfType:CDEObjectChangeTypeUpdate globalIdentifier:globalIds[@"b"] value:@2 toEvent:events[1]];
+        [self addObjectChangeOfType:CDEObjectChangeTypeDelete globalIdentifier:globalIds[@"a"] value:nil toEvent:events[1]];
+        
+        [context save:NULL];
+    }];
+    
+    CDEEventStoreStatistics *statistics = [self fetchStatistics];
+    XCTAssertTrue(statistics.hasBaseline);
+    XCTAssertEqual(statistics.eventCount, (NSUInteger)3);
+    XCTAssertEqual(statistics.baselineObjectChangeCount, (NSUInteger)2);
+    XCTAssertTrue(statistics.baselineByteCount > 0, @"Baseline values should have a size");
+    XCTAssertEqual(statistics.insertCount, (NSUInteger)0);
+    XCTAssertEqual(statistics.updateCount, (NSUInteger)2);
+    XCTAssertEqual(statistics.deleteCount, (NSUInteger)1);
+    XCTAssertEqual(statistics.repeatedUpdateCount, (NSUInteger)1, @"Second update of b should be a repeat");
+    XCTAssertEqualObjects(statistics.objectChangeCountsByEntityName, @{@"A" : @3});
+    
+    [rebaser rebaseWithCompletion:^(NSError *error) {
+        XCTAssertNil(error);
+        [self stopAsyncOp];
+    }];
+    [self waitForAsyncOpToFinish];
+    
+    statistics = [self fetchStatistics];
+    XCTAssertEqual(statistics.eventCount, (NSUInteger)1, @"Only the baseline should remain");
+    XCTAssertEqual(statistics.baselineObjectChangeCount, (NSUInteger)1, @"Deleted object should leave the baseline");
+    XCTAssertEqual(statistics.updateCount + statistics.deleteCount + statistics.repeatedUpdateCount, (NSUInteger)0);
+    XCTAssertEqual(statistics.objectChangeCountsByEntityName.count, (NSUInteger)0);
+}
+
+- (void)testRebasePolicyThresholdsCanBeTuned
+{
+    NSArray *baselines = [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@0] revisions:@[@0]];
+    [context performBlockAndWait:^{
+        CDEStoreModificationEvent *baseline = baselines.lastObject;
+        CDEEventRevision *rev = [CDEEventRevision makeEventRevisionForPersistentStoreIdentifier:@"123" revisionNumber:0 inManagedObjectContext:context];
+        baseline.eventRevisionsOfOtherStores = [NSSet setWithObject:rev];
+        [context save:NULL];
+    }];
+    [self addEventsForType:CDEStoreModificationEventTypeMerge storeId:@"123" globalCounts:@[@1, @2] revisions:@[@1, @2]];
+    XCTAssertFalse([self shouldRebase], @"Few events should not rebase with the default policy");
+    
+    rebaser.policy.eventCountThreshold = 2;
+    XCTAssertTrue([self shouldRebase], @"Lower event threshold should trigger a rebase");
+}
+
+- (void)testRebasePolicyWeighsCompactionAgainstCost
+{
+    CDEEventStoreStatistics *statistics = [[CDEEventStoreStatistics alloc] init];
+    statistics.hasBaseline = YES;
+    statistics.baselineIncludesAllStores = YES;
+    statistics.eventCount = 10;
+    statistics.baselineObjectChangeCount = 100;
+    statistics.baselineByteCount = 10000;
+    statistics.updateCount = 900;
+    statistics.repeatedUpdateCount = 800;
+    statistics.byteCount = 18000;
+    
+    CDERebasePolicy *policy = [[CDERebasePolicy alloc] init];
+    XCTAssertEqual([policy predictedBaselineByteCountForStatistics:statistics], 10000ULL, @"Updates should fold into the baseline");
+    XCTAssertEqualWithAccuracy([policy predictedCompactionForStatistics:statistics], 1.0f - 10000.0f/28000.0f, 1.0e-4);
+    XCTAssertTrue([policy shouldRebaseWithStatistics:statistics]);
+    XCTAssertFalse([policy shouldRebaseUrgentlyWithStatistics:statistics]);
+    
+    policy.maximumRebaseDuration = 0.1;
+    XCTAssertFalse([policy shouldRebaseWithStatistics:statistics], @"Rebase predicted to take too long");
+    
+    statistics.measuredSecondsPerObjectChange = 1.0e-5;
+    XCTAssertTrue([policy shouldRebaseWithStatistics:statistics], @"Measured rate should replace the estimate");
+    
+    policy.minimumByteSavingsPerUploadedByte = 2.0f;
+    XCTAssertFalse([policy shouldRebaseWithStatistics:statistics], @"Savings too small to justify uploading the baseline");
+}
+
 - (void)testRebasingAttributeWithSameGlobalIdButDifferentEntity
 {
     NSArray *baselines = [self addEventsForType:CDEStoreModificationEventTypeBaseline storeId:@"store1" globalCounts:@[@10] revisions:@[@110]];
@@ -466,6 +749,21 @@
     return [context executeFetchRequest:fetch error:NULL];
 }
 
+- (CDEObjectChange *)addObjectChangeOfType:(CDEObjectChangeType)type globalIdentifier:(CDEGlobalIdentifier *)globalId value:(id)value toEvent:(CDEStoreModificationEvent *)event
+{
+    CDEObjectChange *change = [NSEntityDescription insertNewObjectForEntityForName:@"CDEObjectChange" inManagedObjectContext:context];
+    change.storeModificationEvent = event;
+    change.type = type;
+    change.nameOfEntity = @"A";
+    change.globalIdentifier = globalId;
+    if (value) {
+        CDEPropertyChangeValue *propertyValue = [[CDEPropertyChangeValue alloc] initWithType:CDEPropertyChangeTypeAttribute propertyName:@"property"];
+        propertyValue.value = value;
+        change.propertyChangeValues = @[propertyValue];
+    }
+    return change;
+}
+
 - (CDEStoreModificationEvent *)fetchBaseline
 {
     NSFetchRequest *fetch = [NSFetchRequest fetchRequestWithEntityName:@"CDEStoreModificationEvent"];
@@ -199,6 +199,30 @@
     XCTAssertEqual(events.count, (NSUInteger)1, @"Should be an event");
 }
 
+- (void)testStoresCoveredByBaselineAreRetiredAfterInterval
+{
+    NSManagedObjectContext *moc = self.eventStore.managedObjectContext;
+    [moc performBlockAndWait:^{
+        CDEStoreModificationEvent *baseline = [self addModEventForStore:@"otherstore" revision:5 timestamp:1234];
+        baseline.type = CDEStoreModificationEventTypeBaseline;
+        baseline.eventRevisionsOfOtherStores = [NSSet setWithObjects:[self addEventRevisionForStore:@"store1" revision:4], [self addEventRevisionForStore:@"oldstore" revision:3], nil];
+    }];
+    
+    XCTAssertEqual(revisionManager.retiredPersistentStoreIdentifiers.count, (NSUInteger)0, @"Should not retire stores within the interval");
+    XCTAssertNotNil([revisionManager.revisionSetOfMostRecentEvents revisionForPersistentStoreIdentifier:@"oldstore"]);
+    
+    revisionManager.persistentStoreRetirementInterval = 0.0;
+    NSSet *retiredStores = [NSSet setWithObjects:@"otherstore", @"oldstore", nil];
+    XCTAssertEqualObjects(revisionManager.retiredPersistentStoreIdentifiers, retiredStores, @"Local store should never be retired");
+    XCTAssertEqualObjects(revisionManager.allPersistentStoreIdentifiers, [NSSet setWithObject:@"store1"]);
+    XCTAssertEqualObjects(revisionManager.revisionSetForLastMergeOrBaseline.persistentStoreIdentifiers, [NSSet setWithObject:@"store1"]);
+    
+    [moc performBlockAndWait:^{
+        [self addModEventForStore:@"oldstore" revision:4 timestamp:1234];
+    }];
+    XCTAssertEqualObjects(revisionManager.retiredPersistentStoreIdentifiers, [NSSet setWithObject:@"otherstore"], @"Store should return when it saves again");
+}
+
 
 - (void)testFetchingConcurrentEventsForSingleEvent
 {
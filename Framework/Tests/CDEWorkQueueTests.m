@@ -0,0 +1,115 @@
+//
+//  CDEWorkQueueTests.m
+//  Ensembles
+//
+//  Created by Drew McCormack on 27/03/17.
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "CDEDefines.h"
+#import "CDEAsynchronousTaskQueue.h"
+#import "CDEAsynchronousOperation.h"
+
+@interface CDEWorkQueueTestOperation : CDEAsynchronousOperation
+
+@property (nonatomic, assign) BOOL beganOnWorkQueue;
+
+@end
+
+@implementation CDEWorkQueueTestOperation
+
+- (void)beginAsynchronousTask
+{
+    self.beganOnWorkQueue = CDEIsOnWorkQueue();
+    [self endAsynchronousTask];
+}
+
+@end
+
+
+@interface CDEWorkQueueTests : XCTestCase
+
+@end
+
+@implementation CDEWorkQueueTests {
+    dispatch_queue_t workQueue;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    workQueue = dispatch_queue_create("com.mentalfaculty.ensembles.tests.workqueue", DISPATCH_QUEUE_SERIAL);
+}
+
+- (void)tearDown
+{
+    CDESetWorkQueue(NULL);
+    [super tearDown];
+}
+
+- (void)testMainQueueIsDefault
+{
+    XCTAssertEqual(CDEWorkQueue(), dispatch_get_main_queue());
+    XCTAssertTrue(CDEIsOnWorkQueue());
+}
+
+- (void)testPrivateWorkQueue
+{
+    CDESetWorkQueue(workQueue);
+    XCTAssertEqual(CDEWorkQueue(), workQueue);
+    XCTAssertFalse(CDEIsOnWorkQueue());
+
+    __block BOOL onWorkQueue = NO;
+    dispatch_sync(workQueue, ^{
+        onWorkQueue = CDEIsOnWorkQueue();
+    });
+    XCTAssertTrue(onWorkQueue);
+
+    CDESetWorkQueue(NULL);
+    XCTAssertEqual(CDEWorkQueue(), dispatch_get_main_queue());
+    dispatch_sync(workQueue, ^{
+        onWorkQueue = CDEIsOnWorkQueue();
+    });
+    XCTAssertFalse(onWorkQueue);
+}
+
+- (void)testTaskQueueRunsOnWorkQueue
+{
+    CDESetWorkQueue(workQueue);
+
+    __block BOOL tasksOnWorkQueue = YES;
+    __block BOOL completionOnWorkQueue = NO;
+    CDEAsynchronousTaskBlock task = ^(CDEAsynchronousTaskCallbackBlock next) {
+        tasksOnWorkQueue = tasksOnWorkQueue && CDEIsOnWorkQueue();
+        next(nil, NO);
+    };
+
+    dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+    CDEAsynchronousTaskQueue *taskQueue = [[CDEAsynchronousTaskQueue alloc] initWithTask:task repeatCount:3 terminationPolicy:CDETaskQueueTerminationPolicyCompleteAll completion:^(NSError *error) {
+        completionOnWorkQueue = CDEIsOnWorkQueue();
+        dispatch_semaphore_signal(semaphore);
+    }];
+
+    NSOperationQueue *operationQueue = [[NSOperationQueue alloc] init];
+    [operationQueue addOperation:taskQueue];
+
+    long timedOut = dispatch_semaphore_wait(semaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5.0 * NSEC_PER_SEC)));
+    XCTAssertEqual(timedOut, 0L);
+    XCTAssertTrue(tasksOnWorkQueue);
+    XCTAssertTrue(completionOnWorkQueue);
+}
+
+- (void)testOperationStartsOnWorkQueue
+{
+    CDESetWorkQueue(workQueue);
+
+    CDEWorkQueueTestOperation *operation = [[CDEWorkQueueTestOperation alloc] init];
+    NSOperationQueue *operationQueue = [[NSOperationQueue alloc] init];
+    [operationQueue addOperation:operation];
+    [operationQueue waitUntilAllOperationsAreFinished];
+
+    XCTAssertTrue(operation.beganOnWorkQueue);
+}
+
+@end
@@ -0,0 +1,432 @@
+#!/usr/bin/env node
+//
+//  loadtest.js
+//  Ensembles
+//
+//  Drives simulated ensembles against a server implementing the Node cloud protocol,
+//  and reports merges per second and bytes moved.
+//
+//  Each ensemble has several devices sharing one account. A device merge follows the
+//  requests CDECloudManager makes: check the ensemble directories exist, list the
+//  events, baselines and data, download files the device hasn't seen, and upload a
+//  new event, sometimes with a data file. One device per ensemble periodically
+//  rebases, uploading a baseline and deleting the events it replaces.
+//
+//  By default an in-process reference server is started, with the injected latency,
+//  bandwidth and errors given on the command line. Pass --url to test another server.
+//
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+'use strict';
+
+const http = require('http');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const crypto = require('crypto');
+const { ReferenceServer, parseArguments, parseByteCount } = require('./server');
+
+const maximumPathsPerURLRequest = 50;
+const maximumConcurrentTransfers = 4;
+const requestIdleTimeout = 10 * 1000;  // Milliseconds without data before a request fails
+
+const defaultOptions = {
+    url: null,
+    ensembles: 10,
+    devices: 2,
+    duration: 30,           // Seconds
+    interval: 0,            // Milliseconds each device waits between merges
+    eventSize: 4 * 1024,
+    dataSize: 256 * 1024,
+    dataRate: 0.1,          // Fraction of merges that also upload a data file
+    baselineSize: 64 * 1024,
+    rebaseThreshold: 50,    // Events in the cloud before a rebase
+    latency: 0,
+    jitter: 0,
+    bandwidth: 0,
+    errorRate: 0,
+    disconnectRate: 0,
+    json: false
+};
+
+
+// MARK: - Client
+
+class RequestError extends Error {
+    constructor(status, message) {
+        super(message);
+        this.status = status;
+    }
+}
+
+class Client {
+    constructor(baseURL, username, password, stats) {
+        this.baseURL = baseURL.replace(/\/$/, '');
+        this.authorization = 'Basic ' + Buffer.from(`${username}:${password}`).toString('base64');
+        this.stats = stats;
+        this.agent = new http.Agent({ keepAlive: true, maxSockets: maximumConcurrentTransfers });
+    }
+
+    close() {
+        this.agent.destroy();
+    }
+
+    request(method, url, headers, body, kind) {
+        const startTime = process.hrtime.bigint();
+        return new Promise((resolve, reject) => {
+            const request = http.request(url, { method, headers, agent: this.agent }, response => {
+                const chunks = [];
+                response.on('data', chunk => chunks.push(chunk));
+                response.on('error', reject);
+                response.on('end', () => {
+                    const data = Buffer.concat(chunks);
+                    this.stats.recordLatency(kind, Number(process.hrtime.bigint() - startTime) / 1e6);
+                    if (response.statusCode < 200 || response.statusCode >= 300) {
+                        reject(new RequestError(response.statusCode, `HTTP status code was ${response.statusCode}`));
+                        return;
+                    }
+                    resolve(data);
+                });
+                response.on('aborted', () => reject(new RequestError(0, 'Connection dropped')));
+            });
+            request.setTimeout(requestIdleTimeout, () => request.destroy(new RequestError(0, 'Request timed out')));
+            request.on('error', reject);
+            request.end(body);
+        });
+    }
+
+    async post(endpoint, object) {
+        const body = Buffer.from(JSON.stringify(object || {}));
+        const headers = { 'Content-Type': 'application/json', 'Content-Length': body.length, 'Authorization': this.authorization };
+        const data = await this.request('POST', `${this.baseURL}/${endpoint}`, headers, body, endpoint);
+        const response = JSON.parse(data.toString('utf8'));
+        if (!response.success) throw new RequestError(200, response.error || 'Request failed');
+        return response;
+    }
+
+    // Requests signed URLs in batches, and performs the transfers a few at a time
+    async transfer(type, paths, block) {
+        for (let start = 0; start < paths.length; start += maximumPathsPerURLRequest) {
+            const batch = paths.slice(start, start + maximumPathsPerURLRequest);
+            const response = await this.post(type, { paths: batch });
+            if (response.urls.length !== batch.length) throw new RequestError(200, 'Number of signed URLs does not match number of paths');
+
+            let next = 0;
+            const worker = async () => {
+                while (next < batch.length) {
+                    const index = next++;
+                    await block(response.urls[index], start + index);
+                }
+            };
+            const workers = [];
+            for (let i = 0; i < Math.min(maximumConcurrentTransfers, batch.length); i++) workers.push(worker());
+            await Promise.all(workers);
+        }
+    }
+
+    upload(paths, contents) {
+        return this.transfer('uploadurls', paths, async (url, index) => {
+            await this.request('PUT', url, { 'Content-Length': contents[index].length }, contents[index], 'upload');
+            this.stats.bytesUploaded += contents[index].length;
+        });
+    }
+
+    async download(paths) {
+        const contents = new Array(paths.length);
+        await this.transfer('downloadurls', paths, async (url, index) => {
+            try {
+                contents[index] = await this.request('GET', url, {}, null, 'download');
+                this.stats.bytesDownloaded += contents[index].length;
+            }
+            catch (error) {
+                // Another device may have rebased since the listing, removing the file
+                if (error.status !== 404) throw error;
+            }
+        });
+        return contents;
+    }
+
+    remove(paths) {
+        return this.transfer('deleteurls', paths, url => this.request('DELETE', url, {}, null, 'delete'));
+    }
+}
+
+
+// MARK: - Statistics
+
+class Stats {
+    constructor() {
+        this.mergesCompleted = 0;
+        this.mergesFailed = 0;
+        this.rebases = 0;
+        this.bytesUploaded = 0;
+        this.bytesDownloaded = 0;
+        this.latencies = {};
+        this.errors = {};
+    }
+
+    recordLatency(kind, milliseconds) {
+        if (!this.latencies[kind]) this.latencies[kind] = [];
+        this.latencies[kind].push(milliseconds);
+    }
+
+    recordError(error) {
+        const key = error.message;
+        this.errors[key] = (this.errors[key] || 0) + 1;
+    }
+
+    latencySummary() {
+        const summary = {};
+        for (const kind of Object.keys(this.latencies).sort()) {
+            const values = this.latencies[kind].slice().sort((a, b) => a - b);
+            const percentile = p => values[Math.min(values.length - 1, Math.floor(p * values.length))];
+            summary[kind] = {
+                count: values.length,
+                p50: round(percentile(0.5)),
+                p95: round(percentile(0.95)),
+                p99: round(percentile(0.99))
+            };
+        }
+        return summary;
+    }
+}
+
+function round(value) {
+    return Math.round(value * 100) / 100;
+}
+
+
+// MARK: - Simulated Devices
+
+class Device {
+    constructor(ensemble, index, client, stats, options) {
+        this.ensemble = ensemble;
+        this.storeIdentifier = crypto.randomBytes(8).toString('hex');
+        this.isRebasingDevice = (index === 0);
+        this.client = client;
+        this.stats = stats;
+        this.options = options;
+        this.knownFiles = new Set();
+        this.revision = 0;
+    }
+
+    get root() {
+        return `/${this.ensemble}`;
+    }
+
+    // Merges still running at the end time are not counted, so the rate covers the configured duration
+    async run(endTime) {
+        while (Date.now() < endTime) {
+            try {
+                await this.merge();
+                if (Date.now() <= endTime) this.stats.mergesCompleted++;
+            }
+            catch (error) {
+                this.stats.mergesFailed++;
+                this.stats.recordError(error);
+            }
+            if (this.options.interval) await new Promise(resolve => setTimeout(resolve, this.options.interval));
+        }
+    }
+
+    async merge() {
+        const directories = ['', '/events', '/baselines', '/data', '/stores'].map(d => this.root + d);
+        await this.client.post('fileexists', { paths: directories });
+
+        // Snapshot remote files, and download any this device hasn't seen
+        const [events, baselines, data] = await Promise.all(['events', 'baselines', 'data'].map(async directory => {
+            const response = await this.client.post('listdir', { path: `${this.root}/${directory}` });
+            return response.files.map(name => `${this.root}/${directory}/${name}`);
+        }));
+        const newFiles = events.concat(baselines, data).filter(remotePath => !this.knownFiles.has(remotePath));
+        await this.client.download(newFiles);
+        newFiles.forEach(remotePath => this.knownFiles.add(remotePath));
+
+        // Export a new event, sometimes with a data file
+        this.revision++;
+        const uploadPaths = [`${this.root}/events/${this.revision}_${this.storeIdentifier}_${events.length}.cdeevent`];
+        const uploadContents = [randomContents(this.options.eventSize)];
+        if (Math.random() < this.options.dataRate) {
+            uploadPaths.push(`${this.root}/data/${crypto.randomBytes(16).toString('hex')}`);
+            uploadContents.push(randomContents(this.options.dataSize));
+        }
+        await this.client.upload(uploadPaths, uploadContents);
+        uploadPaths.forEach(remotePath => this.knownFiles.add(remotePath));
+
+        if (this.isRebasingDevice && events.length >= this.options.rebaseThreshold) {
+            await this.rebase(events, baselines);
+        }
+    }
+
+    async rebase(events, baselines) {
+        const baselinePath = `${this.root}/baselines/${Date.now()}_${this.storeIdentifier}.cdebaseline`;
+        await this.client.upload([baselinePath], [randomContents(this.options.baselineSize)]);
+        this.knownFiles.add(baselinePath);
+
+        const obsolete = events.concat(baselines);
+        await this.client.remove(obsolete);
+        obsolete.forEach(remotePath => this.knownFiles.delete(remotePath));
+        this.stats.rebases++;
+    }
+}
+
+// Sizes vary between half and one and a half times the mean
+function randomContents(meanSize) {
+    const size = Math.max(1, Math.round(meanSize * (0.5 + Math.random())));
+    return crypto.randomBytes(size);
+}
+
+
+// MARK: - Running
+
+async function runLoadTest(options) {
+    options = Object.assign({}, defaultOptions, options);
+
+    let server = null;
+    let root = null;
+    let baseURL = options.url;
+    if (!baseURL) {
+        root = fs.mkdtempSync(path.join(os.tmpdir(), 'ensembles-loadtest-'));
+        server = new ReferenceServer({
+            port: 0,
+            root,
+            latency: options.latency,
+            jitter: options.jitter,
+            bandwidth: options.bandwidth,
+            errorRate: options.errorRate,
+            disconnectRate: options.disconnectRate,
+            quiet: true
+        });
+        baseURL = await server.start();
+    }
+
+    const stats = new Stats();
+    const clients = [];
+    const devices = [];
+    for (let e = 0; e < options.ensembles; e++) {
+        const client = new Client(baseURL, `loadtest${e}`, 'password', stats);
+        await client.post('login');
+        clients.push(client);
+        for (let d = 0; d < options.devices; d++) {
+            devices.push(new Device(`ensemble${e}`, d, client, stats, options));
+        }
+    }
+
+    const startTime = Date.now();
+    const endTime = startTime + options.duration * 1000;
+    await Promise.all(devices.map(device => device.run(endTime)));
+    const elapsed = (Math.min(Date.now(), endTime) - startTime) / 1000;
+
+    clients.forEach(client => client.close());
+    if (server) {
+        await server.stop();
+        fs.rmSync(root, { recursive: true, force: true });
+    }
+
+    const bytesMoved = stats.bytesUploaded + stats.bytesDownloaded;
+    return {
+        url: options.url || 'in-process',
+        ensembles: options.ensembles,
+        devicesPerEnsemble: options.devices,
+        duration: round(elapsed),
+        mergesCompleted: stats.mergesCompleted,
+        mergesFailed: stats.mergesFailed,
+        mergesPerSecond: round(stats.mergesCompleted / elapsed),
+        rebases: stats.rebases,
+        bytesUploaded: stats.bytesUploaded,
+        bytesDownloaded: stats.bytesDownloaded,
+        bytesMoved,
+        bytesPerSecond: Math.round(bytesMoved / elapsed),
+        latencies: stats.latencySummary(),
+        errors: stats.errors
+    };
+}
+
+function formatBytes(bytes) {
+    const units = ['B', 'KB', 'MB', 'GB'];
+    let unit = 0;
+    while (bytes >= 1024 && unit < units.length - 1) {
+        bytes /= 1024;
+        unit++;
+    }
+    return `${round(bytes)} ${units[unit]}`;
+}
+
+function printReport(report) {
+    console.log(`Server:            ${report.url}`);
+    console.log(`Ensembles:         ${report.ensembles} x ${report.devicesPerEnsemble} devices`);
+    console.log(`Duration:          ${report.duration} s`);
+    console.log(`Merges:            ${report.mergesCompleted} completed, ${report.mergesFailed} failed, ${report.rebases} rebases`);
+    console.log(`Merges per second: ${report.mergesPerSecond}`);
+    console.log(`Bytes moved:       ${formatBytes(report.bytesMoved)} (${formatBytes(report.bytesUploaded)} up, ${formatBytes(report.bytesDownloaded)} down)`);
+    console.log(`Throughput:        ${formatBytes(report.bytesPerSecond)}/s`);
+    console.log('Latency (ms):');
+    for (const kind of Object.keys(report.latencies)) {
+        const l = report.latencies[kind];
+        console.log(`  ${kind.padEnd(14)} n=${String(l.count).padEnd(8)} p50=${String(l.p50).padEnd(8)} p95=${String(l.p95).padEnd(8)} p99=${l.p99}`);
+    }
+    const errors = Object.keys(report.errors);
+    if (errors.length > 0) {
+        console.log('Errors:');
+        errors.forEach(message => console.log(`  ${report.errors[message]} x ${message}`));
+    }
+}
+
+const usage = `usage: loadtest.js [options]
+
+  --url <url>                Base URL of the server to test (default starts an in-process server)
+  --ensembles <number>       Simulated ensembles, each with its own account (default ${defaultOptions.ensembles})
+  --devices <number>         Devices per ensemble (default ${defaultOptions.devices})
+  --duration <seconds>       Length of the test (default ${defaultOptions.duration})
+  --interval <ms>            Pause between merges on each device (default ${defaultOptions.interval})
+  --event-size <bytes>       Mean size of event files (default ${defaultOptions.eventSize})
+  --data-size <bytes>        Mean size of data files (default ${defaultOptions.dataSize})
+  --data-rate <fraction>     Fraction of merges that upload a data file (default ${defaultOptions.dataRate})
+  --baseline-size <bytes>    Mean size of baseline files (default ${defaultOptions.baselineSize})
+  --rebase-threshold <n>     Events in the cloud before rebasing (default ${defaultOptions.rebaseThreshold})
+  --json                     Print the report as JSON
+
+  In-process server only:
+  --latency <ms>             Delay added to every request
+  --jitter <ms>              Random extra delay, up to this amount
+  --bandwidth <bytes/s>      Rate of each file transfer, eg 512k or 2m
+  --error-rate <fraction>    Fraction of requests that fail with status 503
+  --disconnect-rate <frac>   Fraction of file transfers dropped halfway through`;
+
+function main() {
+    const options = parseArguments(process.argv.slice(2), {
+        'url': String,
+        'ensembles': Number,
+        'devices': Number,
+        'duration': Number,
+        'interval': Number,
+        'event-size': parseByteCount,
+        'data-size': parseByteCount,
+        'data-rate': Number,
+        'baseline-size': parseByteCount,
+        'rebase-threshold': Number,
+        'latency': Number,
+        'jitter': Number,
+        'bandwidth': parseByteCount,
+        'error-rate': Number,
+        'disconnect-rate': Number,
+        'json': Boolean
+    }, usage);
+
+    runLoadTest(options).then(report => {
+        if (options.json) {
+            console.log(JSON.stringify(report, null, 2));
+        }
+        else {
+            printReport(report);
+        }
+    }).catch(error => {
+        console.error(error.message);
+        process.exit(1);
+    });
+}
+
+if (require.main === module) main();
+
+module.exports = { runLoadTest };
@@ -0,0 +1,604 @@
+#!/usr/bin/env node
+//
+//  server.js
+//  Ensembles
+//
+//  Reference implementation of the protocol used by CDENodeCloudFileSystem.
+//  Files are stored in a local directory, with one subdirectory per user.
+//  Signed URLs point back at this server, and are signed with an HMAC.
+//
+//  Latency, bandwidth and failures can be injected, so clients can be tested
+//  and benchmarked without a real deployment. Uses only the Node standard library.
+//
+//  Copyright (c) 2017 The Mental Faculty B.V. All rights reserved.
+//
+
+'use strict';
+
+const http = require('http');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const crypto = require('crypto');
+const { URL } = require('url');
+const { Transform, pipeline } = require('stream');
+
+const signedURLLifetime = 15 * 60 * 1000;
+const maximumJSONBodyLength = 10 * 1024 * 1024;
+
+const defaultOptions = {
+    port: 3000,
+    host: '127.0.0.1',
+    root: path.join(os.tmpdir(), 'ensembles-nodeserver'),
+    latency: 0,             // Milliseconds added before each response
+    jitter: 0,              // Random extra milliseconds, up to this amount
+    bandwidth: 0,           // Bytes per second for each file transfer. 0 is unlimited.
+    errorRate: 0,           // Fraction of requests that fail with status 503
+    disconnectRate: 0,      // Fraction of file transfers dropped halfway through
+    users: null,            // Map of username to password. null accepts any credentials.
+    quiet: false
+};
+
+
+// MARK: - Errors
+
+class HTTPError extends Error {
+    constructor(status, message) {
+        super(message);
+        this.status = status;
+    }
+}
+
+
+// MARK: - Throttling
+
+// Passes data through at a fixed rate. If dropAfter is set, the stream fails once that many bytes have passed.
+class Throttle extends Transform {
+    constructor(bytesPerSecond, dropAfter) {
+        super();
+        this.bytesPerSecond = bytesPerSecond;
+        this.dropAfter = dropAfter;
+        this.bytes = 0;
+        this.startTime = null;
+    }
+
+    _transform(chunk, encoding, callback) {
+        if (this.startTime === null) this.startTime = Date.now();
+
+        if (this.dropAfter !== null && this.bytes + chunk.length > this.dropAfter) {
+            this.push(chunk.subarray(0, Math.max(0, this.dropAfter - this.bytes)));
+            this.bytes = this.dropAfter;
+            callback(new Error('Injected disconnect'));
+            return;
+        }
+
+        this.bytes += chunk.length;
+        if (!this.bytesPerSecond) {
+            callback(null, chunk);
+            return;
+        }
+
+        const due = this.startTime + this.bytes / this.bytesPerSecond * 1000;
+        setTimeout(() => callback(null, chunk), Math.max(0, due - Date.now()));
+    }
+}
+
+
+// MARK: - Server
+
+class ReferenceServer {
+    constructor(options) {
+        this.options = Object.assign({}, defaultOptions, options);
+        this.users = this.options.users ? Object.assign({}, this.options.users) : null;
+        this.secret = crypto.randomBytes(32);
+        this.httpServer = http.createServer((request, response) => this.handleRequest(request, response));
+        this.httpServer.keepAliveTimeout = 30 * 1000;
+        this.checksums = new Map(); // Local path to { size, modified, digest }
+        this.resetStats();
+    }
+
+    get baseURL() {
+        const address = this.httpServer.address();
+        return `http://${this.options.host}:${address.port}`;
+    }
+
+    start() {
+        fs.mkdirSync(this.options.root, { recursive: true });
+        return new Promise((resolve, reject) => {
+            this.httpServer.once('error', reject);
+            this.httpServer.listen(this.options.port, this.options.host, () => {
+                this.httpServer.removeListener('error', reject);
+                resolve(this.baseURL);
+            });
+        });
+    }
+
+    stop() {
+        return new Promise(resolve => {
+            this.httpServer.close(() => resolve());
+            if (this.httpServer.closeAllConnections) this.httpServer.closeAllConnections();
+        });
+    }
+
+    resetStats() {
+        this.stats = {
+            requests: {},
+            injectedErrors: 0,
+            injectedDisconnects: 0,
+            bytesUploaded: 0,
+            bytesDownloaded: 0,
+            startTime: Date.now()
+        };
+    }
+
+    log(message) {
+        if (!this.options.quiet) console.log(`${new Date().toISOString()} ${message}`);
+    }
+
+    // MARK: Dispatch
+
+    handleRequest(request, response) {
+        const url = new URL(request.url, 'http://localhost');
+        const isFileRequest = url.pathname.endsWith('/signed');
+        const endpoint = isFileRequest ? 'file' : url.pathname.split('/').pop();
+        this.stats.requests[endpoint] = (this.stats.requests[endpoint] || 0) + 1;
+
+        const delay = this.options.latency + Math.random() * this.options.jitter;
+        setTimeout(() => {
+            let handled;
+            if (endpoint === 'stats') {
+                handled = this.handleStats(request, response);
+            }
+            else if (Math.random() < this.options.errorRate) {
+                this.stats.injectedErrors++;
+                handled = Promise.reject(new HTTPError(503, 'Injected failure'));
+            }
+            else if (isFileRequest) {
+                handled = this.handleFileRequest(request, response, url);
+            }
+            else {
+                handled = this.handleAPIRequest(request, response, endpoint);
+            }
+
+            handled.then(() => {
+                this.log(`${request.method} ${endpoint} ${response.statusCode}`);
+            }).catch(error => {
+                const status = error.status || 500;
+                this.log(`${request.method} ${endpoint} ${status} ${error.message}`);
+                if (response.headersSent) {
+                    response.destroy();
+                    return;
+                }
+                this.sendJSON(response, status, { success: false, error: error.message });
+            });
+        }, delay);
+    }
+
+    sendJSON(response, status, object) {
+        const body = Buffer.from(JSON.stringify(object));
+        response.writeHead(status, { 'Content-Type': 'application/json', 'Content-Length': body.length });
+        response.end(body);
+    }
+
+    handleStats(request, response) {
+        const elapsed = (Date.now() - this.stats.startTime) / 1000;
+        this.sendJSON(response, 200, Object.assign({ success: true, elapsed }, this.stats));
+        return Promise.resolve();
+    }
+
+    // MARK: API Endpoints
+
+    async handleAPIRequest(request, response, endpoint) {
+        if (request.method !== 'POST') throw new HTTPError(405, 'Method not allowed');
+        const body = await this.readJSONBody(request);
+
+        if (endpoint === 'createuser') {
+            if (!body.email || !body.password) throw new HTTPError(400, 'Missing email or password');
+            if (this.users) {
+                if (this.users[body.email]) throw new HTTPError(409, 'User exists');
+                this.users[body.email] = body.password;
+            }
+            this.sendJSON(response, 200, { success: true });
+            return;
+        }
+
+        if (endpoint === 'resetpassword') {
+            this.sendJSON(response, 200, { success: true });
+            return;
+        }
+
+        const user = this.authenticate(request);
+
+        switch (endpoint) {
+            case 'login':
+                await fs.promises.mkdir(this.localPath(user, '/'), { recursive: true });
+                this.sendJSON(response, 200, { success: true });
+                break;
+            case 'changepassword':
+                if (!body.newpassword) throw new HTTPError(400, 'Missing password');
+                if (this.users) this.users[user] = body.newpassword;
+                this.sendJSON(response, 200, { success: true });
+                break;
+            case 'fileexists':
+                this.sendJSON(response, 200, await this.fileExistence(user, body));
+                break;
+            case 'listdir':
+                this.sendJSON(response, 200, await this.directoryListing(user, body));
+                break;
+            case 'uploadurls':
+                this.sendJSON(response, 200, this.signedURLs(request, user, body, 'PUT'));
+                break;
+            case 'downloadurls':
+                this.sendJSON(response, 200, await this.signedDownloadURLs(request, user, body));
+                break;
+            case 'deleteurls':
+                this.sendJSON(response, 200, this.signedURLs(request, user, body, 'DELETE'));
+                break;
+            default:
+                throw new HTTPError(404, `Unknown endpoint ${endpoint}`);
+        }
+    }
+
+    readJSONBody(request) {
+        return new Promise((resolve, reject) => {
+            const chunks = [];
+            let length = 0;
+            request.on('data', chunk => {
+                length += chunk.length;
+                if (length > maximumJSONBodyLength) {
+                    reject(new HTTPError(413, 'Request too large'));
+                    request.destroy();
+                    return;
+                }
+                chunks.push(chunk);
+            });
+            request.on('error', reject);
+            request.on('end', () => {
+                if (length === 0) {
+                    resolve({});
+                    return;
+                }
+                try {
+                    resolve(JSON.parse(Buffer.concat(chunks).toString('utf8')));
+                }
+                catch (error) {
+                    reject(new HTTPError(400, 'Invalid JSON'));
+                }
+            });
+        });
+    }
+
+    authenticate(request) {
+        const header = request.headers.authorization || '';
+        const match = /^Basic (.+)$/.exec(header);
+        if (!match) throw new HTTPError(401, 'Missing credentials');
+
+        const credentials = Buffer.from(match[1], 'base64').toString('utf8');
+        const separator = credentials.indexOf(':');
+        const user = credentials.slice(0, separator);
+        const password = credentials.slice(separator + 1);
+        if (separator <= 0 || password.length === 0) throw new HTTPError(401, 'Invalid credentials');
+        if (this.users && this.users[user] !== password) throw new HTTPError(401, 'Invalid credentials');
+
+        return user;
+    }
+
+    async fileExistence(user, body) {
+        const check = async remotePath => {
+            try {
+                const stat = await fs.promises.stat(this.localPath(user, remotePath));
+                return { exists: true, isdir: stat.isDirectory() };
+            }
+            catch (error) {
+                if (error.code !== 'ENOENT' && error.code !== 'ENOTDIR') throw error;
+                return { exists: false, isdir: false };
+            }
+        };
+
+        // Batch requests pass an array of paths, and get arrays back in the same order
+        if (Array.isArray(body.paths)) {
+            const results = await Promise.all(body.paths.map(check));
+            return { success: true, exists: results.map(r => r.exists), isdir: results.map(r => r.isdir) };
+        }
+
+        if (typeof body.path !== 'string') throw new HTTPError(400, 'Missing path');
+        return Object.assign({ success: true }, await check(body.path));
+    }
+
+    async directoryListing(user, body) {
+        if (typeof body.path !== 'string') throw new HTTPError(400, 'Missing path');
+
+        // Like S3, a missing directory is just an empty prefix
+        let files = [];
+        try {
+            files = await fs.promises.readdir(this.localPath(user, body.path));
+        }
+        catch (error) {
+            if (error.code !== 'ENOENT' && error.code !== 'ENOTDIR') throw error;
+        }
+        return { success: true, files: files.filter(name => !name.startsWith('.')) };
+    }
+
+    // MARK: Signed URLs
+
+    signature(method, user, remotePath, expires) {
+        return crypto.createHmac('sha256', this.secret).update(`${method}\n${user}\n${remotePath}\n${expires}`).digest('hex');
+    }
+
+    signedURLs(request, user, body, method) {
+        if (!Array.isArray(body.paths)) throw new HTTPError(400, 'Missing paths');
+
+        const base = `http://${request.headers.host}/signed`;
+        const expires = Date.now() + signedURLLifetime;
+        const urls = body.paths.map(remotePath => {
+            this.localPath(user, remotePath); // Validates the path
+            const url = new URL(base);
+            url.searchParams.set('method', method);
+            url.searchParams.set('user', user);
+            url.searchParams.set('path', remotePath);
+            url.searchParams.set('expires', String(expires));
+            url.searchParams.set('signature', this.signature(method, user, remotePath, expires));
+            return url.toString();
+        });
+
+        return { success: true, urls };
+    }
+
+    // Each download URL comes with the SHA-256 of the file, in hexadecimal, or null if there is no file
+    async signedDownloadURLs(request, user, body) {
+        const result = this.signedURLs(request, user, body, 'GET');
+        result.checksums = await Promise.all(body.paths.map(async remotePath => {
+            const digest = await this.fileDigest(this.localPath(user, remotePath));
+            return digest ? digest.toString('hex') : null;
+        }));
+        return result;
+    }
+
+    verifySignedURL(request, url) {
+        const params = url.searchParams;
+        const method = params.get('method');
+        const user = params.get('user');
+        const remotePath = params.get('path');
+        const expires = Number(params.get('expires'));
+        const signature = params.get('signature') || '';
+
+        const expected = this.signature(method, user, remotePath, expires);
+        const valid = signature.length === expected.length && crypto.timingSafeEqual(Buffer.from(signature), Buffer.from(expected));
+        if (!valid || method !== request.method) throw new HTTPError(403, 'Invalid signature');
+        if (expires < Date.now()) throw new HTTPError(403, 'Signed URL expired');
+
+        return this.localPath(user, remotePath);
+    }
+
+    // MARK: File Transfers
+
+    async handleFileRequest(request, response, url) {
+        const localPath = this.verifySignedURL(request, url);
+        const dropped = Math.random() < this.options.disconnectRate;
+        if (dropped) this.stats.injectedDisconnects++;
+
+        switch (request.method) {
+            case 'GET':
+                await this.sendFile(request, response, localPath, dropped);
+                break;
+            case 'PUT':
+                await this.receiveFile(request, response, localPath, dropped);
+                break;
+            case 'DELETE':
+                await fs.promises.rm(localPath, { recursive: true, force: true });
+                this.checksums.delete(localPath);
+                response.writeHead(204);
+                response.end();
+                break;
+            default:
+                throw new HTTPError(405, 'Method not allowed');
+        }
+    }
+
+    async sendFile(request, response, localPath, dropped) {
+        const socket = request.socket; // Detached from the request once the transfer fails
+        let stat;
+        try {
+            stat = await fs.promises.stat(localPath);
+        }
+        catch (error) {
+            throw new HTTPError(404, 'File not found');
+        }
+        if (!stat.isFile()) throw new HTTPError(404, 'File not found');
+
+        // Support resuming with a single byte range
+        let start = 0;
+        let end = stat.size - 1;
+        let status = 200;
+        const headers = { 'Content-Type': 'application/octet-stream', 'Accept-Ranges': 'bytes' };
+        const range = /^bytes=(\d*)-(\d*)$/.exec(request.headers.range || '');
+        if (range && (range[1] || range[2])) {
+            if (range[1]) {
+                start = Number(range[1]);
+                if (range[2]) end = Math.min(end, Number(range[2]));
+            }
+            else {
+                start = Math.max(0, stat.size - Number(range[2]));
+            }
+            if (start > end) {
+                response.writeHead(416, { 'Content-Range': `bytes */${stat.size}` });
+                response.end();
+                return;
+            }
+            status = 206;
+            headers['Content-Range'] = `bytes ${start}-${end}/${stat.size}`;
+        }
+
+        // RFC 3230 instance digest, which covers the whole file, even for a range
+        const digest = await this.fileDigest(localPath);
+        if (digest) headers['Digest'] = `SHA-256=${digest.toString('base64')}`;
+
+        const length = end - start + 1;
+        headers['Content-Length'] = length;
+        response.writeHead(status, headers);
+        if (length === 0) {
+            response.end();
+            return;
+        }
+
+        const throttle = new Throttle(this.options.bandwidth, dropped ? Math.floor(length / 2) : null);
+        throttle.on('data', chunk => { this.stats.bytesDownloaded += chunk.length; });
+        await new Promise((resolve, reject) => {
+            pipeline(fs.createReadStream(localPath, { start, end }), throttle, response, error => {
+                if (!error) {
+                    resolve();
+                    return;
+                }
+                // Close the connection, so the client sees the drop at once, rather than waiting for the rest of the body
+                socket.destroy();
+                reject(error);
+            });
+        });
+    }
+
+    async receiveFile(request, response, localPath, dropped) {
+        const socket = request.socket; // Detached from the request once the transfer fails
+        const expectedLength = Number(request.headers['content-length'] || 0);
+        const throttle = new Throttle(this.options.bandwidth, dropped ? Math.floor(expectedLength / 2) : null);
+        throttle.on('data', chunk => { this.stats.bytesUploaded += chunk.length; });
+
+        // Write to a temporary file, and move into place once complete
+        await fs.promises.mkdir(path.dirname(localPath), { recursive: true });
+        const temporaryPath = `${localPath}.${crypto.randomBytes(6).toString('hex')}.upload`;
+        try {
+            await new Promise((resolve, reject) => {
+                pipeline(request, throttle, fs.createWriteStream(temporaryPath), error => {
+                    if (error) reject(error); else resolve();
+                });
+            });
+            await fs.promises.rename(temporaryPath, localPath);
+            this.checksums.delete(localPath);
+        }
+        catch (error) {
+            // The rest of the body is unread, so the connection can't be reused
+            socket.destroy();
+            await fs.promises.rm(temporaryPath, { force: true });
+            throw error;
+        }
+
+        response.writeHead(200, { 'Content-Length': 0 });
+        response.end();
+    }
+
+    // MARK: Checksums
+
+    // Digests are cached until the file changes, so repeated downloads don't read the file twice
+    async fileDigest(localPath) {
+        let stat;
+        try {
+            stat = await fs.promises.stat(localPath);
+        }
+        catch (error) {
+            return null;
+        }
+        if (!stat.isFile()) return null;
+
+        const cached = this.checksums.get(localPath);
+        if (cached && cached.size === stat.size && cached.modified === stat.mtimeMs) return cached.digest;
+
+        let digest;
+        try {
+            digest = await new Promise((resolve, reject) => {
+                const hash = crypto.createHash('sha256');
+                fs.createReadStream(localPath)
+                    .on('error', reject)
+                    .on('data', chunk => hash.update(chunk))
+                    .on('end', () => resolve(hash.digest()));
+            });
+        }
+        catch (error) {
+            return null;
+        }
+        this.checksums.set(localPath, { size: stat.size, modified: stat.mtimeMs, digest });
+        return digest;
+    }
+
+    // MARK: Paths
+
+    localPath(user, remotePath) {
+        if (typeof remotePath !== 'string' || remotePath.includes('\0')) throw new HTTPError(400, 'Invalid path');
+        const userDirectory = path.join(this.options.root, 'users', encodeURIComponent(user).replace(/\./g, '%2E'));
+        const normalized = path.posix.normalize('/' + remotePath);
+        return path.join(userDirectory, normalized);
+    }
+}
+
+
+// MARK: - Command Line
+
+function parseByteCount(string) {
+    const match = /^(\d+(?:\.\d+)?)([kmg]?)b?$/i.exec(String(string));
+    if (!match) throw new Error(`Invalid byte count: ${string}`);
+    const multipliers = { '': 1, k: 1024, m: 1024 * 1024, g: 1024 * 1024 * 1024 };
+    return Math.round(Number(match[1]) * multipliers[match[2].toLowerCase()]);
+}
+
+// Parses --name value pairs into an object, converting with the functions in spec
+function parseArguments(argv, spec, usage) {
+    const result = {};
+    for (let i = 0; i < argv.length; i++) {
+        const name = argv[i].replace(/^--/, '');
+        if (name === 'help' || !(name in spec) || !argv[i].startsWith('--')) {
+            console.log(usage);
+            process.exit(name === 'help' ? 0 : 1);
+        }
+        const convert = spec[name];
+        if (convert === Boolean) {
+            result[name.replace(/-(\w)/g, (m, c) => c.toUpperCase())] = true;
+            continue;
+        }
+        if (i + 1 >= argv.length) {
+            console.log(usage);
+            process.exit(1);
+        }
+        result[name.replace(/-(\w)/g, (m, c) => c.toUpperCase())] = convert(argv[++i]);
+    }
+    return result;
+}
+
+const usage = `usage: server.js [options]
+
+  --port <number>            Port to listen on (default ${defaultOptions.port}, 0 picks a free port)
+  --host <address>           Address to bind (default ${defaultOptions.host})
+  --root <directory>         Directory that stores the files (default ${defaultOptions.root})
+  --latency <ms>             Delay added to every request
+  --jitter <ms>              Random extra delay, up to this amount
+  --bandwidth <bytes/s>      Rate of each file transfer, eg 512k or 2m (default unlimited)
+  --error-rate <fraction>    Fraction of requests that fail with status 503
+  --disconnect-rate <frac>   Fraction of file transfers dropped halfway through
+  --users <file>             JSON file mapping usernames to passwords (default accepts anyone)
+  --quiet                    Don't log requests`;
+
+function main() {
+    const options = parseArguments(process.argv.slice(2), {
+        'port': Number,
+        'host': String,
+        'root': String,
+        'latency': Number,
+        'jitter': Number,
+        'bandwidth': parseByteCount,
+        'error-rate': Number,
+        'disconnect-rate': Number,
+        'users': file => JSON.parse(fs.readFileSync(file, 'utf8')),
+        'quiet': Boolean
+    }, usage);
+
+    const server = new ReferenceServer(options);
+    server.start().then(url => {
+        console.log(`Ensembles reference server listening at ${url}, storing files in ${server.options.root}`);
+    }).catch(error => {
+        console.error(error.message);
+        process.exit(1);
+    });
+
+    process.on('SIGINT', () => server.stop().then(() => process.exit(0)));
+}
+
+if (require.main === module) main();
+
+module.exports = { ReferenceServer, parseArguments, parseByteCount };